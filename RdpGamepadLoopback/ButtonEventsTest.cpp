@@ -0,0 +1,187 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include "LoopbackTrace.h"
+
+#include <ds4_pad.h>
+#include <RdpGamepadButtonEvents.h>
+#include <RdpGamepadButtonReplay.h>
+#include <RdpGamepadStateQueue.h>
+
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <vector>
+
+namespace
+{
+	// All times in this test are virtual microseconds.
+	constexpr uint64_t SamplePeriod = 1000;		// The plugin samples the buttons at 1 kHz...
+	constexpr uint64_t StatePeriod = 33000;		// ...and sends a state on its timer.
+	constexpr uint64_t LinkDelay = 5000;
+	constexpr uint64_t TickPeriod = 16000;		// The receiver's tick.
+	constexpr uint64_t MinHold = 20000;
+
+	struct Tap
+	{
+		uint64_t mPress;
+		uint64_t mRelease;
+		WORD mButton;
+	};
+
+	// Taps of one button at a time, 1 to 15 ms long and so mostly between two states, spaced far enough
+	// apart that the replay can hold each press and release for the minimum hold.
+	std::vector<Tap> MakeTaps(unsigned int count)
+	{
+		static const WORD Buttons[] = { XINPUT_GAMEPAD_A, XINPUT_GAMEPAD_B, XINPUT_GAMEPAD_X, XINPUT_GAMEPAD_RIGHT_SHOULDER };
+		std::mt19937 random(48);
+		std::vector<Tap> taps;
+		uint64_t time = 100000;
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			const uint64_t length = 1000 * (1 + random() % 15);
+			taps.push_back(Tap{ time, time + length, Buttons[random() % 4] });
+			time += 70000 + 1000 * (random() % 50);
+		}
+		return taps;
+	}
+
+	struct Message
+	{
+		uint64_t mArrival;
+		std::vector<RdpGamepad::RdpButtonEdge> mEdges;
+		XINPUT_GAMEPAD mState;
+	};
+
+	struct Applied
+	{
+		uint64_t mTime;
+		WORD mButtons;
+	};
+
+	// Plays the taps through the plugin's edge detector, a link and the receiver's replay on a virtual
+	// clock, and returns every button word the virtual controller got with the time it got it. Without
+	// edges only the states go over, as with a plugin that does not send them.
+	std::vector<Applied> Play(const std::vector<Tap>& taps, bool sendEdges)
+	{
+		RdpGamepad::RdpButtonEdgeDetector detector;
+		RdpGamepadButtonReplay<XINPUT_GAMEPAD> replay(MinHold);
+		std::deque<Message> link;
+		std::vector<Applied> applied;
+		size_t next = 0;
+		WORD buttons = 0;
+		const uint64_t end = taps.back().mRelease + 2000000;
+		for (uint64_t now = 0; now <= end; now += SamplePeriod)
+		{
+			// The controller at this millisecond, sampled as the plugin's high rate timer would.
+			while (next < taps.size() && taps[next].mRelease <= now)
+			{
+				++next;
+			}
+			buttons = (next < taps.size() && taps[next].mPress <= now) ? taps[next].mButton : 0;
+			detector.Sample(now * 1000, buttons);
+
+			if (now % StatePeriod == 0)
+			{
+				Message message;
+				message.mArrival = now + LinkDelay;
+				RdpGamepad::RdpButtonEdge edges[RdpGamepad::ButtonEdgeCapacity];
+				const size_t count = detector.Take(now * 1000, edges);
+				if (sendEdges)
+				{
+					message.mEdges.assign(edges, edges + count);
+				}
+				message.mState = RdpGamepadButtonTraits<XINPUT_GAMEPAD>::Neutral();
+				message.mState.wButtons = buttons;
+				link.push_back(message);
+			}
+
+			if (now % TickPeriod == 0)
+			{
+				while (!link.empty() && link.front().mArrival <= now)
+				{
+					const Message& message = link.front();
+					for (const RdpGamepad::RdpButtonEdge& edge : message.mEdges)
+					{
+						replay.PushEdge(edge.mDigital, now - edge.mAge, now);
+					}
+					replay.Push(message.mState, now);
+					link.pop_front();
+				}
+				replay.Release(now, [&](const XINPUT_GAMEPAD& state)
+				{
+					// The controller starts with no buttons held.
+					if (state.wButtons != (applied.empty() ? 0 : applied.back().mButtons))
+					{
+						applied.push_back(Applied{ now, state.wButtons });
+					}
+				});
+			}
+		}
+		return applied;
+	}
+
+	std::vector<WORD> GetButtonWords(const std::vector<Applied>& applied)
+	{
+		std::vector<WORD> words;
+		for (const Applied& change : applied)
+		{
+			words.push_back(change.mButtons);
+		}
+		return words;
+	}
+}
+
+// Synthetic tap streams sampled at 1 kHz, most taps shorter than the state interval: with edges every
+// tap must reach the virtual controller, in order, each held for at least the minimum hold, while the
+// states alone lose most of them. The detector must keep the final buttons when it runs out of room.
+bool TestButtonEvents()
+{
+	const std::vector<Tap> taps = MakeTaps(200);
+
+	const std::vector<Applied> withEdges = Play(taps, true);
+	std::vector<WORD> expected;
+	for (const Tap& tap : taps)
+	{
+		expected.push_back(tap.mButton);
+		expected.push_back(0);
+	}
+	LOOPBACK_CHECK(GetButtonWords(withEdges) == expected);
+
+	uint64_t maxDelay = 0;
+	for (size_t i = 0; i < withEdges.size(); ++i)
+	{
+		if (i != 0)
+		{
+			LOOPBACK_CHECK(withEdges[i].mTime - withEdges[i - 1].mTime >= MinHold);
+		}
+		if (withEdges[i].mButtons != 0)
+		{
+			const uint64_t delay = withEdges[i].mTime - taps[i / 2].mPress;
+			maxDelay = (delay > maxDelay) ? delay : maxDelay;
+		}
+	}
+
+	const uint64_t statesOnly = LoopbackTrace::CountPresses(GetButtonWords(Play(taps, false)));
+	LOOPBACK_CHECK(statesOnly < taps.size() / 2);
+	std::printf("    %zu taps: all arrive with edges, at most %llu ms late; %llu with states only\n",
+		taps.size(), (unsigned long long)(maxDelay / 1000), (unsigned long long)statesOnly);
+
+	// More changes between two messages than one can carry fold into the newest edge.
+	RdpGamepad::RdpButtonEdgeDetector detector;
+	detector.Sample(0, 0);
+	for (uint64_t i = 1; i <= 3 * RdpGamepad::ButtonEdgeCapacity; ++i)
+	{
+		detector.Sample(i * SamplePeriod * 1000, (i % 2 != 0) ? XINPUT_GAMEPAD_A : 0);
+	}
+	detector.Sample(1000000000, XINPUT_GAMEPAD_Y);
+	RdpGamepad::RdpButtonEdge edges[RdpGamepad::ButtonEdgeCapacity];
+	LOOPBACK_CHECK(detector.Take(1000000000, edges) == RdpGamepad::ButtonEdgeCapacity);
+	LOOPBACK_CHECK(edges[0].mDigital == XINPUT_GAMEPAD_A && edges[0].mAge == (1000000000 - SamplePeriod * 1000) / 1000);
+	LOOPBACK_CHECK(edges[RdpGamepad::ButtonEdgeCapacity - 1].mDigital == XINPUT_GAMEPAD_Y);
+	LOOPBACK_CHECK(detector.GetDroppedCount() == 2 * RdpGamepad::ButtonEdgeCapacity + 1);
+	LOOPBACK_CHECK(detector.Take(1000000000, edges) == 0);
+	return true;
+}
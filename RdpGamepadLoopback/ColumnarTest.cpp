@@ -0,0 +1,144 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include <RdpGamepadColumnarTrace.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+	using namespace RdpGamepad;
+
+	constexpr size_t FrameCount = 10000;
+	constexpr size_t LateFrame = 5000;		// Recorded with a time from before the previous block.
+
+	// Frames 1 ms apart with buttons and axes anywhere in their range, one of them out of time order.
+	std::vector<RdpTraceFrame> MakeFrames(uint32_t seed)
+	{
+		std::mt19937 random(seed);
+		std::vector<RdpTraceFrame> frames(FrameCount);
+		for (size_t i = 0; i < FrameCount; ++i)
+		{
+			RdpTraceFrame& frame = frames[i];
+			frame.mTime = 5000000000ull + i * 1000000;
+			frame.mSource = static_cast<uint8_t>(i % 2);
+			frame.mKind = static_cast<uint8_t>(random() % 3);
+			frame.mButtons = static_cast<uint32_t>(random());
+			for (int32_t& axis : frame.mAxes)
+			{
+				axis = static_cast<int32_t>(random());
+			}
+		}
+		frames[LateFrame].mTime = frames[100].mTime;
+		return frames;
+	}
+
+	bool SameFrame(const RdpTraceFrame& a, const RdpTraceFrame& b)
+	{
+		return a.mTime == b.mTime && a.mSource == b.mSource && a.mKind == b.mKind && a.mButtons == b.mButtons &&
+			std::memcmp(a.mAxes, b.mAxes, sizeof(a.mAxes)) == 0;
+	}
+
+	bool WriteFrames(const std::string& path, const std::vector<RdpTraceFrame>& frames)
+	{
+		RdpColumnarTraceWriter writer;
+		if (!writer.Open(path))
+		{
+			return false;
+		}
+		for (const RdpTraceFrame& frame : frames)
+		{
+			writer.Append(frame);
+		}
+		return writer.Close();
+	}
+
+	// Rewrites the frame count of the first block, in the index and in the block itself, so the two agree.
+	bool CorruptCount(const std::string& path, const std::string& corruptPath, uint32_t count)
+	{
+		std::ifstream input(path, std::ios::in | std::ios::binary);
+		std::vector<char> bytes((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+		if (bytes.size() < sizeof(RdpColumnarTrailer))
+		{
+			return false;
+		}
+		RdpColumnarTrailer trailer;
+		std::memcpy(&trailer, bytes.data() + bytes.size() - sizeof(trailer), sizeof(trailer));
+		RdpColumnarBlockInfo info;
+		std::memcpy(&info, bytes.data() + trailer.mIndexOffset, sizeof(info));
+		info.mCount = count;
+		std::memcpy(bytes.data() + trailer.mIndexOffset, &info, sizeof(info));
+		std::memcpy(bytes.data() + info.mOffset, &count, sizeof(count));
+
+		std::ofstream output(corruptPath, std::ios::out | std::ios::binary | std::ios::trunc);
+		output.write(bytes.data(), bytes.size());
+		return static_cast<bool>(output);
+	}
+}
+
+// Frames written to a columnar trace decode exactly, block by block or only some columns, FindBlock
+// finds the block of any time even with a frame out of order, and a block claiming more frames than a
+// block holds is rejected before anything is allocated for it.
+bool TestColumnar()
+{
+	const std::string path = "RdpGamepadLoopback.test.columnar";
+	const std::vector<RdpTraceFrame> frames = MakeFrames(39);
+	LOOPBACK_CHECK(WriteFrames(path, frames));
+
+	RdpColumnarTraceReader reader;
+	LOOPBACK_CHECK(reader.Open(path.c_str()));
+	const size_t capacity = RdpColumnarTraceWriter::BlockCapacity;
+	LOOPBACK_CHECK(reader.GetBlockCount() == (FrameCount + capacity - 1) / capacity);
+	LOOPBACK_CHECK(reader.GetFrameCount() == FrameCount);
+
+	std::vector<RdpTraceFrame> decoded;
+	size_t frame = 0;
+	for (size_t block = 0; block < reader.GetBlockCount(); ++block)
+	{
+		LOOPBACK_CHECK(reader.DecodeBlock(block, decoded));
+		LOOPBACK_CHECK(decoded.size() == reader.GetBlockInfo(block).mCount);
+		for (const RdpTraceFrame& decodedFrame : decoded)
+		{
+			LOOPBACK_CHECK(SameFrame(decodedFrame, frames[frame++]));
+		}
+	}
+	LOOPBACK_CHECK(frame == FrameCount);
+	LOOPBACK_CHECK(!reader.DecodeBlock(reader.GetBlockCount(), decoded) && decoded.empty());
+
+	// Only the time column: everything else stays zero.
+	LOOPBACK_CHECK(reader.DecodeBlock(1, decoded, 1u << TraceColumnTime));
+	LOOPBACK_CHECK(decoded[0].mTime == frames[capacity].mTime && decoded[0].mButtons == 0 && decoded[0].mAxes[0] == 0);
+
+	// The late frame sits in block 1 with the time of a frame in block 0, which FindBlock still starts at.
+	LOOPBACK_CHECK(reader.FindBlock(0) == 0);
+	LOOPBACK_CHECK(reader.FindBlock(frames[100].mTime) == 0);
+	LOOPBACK_CHECK(reader.FindBlock(frames[capacity - 1].mTime) == 0);
+	LOOPBACK_CHECK(reader.FindBlock(frames[capacity].mTime) == 1);
+	LOOPBACK_CHECK(reader.FindBlock(frames[2 * capacity + 1].mTime) == 2);
+	LOOPBACK_CHECK(reader.FindBlock(frames.back().mTime + 1) == reader.GetBlockCount());
+
+	// A block claiming more frames than a block can hold, up to four billion of them.
+	const std::string corruptPath = path + ".corrupt";
+	for (uint32_t count : { uint32_t(capacity + 1), UINT32_MAX })
+	{
+		LOOPBACK_CHECK(CorruptCount(path, corruptPath, count));
+		RdpColumnarTraceReader corrupt;
+		LOOPBACK_CHECK(corrupt.Open(corruptPath.c_str()));
+		LOOPBACK_CHECK(!corrupt.DecodeBlock(0, decoded) && decoded.empty());
+		LOOPBACK_CHECK(corrupt.DecodeBlock(1, decoded) && decoded.size() == capacity);
+	}
+	std::remove(corruptPath.c_str());
+	std::remove(path.c_str());
+	std::printf("    %zu frames in %zu blocks, %.1f bytes a frame\n", FrameCount, reader.GetBlockCount(),
+		double(reader.GetFileSize()) / FrameCount);
+	return true;
+}
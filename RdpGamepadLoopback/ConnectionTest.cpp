@@ -0,0 +1,148 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include <RdpGamepadConnection.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+	using std::chrono::milliseconds;
+
+	// Stands in for WTSVirtualChannelOpenEx: fails until attempt mSucceedFrom, and counts handles closed.
+	struct FakeOpener
+	{
+		std::atomic<unsigned int> mAttempts{0};
+		std::atomic<unsigned int> mSucceedFrom{0};
+		std::atomic<unsigned int> mClosed{0};
+		std::atomic<RdpGamepadConnection::Handle> mLastClosed{nullptr};
+
+		RdpGamepadConnection::Handle Open()
+		{
+			const unsigned int attempt = ++mAttempts;
+			const unsigned int succeedFrom = mSucceedFrom;
+			return (succeedFrom != 0 && attempt >= succeedFrom) ? reinterpret_cast<RdpGamepadConnection::Handle>(uintptr_t(attempt)) : nullptr;
+		}
+
+		void Close(RdpGamepadConnection::Handle handle)
+		{
+			mLastClosed = handle;
+			++mClosed;
+		}
+	};
+
+	RdpGamepadConnection::Handle WaitForHandle(RdpGamepadConnection& connection, milliseconds timeout)
+	{
+		const Clock::time_point end = Clock::now() + timeout;
+		RdpGamepadConnection::Handle handle;
+		while ((handle = connection.TakeHandle()) == nullptr && Clock::now() < end)
+		{
+			std::this_thread::sleep_for(milliseconds(1));
+		}
+		return handle;
+	}
+
+	bool WaitForAttempts(const FakeOpener& opener, unsigned int attempts, milliseconds timeout)
+	{
+		const Clock::time_point end = Clock::now() + timeout;
+		while (opener.mAttempts < attempts && Clock::now() < end)
+		{
+			std::this_thread::sleep_for(milliseconds(1));
+		}
+		return opener.mAttempts >= attempts;
+	}
+
+	// The delay doubles up to the limit and stays within the jitter of it; Reset starts over.
+	bool TestBackoff()
+	{
+		RdpGamepadBackoff exact(milliseconds(100), milliseconds(5000), 0.0, 1);
+		const long long expected[] = { 100, 200, 400, 800, 1600, 3200, 5000, 5000 };
+		for (long long delay : expected)
+		{
+			LOOPBACK_CHECK(exact.NextDelay().count() == delay);
+		}
+		exact.Reset();
+		LOOPBACK_CHECK(exact.NextDelay().count() == 100);
+
+		RdpGamepadBackoff jittered(milliseconds(100), milliseconds(5000), 0.25, 28);
+		for (int round = 0; round < 100; ++round)
+		{
+			jittered.Reset();
+			for (long long base : expected)
+			{
+				const long long delay = jittered.NextDelay().count();
+				LOOPBACK_CHECK(delay >= base * 3 / 4 - 1 && delay <= base * 5 / 4);
+			}
+		}
+		return true;
+	}
+
+	// Failed opens are retried after the backoff, a handle waits until taken and Reconnect opens another.
+	bool TestRetryAndReconnect()
+	{
+		FakeOpener opener;
+		opener.mSucceedFrom = 4;
+		RdpGamepadConnection connection([&opener]() { return opener.Open(); }, [&opener](RdpGamepadConnection::Handle handle) { opener.Close(handle); });
+
+		const Clock::time_point start = Clock::now();
+		connection.Start();
+		const RdpGamepadConnection::Handle first = WaitForHandle(connection, milliseconds(5000));
+		const long long elapsed = std::chrono::duration_cast<milliseconds>(Clock::now() - start).count();
+		LOOPBACK_CHECK(first == reinterpret_cast<RdpGamepadConnection::Handle>(4));
+		LOOPBACK_CHECK(connection.GetOpenAttempts() == 4);
+
+		// Three waits of 100, 200 and 400 ms, each up to a quarter shorter.
+		LOOPBACK_CHECK(elapsed >= 520);
+		LOOPBACK_CHECK(connection.TakeHandle() == nullptr);
+
+		// Nothing opens until asked to.
+		std::this_thread::sleep_for(milliseconds(50));
+		LOOPBACK_CHECK(opener.mAttempts == 4);
+
+		// The backoff started over with the success, so a new handle comes at once.
+		connection.Reconnect();
+		const RdpGamepadConnection::Handle second = WaitForHandle(connection, milliseconds(1000));
+		LOOPBACK_CHECK(second == reinterpret_cast<RdpGamepadConnection::Handle>(5));
+
+		// A handle nobody took yet makes Reconnect do nothing, and Stop closes it.
+		connection.Reconnect();
+		LOOPBACK_CHECK(WaitForAttempts(opener, 6, milliseconds(1000)));
+		std::this_thread::sleep_for(milliseconds(50));
+		connection.Reconnect();
+		std::this_thread::sleep_for(milliseconds(50));
+		LOOPBACK_CHECK(opener.mAttempts == 6);
+		connection.Stop();
+		LOOPBACK_CHECK(opener.mClosed == 1);
+		LOOPBACK_CHECK(opener.mLastClosed == reinterpret_cast<RdpGamepadConnection::Handle>(6));
+		return true;
+	}
+
+	// Stop cuts a backoff wait short instead of sleeping it out.
+	bool TestCancel()
+	{
+		FakeOpener opener;
+		RdpGamepadConnection connection([&opener]() { return opener.Open(); }, [&opener](RdpGamepadConnection::Handle handle) { opener.Close(handle); });
+		connection.Start();
+		LOOPBACK_CHECK(WaitForAttempts(opener, 4, milliseconds(2000)));
+
+		// Now in a wait of 800 ms or so.
+		const Clock::time_point start = Clock::now();
+		connection.Stop();
+		LOOPBACK_CHECK(Clock::now() - start < milliseconds(200));
+		LOOPBACK_CHECK(opener.mAttempts == 4);
+		LOOPBACK_CHECK(opener.mClosed == 0);
+		LOOPBACK_CHECK(connection.TakeHandle() == nullptr);
+		return true;
+	}
+}
+
+bool TestConnection()
+{
+	return TestBackoff() && TestRetryAndReconnect() && TestCancel();
+}
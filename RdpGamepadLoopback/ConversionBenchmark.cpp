@@ -0,0 +1,177 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "ConversionBenchmark.h"
+
+#include <ViGEmConversion.h>
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace
+{
+	using namespace ViGEmConversion;
+	using Clock = std::chrono::steady_clock;
+
+	// Enough distinct states that the branch predictor cannot learn them, few enough to stay in cache.
+	constexpr size_t StateCount = 4096;
+
+	double Nanoseconds(Clock::duration duration)
+	{
+		return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+	}
+
+	// ViGEmTarget360::SetGamepadState(const PadState&) before the tables.
+	XUSB_REPORT ToX360ReportFloat(const PadState& state)
+	{
+		const uint8_t dpad = ((state.Buttons & 0xf) > 8) ? 8 : (state.Buttons & 0xf);
+		uint16_t button = X360_DPAD_MASK[dpad];
+		for (int i = 0; i < 12; ++i)
+		{
+			const int mask = 1 << (i + 4);
+			if (X360_BUTTON_MASK[i] != 0 && (state.Buttons & mask) == mask)
+			{
+				button |= X360_BUTTON_MASK[i];
+			}
+		}
+
+		XUSB_REPORT report;
+		report.sThumbLX      = int16_t( ((float(state.StickL.X) / float(255.0f)) * 2.0f - 1.0f) * SHRT_MAX);
+		report.sThumbLY      = int16_t(-((float(state.StickL.Y) / float(255.0f)) * 2.0f - 1.0f) * SHRT_MAX);
+		report.sThumbRX      = int16_t( ((float(state.StickR.X) / float(255.0f)) * 2.0f - 1.0f) * SHRT_MAX);
+		report.sThumbRY      = int16_t(-((float(state.StickR.Y) / float(255.0f)) * 2.0f - 1.0f) * SHRT_MAX);
+		report.bLeftTrigger  = state.AnalogButtons.L2;
+		report.bRightTrigger = state.AnalogButtons.R2;
+		report.wButtons      = button;
+		return report;
+	}
+
+	// ViGEmTargetDS4::SetGamepadState(const XINPUT_GAMEPAD&) before the tables.
+	DS4_REPORT ToDS4ReportFloat(const XINPUT_GAMEPAD& gamepad)
+	{
+		uint16_t button = ToDS4Dpad(gamepad.wButtons);
+		for (int i = 0; i < 12; ++i)
+		{
+			if (DS4_BUTTON_MASK[i] != 0 && (gamepad.wButtons & DS4_BUTTON_MASK[i]) == DS4_BUTTON_MASK[i])
+			{
+				button |= uint16_t(1 << (i + 4));
+			}
+		}
+		if (gamepad.bLeftTrigger >= XINPUT_GAMEPAD_TRIGGER_THRESHOLD)
+		{
+			button |= DS4_BUTTON_TRIGGER_LEFT;
+		}
+		if (gamepad.bRightTrigger >= XINPUT_GAMEPAD_TRIGGER_THRESHOLD)
+		{
+			button |= DS4_BUTTON_TRIGGER_RIGHT;
+		}
+
+		DS4_REPORT report = {};
+		report.bThumbLX  = static_cast<uint8_t>( ((gamepad.sThumbLX + SHRT_MAX) / float(USHRT_MAX)) * 0xff);
+		report.bThumbLY  = static_cast<uint8_t>(-((gamepad.sThumbLY - SHRT_MAX) / float(USHRT_MAX)) * 0xff);
+		report.bThumbRX  = static_cast<uint8_t>( ((gamepad.sThumbRX + SHRT_MAX) / float(USHRT_MAX)) * 0xff);
+		report.bThumbRY  = static_cast<uint8_t>(-((gamepad.sThumbRY - SHRT_MAX) / float(USHRT_MAX)) * 0xff);
+		report.wButtons  = button;
+		report.bSpecial  = 0;
+		report.bTriggerL = gamepad.bLeftTrigger;
+		report.bTriggerR = gamepad.bRightTrigger;
+		return report;
+	}
+
+	// The sum of the results keeps the compiler from dropping the work.
+	uint64_t Checksum(const XUSB_REPORT& report)
+	{
+		return uint64_t(report.wButtons) + report.bLeftTrigger + report.bRightTrigger +
+			uint16_t(report.sThumbLX) + uint16_t(report.sThumbLY) + uint16_t(report.sThumbRX) + uint16_t(report.sThumbRY);
+	}
+
+	uint64_t Checksum(const DS4_REPORT& report)
+	{
+		return uint64_t(report.wButtons) + report.bTriggerL + report.bTriggerR +
+			report.bThumbLX + report.bThumbLY + report.bThumbRX + report.bThumbRY;
+	}
+
+	template <typename STATE, typename CONVERT>
+	double TimeConversion(const std::vector<STATE>& states, uint64_t samples, CONVERT&& convert, uint64_t& outChecksum)
+	{
+		outChecksum = 0;
+		const Clock::time_point start = Clock::now();
+		for (uint64_t i = 0; i < samples; ++i)
+		{
+			outChecksum += Checksum(convert(states[i % StateCount]));
+		}
+		return Nanoseconds(Clock::now() - start) / samples;
+	}
+
+	template <typename STATE, typename REPORT, typename CONVERT>
+	double TimeBatches(const std::vector<STATE>& states, uint64_t samples, CONVERT&& convert, uint64_t& outChecksum)
+	{
+		std::vector<REPORT> reports(StateCount);
+		outChecksum = 0;
+		const uint64_t batches = (samples + StateCount - 1) / StateCount;
+		const Clock::time_point start = Clock::now();
+		for (uint64_t i = 0; i < batches; ++i)
+		{
+			convert(states.data(), reports.data(), StateCount);
+			outChecksum += Checksum(reports[i % StateCount]);
+		}
+		return Nanoseconds(Clock::now() - start) / (batches * StateCount);
+	}
+
+	const char* KernelName(BatchKernel kernel)
+	{
+		return (kernel == BatchKernel::SSE2) ? "SSE2" : "scalar";
+	}
+}
+
+int RunConversionBenchmark(uint64_t samples, uint32_t seed)
+{
+	std::mt19937 random(seed);
+	std::vector<PadState> states(StateCount);
+	std::vector<XINPUT_GAMEPAD> gamepads(StateCount);
+	for (size_t i = 0; i < StateCount; ++i)
+	{
+		states[i] = PadState{};
+		states[i].StickL.X = static_cast<uint8_t>(random());
+		states[i].StickL.Y = static_cast<uint8_t>(random());
+		states[i].StickR.X = static_cast<uint8_t>(random());
+		states[i].StickR.Y = static_cast<uint8_t>(random());
+		states[i].Buttons = static_cast<uint16_t>(random());
+		states[i].AnalogButtons.L2 = static_cast<uint8_t>(random());
+		states[i].AnalogButtons.R2 = static_cast<uint8_t>(random());
+
+		gamepads[i].wButtons = static_cast<WORD>(random());
+		gamepads[i].bLeftTrigger = static_cast<BYTE>(random());
+		gamepads[i].bRightTrigger = static_cast<BYTE>(random());
+		gamepads[i].sThumbLX = static_cast<SHORT>(random());
+		gamepads[i].sThumbLY = static_cast<SHORT>(random());
+		gamepads[i].sThumbRX = static_cast<SHORT>(random());
+		gamepads[i].sThumbRY = static_cast<SHORT>(random());
+	}
+
+	uint64_t checksums[4];
+	const double x360Float = TimeConversion(states, samples, &ToX360ReportFloat, checksums[0]);
+	const double x360Table = TimeConversion(states, samples, &ToX360Report, checksums[1]);
+	const double ds4Float = TimeConversion(gamepads, samples, &ToDS4ReportFloat, checksums[2]);
+	const double ds4Table = TimeConversion(gamepads, samples, &ToDS4Report, checksums[3]);
+
+	std::printf("%-20s %llu, checksum %016llx\n", "Samples", (unsigned long long)samples,
+		(unsigned long long)(checksums[0] ^ checksums[1] ^ checksums[2] ^ checksums[3]));
+	std::printf("%-20s %.2f ns per state with formulas, %.2f ns with tables\n", "DS4 -> Xbox 360", x360Float, x360Table);
+	std::printf("%-20s %.2f ns per state with formulas, %.2f ns with tables\n", "XInput -> DS4", ds4Float, ds4Table);
+
+	uint64_t batchChecksum = 0;
+	const double x360Batch = TimeBatches<PadState, XUSB_REPORT>(states, samples, &ConvertToX360Reports, batchChecksum);
+	std::printf("%-20s %.2f ns per state, checksum %016llx\n", "Xbox 360 batch", x360Batch, (unsigned long long)batchChecksum);
+	for (size_t kernel = 0; kernel <= size_t(GetBatchKernel()); ++kernel)
+	{
+		const BatchKernel batchKernel = BatchKernel(kernel);
+		const double ds4Batch = TimeBatches<XINPUT_GAMEPAD, DS4_REPORT>(gamepads, samples,
+			[batchKernel](const XINPUT_GAMEPAD* in, DS4_REPORT* out, size_t count) { ConvertToDS4Reports(in, out, count, batchKernel); },
+			batchChecksum);
+		std::printf("DS4 batch, %-9s %.2f ns per state, checksum %016llx\n", KernelName(batchKernel), ds4Batch, (unsigned long long)batchChecksum);
+	}
+	return 0;
+}
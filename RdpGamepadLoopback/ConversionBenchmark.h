@@ -0,0 +1,12 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstdint>
+
+// Converts samples random controller states between the XInput and DS4 report formats, once with the
+// float formulas and button mask loops the receiver used to have and once with the lookup tables in
+// ViGEmConversion.h, and reports the time spent per state for each. It also times the batch converters
+// with every kernel the CPU supports. Returns a process exit code.
+int RunConversionBenchmark(uint64_t samples, uint32_t seed);
@@ -0,0 +1,179 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include <ViGEmConversion.h>
+
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace ViGEmConversion;
+
+namespace
+{
+	// The mask loops the tables replaced, for DS4 Buttons to XUSB wButtons.
+	uint16_t ToX360ButtonsReference(uint16_t buttons)
+	{
+		const uint8_t dpad = ((buttons & 0xf) > 8) ? 8 : (buttons & 0xf);
+		uint16_t result = X360_DPAD_MASK[dpad];
+		for (size_t i = 0; i < 12; ++i)
+		{
+			const uint16_t mask = uint16_t(1 << (i + 4));
+			if (X360_BUTTON_MASK[i] != 0 && (buttons & mask) == mask)
+			{
+				result |= X360_BUTTON_MASK[i];
+			}
+		}
+		return result;
+	}
+
+	// And for XInput wButtons to DS4 Buttons.
+	uint16_t ToDS4ButtonsReference(uint16_t buttons)
+	{
+		uint16_t result = ToDS4Dpad(buttons);
+		for (size_t i = 0; i < 12; ++i)
+		{
+			if (DS4_BUTTON_MASK[i] != 0 && (buttons & DS4_BUTTON_MASK[i]) == DS4_BUTTON_MASK[i])
+			{
+				result |= uint16_t(1 << (i + 4));
+			}
+		}
+		return result;
+	}
+}
+
+// Every button word, trigger and stick value through the tables, against the code they replaced and the
+// scalar converters they were generated from.
+bool TestConversionTables()
+{
+	for (uint32_t buttons = 0; buttons < 0x10000; ++buttons)
+	{
+		LOOPBACK_CHECK(X360ButtonTable.Remap(uint16_t(buttons)) == ToX360ButtonsReference(uint16_t(buttons)));
+		LOOPBACK_CHECK(DS4ButtonTable.Remap(uint16_t(buttons)) == ToDS4ButtonsReference(uint16_t(buttons)));
+	}
+
+	// Exactly one direction for every combination of d-pad bits, with opposing bits pressed together
+	// resolved the way ToDS4Dpad always did.
+	LOOPBACK_CHECK(ToDS4Dpad(0) == PAD_BUTTON_DPAD_NONE);
+	LOOPBACK_CHECK(ToDS4Dpad(XINPUT_GAMEPAD_DPAD_UP | XINPUT_GAMEPAD_DPAD_RIGHT) == PAD_BUTTON_DPAD_NORTHEAST);
+	LOOPBACK_CHECK(ToDS4Dpad(XINPUT_GAMEPAD_DPAD_DOWN | XINPUT_GAMEPAD_DPAD_LEFT) == PAD_BUTTON_DPAD_SOUTHWEST);
+	for (uint16_t dpad = 0; dpad < 16; ++dpad)
+	{
+		LOOPBACK_CHECK(ToDS4Dpad(dpad) <= PAD_BUTTON_DPAD_NONE);
+	}
+
+	for (uint32_t value = 0; value < 256; ++value)
+	{
+		LOOPBACK_CHECK(StickToThumbTable[value] == StickToThumb(uint8_t(value)));
+		LOOPBACK_CHECK(StickToThumbInvertedTable[value] == StickToThumbInverted(uint8_t(value)));
+	}
+
+	// Whole reports, with the triggers passed through and pressed past the threshold on the DS4.
+	XINPUT_GAMEPAD gamepad = {};
+	for (uint32_t trigger = 0; trigger < 256; ++trigger)
+	{
+		gamepad.bLeftTrigger = BYTE(trigger);
+		gamepad.bRightTrigger = BYTE(255 - trigger);
+		const DS4_REPORT report = ToDS4Report(gamepad);
+		LOOPBACK_CHECK(report.bTriggerL == trigger && report.bTriggerR == 255 - trigger);
+		LOOPBACK_CHECK(((report.wButtons & DS4_BUTTON_TRIGGER_LEFT) != 0) == (trigger >= XINPUT_GAMEPAD_TRIGGER_THRESHOLD));
+		LOOPBACK_CHECK(((report.wButtons & DS4_BUTTON_TRIGGER_RIGHT) != 0) == (255 - trigger >= XINPUT_GAMEPAD_TRIGGER_THRESHOLD));
+		LOOPBACK_CHECK(report.bSpecial == 0);
+	}
+
+	PadState state = {};
+	for (uint32_t value = 0; value < 256; ++value)
+	{
+		state.StickL.X = uint8_t(value);
+		state.StickL.Y = uint8_t(value);
+		state.StickR.X = uint8_t(255 - value);
+		state.StickR.Y = uint8_t(255 - value);
+		state.AnalogButtons.L2 = uint8_t(value);
+		const XUSB_REPORT report = ToX360Report(state);
+		LOOPBACK_CHECK(report.sThumbLX == StickToThumb(uint8_t(value)) && report.sThumbLY == StickToThumbInverted(uint8_t(value)));
+		LOOPBACK_CHECK(report.sThumbRX == StickToThumb(uint8_t(255 - value)) && report.sThumbRY == StickToThumbInverted(uint8_t(255 - value)));
+		LOOPBACK_CHECK(report.bLeftTrigger == value);
+	}
+	return true;
+}
+
+// Every value both ways: exact centers and ends, an identity round trip from the DS4 side, monotonic in
+// both directions and rounding to the nearest step of the matching half of the range.
+bool TestStickConversion()
+{
+	LOOPBACK_CHECK(StickToThumb(0) == -32768 && StickToThumb(128) == 0 && StickToThumb(255) == 32767);
+	LOOPBACK_CHECK(StickToThumbInverted(0) == 32767 && StickToThumbInverted(128) == 0 && StickToThumbInverted(255) == -32767);
+	LOOPBACK_CHECK(SaturatingNegate(-32768) == 32767 && SaturatingNegate(32767) == -32767 && SaturatingNegate(0) == 0);
+	for (uint32_t value = 0; value < 256; ++value)
+	{
+		LOOPBACK_CHECK(ThumbToStick(StickToThumb(uint8_t(value))) == value);
+		LOOPBACK_CHECK(ThumbToStickInverted(StickToThumbInverted(uint8_t(value))) == value);
+		LOOPBACK_CHECK(value == 0 || StickToThumb(uint8_t(value)) > StickToThumb(uint8_t(value - 1)));
+	}
+
+	uint8_t previous = 0;
+	for (int32_t thumb = -32768; thumb <= 32767; ++thumb)
+	{
+		// Nearest step with ties to the center, in double precision: 256 units per step below the center,
+		// 32767 / 127 above it.
+		const double steps = (thumb < 0) ? thumb / 256.0 : thumb * 127.0 / 32767.0;
+		const int32_t nearest = (steps < 0) ? -int32_t(std::ceil(-steps - 0.5)) : int32_t(std::ceil(steps - 0.5));
+		const uint8_t stick = ThumbToStick(int16_t(thumb));
+		LOOPBACK_CHECK(stick == nearest + 128);
+		LOOPBACK_CHECK(stick >= previous);
+		LOOPBACK_CHECK(ThumbToStickInverted(int16_t(thumb)) == ThumbToStick(SaturatingNegate(int16_t(thumb))));
+		previous = stick;
+	}
+	LOOPBACK_CHECK(ThumbToStick(-128) == 128 && ThumbToStick(129) == 128 && ThumbToStick(-129) == 127 && ThumbToStick(130) == 129);
+	return true;
+}
+
+// Every batch kernel the CPU has against the scalar converters, bit for bit, over every thumb value on
+// two axes, and a count that leaves a remainder for each kernel's tail.
+bool TestBatchConversion()
+{
+	constexpr size_t Count = 65536 + 7;
+	std::mt19937 random(3);
+	std::vector<XINPUT_GAMEPAD> gamepads(Count);
+	std::vector<PadState> states(Count);
+	for (size_t i = 0; i < Count; ++i)
+	{
+		gamepads[i].wButtons = WORD(random());
+		gamepads[i].bLeftTrigger = BYTE(random());
+		gamepads[i].bRightTrigger = BYTE(random());
+		gamepads[i].sThumbLX = SHORT(int32_t(i % 65536) - 32768);
+		gamepads[i].sThumbLY = SHORT(random());
+		gamepads[i].sThumbRX = SHORT(random());
+		gamepads[i].sThumbRY = SHORT(32767 - int32_t(i % 65536));
+
+		states[i] = PadState{};
+		states[i].StickL.X = uint8_t(i);
+		states[i].StickL.Y = uint8_t(random());
+		states[i].StickR.X = uint8_t(random());
+		states[i].StickR.Y = uint8_t(i >> 8);
+		states[i].Buttons = uint16_t(random());
+		states[i].AnalogButtons.L2 = uint8_t(random());
+		states[i].AnalogButtons.R2 = uint8_t(random());
+	}
+
+	for (size_t kernel = 0; kernel <= size_t(GetBatchKernel()); ++kernel)
+	{
+		std::vector<DS4_REPORT> ds4Reports(Count);
+		std::vector<XUSB_REPORT> x360Reports(Count);
+		ConvertToDS4Reports(gamepads.data(), ds4Reports.data(), Count, BatchKernel(kernel));
+		ConvertToX360Reports(states.data(), x360Reports.data(), Count);
+		for (size_t i = 0; i < Count; ++i)
+		{
+			const DS4_REPORT ds4Report = ToDS4Report(gamepads[i]);
+			const XUSB_REPORT x360Report = ToX360Report(states[i]);
+			LOOPBACK_CHECK(std::memcmp(&ds4Reports[i], &ds4Report, sizeof(ds4Report)) == 0);
+			LOOPBACK_CHECK(std::memcmp(&x360Reports[i], &x360Report, sizeof(x360Report)) == 0);
+		}
+	}
+	std::printf("    batch kernels up to %s checked\n",
+		(GetBatchKernel() == BatchKernel::SSE2) ? "SSE2" : "scalar");
+	return true;
+}
@@ -0,0 +1,90 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include <RdpGamepadStatistics.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	// More writers than slots, so some of them share one.
+	constexpr unsigned int WriterCount = RdpGamepadCounters::SlotCount + 4;
+	constexpr uint64_t IncrementsPerWriter = 200000;
+}
+
+// Writers bump every counter while a reader takes snapshots: each snapshot must be at least the one
+// before, consistent ones must hold every counter at the same value since the writers bump them in
+// order, and the final totals must be exact.
+bool TestCounters()
+{
+	// Heap allocated, as inside the processor, with every slot on a cache line of its own.
+	std::unique_ptr<RdpGamepadCounters> counters(new RdpGamepadCounters);
+	for (size_t i = 0; i < RdpGamepadCounters::SlotCount; ++i)
+	{
+		LOOPBACK_CHECK(reinterpret_cast<uintptr_t>(counters->GetSlotAddress(i)) % RdpGamepadCounters::CacheLineSize == 0);
+	}
+
+	std::atomic<bool> stop{false};
+	std::vector<std::thread> writers;
+	for (unsigned int writer = 0; writer < WriterCount; ++writer)
+	{
+		writers.emplace_back([&]()
+		{
+			for (uint64_t i = 0; i < IncrementsPerWriter; ++i)
+			{
+				counters->Increment(CounterPacketsSent);
+				counters->Increment(CounterPacketsReceived, 2);
+			}
+		});
+	}
+
+	uint64_t snapshots = 0;
+	uint64_t consistent = 0;
+	bool ordered = true;
+	bool balanced = true;
+	RdpGamepadStatistics previous = counters->TakeSnapshot();
+	std::thread reader([&]()
+	{
+		while (!stop.load())
+		{
+			const RdpGamepadStatistics current = counters->TakeSnapshot();
+			for (size_t i = 0; i < CounterCount; ++i)
+			{
+				ordered = ordered && current.mValues[i] >= previous.mValues[i];
+			}
+			if (current.mConsistent)
+			{
+				// Between a writer's two increments the received count is short by at most two per writer.
+				const uint64_t sent = current[CounterPacketsSent];
+				const uint64_t received = current[CounterPacketsReceived];
+				balanced = balanced && received <= sent * 2 && received + 2 * WriterCount >= sent * 2;
+				++consistent;
+			}
+			++snapshots;
+			previous = current;
+		}
+	});
+
+	for (auto& writer : writers)
+	{
+		writer.join();
+	}
+	stop = true;
+	reader.join();
+
+	const RdpGamepadStatistics totals = counters->TakeSnapshot();
+	LOOPBACK_CHECK(ordered);
+	LOOPBACK_CHECK(balanced);
+	LOOPBACK_CHECK(totals.mConsistent);
+	LOOPBACK_CHECK(totals[CounterPacketsSent] == WriterCount * IncrementsPerWriter);
+	LOOPBACK_CHECK(totals[CounterPacketsReceived] == 2 * WriterCount * IncrementsPerWriter);
+	LOOPBACK_CHECK(totals[CounterReconnects] == 0);
+	std::printf("    %llu snapshots while writing, %llu consistent\n", (unsigned long long)snapshots, (unsigned long long)consistent);
+	return true;
+}
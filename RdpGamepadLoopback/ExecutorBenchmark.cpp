@@ -0,0 +1,211 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "ExecutorBenchmark.h"
+
+#include <RdpGamepadExecutor.h>
+#include <RdpGamepadLatency.h>
+#include <RdpGamepadMessageSplitter.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	using namespace RdpGamepad;
+	using Clock = std::chrono::steady_clock;
+
+	constexpr std::chrono::microseconds TickPeriod(16000);
+	constexpr double StepSeconds = 1.0;
+
+	// Stands in for a pad's tick: drain the channel, convert the newest state, submit the report. Records
+	// how far the time between tick starts strays from the period.
+	class SimulatedPad
+	{
+	public:
+		SimulatedPad(unsigned int workUs, RdpLatencyHistogram& jitter)
+			: mWork(workUs)
+			, mJitter(jitter)
+		{}
+
+		void Tick()
+		{
+			const uint64_t start = RdpLatencyClock::Now();
+			if (mLastStart != 0)
+			{
+				const int64_t deviation = int64_t(start - mLastStart) - int64_t(TickPeriod.count()) * 1000;
+				mJitter.Record(static_cast<uint64_t>(deviation < 0 ? -deviation : deviation));
+			}
+			mLastStart = start;
+
+			for (DWORD i = 0; i < 2; ++i)
+			{
+				XINPUT_STATE state{};
+				state.dwPacketNumber = mPacketNumber++;
+				state.Gamepad.sThumbLX = static_cast<SHORT>(state.dwPacketNumber * 31);
+				const RdpGetStateResponse response = RdpGetStateResponse::MakeResponse(0, ERROR_SUCCESS, state);
+				size_t space;
+				std::memcpy(mSplitter.GetWriteBuffer(space), &response, sizeof(response));
+				mSplitter.Commit(sizeof(response));
+			}
+
+			RdpPacketView view;
+			RdpProtocolPacket packet;
+			while (mSplitter.Next(view) && view.mData != nullptr)
+			{
+				view.CopyTo(packet);
+			}
+			mReport = packet.mGetStateResponse.mState.Gamepad;
+			mReport.sThumbLY = static_cast<SHORT>(~mReport.sThumbLX);
+
+			// The driver call; busy, since the time spent matters, not what it does.
+			const Clock::time_point end = Clock::now() + mWork;
+			while (Clock::now() < end)
+			{
+			}
+			++mTicks;
+		}
+
+		uint64_t GetTicks() const
+		{ return mTicks; }
+
+	private:
+		std::chrono::microseconds mWork;
+		RdpLatencyHistogram& mJitter;
+		uint64_t mLastStart = 0;
+		RdpMessageSplitter mSplitter{ 4096 };
+		XINPUT_GAMEPAD mReport{};
+		DWORD mPacketNumber = 0;
+		std::atomic<uint64_t> mTicks{0};
+	};
+
+	struct StepResult
+	{
+		double mTicksPerPad = 0;
+		double mMissedPercent = 0;
+		uint64_t mMaxDelayUs = 0;
+		double mJitterP50Us = 0;
+		double mJitterP99Us = 0;
+		uint64_t mSteals = 0;
+		double mCpuPercent = 0;
+	};
+
+	StepResult RunSerial(std::vector<std::unique_ptr<SimulatedPad>>& pads)
+	{
+		StepResult result;
+		uint64_t ticks = 0;
+		uint64_t missed = 0;
+		const std::clock_t cpuStart = std::clock();
+		const Clock::time_point start = Clock::now();
+		Clock::time_point due = start;
+		while (due < start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(StepSeconds)))
+		{
+			std::this_thread::sleep_until(due);
+			for (auto& pad : pads)
+			{
+				const uint64_t delay = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - due).count();
+				result.mMaxDelayUs = (delay > result.mMaxDelayUs) ? delay : result.mMaxDelayUs;
+				pad->Tick();
+				missed += (Clock::now() > due + TickPeriod) ? 1 : 0;
+				++ticks;
+			}
+
+			// Like the executor, drop the periods already passed.
+			due += TickPeriod;
+			while (due + TickPeriod < Clock::now())
+			{
+				due += TickPeriod;
+			}
+		}
+		const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		result.mTicksPerPad = ticks / seconds / pads.size();
+		result.mMissedPercent = ticks ? 100.0 * missed / ticks : 0.0;
+		result.mCpuPercent = 100.0 * (std::clock() - cpuStart) / CLOCKS_PER_SEC / seconds;
+		return result;
+	}
+
+	StepResult RunExecutor(std::vector<std::unique_ptr<SimulatedPad>>& pads, RdpGamepadExecutor& executor)
+	{
+		StepResult result;
+		std::vector<uint32_t> ids;
+		for (size_t i = 0; i < pads.size(); ++i)
+		{
+			SimulatedPad* pad = pads[i].get();
+			ids.push_back(executor.Add([pad]() { pad->Tick(); }, TickPeriod, static_cast<int>(i)));
+		}
+
+		const uint64_t stealsBefore = executor.GetStealCount();
+		const std::clock_t cpuStart = std::clock();
+		const Clock::time_point start = Clock::now();
+		std::this_thread::sleep_for(std::chrono::duration<double>(StepSeconds));
+		const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		result.mCpuPercent = 100.0 * (std::clock() - cpuStart) / CLOCKS_PER_SEC / seconds;
+		result.mSteals = executor.GetStealCount() - stealsBefore;
+
+		uint64_t runs = 0;
+		uint64_t misses = 0;
+		for (uint32_t id : ids)
+		{
+			RdpGamepadTaskStatistics statistics;
+			if (executor.GetStatistics(id, statistics))
+			{
+				runs += statistics.mRuns;
+				misses += statistics.mDeadlineMisses;
+				result.mMaxDelayUs = (statistics.mMaxStartDelay > result.mMaxDelayUs) ? statistics.mMaxStartDelay : result.mMaxDelayUs;
+			}
+			executor.Remove(id);
+		}
+		result.mTicksPerPad = runs / seconds / pads.size();
+		result.mMissedPercent = runs ? 100.0 * misses / runs : 0.0;
+		return result;
+	}
+
+	void Print(unsigned int pads, const char* mode, unsigned int workers, const StepResult& result)
+	{
+		std::printf("%5u  %-9s %7u %12.1f %9.2f %10.0f %10.0f %12llu %8llu %7.0f\n", pads, mode, workers,
+			result.mTicksPerPad, result.mMissedPercent, result.mJitterP50Us, result.mJitterP99Us,
+			(unsigned long long)result.mMaxDelayUs, (unsigned long long)result.mSteals, result.mCpuPercent);
+	}
+}
+
+int RunExecutorBenchmark(unsigned int maxPads, unsigned int padWorkUs)
+{
+	RdpGamepadExecutor executor;
+	executor.SetPinWorkers(true);
+	executor.Start();
+
+	std::printf("%u cores, %u us of work per tick, ideal %.1f ticks per second\n",
+		std::thread::hardware_concurrency(), padWorkUs, 1e6 / TickPeriod.count());
+	std::printf("%5s  %-9s %7s %12s %9s %10s %10s %12s %8s %7s\n", "Pads", "Mode", "Workers", "Ticks/s/pad",
+		"Missed %", "Jitter p50", "p99 us", "Max delay us", "Steals", "CPU %");
+	for (unsigned int count = 1; ; count = (count * 2 > maxPads) ? maxPads : count * 2)
+	{
+		for (int mode = 0; mode < 2; ++mode)
+		{
+			std::unique_ptr<RdpLatencyHistogram> jitter(new RdpLatencyHistogram);
+			std::vector<std::unique_ptr<SimulatedPad>> pads;
+			for (unsigned int i = 0; i < count; ++i)
+			{
+				pads.emplace_back(new SimulatedPad(padWorkUs, *jitter));
+			}
+
+			StepResult result = (mode == 0) ? RunSerial(pads) : RunExecutor(pads, executor);
+			std::unique_ptr<RdpLatencyHistogram::Snapshot> snapshot(new RdpLatencyHistogram::Snapshot);
+			jitter->TakeSnapshot(*snapshot);
+			result.mJitterP50Us = snapshot->GetPercentile(0.50) / 1e3;
+			result.mJitterP99Us = snapshot->GetPercentile(0.99) / 1e3;
+			Print(count, (mode == 0) ? "serial" : "executor", (mode == 0) ? 1 : executor.GetWorkerCount(), result);
+		}
+		if (count == maxPads)
+		{
+			break;
+		}
+	}
+	executor.Stop();
+	return 0;
+}
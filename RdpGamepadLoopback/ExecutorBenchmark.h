@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+// Ticks 1, 2, 4 and so on up to maxPads simulated pads every 16 ms for a second each, first all on one
+// thread like a single receiver, then on an RdpGamepadExecutor, and reports the tick rate, deadline
+// misses, start delays, steals and CPU time of each. A simulated tick drains two queued messages,
+// converts the newest state and spends padWorkUs standing in for the driver call. Returns a process exit
+// code.
+int RunExecutorBenchmark(unsigned int maxPads, unsigned int padWorkUs);
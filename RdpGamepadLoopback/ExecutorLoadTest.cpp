@@ -0,0 +1,105 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include <RdpGamepadExecutor.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	constexpr size_t TaskCount = 400;
+	constexpr auto Period = std::chrono::milliseconds(8);		// A receiver tick.
+	constexpr auto RunTime = std::chrono::milliseconds(400);
+
+	uint64_t Expected(std::chrono::milliseconds time)
+	{ return uint64_t(time / Period); }
+
+	// One session's tick: counts its runs and notices ticks after its removal.
+	struct Session
+	{
+		uint32_t mId = 0;
+		std::atomic<uint64_t> mRuns{0};
+		std::atomic<bool> mRemoved{false};
+		std::atomic<bool> mTickedAfterRemove{false};
+
+		void Tick()
+		{
+			if (mRemoved)
+			{
+				mTickedAfterRemove = true;
+			}
+			++mRuns;
+		}
+	};
+}
+
+// Several hundred sessions ticking on the default executor, as the service runs them: every one must
+// keep its rate, few runs may end after their next period started, and removing half of them while the
+// rest keep running must stop exactly those and leave the others ticking.
+bool TestExecutorLoad()
+{
+	std::vector<std::unique_ptr<Session>> sessions;
+	RdpGamepadExecutor executor;
+	executor.Start();
+	for (size_t i = 0; i < TaskCount; ++i)
+	{
+		sessions.emplace_back(new Session);
+		Session* session = sessions.back().get();
+		session->mId = executor.Add([session]() { session->Tick(); }, Period);
+	}
+	LOOPBACK_CHECK(executor.GetTaskCount() == TaskCount);
+
+	std::this_thread::sleep_for(RunTime);
+	uint64_t runs = 0;
+	uint64_t misses = 0;
+	uint64_t fewest = UINT64_MAX;
+	for (const auto& session : sessions)
+	{
+		RdpGamepadTaskStatistics statistics;
+		LOOPBACK_CHECK(executor.GetStatistics(session->mId, statistics));
+		runs += statistics.mRuns;
+		misses += statistics.mDeadlineMisses;
+		fewest = (session->mRuns < fewest) ? session->mRuns.load() : fewest;
+	}
+	LOOPBACK_CHECK(fewest >= Expected(RunTime) / 2);
+	LOOPBACK_CHECK(misses * 100 <= runs);
+	std::printf("    %zu tasks on %u workers: %llu runs, fewest %llu of %llu, %llu deadline misses, %llu steals\n",
+		TaskCount, executor.GetWorkerCount(), (unsigned long long)runs, (unsigned long long)fewest,
+		(unsigned long long)Expected(RunTime), (unsigned long long)misses, (unsigned long long)executor.GetStealCount());
+
+	// Remove every other session while all of them tick.
+	for (size_t i = 0; i < TaskCount; i += 2)
+	{
+		LOOPBACK_CHECK(executor.Remove(sessions[i]->mId));
+		sessions[i]->mRemoved = true;
+	}
+	LOOPBACK_CHECK(executor.GetTaskCount() == TaskCount / 2);
+
+	std::vector<uint64_t> before(TaskCount);
+	for (size_t i = 0; i < TaskCount; ++i)
+	{
+		before[i] = sessions[i]->mRuns;
+	}
+	std::this_thread::sleep_for(RunTime / 2);
+	for (size_t i = 0; i < TaskCount; ++i)
+	{
+		const Session& session = *sessions[i];
+		if (i % 2 == 0)
+		{
+			LOOPBACK_CHECK(!session.mTickedAfterRemove && session.mRuns == before[i]);
+		}
+		else
+		{
+			LOOPBACK_CHECK(session.mRuns - before[i] >= Expected(RunTime / 2) / 2);
+		}
+	}
+	executor.Stop();
+	return true;
+}
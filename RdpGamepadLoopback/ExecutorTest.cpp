@@ -0,0 +1,115 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include <RdpGamepadExecutor.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+namespace
+{
+	constexpr auto Period = std::chrono::milliseconds(5);
+	constexpr auto StallTime = std::chrono::milliseconds(40);
+
+	// Counts the runs of a task and whether any two of them ever overlapped.
+	struct TickProbe
+	{
+		std::atomic<int> mRunning{0};
+		std::atomic<uint64_t> mRuns{0};
+		std::atomic<bool> mOverlapped{false};
+
+		void Run(std::chrono::milliseconds duration)
+		{
+			if (mRunning.fetch_add(1) != 0)
+			{
+				mOverlapped = true;
+			}
+			std::this_thread::sleep_for(duration);
+			++mRuns;
+			mRunning.fetch_sub(1);
+		}
+	};
+
+	void WaitFor(const std::atomic<uint64_t>& runs, uint64_t count)
+	{
+		const auto end = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+		while (runs.load() < count && std::chrono::steady_clock::now() < end)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+}
+
+// Two tasks share a home worker and one of them stalls it: the other worker must steal the quick task
+// instead of letting it wait, the stalled task must drop the periods it missed, and no task may ever
+// run twice at once. Then Remove must wait for a running tick, Stop must stop every tick and Start must
+// resume the tasks still added. Last, a task added to a stuck worker must be stolen by an idle one.
+bool TestExecutor()
+{
+	TickProbe stalling;
+	TickProbe quick;
+	RdpGamepadExecutor executor(2);
+	const uint32_t stallingId = executor.Add([&]() { stalling.Run(StallTime); }, Period, 0);
+	const uint32_t quickId = executor.Add([&]() { quick.Run(std::chrono::milliseconds(0)); }, Period, 0);
+	executor.Start();
+
+	WaitFor(stalling.mRuns, 4);
+	LOOPBACK_CHECK(stalling.mRuns >= 4);
+
+	RdpGamepadTaskStatistics stallingStatistics;
+	RdpGamepadTaskStatistics quickStatistics;
+	LOOPBACK_CHECK(executor.GetStatistics(stallingId, stallingStatistics));
+	LOOPBACK_CHECK(executor.GetStatistics(quickId, quickStatistics));
+	LOOPBACK_CHECK(quickStatistics.mStolenRuns > 0 && executor.GetStealCount() >= quickStatistics.mStolenRuns);
+	LOOPBACK_CHECK(quick.mRuns > stalling.mRuns);
+	LOOPBACK_CHECK(stallingStatistics.mDeadlineMisses > 0 && stallingStatistics.mSkippedRuns > 0);
+	std::printf("    quick task: %llu runs, %llu stolen; stalling task: %llu runs, %llu skipped periods\n",
+		(unsigned long long)quickStatistics.mRuns, (unsigned long long)quickStatistics.mStolenRuns,
+		(unsigned long long)stallingStatistics.mRuns, (unsigned long long)stallingStatistics.mSkippedRuns);
+
+	// Removing the stalling task while it runs returns only once its tick finished.
+	while (stalling.mRunning.load() == 0)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	const uint64_t stallingRuns = stalling.mRuns;
+	LOOPBACK_CHECK(executor.Remove(stallingId));
+	LOOPBACK_CHECK(stalling.mRunning == 0 && stalling.mRuns == stallingRuns + 1);
+	LOOPBACK_CHECK(!executor.Remove(stallingId) && !executor.GetStatistics(stallingId, stallingStatistics));
+	LOOPBACK_CHECK(executor.GetTaskCount() == 1);
+
+	// Stopped, nothing runs; started again, the remaining task carries on.
+	executor.Stop();
+	const uint64_t quickRuns = quick.mRuns;
+	std::this_thread::sleep_for(Period * 4);
+	LOOPBACK_CHECK(quick.mRuns == quickRuns && quick.mRunning == 0);
+	executor.Start();
+	WaitFor(quick.mRuns, quickRuns + 3);
+	LOOPBACK_CHECK(quick.mRuns >= quickRuns + 3);
+	executor.Stop();
+
+	LOOPBACK_CHECK(stalling.mRuns == stallingRuns + 1);
+	LOOPBACK_CHECK(!stalling.mOverlapped && !quick.mOverlapped);
+
+	// A task added to a worker that is stuck wakes the other worker, asleep with nothing due anywhere,
+	// to steal it instead of waiting for the stuck one.
+	TickProbe stuck;
+	TickProbe added;
+	RdpGamepadExecutor idle(2);
+	idle.Add([&]() { stuck.Run(StallTime * 5); }, std::chrono::seconds(10), 0);
+	idle.Start();
+	while (stuck.mRunning.load() == 0)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	idle.Add([&]() { added.Run(std::chrono::milliseconds(0)); }, Period, 0);
+	WaitFor(added.mRuns, 3);
+	LOOPBACK_CHECK(added.mRuns >= 3 && stuck.mRunning == 1);
+	idle.Stop();
+	return true;
+}
@@ -0,0 +1,83 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include <RdpGamepadFeedback.h>
+
+#include <cstdint>
+
+namespace
+{
+	using namespace RdpGamepad;
+
+	bool SameFeedback(const RdpFeedback& a, uint16_t largeMotor, uint16_t smallMotor, uint8_t flags)
+	{
+		return a.mLargeMotor == largeMotor && a.mSmallMotor == smallMotor && a.mFlags == flags;
+	}
+}
+
+// The feedback coalescer only sends what changed, at most once a minimum interval, and a change made
+// while rate limited goes out merged with everything else set since, so the latest feedback always
+// arrives. Times are in milliseconds as in the receiver.
+bool TestFeedback()
+{
+	RdpFeedbackCoalescer coalescer(16);
+	RdpFeedback feedback;
+	LOOPBACK_CHECK(!coalescer.TakeReport(0, feedback));
+
+	// The first report goes out at once, and only with the fields that were set.
+	coalescer.SetRumble(100, 200);
+	LOOPBACK_CHECK(coalescer.TakeReport(1, feedback) && SameFeedback(feedback, 100, 200, FeedbackRumble));
+
+	// Setting the same value again sends nothing, however long after.
+	coalescer.SetRumble(100, 200);
+	LOOPBACK_CHECK(!coalescer.TakeReport(1000, feedback));
+
+	// Changes within the interval wait and merge; the last rumble set wins.
+	coalescer.SetRumble(300, 0);
+	LOOPBACK_CHECK(coalescer.TakeReport(1001, feedback) && SameFeedback(feedback, 300, 0, FeedbackRumble));
+	coalescer.SetRumble(400, 0);
+	LOOPBACK_CHECK(!coalescer.TakeReport(1005, feedback));
+	coalescer.SetLightBar(1, 2, 3);
+	coalescer.SetRumble(500, 50);
+	LOOPBACK_CHECK(!coalescer.TakeReport(1016, feedback));
+	LOOPBACK_CHECK(coalescer.TakeReport(1017, feedback));
+	LOOPBACK_CHECK(SameFeedback(feedback, 500, 50, FeedbackRumble | FeedbackLightBar));
+	LOOPBACK_CHECK(feedback.mLightBarR == 1 && feedback.mLightBarG == 2 && feedback.mLightBarB == 3);
+
+	// A change undone before the interval is up never goes out.
+	coalescer.SetRumble(0, 0);
+	coalescer.SetRumble(500, 50);
+	LOOPBACK_CHECK(!coalescer.TakeReport(1040, feedback));
+
+	// Invalidating resends the current feedback at once; resetting forgets it.
+	coalescer.Invalidate();
+	LOOPBACK_CHECK(coalescer.TakeReport(1041, feedback) && SameFeedback(feedback, 500, 50, FeedbackRumble | FeedbackLightBar));
+	coalescer.Reset();
+	LOOPBACK_CHECK(!coalescer.TakeReport(2000, feedback));
+	coalescer.SetPlayerLed(2);
+	LOOPBACK_CHECK(coalescer.TakeReport(2001, feedback) && feedback.mFlags == FeedbackPlayerLed && feedback.mPlayerLed == 2);
+
+	// A game ramping the motors every millisecond for a second, read every millisecond: at most one
+	// report per interval plus the one catching up with the final value.
+	coalescer.Reset();
+	uint64_t reports = 0;
+	RdpFeedback last{};
+	for (uint64_t now = 0; now < 1100; ++now)
+	{
+		if (now < 1000)
+		{
+			coalescer.SetRumble(static_cast<uint16_t>(now * 65), static_cast<uint16_t>(65535 - now * 65));
+		}
+		if (coalescer.TakeReport(10000 + now, feedback))
+		{
+			++reports;
+			last = feedback;
+		}
+	}
+	LOOPBACK_CHECK(reports >= 1000 / 16 && reports <= 1000 / 16 + 2);
+	LOOPBACK_CHECK(SameFeedback(last, 999 * 65, 65535 - 999 * 65, FeedbackRumble));
+	std::printf("    1000 rumble changes sent as %llu reports\n", static_cast<unsigned long long>(reports));
+	return true;
+}
@@ -0,0 +1,126 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include <RdpGamepadPlatform.h>
+#include <ds4_pad.h>
+#include <RdpGamepadJitterBuffer.h>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace
+{
+	constexpr uint64_t SampleInterval = 33333;	// The plugin's poll interval.
+	constexpr uint64_t MaxDelay = 50000;
+	constexpr size_t SampleCount = 3000;
+
+	struct Playout
+	{
+		std::vector<uint64_t> mArrivals;
+		std::vector<uint64_t> mReleases;
+		uint64_t mMaxAdded = 0;
+		bool mInOrder = true;
+	};
+
+	// Feeds a trace of states sampled every SampleInterval and delayed by up to maxJitter on the way, and
+	// releases every millisecond. The left stick carries the sample number; buttons change every
+	// pressEvery samples, 0 for never.
+	Playout Simulate(uint64_t maxJitter, size_t pressEvery, uint32_t seed)
+	{
+		std::minstd_rand random(seed);
+		std::uniform_int_distribution<uint64_t> jitter(0, maxJitter);
+		Playout playout;
+		for (size_t i = 0; i < SampleCount; ++i)
+		{
+			playout.mArrivals.push_back(i * SampleInterval + jitter(random));
+		}
+
+		// The channel delivers in order, so a late state holds back the ones behind it.
+		for (size_t i = 1; i < SampleCount; ++i)
+		{
+			playout.mArrivals[i] = (playout.mArrivals[i] > playout.mArrivals[i - 1]) ? playout.mArrivals[i] : playout.mArrivals[i - 1];
+		}
+
+		RdpGamepadJitterBuffer<XINPUT_GAMEPAD> buffer(MaxDelay);
+		playout.mReleases.assign(SampleCount, 0);
+		size_t next = 0;
+		size_t expected = 0;
+		for (uint64_t now = 0; expected < SampleCount; now += 1000)
+		{
+			while (next < SampleCount && playout.mArrivals[next] <= now)
+			{
+				XINPUT_GAMEPAD state = {};
+				state.sThumbLX = static_cast<SHORT>(next);
+				state.wButtons = (pressEvery != 0 && (next / pressEvery) % 2 == 1) ? XINPUT_GAMEPAD_A : 0;
+				buffer.Push(state, now);
+				++next;
+			}
+			buffer.Release(now, [&](const XINPUT_GAMEPAD& state)
+			{
+				const size_t sample = static_cast<size_t>(state.sThumbLX);
+				playout.mInOrder = playout.mInOrder && sample >= expected;
+				expected = sample + 1;
+				playout.mReleases[sample] = now;
+				const uint64_t arrival = (playout.mArrivals[sample] + 999) / 1000 * 1000;
+				playout.mMaxAdded = (now - arrival > playout.mMaxAdded) ? now - arrival : playout.mMaxAdded;
+			});
+		}
+		return playout;
+	}
+
+	// Standard deviation of the time between consecutive states in microseconds, over the states that
+	// were played at all.
+	double GetIntervalDeviation(const std::vector<uint64_t>& times)
+	{
+		double sum = 0.0;
+		double squares = 0.0;
+		size_t count = 0;
+		for (size_t i = 1; i < times.size(); ++i)
+		{
+			if (times[i] != 0 && times[i - 1] != 0)
+			{
+				const double interval = double(times[i]) - double(times[i - 1]);
+				sum += interval;
+				squares += interval * interval;
+				++count;
+			}
+		}
+		const double mean = sum / count;
+		return std::sqrt(squares / count - mean * mean);
+	}
+}
+
+bool TestJitterBuffer()
+{
+	// A steady link: the buffer learns there is no jitter and adds no delay.
+	const Playout steady = Simulate(0, 0, 29);
+	LOOPBACK_CHECK(steady.mInOrder);
+	LOOPBACK_CHECK(steady.mMaxAdded <= 1000);
+
+	// Arrivals spread over 15 ms: the states are played out at least twice as evenly, a little later.
+	const Playout jittery = Simulate(15000, 0, 29);
+	const double arrivalDeviation = GetIntervalDeviation(jittery.mArrivals);
+	const double releaseDeviation = GetIntervalDeviation(jittery.mReleases);
+	std::printf("    interval deviation %.1f ms arriving, %.1f ms played out\n", arrivalDeviation / 1000, releaseDeviation / 1000);
+	LOOPBACK_CHECK(jittery.mInOrder);
+	LOOPBACK_CHECK(releaseDeviation * 2 < arrivalDeviation);
+	LOOPBACK_CHECK(jittery.mMaxAdded <= MaxDelay + 1000);
+
+	// Arrivals spread over far more than the maximum delay: never held back longer than that.
+	const Playout bursty = Simulate(200000, 0, 29);
+	LOOPBACK_CHECK(bursty.mInOrder);
+	LOOPBACK_CHECK(bursty.mMaxAdded <= MaxDelay + 1000);
+
+	// Button changes skip the buffer, so every one is played as soon as it arrives.
+	const Playout pressed = Simulate(15000, 7, 29);
+	LOOPBACK_CHECK(pressed.mInOrder);
+	for (size_t i = 7; i < SampleCount; i += 7)
+	{
+		LOOPBACK_CHECK(pressed.mReleases[i] != 0);
+		LOOPBACK_CHECK(pressed.mReleases[i] - pressed.mArrivals[i] < 1000);
+	}
+	return true;
+}
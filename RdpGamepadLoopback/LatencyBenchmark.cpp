@@ -0,0 +1,93 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LatencyBenchmark.h"
+
+#include <RdpGamepadLatency.h>
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	using namespace RdpGamepad;
+	using Clock = std::chrono::steady_clock;
+
+	constexpr double BudgetNs = 20.0;
+
+	// Enough distinct durations to touch most buckets, few enough to stay in cache.
+	constexpr size_t ValueCount = 4096;
+
+	double Nanoseconds(Clock::duration duration)
+	{
+		return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+	}
+
+	// Nanosecond per Record from each of threads threads, all into histogram.
+	double TimeRecord(RdpLatencyHistogram& histogram, const std::vector<uint64_t>& values, uint64_t samples, unsigned int threads)
+	{
+		std::vector<std::thread> workers;
+		std::vector<double> elapsed(threads);
+		for (unsigned int thread = 0; thread < threads; ++thread)
+		{
+			workers.emplace_back([&, thread]()
+			{
+				const Clock::time_point start = Clock::now();
+				for (uint64_t i = 0; i < samples; ++i)
+				{
+					histogram.Record(values[(i + thread) % ValueCount]);
+				}
+				elapsed[thread] = Nanoseconds(Clock::now() - start);
+			});
+		}
+		double total = 0.0;
+		for (unsigned int thread = 0; thread < threads; ++thread)
+		{
+			workers[thread].join();
+			total += elapsed[thread];
+		}
+		return total / (double(samples) * threads);
+	}
+}
+
+int RunLatencyBenchmark(uint64_t samples, uint32_t seed)
+{
+	// Log-uniform from a nanosecond to about 18 minutes, the histogram's range.
+	std::mt19937_64 random(seed);
+	std::vector<uint64_t> values(ValueCount);
+	for (uint64_t& value : values)
+	{
+		const unsigned int bits = static_cast<unsigned int>(random() % RdpLatencyHistogram::MaxValueBits);
+		value = (random() & ((uint64_t(1) << bits) - 1)) | (uint64_t(1) << bits);
+	}
+
+	std::unique_ptr<RdpLatencyHistogram> histogram(new RdpLatencyHistogram);
+	const double singleNs = TimeRecord(*histogram, values, samples, 1);
+
+	// As the receiver times a stage: two clock reads and a Record.
+	const Clock::time_point timedStart = Clock::now();
+	for (uint64_t i = 0; i < samples; ++i)
+	{
+		const uint64_t start = RdpLatencyClock::Now();
+		histogram->Record(RdpLatencyClock::Now() - start);
+	}
+	const double timedNs = Nanoseconds(Clock::now() - timedStart) / samples;
+
+	const unsigned int threads = (std::thread::hardware_concurrency() > 1) ? std::thread::hardware_concurrency() : 2;
+	const double sharedNs = TimeRecord(*histogram, values, samples, threads);
+
+	std::unique_ptr<RdpLatencyHistogram::Snapshot> snapshot(new RdpLatencyHistogram::Snapshot);
+	histogram->TakeSnapshot(*snapshot);
+	const uint64_t expected = samples * (2 + threads);
+
+	std::printf("%-20s %llu recorded, %llu expected\n", "Samples",
+		(unsigned long long)snapshot->GetCount(), (unsigned long long)expected);
+	std::printf("%-20s %.2f ns per Record, budget %.0f ns\n", "One thread", singleNs, BudgetNs);
+	std::printf("%-20s %.2f ns per Record with two clock reads\n", "Timed stage", timedNs);
+	std::printf("%-20s %.2f ns per Record from each of %u threads\n", "Shared", sharedNs, threads);
+	return (snapshot->GetCount() == expected && singleNs < BudgetNs) ? 0 : 1;
+}
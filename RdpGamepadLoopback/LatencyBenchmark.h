@@ -0,0 +1,12 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstdint>
+
+// Records samples durations, spread over the whole range, into a latency histogram from one thread and
+// then from one thread per core, and reports the time per Record alone and with the two clock reads the
+// receiver and the plugin pair it with. Returns a process exit code, 1 when a single threaded Record takes
+// 20 ns or more.
+int RunLatencyBenchmark(uint64_t samples, uint32_t seed);
@@ -0,0 +1,220 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include <RdpGamepadLifecycle.h>
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace
+{
+	constexpr uint64_t StaleTimeout = 2000;
+	constexpr uint64_t StepPeriod = 16;
+
+	// A channel that opens, fails and delivers messages when the test says so, counting every call the
+	// lifecycle makes.
+	class FakeChannel : public RdpGamepadLifecycleHost
+	{
+	public:
+		bool mAvailable = false;		// A channel can be attached.
+		bool mOpen = false;
+		bool mSendFails = false;
+		bool mCloseOnRead = false;		// The channel breaks while reading.
+		std::deque<RdpLifecycleRead> mMessages;
+
+		unsigned int mConnects = 0;
+		unsigned int mDisconnects = 0;
+		unsigned int mRequests = 0;
+		unsigned int mStates = 0;
+		unsigned int mSubmits = 0;
+		unsigned int mStaleTimeouts = 0;
+		unsigned int mNeutralReports = 0;
+
+		bool AttachChannel() override
+		{
+			mOpen = mOpen || mAvailable;
+			return mOpen;
+		}
+
+		void Connect() override
+		{ ++mConnects; }
+
+		void Disconnect() override
+		{
+			++mDisconnects;
+			mOpen = false;
+			mMessages.clear();
+		}
+
+		bool SendRequests() override
+		{
+			++mRequests;
+			return !mSendFails;
+		}
+
+		RdpLifecycleRead Read() override
+		{
+			if (mCloseOnRead)
+			{
+				mOpen = false;
+				return LifecycleReadNone;
+			}
+			if (mMessages.empty())
+			{
+				return LifecycleReadNone;
+			}
+			const RdpLifecycleRead read = mMessages.front();
+			mMessages.pop_front();
+			mStates += (read == LifecycleReadState) ? 1 : 0;
+			return read;
+		}
+
+		void SubmitStates() override
+		{ ++mSubmits; }
+
+		void StaleTimeout() override
+		{ ++mStaleTimeouts; }
+
+		void SubmitNeutral() override
+		{ ++mNeutralReports; }
+
+		bool IsChannelOpen() override
+		{ return mOpen; }
+	};
+
+	bool TestSession()
+	{
+		FakeChannel channel;
+		RdpGamepadLifecycle lifecycle(channel, StaleTimeout);
+		uint64_t now = 1000;
+
+		// Without a channel every step asks for one again and gives up, and nothing is plugged in.
+		lifecycle.Step(now);
+		LOOPBACK_CHECK(lifecycle.GetPhase() == RdpGamepadLifecycle::PhaseDetached && channel.mDisconnects == 1);
+		LOOPBACK_CHECK(channel.mConnects == 0 && channel.mRequests == 0 && channel.mSubmits == 0);
+
+		// Once there is one, the session connects once and drains everything waiting in one step.
+		channel.mAvailable = true;
+		channel.mMessages = { LifecycleReadMessage, LifecycleReadState, LifecycleReadState, LifecycleReadMessage, LifecycleReadState };
+		now += StepPeriod;
+		lifecycle.Step(now);
+		LOOPBACK_CHECK(lifecycle.GetPhase() == RdpGamepadLifecycle::PhaseConnected);
+		LOOPBACK_CHECK(channel.mConnects == 1 && channel.mRequests == 1 && channel.mSubmits == 1);
+		LOOPBACK_CHECK(channel.mMessages.empty() && channel.mStates == 3);
+
+		// Quiet right up to the timeout it stays connected; one step past it goes stale exactly once
+		// and puts the controller at rest on every step until a state arrives again.
+		const uint64_t lastState = now;
+		while (now + StepPeriod <= lastState + StaleTimeout)
+		{
+			now += StepPeriod;
+			lifecycle.Step(now);
+		}
+		LOOPBACK_CHECK(lifecycle.GetPhase() == RdpGamepadLifecycle::PhaseConnected && channel.mStaleTimeouts == 0);
+		for (unsigned int i = 0; i < 10; ++i)
+		{
+			now += StepPeriod;
+			lifecycle.Step(now);
+		}
+		LOOPBACK_CHECK(lifecycle.GetPhase() == RdpGamepadLifecycle::PhaseStale);
+		LOOPBACK_CHECK(channel.mStaleTimeouts == 1 && channel.mNeutralReports == 10);
+		channel.mMessages.push_back(LifecycleReadState);
+		now += StepPeriod;
+		lifecycle.Step(now);
+		LOOPBACK_CHECK(lifecycle.GetPhase() == RdpGamepadLifecycle::PhaseConnected && channel.mNeutralReports == 10);
+		LOOPBACK_CHECK(channel.mConnects == 1 && channel.mDisconnects == 1);
+
+		// A failed send drops the channel, and the next step connects again.
+		channel.mSendFails = true;
+		now += StepPeriod;
+		lifecycle.Step(now);
+		LOOPBACK_CHECK(lifecycle.GetPhase() == RdpGamepadLifecycle::PhaseDetached && channel.mDisconnects == 2);
+		channel.mSendFails = false;
+		now += StepPeriod;
+		lifecycle.Step(now);
+		LOOPBACK_CHECK(lifecycle.GetPhase() == RdpGamepadLifecycle::PhaseConnected && channel.mConnects == 2);
+
+		// So does a channel that breaks while reading, after the step submitted what it had.
+		channel.mCloseOnRead = true;
+		const unsigned int submits = channel.mSubmits;
+		now += StepPeriod;
+		lifecycle.Step(now);
+		LOOPBACK_CHECK(lifecycle.GetPhase() == RdpGamepadLifecycle::PhaseDetached && channel.mDisconnects == 3);
+		LOOPBACK_CHECK(channel.mSubmits == submits + 1);
+		channel.mCloseOnRead = false;
+
+		// Restarting connects again but keeps the channel.
+		now += StepPeriod;
+		lifecycle.Step(now);
+		lifecycle.Restart();
+		now += StepPeriod;
+		lifecycle.Step(now);
+		LOOPBACK_CHECK(channel.mConnects == 4 && channel.mDisconnects == 3);
+		return true;
+	}
+
+	// Many sessions stepped from one thread on a virtual clock, each with a plugin that answers at a
+	// rate of its own and some that fall silent halfway.
+	bool TestManySessions()
+	{
+		constexpr unsigned int SessionCount = 2000;
+		constexpr uint64_t Duration = 10000;
+
+		std::vector<std::unique_ptr<FakeChannel>> channels;
+		std::vector<std::unique_ptr<RdpGamepadLifecycle>> lifecycles;
+		for (unsigned int i = 0; i < SessionCount; ++i)
+		{
+			channels.emplace_back(new FakeChannel);
+			channels.back()->mAvailable = (i % 10) != 0;
+			lifecycles.emplace_back(new RdpGamepadLifecycle(*channels.back(), StaleTimeout));
+		}
+
+		unsigned int steps = 0;
+		for (uint64_t now = 0; now < Duration; now += StepPeriod, ++steps)
+		{
+			for (unsigned int i = 0; i < SessionCount; ++i)
+			{
+				const bool silent = (i % 4) == 1 && now >= Duration / 2;
+				if (!silent && steps % (1 + i % 3) == 0)
+				{
+					channels[i]->mMessages.push_back(LifecycleReadState);
+				}
+				lifecycles[i]->Step(now);
+			}
+		}
+
+		for (unsigned int i = 0; i < SessionCount; ++i)
+		{
+			const FakeChannel& channel = *channels[i];
+			const RdpGamepadLifecycle::Phase phase = lifecycles[i]->GetPhase();
+			if (!channel.mAvailable)
+			{
+				LOOPBACK_CHECK(phase == RdpGamepadLifecycle::PhaseDetached && channel.mConnects == 0);
+				continue;
+			}
+			LOOPBACK_CHECK(channel.mConnects == 1 && channel.mSubmits == steps && channel.mMessages.empty());
+			if ((i % 4) == 1)
+			{
+				LOOPBACK_CHECK(phase == RdpGamepadLifecycle::PhaseStale && channel.mStaleTimeouts == 1);
+			}
+			else
+			{
+				LOOPBACK_CHECK(phase == RdpGamepadLifecycle::PhaseConnected && channel.mStaleTimeouts == 0);
+				LOOPBACK_CHECK(channel.mStates == (steps + i % 3) / (1 + i % 3));
+			}
+		}
+		std::printf("    %u sessions, %u steps each on one thread\n", SessionCount, steps);
+		return true;
+	}
+}
+
+// The receiver's session lifecycle against a fake channel on a virtual clock: connecting, draining,
+// going stale and recovering, dropping a failed channel, and thousands of sessions on one thread.
+bool TestLifecycle()
+{
+	return TestSession() && TestManySessions();
+}
@@ -0,0 +1,119 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <vector>
+
+struct LoopbackLinkSettings
+{
+	uint64_t mDelay = 10000;			// One way delay, microseconds.
+	uint64_t mJitter = 2000;			// Extra delay drawn uniformly from [0, mJitter], microseconds.
+	double mLoss = 0.0;					// Fraction of messages dropped.
+	uint64_t mBandwidth = 0;			// Bytes per second; 0 is unlimited.
+	uint64_t mSendBuffer = 1024;		// Bytes a writer may queue before its writes block.
+};
+
+// One direction of a simulated network connection. Messages leave in order, each one occupying the
+// link for its serialization time, and arrive after the delay plus jitter, never overtaking the
+// message before them, like a stream transport with a variable queueing delay. Times are simulated
+// microseconds.
+class LoopbackLink
+{
+public:
+	LoopbackLink(const LoopbackLinkSettings& settings, uint32_t seed)
+		: mSettings(settings)
+		, mRandom(seed)
+	{}
+
+	void Send(uint64_t now, const void* data, size_t size)
+	{
+		mSentMessages += 1;
+		mSentBytes += size;
+		if (mSettings.mLoss > 0.0 && std::uniform_real_distribution<double>(0.0, 1.0)(mRandom) < mSettings.mLoss)
+		{
+			mLostMessages += 1;
+			return;
+		}
+
+		uint64_t sent = std::max(now, mBusyUntil);
+		if (mSettings.mBandwidth != 0)
+		{
+			sent += size * 1000000 / mSettings.mBandwidth;
+		}
+		mBusyUntil = sent;
+
+		const uint64_t jitter = (mSettings.mJitter != 0) ? std::uniform_int_distribution<uint64_t>(0, mSettings.mJitter)(mRandom) : 0;
+		const uint64_t arrival = std::max(sent + mSettings.mDelay + jitter, mLastArrival);
+		mLastArrival = arrival;
+
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		mInFlight.push_back(Message{ arrival, std::vector<uint8_t>(bytes, bytes + size) });
+	}
+
+	// Takes the link for size bytes of other traffic sharing it, such as the session's video.
+	void Occupy(uint64_t now, size_t size)
+	{
+		if (mSettings.mBandwidth != 0)
+		{
+			mBusyUntil = std::max(now, mBusyUntil) + size * 1000000 / mSettings.mBandwidth;
+		}
+	}
+
+	// How long a write at now would block: the part of the queue in front of the link that does not fit
+	// the send buffer.
+	uint64_t GetWriteBlockTime(uint64_t now) const
+	{
+		if (mSettings.mBandwidth == 0 || mBusyUntil <= now)
+		{
+			return 0;
+		}
+		const uint64_t buffered = mSettings.mSendBuffer * 1000000 / mSettings.mBandwidth;
+		return (mBusyUntil - now > buffered) ? mBusyUntil - now - buffered : 0;
+	}
+
+	// Moves the next message that has arrived by now into outData.
+	bool Receive(uint64_t now, std::vector<uint8_t>& outData)
+	{
+		if (mInFlight.empty() || mInFlight.front().mArrival > now)
+		{
+			return false;
+		}
+		outData.swap(mInFlight.front().mData);
+		mInFlight.pop_front();
+		return true;
+	}
+
+	// Arrival time of the next message, or UINT64_MAX when nothing is in flight.
+	uint64_t GetNextArrival() const
+	{ return mInFlight.empty() ? UINT64_MAX : mInFlight.front().mArrival; }
+
+	uint64_t GetSentMessages() const
+	{ return mSentMessages; }
+
+	uint64_t GetSentBytes() const
+	{ return mSentBytes; }
+
+	uint64_t GetLostMessages() const
+	{ return mLostMessages; }
+
+private:
+	struct Message
+	{
+		uint64_t mArrival;
+		std::vector<uint8_t> mData;
+	};
+
+	LoopbackLinkSettings mSettings;
+	std::mt19937 mRandom;
+	std::deque<Message> mInFlight;
+	uint64_t mBusyUntil = 0;
+	uint64_t mLastArrival = 0;
+	uint64_t mSentMessages = 0;
+	uint64_t mSentBytes = 0;
+	uint64_t mLostMessages = 0;
+};
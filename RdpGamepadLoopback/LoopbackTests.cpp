@@ -0,0 +1,68 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include <chrono>
+#include <cstring>
+
+namespace
+{
+	const struct
+	{
+		const char* mName;
+		bool (*mRun)();
+	} sTests[] =
+	{
+		{ "report-cache", &TestReportCache },
+		{ "state-queue", &TestStateQueue },
+		{ "connection", &TestConnection },
+		{ "jitter-buffer", &TestJitterBuffer },
+		{ "switch-type", &TestSwitchType },
+		{ "conversion-tables", &TestConversionTables },
+		{ "stick-conversion", &TestStickConversion },
+		{ "batch-conversion", &TestBatchConversion },
+		{ "mapping", &TestMapping },
+		{ "counters", &TestCounters },
+		{ "trace-replay", &TestTraceReplay },
+		{ "splitter", &TestSplitter },
+		{ "target-pool", &TestTargetPool },
+		{ "executor", &TestExecutor },
+		{ "lifecycle", &TestLifecycle },
+		{ "button-events", &TestButtonEvents },
+		{ "motion", &TestMotion },
+		{ "rate-control", &TestRateControl },
+		{ "feedback", &TestFeedback },
+		{ "columnar", &TestColumnar },
+		{ "executor-load", &TestExecutorLoad },
+	};
+}
+
+int RunTests(const char* filter)
+{
+	using Clock = std::chrono::steady_clock;
+
+	unsigned int run = 0;
+	unsigned int failed = 0;
+	for (const auto& test : sTests)
+	{
+		if (std::strstr(test.mName, filter) == nullptr)
+		{
+			continue;
+		}
+		const Clock::time_point start = Clock::now();
+		const bool passed = test.mRun();
+		const double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		std::printf("%-20s %s (%.0f ms)\n", test.mName, passed ? "ok" : "FAILED", milliseconds);
+		++run;
+		failed += passed ? 0 : 1;
+	}
+
+	if (run == 0)
+	{
+		std::fprintf(stderr, "No test matches %s\n", filter);
+		return 2;
+	}
+	std::printf("%u of %u tests passed\n", run - failed, run);
+	return (failed == 0) ? 0 : 1;
+}
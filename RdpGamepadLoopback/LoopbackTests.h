@@ -0,0 +1,46 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstdio>
+
+// Checks of the plugin's and the receiver's building blocks that need neither Remote Desktop nor the
+// ViGEm driver, so they run wherever the loopback builds. Each test returns whether all of its checks
+// held; LOOPBACK_CHECK prints the first one that did not and fails the test.
+#define LOOPBACK_CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			std::printf("    %s(%d): %s\n", __FILE__, __LINE__, #condition); \
+			return false; \
+		} \
+	} \
+	while (false)
+
+bool TestReportCache();
+bool TestStateQueue();
+bool TestConnection();
+bool TestJitterBuffer();
+bool TestSwitchType();
+bool TestConversionTables();
+bool TestStickConversion();
+bool TestBatchConversion();
+bool TestMapping();
+bool TestCounters();
+bool TestTraceReplay();
+bool TestSplitter();
+bool TestTargetPool();
+bool TestExecutor();
+bool TestLifecycle();
+bool TestButtonEvents();
+bool TestMotion();
+bool TestRateControl();
+bool TestFeedback();
+bool TestColumnar();
+bool TestExecutorLoad();
+
+// Runs the tests whose name contains filter, all of them for an empty filter, and reports each. Returns a
+// process exit code.
+int RunTests(const char* filter);
@@ -0,0 +1,103 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <RdpGamepadPlatform.h>
+#include <RdpGamepadTrace.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The XInput states the plugin recorded in a trace, as a timeline in microseconds from the first one, so
+// a recorded session can stand in for the loopback's synthetic controller. The trace's button changes
+// are the reference the states arriving at the pad are checked against.
+class LoopbackTrace
+{
+public:
+	// Returns false if the file is not a trace or holds no XInput states from the plugin.
+	bool Load(const std::string& path)
+	{
+		mTimes.clear();
+		mStates.clear();
+
+		RdpGamepad::RdpTraceReader reader;
+		if (!reader.Open(path))
+		{
+			return false;
+		}
+		uint64_t firstTime = 0;
+		RdpGamepad::RdpTraceReplayer::Replay(reader, RdpGamepad::TraceSourcePlugin, RdpGamepad::RdpTraceReplayer::PacingFastest,
+			[&](const RdpGamepad::RdpTraceSample& sample)
+			{
+				XINPUT_GAMEPAD state;
+				if (sample.mHeader.mKind != RdpGamepad::TraceKindXInput || !sample.GetState(state))
+				{
+					return;
+				}
+				if (mTimes.empty())
+				{
+					firstTime = sample.mHeader.mTime;
+				}
+				// Samples from several threads may be a little out of order; keep the timeline sorted.
+				const uint64_t time = (sample.mHeader.mTime > firstTime) ? (sample.mHeader.mTime - firstTime) / 1000 : 0;
+				mTimes.push_back(mTimes.empty() ? time : std::max(time, mTimes.back()));
+				mStates.push_back(state);
+			});
+		return !mStates.empty();
+	}
+
+	size_t GetStateCount() const
+	{ return mStates.size(); }
+
+	// Microseconds from the first state to the last.
+	uint64_t GetDuration() const
+	{ return mTimes.empty() ? 0 : mTimes.back(); }
+
+	// The last state recorded at or before time, or the first state for earlier times.
+	const XINPUT_GAMEPAD& GetState(uint64_t time) const
+	{
+		const size_t next = std::upper_bound(mTimes.begin(), mTimes.end(), time) - mTimes.begin();
+		return mStates[(next != 0) ? next - 1 : 0];
+	}
+
+	// Every button word the trace moves to, in order, starting from no buttons held.
+	std::vector<WORD> GetButtonChanges() const
+	{
+		std::vector<WORD> changes;
+		WORD buttons = 0;
+		for (const XINPUT_GAMEPAD& state : mStates)
+		{
+			if (state.wButtons != buttons)
+			{
+				buttons = state.wButtons;
+				changes.push_back(buttons);
+			}
+		}
+		return changes;
+	}
+
+	// Presses of any button in a sequence of button words starting from no buttons held. Unlike the
+	// words themselves this does not depend on how changes of several buttons close together are
+	// grouped, which the receiver's button replay may do differently from the trace.
+	static uint64_t CountPresses(const std::vector<WORD>& changes)
+	{
+		uint64_t presses = 0;
+		WORD buttons = 0;
+		for (WORD change : changes)
+		{
+			for (WORD pressed = WORD(change & ~buttons); pressed != 0; pressed = WORD(pressed & (pressed - 1)))
+			{
+				++presses;
+			}
+			buttons = change;
+		}
+		return presses;
+	}
+
+private:
+	std::vector<uint64_t> mTimes;
+	std::vector<XINPUT_GAMEPAD> mStates;
+};
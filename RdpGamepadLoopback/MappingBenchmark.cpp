@@ -0,0 +1,73 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "MappingBenchmark.h"
+
+#include <GamepadMapping.h>
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	// Enough distinct states that the branch predictor cannot learn them, few enough to stay in cache.
+	constexpr size_t StateCount = 4096;
+
+	double Nanoseconds(Clock::duration duration)
+	{
+		return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+	}
+}
+
+int RunMappingBenchmark(uint64_t samples, uint32_t seed)
+{
+	MappingProfile profile;
+	profile.ButtonMap[12] = XINPUT_GAMEPAD_B;
+	profile.ButtonMap[13] = XINPUT_GAMEPAD_A;
+	profile.LeftStick.AxialDeadzone = 0.05f;
+	profile.LeftStick.RadialDeadzone = 0.15f;
+	profile.LeftStick.CurveExponent = 1.5f;
+	profile.RightStick.RadialDeadzone = 0.1f;
+	profile.RightStick.RadialSaturation = 0.95f;
+	profile.LeftTrigger.Deadzone = 20;
+	profile.RightTrigger.CurveExponent = 2.0f;
+
+	std::mt19937 random(seed);
+	std::vector<XINPUT_GAMEPAD> states(StateCount);
+	for (XINPUT_GAMEPAD& state : states)
+	{
+		state.wButtons = static_cast<WORD>(random());
+		state.bLeftTrigger = static_cast<BYTE>(random());
+		state.bRightTrigger = static_cast<BYTE>(random());
+		state.sThumbLX = static_cast<SHORT>(random());
+		state.sThumbLY = static_cast<SHORT>(random());
+		state.sThumbRX = static_cast<SHORT>(random());
+		state.sThumbRY = static_cast<SHORT>(random());
+	}
+
+	GamepadMapper mapper;
+	const Clock::time_point compileStart = Clock::now();
+	mapper.SetProfile(profile);
+	const double compileNs = Nanoseconds(Clock::now() - compileStart);
+
+	// The sum of the results keeps the compiler from dropping the work.
+	uint64_t checksum = 0;
+	const Clock::time_point applyStart = Clock::now();
+	for (uint64_t i = 0; i < samples; ++i)
+	{
+		XINPUT_GAMEPAD state = states[i % StateCount];
+		mapper.Apply(state);
+		checksum += uint64_t(state.wButtons) + state.bLeftTrigger + state.bRightTrigger +
+			uint16_t(state.sThumbLX) + uint16_t(state.sThumbLY) + uint16_t(state.sThumbRX) + uint16_t(state.sThumbRY);
+	}
+	const double applyNs = Nanoseconds(Clock::now() - applyStart);
+
+	std::printf("%-20s %llu, checksum %016llx\n", "Samples", (unsigned long long)samples, (unsigned long long)checksum);
+	std::printf("%-20s %.2f ns per sample\n", "Apply", applyNs / samples);
+	std::printf("%-20s %.2f ms per profile\n", "Compile", compileNs / 1e6);
+	return 0;
+}
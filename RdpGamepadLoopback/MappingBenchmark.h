@@ -0,0 +1,11 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstdint>
+
+// Applies a mapping profile with a radial deadzone, response curves and remapped buttons to samples random
+// controller states through the receiver's GamepadMapper, and reports the time spent per sample and to
+// compile the profile. Returns a process exit code.
+int RunMappingBenchmark(uint64_t samples, uint32_t seed);
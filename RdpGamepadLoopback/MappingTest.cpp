@@ -0,0 +1,192 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include <GamepadMapping.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	bool Parse(const char* text, MappingProfile& outProfile)
+	{
+		std::istringstream input(text);
+		return ParseMappingProfile(input, outProfile);
+	}
+
+	bool SameGamepad(const XINPUT_GAMEPAD& a, const XINPUT_GAMEPAD& b)
+	{
+		return a.wButtons == b.wButtons && a.bLeftTrigger == b.bLeftTrigger && a.bRightTrigger == b.bRightTrigger &&
+			a.sThumbLX == b.sThumbLX && a.sThumbLY == b.sThumbLY && a.sThumbRX == b.sThumbRX && a.sThumbRY == b.sThumbRY;
+	}
+
+	XINPUT_GAMEPAD Mapped(const MappingProfile& profile, XINPUT_GAMEPAD gamepad)
+	{
+		CompiledMapping(profile).Apply(gamepad);
+		return gamepad;
+	}
+
+	bool TestParse()
+	{
+		MappingProfile profile;
+		LOOPBACK_CHECK(Parse(
+			"# Swap A and B, drop BACK.\n"
+			"ButtonMap.A B\n"
+			"ButtonMap.B A   # trailing comment\n"
+			"  ButtonMap.BACK None\n"
+			"\n"
+			"LeftStick.RadialDeadzone 0.2\n"
+			"RightStick.CurveExponent 2\n"
+			"LeftTrigger.Deadzone 30\n"
+			"RightTrigger.Saturation 200\n"
+			"RightTrigger.CurveExponent 0.5\n", profile));
+		LOOPBACK_CHECK(profile.ButtonMap[12] == XINPUT_GAMEPAD_B);
+		LOOPBACK_CHECK(profile.ButtonMap[13] == XINPUT_GAMEPAD_A);
+		LOOPBACK_CHECK(profile.ButtonMap[5] == 0);
+		LOOPBACK_CHECK(profile.ButtonMap[4] == XINPUT_GAMEPAD_START);
+		LOOPBACK_CHECK(profile.LeftStick.RadialDeadzone == 0.2f);
+		LOOPBACK_CHECK(profile.RightStick.CurveExponent == 2.0f);
+		LOOPBACK_CHECK(profile.LeftTrigger.Deadzone == 30);
+		LOOPBACK_CHECK(profile.RightTrigger.Saturation == 200);
+		LOOPBACK_CHECK(profile.RightTrigger.CurveExponent == 0.5f);
+
+		XINPUT_GAMEPAD gamepad{};
+		gamepad.wButtons = XINPUT_GAMEPAD_A | XINPUT_GAMEPAD_BACK | XINPUT_GAMEPAD_START;
+		gamepad.bLeftTrigger = 20;
+		gamepad.bRightTrigger = 250;
+		const XINPUT_GAMEPAD mapped = Mapped(profile, gamepad);
+		LOOPBACK_CHECK(mapped.wButtons == (XINPUT_GAMEPAD_B | XINPUT_GAMEPAD_START));
+		LOOPBACK_CHECK(mapped.bLeftTrigger == 0);
+		LOOPBACK_CHECK(mapped.bRightTrigger == 255);
+
+		// A bad line leaves the profile as it was.
+		const char* malformed[] =
+		{
+			"ButtonMap.A\n",
+			"ButtonMap.A B C\n",
+			"ButtonMap.GUIDE A\n",
+			"ButtonMap.A Z\n",
+			"LeftStick.Deadzone 0.1\n",
+			"LeftStick.RadialDeadzone 0.1x\n",
+			"LeftStick.RadialDeadzone nan\n",
+			"LeftTrigger.Deadzone 256\n",
+			"LeftTrigger.Deadzone -1\n",
+			"MiddleStick.CurveExponent 1\n",
+			"CurveExponent 1\n",
+		};
+		for (const char* text : malformed)
+		{
+			MappingProfile unchanged = profile;
+			LOOPBACK_CHECK(!Parse(text, unchanged));
+			LOOPBACK_CHECK(unchanged.ButtonMap[12] == XINPUT_GAMEPAD_B && unchanged.LeftTrigger.Deadzone == 30);
+		}
+		return true;
+	}
+
+	// Readers apply the mapper as fast as they can while the profile flips between two that give different
+	// results; each result must be one or the other, never a mix or a freed mapping's leftovers.
+	// A deadzone covering all or nearly all of the axis must not overflow the rescale and flip the sign.
+	bool TestAxialDeadzone()
+	{
+		for (float deadzone : {1.0f, 0.99999f})
+		{
+			MappingProfile profile;
+			profile.LeftStick.AxialDeadzone = deadzone;
+
+			XINPUT_GAMEPAD gamepad{};
+			gamepad.sThumbLX = 30000;
+			gamepad.sThumbLY = -30000;
+			XINPUT_GAMEPAD mapped = Mapped(profile, gamepad);
+			LOOPBACK_CHECK(mapped.sThumbLX == 0 && mapped.sThumbLY == 0);
+
+			for (SHORT full : {SHORT(SHRT_MAX), SHORT(SHRT_MIN)})
+			{
+				gamepad.sThumbLX = full;
+				gamepad.sThumbLY = 0;
+				mapped = Mapped(profile, gamepad);
+				LOOPBACK_CHECK((full > 0) ? mapped.sThumbLX >= 0 : mapped.sThumbLX <= 0);
+				LOOPBACK_CHECK(deadzone == 1.0f || std::abs(mapped.sThumbLX) == SHRT_MAX);
+			}
+		}
+		return true;
+	}
+
+	bool TestHotSwap()
+	{
+		MappingProfile first;
+		first.ButtonMap[12] = XINPUT_GAMEPAD_B;
+		first.LeftStick.RadialDeadzone = 0.3f;
+		first.RightTrigger.Deadzone = 100;
+		MappingProfile second;
+		second.ButtonMap[12] = XINPUT_GAMEPAD_Y;
+		second.LeftStick.CurveExponent = 3.0f;
+		second.RightTrigger.CurveExponent = 2.0f;
+
+		XINPUT_GAMEPAD input{};
+		input.wButtons = XINPUT_GAMEPAD_A | XINPUT_GAMEPAD_DPAD_LEFT;
+		input.bRightTrigger = 180;
+		input.sThumbLX = 9000;
+		input.sThumbLY = -12000;
+		const XINPUT_GAMEPAD expected[2] = { Mapped(first, input), Mapped(second, input) };
+		LOOPBACK_CHECK(!SameGamepad(expected[0], expected[1]));
+
+		GamepadMapper mapper;
+		XINPUT_GAMEPAD unmapped = input;
+		LOOPBACK_CHECK(!mapper.Apply(unmapped));
+		LOOPBACK_CHECK(SameGamepad(unmapped, input));
+		mapper.SetProfile(first);
+
+		std::atomic<bool> stop{false};
+		std::atomic<uint64_t> applied{0};
+		std::atomic<uint64_t> torn{0};
+		std::vector<std::thread> readers;
+		for (int i = 0; i < 3; ++i)
+		{
+			readers.emplace_back([&]()
+			{
+				while (!stop.load())
+				{
+					XINPUT_GAMEPAD gamepad = input;
+					if (!mapper.Apply(gamepad) || !(SameGamepad(gamepad, expected[0]) || SameGamepad(gamepad, expected[1])))
+					{
+						torn.fetch_add(1);
+					}
+					applied.fetch_add(1);
+				}
+			});
+		}
+		for (int swap = 0; swap < 1000; ++swap)
+		{
+			mapper.SetProfile((swap % 2 == 0) ? second : first);
+		}
+		stop = true;
+		for (auto& reader : readers)
+		{
+			reader.join();
+		}
+		LOOPBACK_CHECK(applied.load() != 0);
+		LOOPBACK_CHECK(torn.load() == 0);
+
+		// With no reader left, the next swap frees every mapping replaced while they ran.
+		mapper.SetProfile(first);
+		LOOPBACK_CHECK(mapper.GetRetiredCount() == 0);
+		XINPUT_GAMEPAD gamepad = input;
+		LOOPBACK_CHECK(mapper.Apply(gamepad) && SameGamepad(gamepad, expected[0]));
+
+		mapper.ClearProfile();
+		LOOPBACK_CHECK(mapper.GetRetiredCount() == 0);
+		gamepad = input;
+		LOOPBACK_CHECK(!mapper.Apply(gamepad) && SameGamepad(gamepad, input));
+		return true;
+	}
+}
+
+bool TestMapping()
+{
+	return TestParse() && TestAxialDeadzone() && TestHotSwap();
+}
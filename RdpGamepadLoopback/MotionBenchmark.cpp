@@ -0,0 +1,226 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "MotionBenchmark.h"
+
+#include <RdpGamepadMotionFilter.h>
+#include <RdpGamepadProtocol.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	using namespace RdpGamepad;
+	using Clock = std::chrono::steady_clock;
+
+	constexpr uint64_t TickPeriodUs = 16000;
+	constexpr double Pi = 3.14159265358979323846;
+
+	// The DualShock 4's gyroscope reports about 16.4 units per degree a second.
+	constexpr double GyroUnitsPerDegree = 16.4;
+
+	// Someone aiming: slow sweeps with hand tremor and sensor noise on top, the controller tilted a little
+	// and gravity on the accelerometer's Y axis (8192 units per g). Every other second a finger swipes
+	// across the touchpad.
+	class SyntheticImu
+	{
+	public:
+		explicit SyntheticImu(uint32_t seed)
+			: mRandom(seed)
+		{}
+
+		RdpMotionSample Sample(uint64_t timeUs, RdpTouchPoint (&outTouch)[TouchPointCount])
+		{
+			const double t = timeUs / 1e6;
+			RdpMotionSample sample;
+			sample.mTime = static_cast<uint32_t>(timeUs);
+			sample.mGyro[0] = Clamp(1800.0 * std::sin(2 * Pi * 0.7 * t) + 150.0 * std::sin(2 * Pi * 9.0 * t) + Noise(6));
+			sample.mGyro[1] = Clamp(2400.0 * std::sin(2 * Pi * 0.45 * t + 1.0) + 150.0 * std::sin(2 * Pi * 11.0 * t) + Noise(6));
+			sample.mGyro[2] = Clamp(300.0 * std::sin(2 * Pi * 0.3 * t) + Noise(6));
+			sample.mAccel[0] = Clamp(600.0 * std::sin(2 * Pi * 0.7 * t) + Noise(24));
+			sample.mAccel[1] = Clamp(8192.0 - 300.0 * std::cos(2 * Pi * 0.45 * t) + Noise(24));
+			sample.mAccel[2] = Clamp(1200.0 + Noise(24));
+
+			const uint64_t swipe = timeUs % 2000000;
+			outTouch[0] = RdpTouchPoint{};
+			outTouch[1] = RdpTouchPoint{};
+			if (swipe >= 1000000 && swipe < 1500000)
+			{
+				outTouch[0].mDown = 1;
+				outTouch[0].mId = static_cast<uint8_t>(timeUs / 2000000);
+				outTouch[0].mX = static_cast<uint16_t>(200 + (swipe - 1000000) * 1500 / 500000);
+				outTouch[0].mY = 470;
+			}
+			return sample;
+		}
+
+	private:
+		uint32_t mRandom;
+
+		double Noise(int amplitude)
+		{
+			mRandom = mRandom * 1664525u + 1013904223u;
+			return static_cast<int>(mRandom >> 16) % (2 * amplitude + 1) - amplitude;
+		}
+
+		static int16_t Clamp(double value)
+		{
+			return static_cast<int16_t>(value < -32768.0 ? -32768.0 : value > 32767.0 ? 32767.0 : value);
+		}
+	};
+
+	bool SameSample(const RdpMotionSample& a, const RdpMotionSample& b)
+	{
+		return a.mTime == b.mTime &&
+			std::memcmp(a.mGyro, b.mGyro, sizeof(a.mGyro)) == 0 &&
+			std::memcmp(a.mAccel, b.mAccel, sizeof(a.mAccel)) == 0;
+	}
+}
+
+int RunMotionBenchmark(unsigned int rateHz, double seconds, uint32_t seed)
+{
+	SyntheticImu imu(seed);
+	RdpMotionRecorder recorder;
+	RdpGamepadMotionFilter filter;
+	std::vector<RdpMotionSample> sent;
+
+	const uint64_t period = 1000000 / rateHz;
+	const uint64_t end = static_cast<uint64_t>(seconds * 1e6);
+
+	uint64_t messages = 0;
+	uint64_t wireBytes = 0;
+	uint64_t decoded = 0;
+	uint64_t mismatches = 0;
+	uint64_t lost = 0;
+	uint64_t reports = 0;
+	Clock::duration encodeTime{};
+	Clock::duration decodeTime{};
+
+	// Rotation in gyroscope units times microseconds: as sampled, as integrated from the reports, and as
+	// integrated from reports carrying only the newest sample of each tick.
+	double sampled[3] = {};
+	double sampledAtFirstReport[3] = {};
+	double averaged[3] = {};
+	double newest[3] = {};
+	double travelled = 0;
+	RdpMotionSample last = {};
+	uint64_t lastReportTime = 0;
+	bool hasReport = false;
+
+	uint64_t sampleTime = 0;
+	for (uint64_t tick = TickPeriodUs; tick <= end; tick += TickPeriodUs)
+	{
+		// The plugin's sampler thread.
+		for (; sampleTime <= tick; sampleTime += period)
+		{
+			RdpTouchPoint touch[TouchPointCount];
+			const RdpMotionSample sample = imu.Sample(sampleTime, touch);
+			if (!sent.empty())
+			{
+				const double elapsed = double(uint32_t(sample.mTime - last.mTime));
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					sampled[axis] += sample.mGyro[axis] * elapsed;
+					travelled += std::fabs(sample.mGyro[axis] * elapsed);
+				}
+			}
+			last = sample;
+			sent.push_back(sample);
+			recorder.Sample(sample, touch);
+		}
+
+		// The plugin answers the receiver's state request with every sample waiting.
+		for (;;)
+		{
+			RdpMotionBatch batch;
+			const Clock::time_point encodeStart = Clock::now();
+			const bool taken = recorder.Take(batch);
+			encodeTime += Clock::now() - encodeStart;
+			if (!taken)
+			{
+				break;
+			}
+
+			const RdpMotionResponse response = RdpMotionResponse::MakeResponse(0, batch);
+			RdpProtocolPacket packet;
+			std::memcpy(&packet, &response, response.mMessageSize);
+			if (!packet.IsValid())
+			{
+				std::fprintf(stderr, "Invalid motion message of %u bytes\n", unsigned(response.mMessageSize));
+				return 1;
+			}
+			++messages;
+			wireBytes += response.mMessageSize;
+
+			RdpMotionSample samples[MotionBatchCapacity];
+			const Clock::time_point decodeStart = Clock::now();
+			const size_t count = Motion::Decode(packet.mMotionResponse.mBatch, packet.mMotionResponse.GetDataSize(), samples);
+			decodeTime += Clock::now() - decodeStart;
+			if (count != batch.mCount)
+			{
+				std::fprintf(stderr, "Motion batch %u did not decode\n", unsigned(batch.mSequence));
+				return 1;
+			}
+			for (size_t i = 0; i < count; ++i)
+			{
+				const size_t index = packet.mMotionResponse.mBatch.mSequence + i;
+				mismatches += (index >= sent.size() || !SameSample(sent[index], samples[i])) ? 1 : 0;
+			}
+			decoded += count;
+			lost += filter.Push(packet.mMotionResponse.mBatch, samples, count);
+		}
+
+		// The receiver's tick.
+		RdpGamepadMotionReport report;
+		if (filter.Take(report))
+		{
+			if (hasReport)
+			{
+				const double elapsed = double(report.mTime - lastReportTime);
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					averaged[axis] += report.mGyro[axis] * elapsed;
+					newest[axis] += last.mGyro[axis] * elapsed;
+				}
+			}
+			else
+			{
+				std::memcpy(sampledAtFirstReport, sampled, sizeof(sampled));
+			}
+			lastReportTime = report.mTime;
+			hasReport = true;
+			++reports;
+		}
+	}
+
+	double averagedError = 0;
+	double newestError = 0;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const double expected = sampled[axis] - sampledAtFirstReport[axis];
+		averagedError = std::fmax(averagedError, std::fabs(averaged[axis] - expected));
+		newestError = std::fmax(newestError, std::fabs(newest[axis] - expected));
+	}
+	const double toDegrees = 1.0 / GyroUnitsPerDegree / 1e6;
+	const double encodeNs = double(std::chrono::duration_cast<std::chrono::nanoseconds>(encodeTime).count());
+	const double decodeNs = double(std::chrono::duration_cast<std::chrono::nanoseconds>(decodeTime).count());
+	const size_t wholeBytes = sizeof(RdpProtocolHeader) + MotionBatchHeaderSize;
+
+	std::printf("%-20s %llu at %u Hz, %llu decoded, %llu mismatched, %llu lost\n", "Samples",
+		(unsigned long long)sent.size(), rateHz, (unsigned long long)decoded, (unsigned long long)mismatches, (unsigned long long)lost);
+	std::printf("%-20s %llu, %.1f samples each, %llu reports\n", "Messages",
+		(unsigned long long)messages, messages ? double(decoded) / messages : 0.0, (unsigned long long)reports);
+	std::printf("%-20s %.2f bytes per sample delta coded, %.2f whole, %.0f bytes/s\n", "Wire",
+		decoded ? double(wireBytes) / decoded : 0.0,
+		decoded ? double(messages * wholeBytes + decoded * (sizeof(uint32_t) + 6 * sizeof(int16_t))) / decoded : 0.0,
+		wireBytes / seconds);
+	std::printf("%-20s encode %.1f ns, decode %.1f ns per sample\n", "CPU",
+		decoded ? encodeNs / decoded : 0.0, decoded ? decodeNs / decoded : 0.0);
+	std::printf("%-20s %.1f degrees turned; integrated error %.4f degrees averaged, %.2f newest sample only\n", "Rotation",
+		travelled * toDegrees, averagedError * toDegrees, newestError * toDegrees);
+	return (mismatches == 0 && lost == 0) ? 0 : 1;
+}
@@ -0,0 +1,13 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstdint>
+
+// Streams seconds of synthetic aiming motion sampled at rateHz through the plugin's motion recorder, the
+// MotionResponse message and the receiver's motion filter, in simulated time, with the receiver ticking
+// every 16 ms. Reports the bytes per sample on the wire against sending every sample whole, the time
+// spent encoding and decoding, lost samples and how far the rotation a game would integrate from the
+// receiver's reports strays from the rotation sampled. Returns a process exit code.
+int RunMotionBenchmark(unsigned int rateHz, double seconds, uint32_t seed);
@@ -0,0 +1,175 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include <RdpGamepadMotion.h>
+#include <RdpGamepadMotionFilter.h>
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace
+{
+	using namespace RdpGamepad;
+
+	bool SameSample(const RdpMotionSample& a, const RdpMotionSample& b)
+	{
+		return a.mTime == b.mTime &&
+			std::memcmp(a.mGyro, b.mGyro, sizeof(a.mGyro)) == 0 &&
+			std::memcmp(a.mAccel, b.mAccel, sizeof(a.mAccel)) == 0;
+	}
+
+	// Samples at 1 kHz with a little timer jitter, starting just before the plugin's clock wraps. Smooth
+	// motion gives small differences; rough motion jumps anywhere in the axis range on every sample,
+	// which is the largest a sample can encode to.
+	std::vector<RdpMotionSample> MakeSamples(size_t count, bool rough, uint32_t seed)
+	{
+		std::mt19937 random(seed);
+		std::vector<RdpMotionSample> samples(count);
+		uint32_t time = UINT32_MAX - 20000;
+		int16_t axes[6] = { 0, 0, 0, 0, 8192, 1200 };
+		for (RdpMotionSample& sample : samples)
+		{
+			time += 1000 + ((random() % 8 == 0) ? random() % 200 : 0);
+			sample.mTime = time;
+			for (int axis = 0; axis < 6; ++axis)
+			{
+				axes[axis] = rough ? static_cast<int16_t>(random()) : static_cast<int16_t>(axes[axis] + int(random() % 41) - 20);
+			}
+			std::memcpy(sample.mGyro, axes, sizeof(sample.mGyro));
+			std::memcpy(sample.mAccel, axes + 3, sizeof(sample.mAccel));
+		}
+		return samples;
+	}
+
+	// Encodes the samples batch after batch and decodes each batch on its own, as the receiver does.
+	bool RoundTrip(const std::vector<RdpMotionSample>& samples, size_t& outBatches, size_t& outBytes)
+	{
+		outBatches = 0;
+		outBytes = 0;
+		size_t offset = 0;
+		while (offset < samples.size())
+		{
+			RdpMotionBatch batch;
+			const size_t encoded = Motion::Encode(samples.data() + offset, samples.size() - offset, static_cast<uint32_t>(offset), batch);
+			LOOPBACK_CHECK(encoded != 0 && encoded == batch.mCount && batch.mSize <= MotionDataCapacity);
+			LOOPBACK_CHECK(batch.mSequence == offset && batch.mTime == samples[offset].mTime);
+
+			RdpMotionSample decoded[MotionBatchCapacity];
+			LOOPBACK_CHECK(Motion::Decode(batch, batch.mSize, decoded) == encoded);
+			for (size_t i = 0; i < encoded; ++i)
+			{
+				LOOPBACK_CHECK(SameSample(decoded[i], samples[offset + i]));
+			}
+			offset += encoded;
+			outBytes += MotionBatchHeaderSize + batch.mSize;
+			++outBatches;
+		}
+		return true;
+	}
+}
+
+// The motion encoding round trip at 1 kHz: every sample must come back exactly, across the clock wrapping
+// and at the extremes of the axis range, a full batch must stop short of overflowing, malformed batches
+// must decode to nothing, the recorder must hand out every sample once, in order, or count the gap, and
+// the receiver must not let a sample out of time order skew its average.
+bool TestMotion()
+{
+	// Varints and zigzag at the edges of their ranges.
+	const int32_t differences[] = { 0, 1, -1, 63, -64, 64, 32767, -32768, 65535, -65535 };
+	for (int32_t difference : differences)
+	{
+		uint8_t buffer[5];
+		uint8_t* write = buffer;
+		LOOPBACK_CHECK(Motion::PutVarint(write, buffer + sizeof(buffer), Motion::ZigZag(difference)));
+		LOOPBACK_CHECK(write - buffer <= 3);
+		const uint8_t* read = buffer;
+		uint32_t value;
+		LOOPBACK_CHECK(Motion::GetVarint(read, write, value) && read == write && Motion::UnZigZag(value) == difference);
+		read = buffer;
+		LOOPBACK_CHECK(write - buffer == 1 || !Motion::GetVarint(read, write - 1, value));
+	}
+	const uint8_t tooLong[] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x01 };
+	const uint8_t* read = tooLong;
+	uint32_t value;
+	LOOPBACK_CHECK(!Motion::GetVarint(read, tooLong + sizeof(tooLong), value));
+
+	// Smooth motion fills whole batches; rough motion runs out of bytes first.
+	size_t batches;
+	size_t bytes;
+	const std::vector<RdpMotionSample> smooth = MakeSamples(10000, false, 49);
+	LOOPBACK_CHECK(RoundTrip(smooth, batches, bytes));
+	LOOPBACK_CHECK(batches == (smooth.size() + MotionBatchCapacity - 1) / MotionBatchCapacity);
+	std::printf("    smooth: %.1f bytes a sample in %zu batches\n", double(bytes) / smooth.size(), batches);
+	const std::vector<RdpMotionSample> rough = MakeSamples(10000, true, 50);
+	LOOPBACK_CHECK(RoundTrip(rough, batches, bytes));
+	LOOPBACK_CHECK(batches > (rough.size() + MotionBatchCapacity - 1) / MotionBatchCapacity);
+	std::printf("    rough: %.1f bytes a sample in %zu batches\n", double(bytes) / rough.size(), batches);
+
+	// Malformed batches: cut short, claiming too many samples, or with bytes left over.
+	RdpMotionBatch batch;
+	RdpMotionSample decoded[MotionBatchCapacity];
+	const size_t encoded = Motion::Encode(smooth.data(), MotionBatchCapacity, 0, batch);
+	LOOPBACK_CHECK(encoded == MotionBatchCapacity);
+	LOOPBACK_CHECK(Motion::Decode(batch, batch.mSize - 1, decoded) == 0);
+	RdpMotionBatch broken = batch;
+	--broken.mSize;
+	LOOPBACK_CHECK(Motion::Decode(broken, broken.mSize, decoded) == 0);
+	broken = batch;
+	broken.mCount = MotionBatchCapacity + 1;
+	LOOPBACK_CHECK(Motion::Decode(broken, broken.mSize, decoded) == 0);
+	broken = batch;
+	--broken.mCount;
+	LOOPBACK_CHECK(Motion::Decode(broken, broken.mSize, decoded) == 0);
+
+	// The recorder sampled at 1 kHz and emptied every 16 ms hands out every sample once.
+	RdpMotionRecorder recorder;
+	RdpTouchPoint touch[TouchPointCount] = {};
+	uint32_t sequence = 0;
+	for (size_t i = 0; i < smooth.size(); ++i)
+	{
+		touch[0].mDown = 1;
+		touch[0].mX = static_cast<uint16_t>(i % 1920);
+		recorder.Sample(smooth[i], touch);
+		if (i % 16 == 15)
+		{
+			LOOPBACK_CHECK(recorder.Take(batch));
+			LOOPBACK_CHECK(batch.mSequence == sequence && batch.mCount == 16 && batch.mTouch[0].mX == i % 1920);
+			LOOPBACK_CHECK(Motion::Decode(batch, batch.mSize, decoded) == 16);
+			for (size_t j = 0; j < 16; ++j)
+			{
+				LOOPBACK_CHECK(SameSample(decoded[j], smooth[sequence + j]));
+			}
+			sequence += batch.mCount;
+		}
+	}
+	LOOPBACK_CHECK(!recorder.Take(batch) && recorder.GetDroppedCount() == 0);
+
+	// Left alone for longer than it holds, it drops the oldest and the sequence number shows the gap.
+	for (size_t i = 0; i < RdpMotionRecorder::Capacity + 10; ++i)
+	{
+		recorder.Sample(smooth[i], touch);
+	}
+	LOOPBACK_CHECK(recorder.GetDroppedCount() == 10 && recorder.GetPendingCount() == RdpMotionRecorder::Capacity);
+	LOOPBACK_CHECK(recorder.Take(batch) && batch.mSequence == sequence + 10 && batch.mCount == MotionBatchCapacity);
+	LOOPBACK_CHECK(Motion::Decode(batch, batch.mSize, decoded) == MotionBatchCapacity && SameSample(decoded[0], smooth[10]));
+
+	// The receiver's filter drops a sample older than the one before it instead of weighting it by the
+	// wrapped difference, across the plugin's clock wrapping too.
+	const uint32_t times[] = { UINT32_MAX - 1500, UINT32_MAX - 500, UINT32_MAX - 1000, 499 };
+	RdpMotionSample ordered[4] = {};
+	for (size_t i = 0; i < 4; ++i)
+	{
+		ordered[i].mTime = times[i];
+		ordered[i].mGyro[0] = (i == 2) ? 30000 : 100;
+	}
+	RdpMotionBatch orderedBatch{};
+	RdpGamepadMotionFilter filter;
+	LOOPBACK_CHECK(filter.Push(orderedBatch, ordered, 4) == 0);
+	RdpGamepadMotionReport report;
+	LOOPBACK_CHECK(filter.Take(report) && report.mGyro[0] == 100 && report.mTime == 2000);
+	return true;
+}
@@ -0,0 +1,208 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include "LoopbackLink.h"
+
+#include <RdpGamepadProtocol.h>
+#include <RdpGamepadRateControl.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+namespace
+{
+	using namespace RdpGamepad;
+
+	// All times in this test are virtual microseconds.
+	constexpr uint64_t StatePeriod = 16000;			// The receiver asks for a state every tick.
+	constexpr uint64_t PressPeriod = 500000;
+	constexpr uint64_t PhaseLength = 10000000;		// Other traffic fills the link every other phase.
+	constexpr uint64_t Duration = 5 * PhaseLength;
+	constexpr uint64_t VideoFrameInterval = 1000000 / 60;
+	constexpr uint64_t LinkBandwidth = 3000;
+	constexpr uint64_t CrossTraffic = 2000;
+
+	// RdpGamepadProcessor's rate control bounds.
+	const RdpRateLimits Limits = { 16000, 100000, 0, 2048, 100000, 1000000 };
+
+	struct LinkResult
+	{
+		uint64_t mBytes = 0;
+		uint64_t mPresses = 0;
+		uint64_t mPressesArrived = 0;
+		uint64_t mMaxButtonLatency = 0;
+		std::vector<uint64_t> mCongestedLatency;	// Of states sampled while other traffic filled the link.
+		RdpRateStatus mStatus = {};
+	};
+
+	bool IsCongested(uint64_t now)
+	{ return (now / PhaseLength) % 2 == 1; }
+
+	// Both sticks sweeping all the time and A pressed for half of every PressPeriod.
+	XINPUT_STATE Sample(uint64_t now)
+	{
+		const double t = now / 1e6;
+		XINPUT_STATE state = {};
+		state.dwPacketNumber = static_cast<DWORD>(now);
+		state.Gamepad.wButtons = ((now / (PressPeriod / 2)) % 2 == 1) ? XINPUT_GAMEPAD_A : 0;
+		state.Gamepad.sThumbLX = static_cast<SHORT>(20000 * std::sin(t * 1.3));
+		state.Gamepad.sThumbRY = static_cast<SHORT>(20000 * std::cos(t * 0.7));
+		return state;
+	}
+
+	uint64_t Percentile(std::vector<uint64_t> values, double fraction)
+	{
+		if (values.empty())
+		{
+			return 0;
+		}
+		std::sort(values.begin(), values.end());
+		return values[std::min(values.size() - 1, size_t(fraction * values.size()))];
+	}
+
+	// The plugin's state and probe messages over a link that video fills every other phase, with the
+	// probes echoed at the host's next tick over an idle return path.
+	LinkResult RunLink(bool rateControl)
+	{
+		LoopbackLinkSettings settings;
+		settings.mJitter = 0;
+		settings.mBandwidth = LinkBandwidth;
+		LoopbackLink toHost(settings, 1);
+		LoopbackLinkSettings returnSettings;
+		returnSettings.mJitter = 0;
+		LoopbackLink toPlugin(returnSettings, 2);
+
+		RdpRateController rate;
+		if (rateControl)
+		{
+			rate.Configure(Limits);
+		}
+
+		LinkResult result;
+		WORD sentButtons = 0;
+		WORD arrivedButtons = 0;
+		std::deque<uint64_t> changeTimes;		// Of the button changes not yet arrived.
+		std::vector<uint8_t> data;
+		for (uint64_t now = 0; now <= Duration + PhaseLength / 10; now += 1000)
+		{
+			if (now % VideoFrameInterval < 1000 && IsCongested(now) && now <= Duration)
+			{
+				toHost.Occupy(now, CrossTraffic * VideoFrameInterval / 1000000);
+			}
+
+			while (toPlugin.Receive(now, data))
+			{
+				RdpRateProbe probe;
+				std::memcpy(&probe, data.data(), sizeof(probe));
+				rate.OnProbe(now, probe.mTime);
+			}
+
+			if (now % StatePeriod == 0 && now <= Duration)
+			{
+				const XINPUT_STATE state = Sample(now);
+				if (state.Gamepad.wButtons != sentButtons)
+				{
+					sentButtons = state.Gamepad.wButtons;
+					result.mPresses += (sentButtons != 0) ? 1 : 0;
+					changeTimes.push_back(now);
+				}
+
+				uint32_t probeTime;
+				if (rate.TakeProbe(now, probeTime))
+				{
+					const RdpRateProbe probe = RdpRateProbe::MakeProbe(0, probeTime);
+					toHost.Send(now, &probe, probe.mMessageSize);
+				}
+				const uint16_t analog[RateAnalogCount] = { static_cast<uint16_t>(state.Gamepad.sThumbLX + 32768), 32768, 32768,
+					static_cast<uint16_t>(state.Gamepad.sThumbRY + 32768), 0, 0 };
+				if (rate.Admit(now, state.Gamepad.wButtons, analog, false))
+				{
+					rate.OnWrite(toHost.GetWriteBlockTime(now));
+					const RdpGetStateResponse response = RdpGetStateResponse::MakeResponse(0, ERROR_SUCCESS, state);
+					toHost.Send(now, &response, response.mMessageSize);
+				}
+			}
+
+			while (toHost.Receive(now, data))
+			{
+				RdpProtocolPacket packet;
+				std::memcpy(&packet, data.data(), data.size());
+				if (packet.mHeader.mMessageType == RdpMessageType::RateProbe)
+				{
+					// The host reads its channel once a tick.
+					const uint64_t echo = (now / StatePeriod + 1) * StatePeriod;
+					toPlugin.Send(echo, &packet.mRateProbe, packet.mRateProbe.mMessageSize);
+					continue;
+				}
+
+				const XINPUT_STATE& state = packet.mGetStateResponse.mState;
+				if (IsCongested(state.dwPacketNumber))
+				{
+					result.mCongestedLatency.push_back(now - state.dwPacketNumber);
+				}
+				if (state.Gamepad.wButtons != arrivedButtons)
+				{
+					arrivedButtons = state.Gamepad.wButtons;
+					result.mPressesArrived += (arrivedButtons != 0) ? 1 : 0;
+					if (!changeTimes.empty())
+					{
+						result.mMaxButtonLatency = std::max<uint64_t>(result.mMaxButtonLatency, now - changeTimes.front());
+						changeTimes.pop_front();
+					}
+				}
+			}
+		}
+		result.mBytes = toHost.GetSentBytes();
+		result.mStatus = rate.GetStatus();
+		return result;
+	}
+}
+
+// The rate controller on its own and on a simulated link that video fills every other 10 seconds.
+// Without it, states queue behind the video and arrive seconds late; with it, every button change
+// still goes out at once, fewer bytes are sent, the states sent while the link is full arrive far
+// sooner, and the headroom grows back once the link is clear.
+bool TestRateControl()
+{
+	// Disabled, every state goes out; enabled, an idle controller only sends the keepalive, and a button
+	// change goes out even right after another state.
+	RdpRateController rate;
+	const uint16_t rest[RateAnalogCount] = { 32768, 32768, 32768, 32768, 0, 0 };
+	LOOPBACK_CHECK(rate.Admit(0, 0, rest, false) && rate.Admit(1, 0, rest, false));
+	rate.Configure(Limits);
+	LOOPBACK_CHECK(rate.Admit(0, 0, rest, false));
+	uint64_t admitted = 0;
+	for (uint64_t now = StatePeriod; now < 1000000; now += StatePeriod)
+	{
+		admitted += rate.Admit(now, 0, rest, false) ? 1 : 0;
+	}
+	const uint64_t keepalive = (Limits.mMinKeepalive + StatePeriod - 1) / StatePeriod * StatePeriod;
+	LOOPBACK_CHECK(admitted == (1000000 - 1) / keepalive);
+	LOOPBACK_CHECK(rate.Admit(1000001, XINPUT_GAMEPAD_B, rest, false) && rate.Admit(1000002, 0, rest, false));
+	LOOPBACK_CHECK(!rate.Admit(1000003, 0, rest, false) && rate.Admit(1000004, 0, rest, true));
+
+	const LinkResult plain = RunLink(false);
+	const LinkResult controlled = RunLink(true);
+	const uint64_t plainP99 = Percentile(plain.mCongestedLatency, 0.99);
+	const uint64_t controlledP50 = Percentile(controlled.mCongestedLatency, 0.50);
+	const uint64_t controlledP99 = Percentile(controlled.mCongestedLatency, 0.99);
+	std::printf("    without rate control: %llu bytes, congested p99 %llu ms, button max %llu ms\n",
+		(unsigned long long)plain.mBytes, (unsigned long long)(plainP99 / 1000), (unsigned long long)(plain.mMaxButtonLatency / 1000));
+	std::printf("    with rate control: %llu bytes, congested p50 %llu ms p99 %llu ms, button max %llu ms, %llu backoffs\n",
+		(unsigned long long)controlled.mBytes, (unsigned long long)(controlledP50 / 1000), (unsigned long long)(controlledP99 / 1000),
+		(unsigned long long)(controlled.mMaxButtonLatency / 1000), (unsigned long long)controlled.mStatus.mBackoffs);
+
+	LOOPBACK_CHECK(plain.mPressesArrived == plain.mPresses && controlled.mPressesArrived == controlled.mPresses);
+	LOOPBACK_CHECK(controlled.mBytes < plain.mBytes);
+	LOOPBACK_CHECK(controlled.mStatus.mBackoffs > 0 && controlled.mStatus.mSuppressed > 0);
+	LOOPBACK_CHECK(controlledP99 * 4 < plainP99);
+	LOOPBACK_CHECK(controlled.mMaxButtonLatency * 4 < plain.mMaxButtonLatency);
+	LOOPBACK_CHECK(controlled.mStatus.mHeadroom == 1.0);
+	return true;
+}
@@ -0,0 +1,916 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+// Runs the plugin's message handling and the receiver's tick against each other over a simulated
+// network, in simulated time, and reports throughput, input latency and the CPU time spent per
+// simulated second:
+//
+//   RdpGamepadLoopback [--seconds s] [--delay ms] [--jitter ms] [--loss fraction] [--bandwidth bytes/s]
+//                      [--source sine|random|taps] [--trace file] [--tap ms] [--button-events ms] [--poll]
+//                      [--no-coalesce] [--jitter-buffer ms] [--rate-control] [--cross-traffic bytes/s] [--seed n]
+//   RdpGamepadLoopback --transport tcp:<port>|unix:<path>|shm:<name> [--messages n]
+//   RdpGamepadLoopback --executor <pads> [--pad-work us]
+//   RdpGamepadLoopback --motion <Hz> [--seconds s] [--seed n]
+//   RdpGamepadLoopback --mapping <samples> [--seed n]
+//   RdpGamepadLoopback --latency <samples> [--seed n]
+//   RdpGamepadLoopback --conversion <samples> [--seed n]
+//   RdpGamepadLoopback --test [name]
+//
+// The real endpoints are tied to Remote Desktop and ViGEm, so the endpoints here follow
+// CRdpGamepadChannel and RdpGamepadProcessor (in CONTROLLER_360 mode) step by step, on top of the
+// same protocol, state queue, jitter buffer, button edge detector and replay, feedback coalescer and
+// latency histograms. --source taps presses A for --tap milliseconds every 97 ms and reports how many of
+// those taps reached the pad; --trace replays the plugin's XInput states from a trace the plugin recorded,
+// on their recorded timeline and for its length instead of --seconds, and fails unless exactly the
+// trace's button presses reach the pad, which makes a recorded session a regression check; --button-events has the plugin sample buttons every millisecond and the
+// receiver replay the edges with the given minimum hold. --cross-traffic has other traffic take that much
+// of the plugin's direction of the link every other 10 seconds, as the session's video would, and
+// --rate-control has the receiver turn on the plugin's rate controller.
+//
+// With --transport the endpoints talk over a real local transport instead, in real time; see
+// TransportBenchmark.h. With --executor it measures how the receiver's executor scales with the
+// number of pads; see ExecutorBenchmark.h. With --motion it streams DS4 motion samples through the
+// encoder and the receiver's filter; see MotionBenchmark.h. With --mapping it times the receiver's
+// mapping profiles per sample; see MappingBenchmark.h. With --latency it times recording into the latency
+// histograms; see LatencyBenchmark.h. With --conversion it times converting states between the report
+// formats; see ConversionBenchmark.h. With --test it runs the checks in
+// LoopbackTests.h whose name contains name, or all of them.
+
+#include <RdpGamepadProtocol.h>
+#include <RdpGamepadStateQueue.h>
+#include <RdpGamepadButtonReplay.h>
+#include <RdpGamepadJitterBuffer.h>
+
+#include "ConversionBenchmark.h"
+#include "ExecutorBenchmark.h"
+#include "LatencyBenchmark.h"
+#include "LoopbackLink.h"
+#include "LoopbackTests.h"
+#include "LoopbackTrace.h"
+#include "MappingBenchmark.h"
+#include "MotionBenchmark.h"
+#include "TransportBenchmark.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+	using namespace RdpGamepad;
+
+	constexpr uint64_t MicrosecondsPerSecond = 1000000;
+	constexpr uint64_t ReceiverTickInterval = 16000;		// RdpGamepadProcessor::Run.
+	constexpr uint64_t PluginPollInterval = 1000000 / 30;	// kPollInterval in the plugin.
+	constexpr uint64_t PluginPollTimeout = 2000000;
+	constexpr unsigned int StaleTicks = 120;
+	constexpr uint64_t TapInterval = 97000;				// Not a multiple of either interval above.
+	constexpr uint32_t ButtonSamplePeriod = 1000;		// RdpGamepadProcessor::ButtonSamplePeriodUs.
+	constexpr uint64_t CrossTrafficPeriod = 10000000;
+	constexpr uint64_t VideoFrameInterval = 1000000 / 60;
+	constexpr uint64_t TraceMargin = 1000000;			// Before a trace for connecting, after it for delivery.
+
+	// RdpGamepadProcessor's rate control bounds.
+	const RdpRateLimits RateLimits = { ReceiverTickInterval, 100000, 0, 2048, 100000, 1000000 };
+
+	enum InputSource
+	{
+		InputSine,
+		InputRandom,
+		InputTaps,
+		InputTrace,
+	};
+
+	struct Settings
+	{
+		double mSeconds = 60.0;
+		LoopbackLinkSettings mLink;
+		InputSource mSource = InputSine;
+		std::string mTracePath;
+		unsigned int mTapMs = 5;
+		unsigned int mButtonEventsMs = 0;
+		bool mPoll = false;
+		bool mCoalesce = true;
+		unsigned int mJitterBufferMs = 0;
+		bool mRateControl = false;
+		uint64_t mCrossTraffic = 0;
+		uint32_t mSeed = 1;
+	};
+
+	void GetAnalog(const XINPUT_GAMEPAD& gamepad, uint16_t (&outAnalog)[RateAnalogCount])
+	{
+		outAnalog[0] = static_cast<uint16_t>(gamepad.sThumbLX + 32768);
+		outAnalog[1] = static_cast<uint16_t>(gamepad.sThumbLY + 32768);
+		outAnalog[2] = static_cast<uint16_t>(gamepad.sThumbRX + 32768);
+		outAnalog[3] = static_cast<uint16_t>(gamepad.sThumbRY + 32768);
+		outAnalog[4] = static_cast<uint16_t>(gamepad.bLeftTrigger * 257);
+		outAnalog[5] = static_cast<uint16_t>(gamepad.bRightTrigger * 257);
+	}
+
+	// A synthetic physical controller. The right stick's Y axis carries a sample counter, so the pad sink
+	// can tell when each state it receives was sampled; for a trace this replaces the recorded axis.
+	class SyntheticPad
+	{
+	public:
+		SyntheticPad(InputSource source, const LoopbackTrace& trace, unsigned int tapMs, uint32_t seed)
+			: mSource(source)
+			, mTrace(trace)
+			, mTapLength(tapMs * 1000ull)
+			, mRandom(seed)
+			, mSampleTimes(65536, 0)
+		{}
+
+		XINPUT_STATE Sample(uint64_t now)
+		{
+			const double seconds = double(now) / MicrosecondsPerSecond;
+			XINPUT_GAMEPAD& gamepad = mState.Gamepad;
+			if (mSource == InputTrace)
+			{
+				gamepad = GetTraceState(now);
+			}
+			else if (mSource != InputRandom)
+			{
+				// Half a turn per second on the left stick.
+				const double angle = seconds * 3.14159265358979;
+				gamepad.sThumbLX = static_cast<SHORT>(30000.0 * std::cos(angle));
+				gamepad.sThumbLY = static_cast<SHORT>(30000.0 * std::sin(angle));
+				gamepad.bRightTrigger = static_cast<BYTE>(127.5 + 127.5 * std::sin(angle * 0.25));
+				gamepad.wButtons = GetButtons(now);
+			}
+			else
+			{
+				// A random walk on the sticks and triggers, and a random button toggled now and then.
+				std::uniform_int_distribution<int> step(-2000, 2000);
+				gamepad.sThumbLX = Clamp(gamepad.sThumbLX + step(mRandom));
+				gamepad.sThumbLY = Clamp(gamepad.sThumbLY + step(mRandom));
+				gamepad.sThumbRX = Clamp(gamepad.sThumbRX + step(mRandom));
+				gamepad.bLeftTrigger = static_cast<BYTE>(gamepad.bLeftTrigger + step(mRandom) / 100);
+				if (std::uniform_int_distribution<int>(0, 7)(mRandom) == 0)
+				{
+					gamepad.wButtons ^= static_cast<WORD>(1u << std::uniform_int_distribution<int>(0, 15)(mRandom));
+				}
+			}
+
+			gamepad.sThumbRY = static_cast<SHORT>(mSequence);
+			mSampleTimes[mSequence] = now;
+			mSequence = static_cast<uint16_t>(mSequence + 1);
+			++mState.dwPacketNumber;
+			return mState;
+		}
+
+		// The buttons held at time now, without taking a state. The sine source holds A for 100ms out of
+		// every 500ms, the tap source for the tap length at the end of every TapInterval.
+		WORD GetButtons(uint64_t now) const
+		{
+			switch (mSource)
+			{
+			case InputSine:
+				return ((now % 500000) < 100000) ? XINPUT_GAMEPAD_A : 0;
+
+			case InputTaps:
+				return ((now % TapInterval) >= TapInterval - mTapLength) ? XINPUT_GAMEPAD_A : 0;
+
+			case InputTrace:
+				return GetTraceState(now).wButtons;
+
+			default:
+				return mState.Gamepad.wButtons;
+			}
+		}
+
+		// Taps that ended by time end.
+		uint64_t GetTapCount(uint64_t end) const
+		{ return (mSource == InputTaps) ? end / TapInterval : 0; }
+
+		uint64_t GetSampleTime(const XINPUT_GAMEPAD& gamepad) const
+		{ return mSampleTimes[static_cast<uint16_t>(gamepad.sThumbRY)]; }
+
+	private:
+		InputSource mSource;
+		const LoopbackTrace& mTrace;
+		uint64_t mTapLength;
+		std::mt19937 mRandom;
+		XINPUT_STATE mState{};
+		uint16_t mSequence = 0;
+		std::vector<uint64_t> mSampleTimes;
+
+		static SHORT Clamp(int value)
+		{ return static_cast<SHORT>(std::min(std::max(value, -32768), 32767)); }
+
+		// The controller rests until the receiver had time to connect, then plays the trace.
+		XINPUT_GAMEPAD GetTraceState(uint64_t now) const
+		{ return (now >= TraceMargin) ? mTrace.GetState(now - TraceMargin) : XINPUT_GAMEPAD{}; }
+	};
+
+	// Stands in for the ViGEm target: times every state submitted to it.
+	class FakePadSink
+	{
+	public:
+		explicit FakePadSink(const SyntheticPad& pad)
+			: mPad(pad)
+		{}
+
+		void SetGamepadState(uint64_t now, const XINPUT_GAMEPAD& gamepad)
+		{
+			++mSubmitted;
+			const bool pressed = (gamepad.wButtons & XINPUT_GAMEPAD_A) != 0;
+			if (pressed && !mPressed)
+			{
+				++mPresses;
+				mPressTime = now;
+			}
+			else if (!pressed && mPressed)
+			{
+				const uint64_t hold = now - mPressTime;
+				mShortestHold = std::min(mShortestHold, hold);
+			}
+			mPressed = pressed;
+
+			const XINPUT_GAMEPAD neutral = RdpGamepadButtonTraits<XINPUT_GAMEPAD>::Neutral();
+			if (std::memcmp(&gamepad, &neutral, sizeof(gamepad)) != 0)
+			{
+				const uint64_t latency = (now - mPad.GetSampleTime(gamepad)) * 1000;
+				mLatency.Record(latency);
+				if (gamepad.wButtons != mButtons)
+				{
+					mButtonLatency.Record(latency);
+				}
+			}
+			if (gamepad.wButtons != mButtons)
+			{
+				mButtonChanges.push_back(gamepad.wButtons);
+			}
+			mButtons = gamepad.wButtons;
+		}
+
+		// Every button word the pad moved to, in order.
+		const std::vector<WORD>& GetButtonChanges() const
+		{ return mButtonChanges; }
+
+		uint64_t GetSubmitted() const
+		{ return mSubmitted; }
+
+		// Times A went down on the pad, and the shortest time it then stayed down.
+		uint64_t GetPresses() const
+		{ return mPresses; }
+
+		uint64_t GetShortestHold() const
+		{ return mShortestHold; }
+
+		const RdpLatencyHistogram& GetLatency() const
+		{ return mLatency; }
+
+		// Latency of the states that changed the buttons.
+		const RdpLatencyHistogram& GetButtonLatency() const
+		{ return mButtonLatency; }
+
+	private:
+		const SyntheticPad& mPad;
+		RdpLatencyHistogram mLatency;
+		RdpLatencyHistogram mButtonLatency;
+		WORD mButtons = 0;
+		std::vector<WORD> mButtonChanges;
+		uint64_t mSubmitted = 0;
+		uint64_t mPresses = 0;
+		uint64_t mPressTime = 0;
+		uint64_t mShortestHold = UINT64_MAX;
+		bool mPressed = false;
+	};
+
+	// Follows CRdpGamepadChannel: validates each message and answers it, and runs the poll timers.
+	class LoopbackPlugin
+	{
+	public:
+		LoopbackPlugin(LoopbackLink& toReceiver, SyntheticPad& pad)
+			: mToReceiver(toReceiver)
+			, mPad(pad)
+		{}
+
+		void OnDataReceived(uint64_t now, const std::vector<uint8_t>& data)
+		{
+			if (data.size() < sizeof(RdpProtocolHeader) || data.size() > sizeof(RdpProtocolPacket))
+			{
+				++mProtocolErrors;
+				return;
+			}
+
+			RdpProtocolPacket packet;
+			std::memcpy(&packet, data.data(), data.size());
+			if (!packet.IsValid())
+			{
+				++mProtocolErrors;
+				return;
+			}
+
+			switch (packet.mHeader.mMessageType)
+			{
+			case RdpMessageType::GetStateRequest:
+				SendControllerState(now, packet.mGetStateRequest.mUserIndex);
+				break;
+
+			case RdpMessageType::PollStateRequest:
+				SendControllerState(now, packet.mPollStateRequest.mUserIndex);
+				mPollUser = packet.mPollStateRequest.mUserIndex;
+				mPollInterval = mRate.IsEnabled() ? mRate.GetMinInterval() : PluginPollInterval;
+				mPollTime = now + mPollInterval;
+				mPollTimeout = now + PluginPollTimeout;
+				break;
+
+			case RdpMessageType::SetFeedbackRequest:
+				Send(now, RdpSetFeedbackResponse::MakeResponse(packet.mSetFeedbackRequest.mUserIndex, ERROR_SUCCESS));
+				break;
+
+			case RdpMessageType::GetLatencyRequest:
+				{
+					RdpLatencySummary stages[LatencyStageCount];
+					mLatency.Summarize(stages);
+					Send(now, RdpGetLatencyResponse::MakeResponse(packet.mGetLatencyRequest.mUserIndex, stages));
+				}
+				break;
+
+			case RdpMessageType::SetButtonEventsRequest:
+				mButtonEdges.Reset();
+				mSamplePeriod = packet.mSetButtonEventsRequest.mSamplePeriod;
+				mSampleTime = (mSamplePeriod != 0) ? now + mSamplePeriod : UINT64_MAX;
+				break;
+
+			case RdpMessageType::SetRateControlRequest:
+				mRate.Configure(packet.mSetRateControlRequest.mLimits);
+				break;
+
+			case RdpMessageType::RateProbe:
+				mRate.OnProbe(now, packet.mRateProbe.mTime);
+				break;
+
+			default:
+				break;
+			}
+		}
+
+		void RunTimers(uint64_t now)
+		{
+			if (mPollTimeout <= now)
+			{
+				mPollTime = UINT64_MAX;
+				mPollTimeout = UINT64_MAX;
+			}
+			while (mPollTime <= now)
+			{
+				SendControllerState(mPollTime, mPollUser);
+				mPollTime += mPollInterval;
+			}
+			while (mSampleTime <= now)
+			{
+				mButtonEdges.Sample(mSampleTime * 1000, mPad.GetButtons(mSampleTime));
+				mSampleTime += mSamplePeriod;
+			}
+		}
+
+		uint64_t GetNextTimer() const
+		{ return std::min(std::min(mPollTime, mPollTimeout), mSampleTime); }
+
+		uint64_t GetProtocolErrors() const
+		{ return mProtocolErrors; }
+
+		RdpRateStatus GetRateStatus()
+		{ return mRate.GetStatus(); }
+
+	private:
+		LoopbackLink& mToReceiver;
+		SyntheticPad& mPad;
+		RdpLatencyStages mLatency;
+		RdpRateController mRate;
+		DWORD mPollUser = 0;
+		uint64_t mPollInterval = PluginPollInterval;
+		uint64_t mPollTime = UINT64_MAX;
+		uint64_t mPollTimeout = UINT64_MAX;
+		uint64_t mProtocolErrors = 0;
+		RdpButtonEdgeDetector mButtonEdges;
+		uint32_t mSamplePeriod = 0;
+		uint64_t mSampleTime = UINT64_MAX;
+
+		void SendControllerState(uint64_t now, DWORD userIndex)
+		{
+			const uint64_t encodeTime = RdpLatencyClock::Now();
+			const XINPUT_STATE state = mPad.Sample(now);
+			auto response = RdpGetStateResponse::MakeResponse(userIndex, ERROR_SUCCESS, state);
+			bool edgesSent = false;
+			if (mSamplePeriod != 0)
+			{
+				mButtonEdges.Sample(now * 1000, state.Gamepad.wButtons);
+				RdpButtonEdge edges[ButtonEdgeCapacity];
+				const size_t count = mButtonEdges.Take(now * 1000, edges);
+				if (count != 0)
+				{
+					Send(now, RdpButtonEventsResponse::MakeResponse(userIndex, ButtonSourceXInput, edges, count));
+					edgesSent = true;
+				}
+			}
+
+			uint16_t analog[RateAnalogCount];
+			GetAnalog(state.Gamepad, analog);
+			uint32_t probeTime;
+			if (mRate.TakeProbe(now, probeTime))
+			{
+				Send(now, RdpRateProbe::MakeProbe(userIndex, probeTime));
+			}
+			if (!mRate.Admit(now, state.Gamepad.wButtons, analog, edgesSent))
+			{
+				return;
+			}
+
+			// Simulated writes return at once; the link tells how long a real one would have blocked.
+			const uint64_t writeTime = RdpLatencyClock::Now();
+			mRate.OnWrite(mToReceiver.GetWriteBlockTime(now));
+			Send(now, response);
+			mLatency.Record(LatencyEncode, encodeTime, writeTime);
+			mLatency.Record(LatencyWrite, writeTime, RdpLatencyClock::Now());
+		}
+
+		void Send(uint64_t now, const RdpProtocolHeader& message)
+		{
+			mToReceiver.Send(now, &message, message.mMessageSize);
+		}
+	};
+
+	// Follows one RdpGamepadProcessor::RdpGamepadProcess360 tick: request a state, forward feedback,
+	// drain the channel into the state queue and submit to the pad.
+	class LoopbackReceiver
+	{
+	public:
+		LoopbackReceiver(const Settings& settings, LoopbackLink& toPlugin, LoopbackLink& fromPlugin, FakePadSink& sink, uint32_t seed)
+			: mSettings(settings)
+			, mToPlugin(toPlugin)
+			, mFromPlugin(fromPlugin)
+			, mSink(sink)
+			, mRandom(seed)
+		{
+			if (settings.mJitterBufferMs != 0)
+			{
+				mGamepadJitter.SetMaxDelay(settings.mJitterBufferMs * 1000ull);
+			}
+			mGamepadReplay.SetMinHold(settings.mButtonEventsMs * 1000ull);
+		}
+
+		void Tick(uint64_t now)
+		{
+			++mPollTicks;
+
+			if (mPollTicks == 1 && mSettings.mButtonEventsMs != 0)
+			{
+				Send(now, RdpSetButtonEventsRequest::MakeRequest(0, ButtonSourceXInput, ButtonSamplePeriod));
+			}
+			if (mPollTicks == 1 && mSettings.mRateControl)
+			{
+				Send(now, RdpSetRateControlRequest::MakeRequest(0, RateLimits));
+			}
+
+			// Request controller state; in poll mode renew the subscription well before it expires.
+			if (!mSettings.mPoll)
+			{
+				Send(now, RdpGetStateRequest::MakeRequest(0));
+			}
+			else if (mPollTicks % 60 == 1)
+			{
+				Send(now, RdpPollStateRequest::MakeRequest(0));
+			}
+
+			// A game that changes rumble a few times a second.
+			if (std::uniform_int_distribution<int>(0, 15)(mRandom) == 0)
+			{
+				mFeedback.SetRumble(static_cast<uint16_t>(mRandom()), static_cast<uint16_t>(mRandom()));
+			}
+			RdpFeedback feedback;
+			if (mFeedback.TakeReport(now / 1000, feedback))
+			{
+				Send(now, RdpSetFeedbackRequest::MakeRequest(0, FeedbackTargetXInput, feedback));
+			}
+
+			auto applyState = [this, now](const XINPUT_GAMEPAD& state) { mSink.SetGamepadState(now, state); };
+			std::vector<uint8_t> data;
+			while (mFromPlugin.Receive(now, data))
+			{
+				RdpProtocolPacket packet;
+				if (data.size() < sizeof(RdpProtocolHeader) || data.size() > sizeof(packet))
+				{
+					++mInvalidPackets;
+					continue;
+				}
+				std::memcpy(&packet, data.data(), data.size());
+				if (!packet.IsValid())
+				{
+					++mInvalidPackets;
+					continue;
+				}
+
+				if (packet.mHeader.mMessageType == RdpMessageType::GetStateResponse && packet.mGetStateResponse.mUserIndex == 0)
+				{
+					if (packet.mGetStateResponse.mResult == 0)
+					{
+						ReceiveState(now, packet.mGetStateResponse.mState.Gamepad);
+					}
+					else
+					{
+						ReceiveState(now, RdpGamepadButtonTraits<XINPUT_GAMEPAD>::Neutral());
+					}
+					mLastGetStateResponseTicks = mPollTicks;
+				}
+				else if (packet.mHeader.mMessageType == RdpMessageType::RateProbe)
+				{
+					Send(now, packet.mRateProbe);
+				}
+				else if (packet.mHeader.mMessageType == RdpMessageType::ButtonEventsResponse && mSettings.mButtonEventsMs != 0)
+				{
+					const RdpButtonEventsResponse& response = packet.mButtonEventsResponse;
+					for (size_t i = 0; i < response.mCount && i < ButtonEdgeCapacity; ++i)
+					{
+						mGamepadReplay.PushEdge(response.mEdges[i].mDigital, now - std::min<uint64_t>(now, response.mEdges[i].mAge), now);
+					}
+				}
+
+				if (!mSettings.mCoalesce)
+				{
+					mGamepadStates.Apply(applyState);
+				}
+			}
+			if (mSettings.mButtonEventsMs != 0)
+			{
+				mGamepadReplay.Release(now, [this, now](const XINPUT_GAMEPAD& state) { QueueState(now, state); });
+			}
+			if (mSettings.mJitterBufferMs != 0)
+			{
+				mGamepadJitter.Release(now, [this](const XINPUT_GAMEPAD& state) { mGamepadStates.Push(state); });
+			}
+			mGamepadStates.Apply(applyState);
+
+			// Remove stale controller data
+			if (mPollTicks < mLastGetStateResponseTicks || (mPollTicks - mLastGetStateResponseTicks) > StaleTicks)
+			{
+				++mStaleTicks;
+				mGamepadReplay.Reset();
+				mGamepadJitter.Reset();
+				mGamepadStates.Push(RdpGamepadButtonTraits<XINPUT_GAMEPAD>::Neutral());
+				mGamepadStates.Apply(applyState);
+			}
+		}
+
+		uint64_t GetInvalidPackets() const
+		{ return mInvalidPackets; }
+
+		uint64_t GetStaleTicks() const
+		{ return mStaleTicks; }
+
+	private:
+		const Settings& mSettings;
+		LoopbackLink& mToPlugin;
+		LoopbackLink& mFromPlugin;
+		FakePadSink& mSink;
+		std::mt19937 mRandom;
+		RdpGamepadStateQueue<XINPUT_GAMEPAD> mGamepadStates;
+		RdpGamepadJitterBuffer<XINPUT_GAMEPAD> mGamepadJitter;
+		RdpGamepadButtonReplay<XINPUT_GAMEPAD> mGamepadReplay;
+		RdpFeedbackCoalescer mFeedback;
+		unsigned int mPollTicks = 0;
+		unsigned int mLastGetStateResponseTicks = 0;
+		uint64_t mInvalidPackets = 0;
+		uint64_t mStaleTicks = 0;
+
+		void ReceiveState(uint64_t now, const XINPUT_GAMEPAD& state)
+		{
+			if (mSettings.mButtonEventsMs != 0)
+			{
+				mGamepadReplay.Push(state, now);
+			}
+			else
+			{
+				QueueState(now, state);
+			}
+		}
+
+		void QueueState(uint64_t now, const XINPUT_GAMEPAD& state)
+		{
+			if (mSettings.mJitterBufferMs != 0)
+			{
+				mGamepadJitter.Push(state, now);
+			}
+			else
+			{
+				mGamepadStates.Push(state);
+			}
+		}
+
+		void Send(uint64_t now, const RdpProtocolHeader& message)
+		{
+			mToPlugin.Send(now, &message, message.mMessageSize);
+		}
+	};
+
+	void PrintLink(const char* name, const LoopbackLink& link, double seconds)
+	{
+		std::printf("%-20s %10llu messages %12llu bytes %10.0f B/s %8llu lost\n", name,
+			(unsigned long long)link.GetSentMessages(), (unsigned long long)link.GetSentBytes(),
+			link.GetSentBytes() / seconds, (unsigned long long)link.GetLostMessages());
+	}
+
+	int Run(const Settings& settings)
+	{
+		LoopbackTrace trace;
+		if (settings.mSource == InputTrace && !trace.Load(settings.mTracePath))
+		{
+			std::fprintf(stderr, "%s holds no XInput states from the plugin\n", settings.mTracePath.c_str());
+			return 1;
+		}
+
+		// A trace plays to its end, with time for its last states to arrive.
+		const uint64_t end = (settings.mSource == InputTrace) ? TraceMargin + trace.GetDuration() + TraceMargin :
+			static_cast<uint64_t>(settings.mSeconds * MicrosecondsPerSecond);
+
+		LoopbackLink toPlugin(settings.mLink, settings.mSeed * 2 + 0);
+		LoopbackLink toReceiver(settings.mLink, settings.mSeed * 2 + 1);
+		SyntheticPad pad(settings.mSource, trace, settings.mTapMs, settings.mSeed);
+		FakePadSink sink(pad);
+		LoopbackPlugin plugin(toReceiver, pad);
+		LoopbackReceiver receiver(settings, toPlugin, toReceiver, sink, settings.mSeed);
+
+		const std::clock_t cpuStart = std::clock();
+		const auto wallStart = std::chrono::steady_clock::now();
+
+		uint64_t now = 0;
+		uint64_t receiverTick = 0;
+		uint64_t videoFrame = (settings.mCrossTraffic != 0) ? 0 : UINT64_MAX;
+		std::vector<uint8_t> data;
+		while (now <= end)
+		{
+			if (videoFrame <= now)
+			{
+				if ((now / CrossTrafficPeriod) % 2 == 1)
+				{
+					toReceiver.Occupy(now, static_cast<size_t>(settings.mCrossTraffic * VideoFrameInterval / MicrosecondsPerSecond));
+				}
+				videoFrame += VideoFrameInterval;
+			}
+			while (toPlugin.Receive(now, data))
+			{
+				plugin.OnDataReceived(now, data);
+			}
+			plugin.RunTimers(now);
+			if (receiverTick <= now)
+			{
+				receiver.Tick(now);
+				receiverTick += ReceiverTickInterval;
+			}
+			now = std::min(std::min(std::min(receiverTick, plugin.GetNextTimer()), toPlugin.GetNextArrival()), videoFrame);
+		}
+
+		const double cpuSeconds = double(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+		const double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+		const double seconds = double(end) / MicrosecondsPerSecond;
+
+		std::unique_ptr<RdpLatencyHistogram::Snapshot> latency(new RdpLatencyHistogram::Snapshot);
+		sink.GetLatency().TakeSnapshot(*latency);
+		std::unique_ptr<RdpLatencyHistogram::Snapshot> buttonLatency(new RdpLatencyHistogram::Snapshot);
+		sink.GetButtonLatency().TakeSnapshot(*buttonLatency);
+
+		std::printf("Simulated %.1f s in %.3f s wall, %.3f s CPU (%.3f ms CPU per simulated second)\n",
+			seconds, wallSeconds, cpuSeconds, cpuSeconds * 1000.0 / seconds);
+		PrintLink("Receiver -> plugin", toPlugin, seconds);
+		PrintLink("Plugin -> receiver", toReceiver, seconds);
+		std::printf("%-20s %10llu states   %12.1f per second\n", "Submitted to pad",
+			(unsigned long long)sink.GetSubmitted(), sink.GetSubmitted() / seconds);
+		std::printf("%-20s p50 %.2f  p90 %.2f  p99 %.2f  max %.2f ms over %llu states\n", "Input latency",
+			latency->GetPercentile(0.50) / 1e6, latency->GetPercentile(0.90) / 1e6, latency->GetPercentile(0.99) / 1e6,
+			latency->GetMax() / 1e6, (unsigned long long)latency->GetCount());
+		std::printf("%-20s p50 %.2f  p90 %.2f  p99 %.2f  max %.2f ms over %llu states\n", "Button latency",
+			buttonLatency->GetPercentile(0.50) / 1e6, buttonLatency->GetPercentile(0.90) / 1e6, buttonLatency->GetPercentile(0.99) / 1e6,
+			buttonLatency->GetMax() / 1e6, (unsigned long long)buttonLatency->GetCount());
+		if (settings.mRateControl)
+		{
+			const RdpRateStatus rate = plugin.GetRateStatus();
+			std::printf("%-20s %llu states sent, %llu held back, %llu backoffs; round trip %.1f ms over %.1f ms base\n", "Rate control",
+				(unsigned long long)rate.mAdmitted, (unsigned long long)rate.mSuppressed, (unsigned long long)rate.mBackoffs,
+				rate.mSmoothedRtt / 1000.0, rate.mBaseRtt / 1000.0);
+		}
+		if (settings.mSource == InputTaps)
+		{
+			const uint64_t taps = pad.GetTapCount(end);
+			std::printf("%-20s %llu of %llu reached the pad (%.1f%%), shortest hold %.1f ms\n", "Taps",
+				(unsigned long long)sink.GetPresses(), (unsigned long long)taps, taps ? 100.0 * sink.GetPresses() / taps : 0.0,
+				sink.GetPresses() ? sink.GetShortestHold() / 1000.0 : 0.0);
+		}
+		std::printf("%-20s %llu stale ticks, %llu invalid packets, %llu plugin protocol errors\n", "Errors",
+			(unsigned long long)receiver.GetStaleTicks(), (unsigned long long)receiver.GetInvalidPackets(),
+			(unsigned long long)plugin.GetProtocolErrors());
+		if (settings.mSource == InputTrace)
+		{
+			const uint64_t recorded = LoopbackTrace::CountPresses(trace.GetButtonChanges());
+			const uint64_t reached = LoopbackTrace::CountPresses(sink.GetButtonChanges());
+			std::printf("%-20s %llu states over %.1f s; %llu button presses reached the pad of %llu recorded\n", "Trace",
+				(unsigned long long)trace.GetStateCount(), trace.GetDuration() / 1e6,
+				(unsigned long long)reached, (unsigned long long)recorded);
+			return (reached == recorded) ? 0 : 1;
+		}
+		return 0;
+	}
+
+	int Usage()
+	{
+		std::fprintf(stderr,
+			"Usage: RdpGamepadLoopback [--seconds s] [--delay ms] [--jitter ms] [--loss fraction] [--bandwidth bytes/s]\n"
+			"                          [--source sine|random|taps] [--trace file] [--tap ms] [--button-events ms] [--poll]\n"
+			"                          [--no-coalesce] [--jitter-buffer ms] [--rate-control] [--cross-traffic bytes/s] [--seed n]\n"
+			"       RdpGamepadLoopback --transport tcp:<port>|unix:<path>|shm:<name> [--messages n]\n"
+			"       RdpGamepadLoopback --executor <pads> [--pad-work us]\n"
+			"       RdpGamepadLoopback --motion <Hz> [--seconds s] [--seed n]\n"
+			"       RdpGamepadLoopback --mapping <samples> [--seed n]\n"
+			"       RdpGamepadLoopback --latency <samples> [--seed n]\n"
+			"       RdpGamepadLoopback --conversion <samples> [--seed n]\n"
+			"       RdpGamepadLoopback --test [name]\n");
+		return 2;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc >= 2 && std::strcmp(argv[1], "--test") == 0)
+	{
+		return (argc <= 3) ? RunTests((argc == 3) ? argv[2] : "") : Usage();
+	}
+
+	Settings settings;
+	std::string transportAddress;
+	uint64_t transportMessages = 100000;
+	unsigned int executorPads = 0;
+	unsigned int padWorkUs = 100;
+	unsigned int motionRate = 0;
+	uint64_t mappingSamples = 0;
+	uint64_t latencySamples = 0;
+	uint64_t conversionSamples = 0;
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* option = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+		if (std::strcmp(option, "--poll") == 0)
+		{
+			settings.mPoll = true;
+			continue;
+		}
+		if (std::strcmp(option, "--no-coalesce") == 0)
+		{
+			settings.mCoalesce = false;
+			continue;
+		}
+		if (std::strcmp(option, "--rate-control") == 0)
+		{
+			settings.mRateControl = true;
+			continue;
+		}
+		if (value == nullptr)
+		{
+			return Usage();
+		}
+
+		++i;
+		if (std::strcmp(option, "--seconds") == 0)
+		{
+			settings.mSeconds = std::atof(value);
+		}
+		else if (std::strcmp(option, "--delay") == 0)
+		{
+			settings.mLink.mDelay = static_cast<uint64_t>(std::atof(value) * 1000.0);
+		}
+		else if (std::strcmp(option, "--jitter") == 0)
+		{
+			settings.mLink.mJitter = static_cast<uint64_t>(std::atof(value) * 1000.0);
+		}
+		else if (std::strcmp(option, "--loss") == 0)
+		{
+			settings.mLink.mLoss = std::atof(value);
+		}
+		else if (std::strcmp(option, "--bandwidth") == 0)
+		{
+			settings.mLink.mBandwidth = std::strtoull(value, nullptr, 10);
+		}
+		else if (std::strcmp(option, "--source") == 0)
+		{
+			settings.mSource = (std::strcmp(value, "random") == 0) ? InputRandom : (std::strcmp(value, "taps") == 0) ? InputTaps : InputSine;
+		}
+		else if (std::strcmp(option, "--trace") == 0)
+		{
+			settings.mSource = InputTrace;
+			settings.mTracePath = value;
+		}
+		else if (std::strcmp(option, "--tap") == 0)
+		{
+			settings.mTapMs = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+		}
+		else if (std::strcmp(option, "--button-events") == 0)
+		{
+			settings.mButtonEventsMs = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+		}
+		else if (std::strcmp(option, "--jitter-buffer") == 0)
+		{
+			settings.mJitterBufferMs = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+		}
+		else if (std::strcmp(option, "--cross-traffic") == 0)
+		{
+			settings.mCrossTraffic = std::strtoull(value, nullptr, 10);
+		}
+		else if (std::strcmp(option, "--seed") == 0)
+		{
+			settings.mSeed = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+		}
+		else if (std::strcmp(option, "--transport") == 0)
+		{
+			transportAddress = value;
+		}
+		else if (std::strcmp(option, "--messages") == 0)
+		{
+			transportMessages = std::strtoull(value, nullptr, 10);
+		}
+		else if (std::strcmp(option, "--executor") == 0)
+		{
+			executorPads = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+			if (executorPads == 0)
+			{
+				return Usage();
+			}
+		}
+		else if (std::strcmp(option, "--pad-work") == 0)
+		{
+			padWorkUs = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+		}
+		else if (std::strcmp(option, "--motion") == 0)
+		{
+			motionRate = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+			if (motionRate == 0 || motionRate > 1000000)
+			{
+				return Usage();
+			}
+		}
+		else if (std::strcmp(option, "--mapping") == 0)
+		{
+			mappingSamples = std::strtoull(value, nullptr, 10);
+			if (mappingSamples == 0)
+			{
+				return Usage();
+			}
+		}
+		else if (std::strcmp(option, "--latency") == 0)
+		{
+			latencySamples = std::strtoull(value, nullptr, 10);
+			if (latencySamples == 0)
+			{
+				return Usage();
+			}
+		}
+		else if (std::strcmp(option, "--conversion") == 0)
+		{
+			conversionSamples = std::strtoull(value, nullptr, 10);
+			if (conversionSamples == 0)
+			{
+				return Usage();
+			}
+		}
+		else
+		{
+			return Usage();
+		}
+	}
+
+	if (executorPads != 0)
+	{
+		return RunExecutorBenchmark(executorPads, padWorkUs);
+	}
+	if (motionRate != 0)
+	{
+		return (settings.mSeconds > 0.0) ? RunMotionBenchmark(motionRate, settings.mSeconds, settings.mSeed) : Usage();
+	}
+	if (mappingSamples != 0)
+	{
+		return RunMappingBenchmark(mappingSamples, settings.mSeed);
+	}
+	if (latencySamples != 0)
+	{
+		return RunLatencyBenchmark(latencySamples, settings.mSeed);
+	}
+	if (conversionSamples != 0)
+	{
+		return RunConversionBenchmark(conversionSamples, settings.mSeed);
+	}
+	if (!transportAddress.empty())
+	{
+		return (transportMessages != 0) ? RunTransportBenchmark(transportAddress, transportMessages) : Usage();
+	}
+	if (!(settings.mSeconds > 0.0))
+	{
+		return Usage();
+	}
+	return Run(settings);
+}
@@ -0,0 +1,150 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include <ViGEmReportCache.h>
+
+#include <cstdint>
+#include <cstring>
+
+namespace
+{
+	// Laid out like XUSB_REPORT.
+	struct FakeReport
+	{
+		uint16_t mButtons;
+		uint8_t mLeftTrigger;
+		uint8_t mRightTrigger;
+		int16_t mThumbs[4];
+	};
+
+	// Laid out like DS4_REPORT, with a padding byte at the end.
+	struct FakePaddedReport
+	{
+		uint8_t mThumbs[4];
+		uint16_t mButtons;
+		uint8_t mSpecial;
+		uint8_t mTriggers[2];
+	};
+	static_assert(sizeof(FakePaddedReport) == 10, "FakePaddedReport must end in padding like DS4_REPORT");
+}
+
+// As ViGEmInterface.h does for DS4_REPORT.
+template <>
+struct ViGEmReportTraits<FakePaddedReport>
+{
+	static bool Equal(const FakePaddedReport& a, const FakePaddedReport& b)
+	{
+		return std::memcmp(a.mThumbs, b.mThumbs, sizeof(a.mThumbs)) == 0 && a.mButtons == b.mButtons &&
+			a.mSpecial == b.mSpecial && std::memcmp(a.mTriggers, b.mTriggers, sizeof(a.mTriggers)) == 0;
+	}
+};
+
+namespace
+{
+	// Stands in for the driver behind a ViGEm target: counts the updates that get past the cache, each of
+	// which would be an IOCTL, and fails them on request.
+	template <typename REPORT>
+	class CountingDriver
+	{
+	public:
+		bool Update(const REPORT& report, uint64_t now)
+		{
+			++mUpdates;
+			return mCache.Submit(report, now, [this](const REPORT&)
+			{
+				++mIoctls;
+				return !mFail;
+			});
+		}
+
+		ViGEmReportCache<REPORT> mCache;
+		uint64_t mUpdates = 0;
+		uint64_t mIoctls = 0;
+		bool mFail = false;
+	};
+}
+
+bool TestReportCache()
+{
+	CountingDriver<FakeReport> driver;
+	FakeReport report = {};
+
+	// The first report always goes out, identical ones after it never do.
+	LOOPBACK_CHECK(driver.Update(report, 0));
+	LOOPBACK_CHECK(driver.mIoctls == 1);
+	for (uint64_t now = 1; now <= 1000; ++now)
+	{
+		LOOPBACK_CHECK(!driver.Update(report, now * 16));
+	}
+	LOOPBACK_CHECK(driver.mIoctls == 1);
+	LOOPBACK_CHECK(driver.mCache.GetStats().Skipped == 1000);
+
+	// Every change goes out, including one back to an earlier report.
+	report.mThumbs[0] = 1;
+	driver.Update(report, 20000);
+	LOOPBACK_CHECK(driver.mIoctls == 2);
+	report.mButtons = 0x1000;
+	driver.Update(report, 20000);
+	LOOPBACK_CHECK(driver.mIoctls == 3);
+	report.mButtons = 0;
+	driver.Update(report, 20001);
+	LOOPBACK_CHECK(driver.mIoctls == 4);
+	driver.Update(report, 20002);
+	LOOPBACK_CHECK(driver.mIoctls == 4);
+
+	// A rejected update reports failure and is not counted as submitted, and the same report goes out
+	// again until the driver takes it.
+	report.mRightTrigger = 9;
+	driver.mFail = true;
+	LOOPBACK_CHECK(!driver.Update(report, 20003) && !driver.Update(report, 20004));
+	LOOPBACK_CHECK(driver.mIoctls == 6 && driver.mCache.GetStats().Failed == 2 && driver.mCache.GetStats().Submitted == 4);
+	driver.mFail = false;
+	LOOPBACK_CHECK(driver.Update(report, 20005) && !driver.Update(report, 20006));
+	LOOPBACK_CHECK(driver.mIoctls == 7);
+
+	// Invalidating sends the same report again.
+	driver.mCache.Invalidate();
+	driver.Update(report, 20007);
+	LOOPBACK_CHECK(driver.mIoctls == 8);
+
+	// With a refresh interval an unchanged report goes out again once it is that old, and not before.
+	driver.mCache.SetRefreshInterval(100);
+	driver.Update(report, 20106);
+	LOOPBACK_CHECK(driver.mIoctls == 8);
+	driver.Update(report, 20107);
+	LOOPBACK_CHECK(driver.mIoctls == 9);
+	for (uint64_t now = 20108; now < 21107; ++now)
+	{
+		driver.Update(report, now);
+	}
+	LOOPBACK_CHECK(driver.mIoctls == 18);
+
+	// A change resets the refresh.
+	report.mLeftTrigger = 255;
+	driver.Update(report, 21150);
+	LOOPBACK_CHECK(driver.mIoctls == 19);
+	driver.Update(report, 21249);
+	LOOPBACK_CHECK(driver.mIoctls == 19);
+
+	const ViGEmUpdateStats& stats = driver.mCache.GetStats();
+	LOOPBACK_CHECK(stats.Submitted + stats.Failed == driver.mIoctls);
+	LOOPBACK_CHECK(stats.Submitted + stats.Failed + stats.Skipped == driver.mUpdates);
+
+	// Reports that differ only in their padding are the same report.
+	CountingDriver<FakePaddedReport> padded;
+	FakePaddedReport first;
+	FakePaddedReport second;
+	std::memset(&first, 0x00, sizeof(first));
+	std::memset(&second, 0xff, sizeof(second));
+	std::memset(second.mThumbs, 0, sizeof(second.mThumbs));
+	second.mButtons = 0;
+	second.mSpecial = 0;
+	std::memset(second.mTriggers, 0, sizeof(second.mTriggers));
+	LOOPBACK_CHECK(std::memcmp(&first, &second, sizeof(first)) != 0);
+	LOOPBACK_CHECK(padded.Update(first, 0) && !padded.Update(second, 1));
+	second.mButtons = 0x20;
+	LOOPBACK_CHECK(padded.Update(second, 2) && padded.mIoctls == 2);
+	return true;
+}
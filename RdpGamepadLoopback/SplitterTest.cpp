@@ -0,0 +1,221 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include <RdpGamepadMessageSplitter.h>
+#include <RdpGamepadSocketTransport.h>
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	using namespace RdpGamepad;
+
+	constexpr size_t MessageCount = 2000;
+	constexpr int WaitTimeoutMs = 5000;
+
+	// Messages of every size the receiver reads, each one different.
+	std::vector<std::vector<char>> MakeMessages(size_t count)
+	{
+		std::vector<std::vector<char>> messages;
+		for (size_t i = 0; i < count; ++i)
+		{
+			auto add = [&messages](const RdpProtocolHeader& message)
+			{
+				const char* data = reinterpret_cast<const char*>(&message);
+				messages.emplace_back(data, data + message.mMessageSize);
+			};
+
+			XINPUT_STATE state{};
+			state.dwPacketNumber = DWORD(i);
+			RdpLatencySummary stages[LatencyStageCount] = {};
+			stages[0].mCount = uint32_t(i);
+			switch (i % 4)
+			{
+			case 0: add(RdpGetStateResponse::MakeResponse(0, ERROR_SUCCESS, state)); break;
+			case 1: add(RdpGetStateRequest::MakeRequest(DWORD(i % 4))); break;
+			case 2: add(RdpGetLatencyResponse::MakeResponse(0, stages)); break;
+			default: add(RdpSetFeedbackResponse::MakeResponse(DWORD(i % 4), ERROR_SUCCESS)); break;
+			}
+		}
+		return messages;
+	}
+
+	std::vector<char> Concatenate(const std::vector<std::vector<char>>& messages)
+	{
+		std::vector<char> stream;
+		for (const auto& message : messages)
+		{
+			stream.insert(stream.end(), message.begin(), message.end());
+		}
+		return stream;
+	}
+
+	bool IsMessage(const RdpPacketView& view, const std::vector<char>& message)
+	{
+		return view.mSize == message.size() && std::memcmp(view.mData, message.data(), message.size()) == 0;
+	}
+
+	// Feeds the stream to a splitter no larger than one message in pieces cut by nextCut, taking the
+	// messages out with Split or, every other piece, with Next. Returns how many came out in order, or 0
+	// if bytes were left over at the end.
+	template <typename CUT>
+	size_t SplitStream(const std::vector<std::vector<char>>& messages, const std::vector<char>& stream, CUT nextCut)
+	{
+		RdpMessageSplitter splitter(sizeof(RdpProtocolPacket));
+		std::vector<RdpPacketView> views;
+		size_t received = 0;
+		size_t offset = 0;
+		bool useNext = false;
+		while (offset < stream.size())
+		{
+			size_t space;
+			char* buffer = splitter.GetWriteBuffer(space);
+			const size_t size = std::min(std::min(nextCut(), space), stream.size() - offset);
+			std::memcpy(buffer, stream.data() + offset, size);
+			splitter.Commit(size);
+			offset += size;
+
+			views.clear();
+			bool valid = true;
+			if (useNext)
+			{
+				RdpPacketView view;
+				while ((valid = splitter.Next(view)) && view.mData != nullptr)
+				{
+					views.push_back(view);
+				}
+			}
+			else
+			{
+				valid = splitter.Split(views);
+			}
+			useNext = !useNext;
+
+			for (const RdpPacketView& view : views)
+			{
+				if (received == messages.size() || !IsMessage(view, messages[received]))
+				{
+					return received;
+				}
+				++received;
+			}
+			if (!valid)
+			{
+				return received;
+			}
+		}
+		return (splitter.GetBuffered() == 0) ? received : 0;
+	}
+
+	// A plugin side socket writing the stream in random pieces, to a receiver reading it through the
+	// socket transport. A local TCP port works on every platform the transport does.
+	bool TestSocketBoundaries(const std::vector<std::vector<char>>& messages, const std::vector<char>& stream)
+	{
+		RdpSocketAddress address;
+		RdpGamepadSocketListener listener;
+		bool listening = false;
+		for (int port = 47900; port < 47950 && !listening; ++port)
+		{
+			listening = address.Parse("tcp:" + std::to_string(port)) && listener.Listen(address);
+		}
+		LOOPBACK_CHECK(listening);
+
+		RdpSocket::Handle writer = ::socket(AF_INET, SOCK_STREAM, 0);
+		LOOPBACK_CHECK(writer != RdpSocket::InvalidHandle);
+		LOOPBACK_CHECK(::connect(writer, address.Get(), address.mLength) == 0);
+		std::unique_ptr<RdpGamepadSocketTransport> reader = listener.Accept(WaitTimeoutMs);
+		LOOPBACK_CHECK(reader != nullptr);
+
+		std::thread writing([&stream, writer]()
+		{
+			std::mt19937 random(1);
+			size_t offset = 0;
+			while (offset < stream.size())
+			{
+				const size_t size = std::min<size_t>(stream.size() - offset, 1 + random() % 300);
+				const auto sent = ::send(writer, stream.data() + offset, static_cast<int>(size), 0);
+				if (sent <= 0)
+				{
+					break;
+				}
+				offset += static_cast<size_t>(sent);
+				if (random() % 50 == 0)
+				{
+					std::this_thread::yield();
+				}
+			}
+			RdpSocket::CloseSocket(writer);
+		});
+
+		// Mixes single and batched receives, as the processor would with both kinds of caller.
+		std::mt19937 random(2);
+		size_t received = 0;
+		bool inOrder = true;
+		RdpProtocolPacket packet;
+		while (reader->IsOpen() && received < messages.size() && inOrder)
+		{
+			if (random() % 4 == 0)
+			{
+				if (reader->Receive(&packet))
+				{
+					inOrder = std::memcmp(&packet, messages[received].data(), messages[received].size()) == 0;
+					++received;
+					continue;
+				}
+			}
+			else
+			{
+				RdpPacketSpan span;
+				if (reader->ReceiveBatch(span))
+				{
+					for (const RdpPacketView& view : span)
+					{
+						inOrder = inOrder && received < messages.size() && IsMessage(view, messages[received]);
+						++received;
+					}
+					continue;
+				}
+			}
+			if (!reader->WaitReadable(WaitTimeoutMs))
+			{
+				break;
+			}
+		}
+		writing.join();
+		LOOPBACK_CHECK(inOrder);
+		LOOPBACK_CHECK(received == messages.size());
+		return true;
+	}
+}
+
+// Every way of cutting the stream up: pieces of each fixed size up to two of the largest messages,
+// random pieces, and a real socket delivering wherever the network stack cuts it.
+bool TestSplitter()
+{
+	const std::vector<std::vector<char>> messages = MakeMessages(MessageCount);
+	const std::vector<char> stream = Concatenate(messages);
+
+	for (size_t piece = 1; piece <= 2 * sizeof(RdpProtocolPacket); ++piece)
+	{
+		LOOPBACK_CHECK(SplitStream(messages, stream, [piece]() { return piece; }) == messages.size());
+	}
+	std::mt19937 random(3);
+	for (int run = 0; run < 20; ++run)
+	{
+		LOOPBACK_CHECK(SplitStream(messages, stream, [&random]() { return size_t(1 + random() % 97); }) == messages.size());
+	}
+
+	// A header that can't be a message ends the stream, with the messages before it still whole.
+	std::vector<std::vector<char>> corrupt(messages.begin(), messages.begin() + 10);
+	corrupt.push_back(std::vector<char>(sizeof(RdpProtocolHeader), char(0x7f)));
+	LOOPBACK_CHECK(SplitStream(corrupt, Concatenate(corrupt), []() { return size_t(7); }) == 10);
+
+	return TestSocketBoundaries(messages, stream);
+}
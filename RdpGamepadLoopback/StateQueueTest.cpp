@@ -0,0 +1,151 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include <RdpGamepadPlatform.h>
+#include <ds4_pad.h>
+#include <RdpGamepadStateQueue.h>
+
+#include <random>
+#include <vector>
+
+namespace
+{
+	template <typename STATE>
+	std::vector<STATE> Apply(RdpGamepadStateQueue<STATE>& queue)
+	{
+		std::vector<STATE> applied;
+		queue.Apply([&applied](const STATE& state) { applied.push_back(state); });
+		return applied;
+	}
+
+	XINPUT_GAMEPAD MakeGamepad(WORD buttons, SHORT thumbLX = 0)
+	{
+		XINPUT_GAMEPAD gamepad = {};
+		gamepad.wButtons = buttons;
+		gamepad.sThumbLX = thumbLX;
+		return gamepad;
+	}
+
+	// Scripted bursts with a known outcome.
+	bool TestScriptedBursts()
+	{
+		RdpGamepadStateQueue<XINPUT_GAMEPAD> queue;
+		LOOPBACK_CHECK(queue.IsEmpty());
+		LOOPBACK_CHECK(Apply(queue).empty());
+
+		// The first burst has nothing to compare against, so only its newest state goes out.
+		queue.Push(MakeGamepad(XINPUT_GAMEPAD_A));
+		queue.Push(MakeGamepad(0, 100));
+		std::vector<XINPUT_GAMEPAD> applied = Apply(queue);
+		LOOPBACK_CHECK(applied.size() == 1 && applied[0].wButtons == 0 && applied[0].sThumbLX == 100);
+		LOOPBACK_CHECK(queue.IsEmpty());
+
+		// Analog changes only: the newest state.
+		queue.Push(MakeGamepad(0, 200));
+		queue.Push(MakeGamepad(0, 300));
+		applied = Apply(queue);
+		LOOPBACK_CHECK(applied.size() == 1 && applied[0].sThumbLX == 300);
+
+		// A tap inside the burst comes out as a transition with the analog values of the newest state.
+		queue.Push(MakeGamepad(XINPUT_GAMEPAD_A, 310));
+		queue.Push(MakeGamepad(0, 320));
+		applied = Apply(queue);
+		LOOPBACK_CHECK(applied.size() == 2);
+		LOOPBACK_CHECK(applied[0].wButtons == XINPUT_GAMEPAD_A && applied[0].sThumbLX == 320);
+		LOOPBACK_CHECK(applied[1].wButtons == 0 && applied[1].sThumbLX == 320);
+
+		// A press the newest state shows needs no transition.
+		queue.Push(MakeGamepad(0));
+		queue.Push(MakeGamepad(XINPUT_GAMEPAD_B));
+		applied = Apply(queue);
+		LOOPBACK_CHECK(applied.size() == 1 && applied[0].wButtons == XINPUT_GAMEPAD_B);
+
+		// A held button let go and pressed again, together with a tap of another, in one transition.
+		queue.Push(MakeGamepad(0));
+		queue.Push(MakeGamepad(XINPUT_GAMEPAD_X));
+		queue.Push(MakeGamepad(XINPUT_GAMEPAD_B));
+		applied = Apply(queue);
+		LOOPBACK_CHECK(applied.size() == 2);
+		LOOPBACK_CHECK(applied[0].wButtons == XINPUT_GAMEPAD_X);
+		LOOPBACK_CHECK(applied[1].wButtons == XINPUT_GAMEPAD_B);
+
+		// Reset forgets what was applied, so the next burst is a first one again.
+		queue.Push(MakeGamepad(XINPUT_GAMEPAD_Y));
+		queue.Reset();
+		LOOPBACK_CHECK(queue.IsEmpty());
+		queue.Push(MakeGamepad(0));
+		queue.Push(MakeGamepad(XINPUT_GAMEPAD_Y));
+		queue.Push(MakeGamepad(0));
+		applied = Apply(queue);
+		LOOPBACK_CHECK(applied.size() == 1 && applied[0].wButtons == 0);
+		return true;
+	}
+
+	// The d-pad direction of a DS4 state is a number, not bits, so it always follows the newest state;
+	// the special buttons are tracked like any other.
+	bool TestPadStateBursts()
+	{
+		typedef RdpGamepadButtonTraits<PadState> Traits;
+		RdpGamepadStateQueue<PadState> queue;
+		queue.Push(Traits::Neutral());
+		LOOPBACK_CHECK(Apply(queue).size() == 1);
+
+		PadState state = Traits::Neutral();
+		state.Buttons = PAD_BUTTON_DPAD_EAST;
+		queue.Push(state);
+		state.Buttons = PAD_BUTTON_DPAD_NONE;
+		state.SpecialButtons = 1;
+		queue.Push(state);
+		queue.Push(Traits::Neutral());
+		std::vector<PadState> applied = Apply(queue);
+		LOOPBACK_CHECK(applied.size() == 2);
+		LOOPBACK_CHECK(applied[0].SpecialButtons == 1 && applied[0].Buttons == PAD_BUTTON_DPAD_NONE);
+		LOOPBACK_CHECK(applied[1].SpecialButtons == 0 && applied[1].Buttons == PAD_BUTTON_DPAD_NONE);
+		return true;
+	}
+
+	// Random bursts: the newest state always goes out last, at most one transition precedes it, and every
+	// button that changed anywhere in the burst changes in what goes out.
+	bool TestRandomBursts()
+	{
+		std::minstd_rand random(27);
+		RdpGamepadStateQueue<XINPUT_GAMEPAD> queue;
+		WORD applied = 0;
+		bool hasApplied = false;
+		for (int burst = 0; burst < 100000; ++burst)
+		{
+			const int count = std::uniform_int_distribution<int>(1, 6)(random);
+			WORD changed = 0;
+			XINPUT_GAMEPAD newest = {};
+			for (int i = 0; i < count; ++i)
+			{
+				newest = MakeGamepad(static_cast<WORD>(random() & random() & 0xf3ff), static_cast<SHORT>(burst));
+				changed |= newest.wButtons ^ applied;
+				queue.Push(newest);
+			}
+
+			const std::vector<XINPUT_GAMEPAD> states = Apply(queue);
+			LOOPBACK_CHECK(!states.empty() && states.size() <= 2);
+			LOOPBACK_CHECK(states.back().wButtons == newest.wButtons && states.back().sThumbLX == newest.sThumbLX);
+			if (hasApplied)
+			{
+				WORD shown = 0;
+				for (const XINPUT_GAMEPAD& state : states)
+				{
+					shown |= state.wButtons ^ applied;
+				}
+				LOOPBACK_CHECK(shown == changed);
+			}
+			applied = newest.wButtons;
+			hasApplied = true;
+		}
+		return true;
+	}
+}
+
+bool TestStateQueue()
+{
+	return TestScriptedBursts() && TestPadStateBursts() && TestRandomBursts();
+}
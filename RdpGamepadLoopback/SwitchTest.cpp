@@ -0,0 +1,249 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include <RdpGamepadPlatform.h>
+#include <ds4_pad.h>
+#include <RdpGamepadLifecycle.h>
+#include <RdpGamepadStateQueue.h>
+#include <RdpGamepadTargetPool.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+
+namespace
+{
+	constexpr uint64_t TickPeriod = 16;		// RdpGamepadProcessor::TickPeriodMs.
+
+	enum FakeType
+	{
+		FakeType360,
+		FakeTypeDS4,
+	};
+
+	// A virtual controller that remembers the last state it got.
+	struct FakeTarget
+	{
+		FakeType mType;
+		uint64_t mSubmitted = 0;
+		uint64_t mLastSubmitTime = 0;
+	};
+
+	// Counts the controllers plugged in and out.
+	class FakeSink : public RdpGamepadTargetSink<FakeTarget>
+	{
+	public:
+		FakeSink(FakeType type, unsigned int& added, unsigned int& removed)
+			: mType(type)
+			, mAdded(added)
+			, mRemoved(removed)
+		{}
+
+		std::shared_ptr<FakeTarget> Add() override
+		{
+			++mAdded;
+			std::shared_ptr<FakeTarget> target = std::make_shared<FakeTarget>();
+			target->mType = mType;
+			return target;
+		}
+
+		void Remove(std::shared_ptr<FakeTarget>) override
+		{ ++mRemoved; }
+
+		void SubmitNeutral(FakeTarget&) override
+		{}
+
+	private:
+		FakeType mType;
+		unsigned int& mAdded;
+		unsigned int& mRemoved;
+	};
+
+	// Follows RdpGamepadProcessor's tick and type switch over a fake channel whose plugin answers every
+	// request with a state of the kind asked for, in time for the same tick's read.
+	class FakeSession : private RdpGamepadLifecycleHost
+	{
+	public:
+		FakeSession()
+			: mLifecycle(*this)
+			, mPool360(std::unique_ptr<RdpGamepadTargetSink<FakeTarget>>(new FakeSink(FakeType360, mAdded, mRemoved)))
+			, mPoolDS4(std::unique_ptr<RdpGamepadTargetSink<FakeTarget>>(new FakeSink(FakeTypeDS4, mAdded, mRemoved)))
+		{}
+
+		// From any thread, like the tray menu.
+		void SetType(FakeType type)
+		{ mRequestedType = type; }
+
+		void Tick(uint64_t now)
+		{
+			mNow = now;
+			const FakeType requestedType = mRequestedType;
+			if (requestedType != mType)
+			{
+				// RdpGamepadSwitchType: back to the pool, keep the channel, connect again.
+				mPool360.Release(std::move(mTarget360), now);
+				mPoolDS4.Release(std::move(mTargetDS4), now);
+				mGamepadStates.Reset();
+				mPadStates.Reset();
+				mLifecycle.Restart();
+				mType = requestedType;
+			}
+			mLifecycle.Step(now);
+			mPool360.Expire(now);
+			mPoolDS4.Expire(now);
+		}
+
+		const std::shared_ptr<FakeTarget>& GetTarget() const
+		{ return (mType == FakeType360) ? mTarget360 : mTargetDS4; }
+
+		unsigned int mChannelsOpened = 0;
+		unsigned int mDisconnects = 0;
+		unsigned int mAdded = 0;
+		unsigned int mRemoved = 0;
+
+	private:
+		RdpGamepadLifecycle mLifecycle;
+		RdpGamepadTargetPool<FakeTarget> mPool360;
+		RdpGamepadTargetPool<FakeTarget> mPoolDS4;
+		std::shared_ptr<FakeTarget> mTarget360;
+		std::shared_ptr<FakeTarget> mTargetDS4;
+		RdpGamepadStateQueue<XINPUT_GAMEPAD> mGamepadStates;
+		RdpGamepadStateQueue<PadState> mPadStates;
+		std::deque<FakeType> mResponses;
+		std::atomic<FakeType> mRequestedType{FakeType360};
+		FakeType mType = FakeType360;
+		bool mChannelOpen = false;
+		uint64_t mNow = 0;
+
+		bool AttachChannel() override
+		{
+			if (!mChannelOpen)
+			{
+				mChannelOpen = true;
+				++mChannelsOpened;
+			}
+			return true;
+		}
+
+		void Connect() override
+		{
+			bool reused;
+			if (mType == FakeType360)
+			{
+				mTarget360 = mPool360.Acquire(reused);
+			}
+			else
+			{
+				mTargetDS4 = mPoolDS4.Acquire(reused);
+			}
+		}
+
+		void Disconnect() override
+		{
+			++mDisconnects;
+			mChannelOpen = false;
+			mResponses.clear();
+		}
+
+		bool SendRequests() override
+		{
+			mResponses.push_back(mType);
+			return true;
+		}
+
+		RdpLifecycleRead Read() override
+		{
+			if (mResponses.empty())
+			{
+				return LifecycleReadNone;
+			}
+			const FakeType kind = mResponses.front();
+			mResponses.pop_front();
+			if (kind != mType)
+			{
+				return LifecycleReadMessage;
+			}
+			if (kind == FakeType360)
+			{
+				mGamepadStates.Push(RdpGamepadButtonTraits<XINPUT_GAMEPAD>::Neutral());
+			}
+			else
+			{
+				mPadStates.Push(RdpGamepadButtonTraits<PadState>::Neutral());
+			}
+			return LifecycleReadState;
+		}
+
+		void SubmitStates() override
+		{
+			FakeTarget& target = *GetTarget();
+			auto submit = [this, &target](const auto&)
+			{
+				++target.mSubmitted;
+				target.mLastSubmitTime = mNow;
+			};
+			if (mType == FakeType360)
+			{
+				mGamepadStates.Apply(submit);
+			}
+			else
+			{
+				mPadStates.Apply(submit);
+			}
+		}
+
+		void StaleTimeout() override
+		{}
+
+		void SubmitNeutral() override
+		{}
+
+		bool IsChannelOpen() override
+		{ return mChannelOpen; }
+	};
+}
+
+bool TestSwitchType()
+{
+	FakeSession session;
+	uint64_t now = 0;
+	for (int tick = 0; tick < 10; ++tick, now += TickPeriod)
+	{
+		session.Tick(now);
+	}
+	LOOPBACK_CHECK(session.GetTarget() && session.GetTarget()->mType == FakeType360);
+	LOOPBACK_CHECK(session.GetTarget()->mSubmitted == 10);
+
+	// Switch back and forth, requesting halfway between two ticks as the menu would. Each switch takes
+	// effect at the next tick, whose own state already reaches the new controller.
+	uint64_t worstLatency = 0;
+	for (int round = 0; round < 8; ++round)
+	{
+		const FakeType type = (round % 2 == 0) ? FakeTypeDS4 : FakeType360;
+		const uint64_t requestTime = now - TickPeriod / 2;
+		session.SetType(type);
+
+		int ticks = 0;
+		while (!(session.GetTarget() && session.GetTarget()->mType == type && session.GetTarget()->mLastSubmitTime >= requestTime) && ticks < 10)
+		{
+			session.Tick(now);
+			now += TickPeriod;
+			++ticks;
+		}
+		LOOPBACK_CHECK(ticks == 1);
+		const uint64_t latency = session.GetTarget()->mLastSubmitTime - requestTime;
+		worstLatency = (latency > worstLatency) ? latency : worstLatency;
+	}
+	std::printf("    switch to the first state on the new controller within %llu ms\n", (unsigned long long)worstLatency);
+	LOOPBACK_CHECK(worstLatency <= TickPeriod);
+
+	// The channel stayed open throughout, and every switch after the first of each type got its
+	// controller back from the pool.
+	LOOPBACK_CHECK(session.mChannelsOpened == 1);
+	LOOPBACK_CHECK(session.mDisconnects == 0);
+	LOOPBACK_CHECK(session.mAdded == 2);
+	LOOPBACK_CHECK(session.mRemoved == 0);
+	return true;
+}
@@ -0,0 +1,130 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include <RdpGamepadTargetPool.h>
+
+#include <memory>
+
+namespace
+{
+	struct FakeTarget
+	{
+		unsigned int mId;
+		unsigned int mNeutralReports = 0;
+	};
+
+	struct DriverCounts
+	{
+		unsigned int mAdded = 0;
+		unsigned int mRemoved = 0;
+		unsigned int mNeutralReports = 0;
+	};
+
+	// Stands in for the ViGEm driver: numbers the controllers it plugs in and counts every call.
+	class FakeDriver : public RdpGamepadTargetSink<FakeTarget>
+	{
+	public:
+		explicit FakeDriver(DriverCounts& counts)
+			: mCounts(counts)
+		{}
+
+		std::shared_ptr<FakeTarget> Add() override
+		{
+			std::shared_ptr<FakeTarget> target = std::make_shared<FakeTarget>();
+			target->mId = ++mCounts.mAdded;
+			return target;
+		}
+
+		void Remove(std::shared_ptr<FakeTarget> target) override
+		{
+			if (target)
+			{
+				++mCounts.mRemoved;
+			}
+		}
+
+		void SubmitNeutral(FakeTarget& target) override
+		{
+			++target.mNeutralReports;
+			++mCounts.mNeutralReports;
+		}
+
+	private:
+		DriverCounts& mCounts;
+	};
+
+	using FakePool = RdpGamepadTargetPool<FakeTarget>;
+
+	bool TestPool(DriverCounts& counts)
+	{
+		FakePool pool(std::unique_ptr<RdpGamepadTargetSink<FakeTarget>>(new FakeDriver(counts)), 1000);
+		bool reused;
+		std::shared_ptr<FakeTarget> target = pool.Acquire(reused);
+		LOOPBACK_CHECK(!reused && counts.mAdded == 1);
+
+		// Dropping and reconnecting within the grace period keeps the same controller plugged in, at rest
+		// while nobody holds it.
+		for (uint64_t i = 0; i < 50; ++i)
+		{
+			pool.Release(std::move(target), 100 + i * 10);
+			LOOPBACK_CHECK(!target);
+			pool.Expire(100 + i * 10 + 5);
+			target = pool.Acquire(reused);
+			LOOPBACK_CHECK(reused && target->mId == 1);
+		}
+		LOOPBACK_CHECK(counts.mAdded == 1 && counts.mRemoved == 0);
+		LOOPBACK_CHECK(counts.mNeutralReports == 50 && target->mNeutralReports == 50);
+
+		// Once the grace period passed it is unplugged, exactly once, and the next connection gets a new one.
+		pool.Release(std::move(target), 2000);
+		pool.Expire(2999);
+		LOOPBACK_CHECK(counts.mRemoved == 0 && pool.GetIdleCount() == 1);
+		pool.Expire(3000);
+		LOOPBACK_CHECK(counts.mRemoved == 1 && pool.GetIdleCount() == 0);
+		target = pool.Acquire(reused);
+		LOOPBACK_CHECK(!reused && counts.mAdded == 2);
+
+		// At most MaxIdle wait, the oldest going first, and the newest is handed out again.
+		std::shared_ptr<FakeTarget> extra[FakePool::MaxIdle + 2];
+		for (auto& other : extra)
+		{
+			other = pool.Acquire(reused);
+		}
+		for (auto& other : extra)
+		{
+			pool.Release(std::move(other), 4000);
+		}
+		LOOPBACK_CHECK(pool.GetIdleCount() == FakePool::MaxIdle && counts.mRemoved == 3);
+		std::shared_ptr<FakeTarget> last = pool.Acquire(reused);
+		LOOPBACK_CHECK(reused && last->mId == counts.mAdded);
+		pool.Release(std::move(last), 4001);
+
+		// Switching to the other kind of controller unplugs every idle one at once.
+		LOOPBACK_CHECK(pool.GetIdleCount() == FakePool::MaxIdle);
+		pool.Clear();
+		LOOPBACK_CHECK(pool.GetIdleCount() == 0 && counts.mRemoved == 3 + FakePool::MaxIdle);
+
+		// Without a grace period a released controller is unplugged at once.
+		pool.SetGracePeriod(0);
+		pool.Release(std::move(target), 5000);
+		LOOPBACK_CHECK(counts.mRemoved == 4 + FakePool::MaxIdle);
+		pool.Release(nullptr, 5000);
+		LOOPBACK_CHECK(counts.mRemoved == 4 + FakePool::MaxIdle);
+		return true;
+	}
+}
+
+// The warm pool against a fake driver counting plug and unplug calls, down to the pool unplugging the
+// controllers still waiting when it goes away.
+bool TestTargetPool()
+{
+	DriverCounts counts;
+	if (!TestPool(counts))
+	{
+		return false;
+	}
+	LOOPBACK_CHECK(counts.mAdded == counts.mRemoved);
+	return true;
+}
@@ -0,0 +1,106 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "LoopbackTests.h"
+
+#include "LoopbackTrace.h"
+
+#include <ds4_pad.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	constexpr size_t StateCount = 3000;
+	constexpr uint64_t StateInterval = 1000;				// Microseconds.
+	constexpr uint64_t FirstTime = 5000000000ull;			// Nanoseconds, as RdpLatencyClock.
+
+	// Three seconds sampled every millisecond: A tapped for 3 ms every 50 ms, B held every other 400 ms
+	// and the left stick turning.
+	XINPUT_GAMEPAD MakeState(size_t index)
+	{
+		XINPUT_GAMEPAD gamepad{};
+		gamepad.wButtons = WORD(((index % 50) < 3 ? XINPUT_GAMEPAD_A : 0) | ((index / 400) % 2 ? XINPUT_GAMEPAD_B : 0));
+		gamepad.sThumbLX = SHORT(int32_t(index * 37 % 60000) - 30000);
+		gamepad.bLeftTrigger = BYTE(index);
+		return gamepad;
+	}
+
+	bool SameGamepad(const XINPUT_GAMEPAD& a, const XINPUT_GAMEPAD& b)
+	{ return std::memcmp(&a, &b, sizeof(a)) == 0; }
+
+	// Records the states as the plugin would, with the receiver's DS4 reports in between, which a trace
+	// source has to skip. Pauses whenever a quarter of the ring is used so the writer keeps up.
+	bool RecordTrace(const std::string& path)
+	{
+		RdpGamepad::RdpTraceRecorder recorder;
+		if (!recorder.Start(path))
+		{
+			return false;
+		}
+		for (size_t i = 0; i < StateCount; ++i)
+		{
+			const uint64_t time = FirstTime + i * StateInterval * 1000;
+			recorder.Record(RdpGamepad::TraceSourcePlugin, RdpGamepad::TraceKindXInput, time, MakeState(i));
+			PadState report{};
+			report.StickL.X = uint8_t(i);
+			recorder.Record(RdpGamepad::TraceSourceReceiver, RdpGamepad::TraceKindDS4, time + 500000, report);
+			if ((i + 1) % (RdpGamepad::RdpTraceRecorder::Capacity / 8) == 0)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+		}
+		recorder.Stop();
+		return recorder.GetDroppedCount() == 0;
+	}
+}
+
+// A recorded trace read back as the loopback's --trace source: every plugin state on its recorded
+// timeline, held between samples, and the trace's button changes as the reference a replay is checked
+// against.
+bool TestTraceReplay()
+{
+	const std::string path = "RdpGamepadLoopback.test.trace";
+	LOOPBACK_CHECK(RecordTrace(path));
+
+	LoopbackTrace trace;
+	const bool loaded = trace.Load(path);
+	std::remove(path.c_str());
+	LOOPBACK_CHECK(loaded);
+	LOOPBACK_CHECK(trace.GetStateCount() == StateCount);
+	LOOPBACK_CHECK(trace.GetDuration() == (StateCount - 1) * StateInterval);
+	for (size_t i = 0; i < StateCount; ++i)
+	{
+		LOOPBACK_CHECK(SameGamepad(trace.GetState(i * StateInterval), MakeState(i)));
+		LOOPBACK_CHECK(SameGamepad(trace.GetState(i * StateInterval + StateInterval / 2), MakeState(i)));
+	}
+	LOOPBACK_CHECK(SameGamepad(trace.GetState(UINT64_MAX), MakeState(StateCount - 1)));
+
+	std::vector<WORD> expected;
+	WORD buttons = 0;
+	for (size_t i = 0; i < StateCount; ++i)
+	{
+		if (MakeState(i).wButtons != buttons)
+		{
+			buttons = MakeState(i).wButtons;
+			expected.push_back(buttons);
+		}
+	}
+	const std::vector<WORD> changes = trace.GetButtonChanges();
+	LOOPBACK_CHECK(changes == expected);
+
+	// 60 taps of A and 4 presses of B; a press of A and B together counts twice, and a tap the pad never
+	// saw goes missing from the count.
+	LOOPBACK_CHECK(LoopbackTrace::CountPresses(changes) == 64);
+	LOOPBACK_CHECK(LoopbackTrace::CountPresses({ XINPUT_GAMEPAD_A | XINPUT_GAMEPAD_B, XINPUT_GAMEPAD_B, 0 }) == 2);
+	std::vector<WORD> missed(changes.begin(), changes.begin() + 2);
+	missed.insert(missed.end(), changes.begin() + 4, changes.end());
+	LOOPBACK_CHECK(LoopbackTrace::CountPresses(missed) == 63);
+
+	LOOPBACK_CHECK(!trace.Load(path));
+	return true;
+}
@@ -0,0 +1,225 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "TransportBenchmark.h"
+
+#include <RdpGamepadSharedMemoryTransport.h>
+#include <RdpGamepadSocketTransport.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+
+namespace
+{
+	using namespace RdpGamepad;
+
+	constexpr int WaitTimeoutMs = 5000;
+
+	XINPUT_STATE MakeState(DWORD packetNumber)
+	{
+		XINPUT_STATE state{};
+		state.dwPacketNumber = packetNumber;
+		state.Gamepad.wButtons = static_cast<WORD>(packetNumber);
+		state.Gamepad.sThumbLX = static_cast<SHORT>(packetNumber * 7);
+		return state;
+	}
+
+	// Blocks until a message arrives, the transport closes or the timeout passes.
+	template <typename TRANSPORT>
+	bool ReceiveWait(TRANSPORT& transport, RdpProtocolPacket& packet)
+	{
+		while (!transport.Receive(&packet))
+		{
+			if (!transport.IsOpen() || !transport.WaitReadable(WaitTimeoutMs))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Answers GetStateRequest with one response and PollStateRequest with a burst of mUserIndex
+	// responses, numbered from 0, sent back to back.
+	template <typename TRANSPORT>
+	void ServePlugin(TRANSPORT& transport, std::atomic<bool>& failed)
+	{
+		RdpProtocolPacket packet;
+		DWORD sequence = 0;
+		while (ReceiveWait(transport, packet))
+		{
+			if (packet.mHeader.mMessageType == GetStateRequest)
+			{
+				if (!transport.Send(RdpGetStateResponse::MakeResponse(packet.mHeader.mUserIndex, ERROR_SUCCESS, MakeState(sequence++))))
+				{
+					failed = true;
+					return;
+				}
+			}
+			else if (packet.mHeader.mMessageType == PollStateRequest)
+			{
+				for (DWORD i = 0; i < packet.mHeader.mUserIndex; ++i)
+				{
+					if (!transport.Send(RdpGetStateResponse::MakeResponse(0, ERROR_SUCCESS, MakeState(i))))
+					{
+						failed = true;
+						return;
+					}
+				}
+			}
+		}
+	}
+
+	bool IsExpectedState(const RdpProtocolPacket& packet, DWORD packetNumber)
+	{
+		const XINPUT_STATE expected = MakeState(packetNumber);
+		return packet.mHeader.mMessageType == GetStateResponse &&
+			std::memcmp(&packet.mGetStateResponse.mState, &expected, sizeof(expected)) == 0;
+	}
+
+	template <typename TRANSPORT>
+	int Measure(const std::string& address, TRANSPORT& receiver, uint64_t messages, std::thread& plugin, std::atomic<bool>& pluginFailed)
+	{
+		// Round trips, one request in flight at a time, like a receiver tick waiting on its answer.
+		std::unique_ptr<RdpLatencyHistogram> roundTrips(new RdpLatencyHistogram);
+		RdpProtocolPacket packet;
+		uint64_t errors = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (uint64_t i = 0; i < messages; ++i)
+		{
+			const uint64_t sent = RdpLatencyClock::Now();
+			if (!receiver.Send(RdpGetStateRequest::MakeRequest(0)) || !ReceiveWait(receiver, packet))
+			{
+				++errors;
+				break;
+			}
+			roundTrips->Record(RdpLatencyClock::Now() - sent);
+			errors += IsExpectedState(packet, static_cast<DWORD>(i)) ? 0 : 1;
+		}
+		const double roundTripSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// One way throughput: the plugin streams every state as fast as the transport takes them, and
+		// the receiver drains them in batches like the receiver tick does.
+		uint64_t streamed = 0;
+		uint64_t batches = 0;
+		start = std::chrono::steady_clock::now();
+		if (errors == 0 && receiver.Send(RdpPollStateRequest::MakeRequest(static_cast<DWORD>(messages))))
+		{
+			RdpPacketSpan batch;
+			while (streamed < messages)
+			{
+				if (!receiver.ReceiveBatch(batch))
+				{
+					if (!receiver.IsOpen() || !receiver.WaitReadable(WaitTimeoutMs))
+					{
+						break;
+					}
+					continue;
+				}
+				++batches;
+				for (const RdpPacketView& view : batch)
+				{
+					view.CopyTo(packet);
+					errors += IsExpectedState(packet, static_cast<DWORD>(streamed++)) ? 0 : 1;
+				}
+			}
+		}
+		const double streamSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		errors += messages - streamed;
+
+		receiver.Close();
+		plugin.join();
+		errors += pluginFailed ? 1 : 0;
+		errors += receiver.GetInvalidPacketCount();
+
+		std::unique_ptr<RdpLatencyHistogram::Snapshot> latency(new RdpLatencyHistogram::Snapshot);
+		roundTrips->TakeSnapshot(*latency);
+		const double streamBytes = double(streamed) * sizeof(RdpGetStateResponse);
+
+		std::printf("%-20s %s\n", "Transport", address.c_str());
+		std::printf("%-20s %10llu round trips %10.0f per second\n", "Request/response",
+			(unsigned long long)latency->GetCount(), latency->GetCount() / roundTripSeconds);
+		std::printf("%-20s p50 %.1f  p90 %.1f  p99 %.1f  max %.1f us\n", "Round trip",
+			latency->GetPercentile(0.50) / 1e3, latency->GetPercentile(0.90) / 1e3, latency->GetPercentile(0.99) / 1e3,
+			latency->GetMax() / 1e3);
+		std::printf("%-20s %10llu states      %10.0f per second %8.1f MB/s\n", "Streamed",
+			(unsigned long long)streamed, streamed / streamSeconds, streamBytes / streamSeconds / 1e6);
+		std::printf("%-20s %10llu batches     %10.1f states per batch\n", "Stream reads",
+			(unsigned long long)batches, batches ? double(streamed) / batches : 0.0);
+		std::printf("%-20s %llu\n", "Errors", (unsigned long long)errors);
+		return (errors == 0) ? 0 : 1;
+	}
+
+	int RunSharedMemory(const std::string& address, uint64_t messages)
+	{
+		const std::string name = address.substr(4);
+		std::unique_ptr<RdpGamepadSharedMemoryTransport> server = RdpGamepadSharedMemoryTransport::Create(name);
+		if (!server)
+		{
+			std::fprintf(stderr, "Cannot create shared memory %s\n", name.c_str());
+			return 1;
+		}
+
+		std::unique_ptr<RdpGamepadSharedMemoryTransport> receiver = RdpGamepadSharedMemoryTransport::Open(name);
+		if (!receiver)
+		{
+			std::fprintf(stderr, "Cannot open shared memory %s\n", name.c_str());
+			return 1;
+		}
+
+		std::atomic<bool> pluginFailed{false};
+		std::thread plugin([&server, &pluginFailed]() { ServePlugin(*server, pluginFailed); });
+		return Measure(address, *receiver, messages, plugin, pluginFailed);
+	}
+
+	int RunSocket(const std::string& address, uint64_t messages)
+	{
+		RdpSocketAddress socketAddress;
+		if (!socketAddress.Parse(address))
+		{
+			std::fprintf(stderr, "Malformed transport address %s\n", address.c_str());
+			return 2;
+		}
+
+		RdpGamepadSocketListener listener;
+		if (!listener.Listen(socketAddress))
+		{
+			std::fprintf(stderr, "Cannot listen at %s\n", address.c_str());
+			return 1;
+		}
+
+		std::atomic<bool> pluginFailed{false};
+		std::thread plugin([&listener, &pluginFailed]()
+		{
+			std::unique_ptr<RdpGamepadSocketTransport> server = listener.Accept(WaitTimeoutMs);
+			if (server)
+			{
+				ServePlugin(*server, pluginFailed);
+			}
+			else
+			{
+				pluginFailed = true;
+			}
+		});
+
+		std::unique_ptr<RdpGamepadSocketTransport> receiver = RdpGamepadSocketTransport::Connect(socketAddress);
+		if (!receiver)
+		{
+			std::fprintf(stderr, "Cannot connect to %s\n", address.c_str());
+			plugin.join();
+			return 1;
+		}
+		return Measure(address, *receiver, messages, plugin, pluginFailed);
+	}
+}
+
+int RunTransportBenchmark(const std::string& address, uint64_t messages)
+{
+	if (address.compare(0, 4, "shm:") == 0)
+	{
+		return RunSharedMemory(address, messages);
+	}
+	return RunSocket(address, messages);
+}
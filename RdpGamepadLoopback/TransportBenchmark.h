@@ -0,0 +1,13 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Runs a plugin and a receiver endpoint on two threads joined by a real transport at the given address
+// ("tcp:<port>", "unix:<path>" or "shm:<name>"), then measures request round trips and streamed state
+// throughput, messages at a time. Returns a process exit code; anything but 0 means a message was lost,
+// reordered or corrupted.
+int RunTransportBenchmark(const std::string& address, uint64_t messages);
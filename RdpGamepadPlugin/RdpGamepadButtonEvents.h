@@ -0,0 +1,106 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace RdpGamepad
+{
+#pragma pack(push)
+#pragma pack(1)
+
+	enum RdpButtonEventSource : uint8_t
+	{
+		ButtonSourceXInput,			// XINPUT_GAMEPAD::wButtons.
+		ButtonSourceDS4,			// PadState::Buttons in the low 16 bits, PadState::SpecialButtons above.
+	};
+
+	// The digital inputs of the controller right after one of them changed.
+	struct RdpButtonEdge
+	{
+		uint32_t            mAge;			// Microseconds between the edge and sending the message carrying it.
+		uint32_t            mDigital;
+	};
+
+#pragma pack(pop)
+
+	// Most edges one message carries; more than this between two states is faster than anyone can press.
+	static constexpr size_t ButtonEdgeCapacity = 16;
+
+	// Samples the digital inputs far more often than states are sent and keeps every change in between,
+	// so a tap shorter than the state interval is still reported. Sample and Take may be called from
+	// different threads. Times are RdpLatencyClock nanoseconds.
+	class RdpButtonEdgeDetector
+	{
+	public:
+		// Records an edge if digital differs from the previous sample. The first sample after Reset only
+		// sets the baseline.
+		void Sample(uint64_t time, uint32_t digital)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (!mHasSample)
+			{
+				mHasSample = true;
+				mDigital = digital;
+				return;
+			}
+			if (digital == mDigital)
+			{
+				return;
+			}
+			mDigital = digital;
+
+			// Out of room: fold the change into the newest edge, which keeps the final state right.
+			if (mCount == ButtonEdgeCapacity)
+			{
+				mEdges[mCount - 1] = Edge{ time, digital };
+				++mDropped;
+				return;
+			}
+			mEdges[mCount++] = Edge{ time, digital };
+		}
+
+		// Moves the edges seen since the last call to outEdges, oldest first, and returns their number.
+		size_t Take(uint64_t now, RdpButtonEdge (&outEdges)[ButtonEdgeCapacity])
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			for (size_t i = 0; i < mCount; ++i)
+			{
+				const uint64_t age = (now > mEdges[i].mTime) ? (now - mEdges[i].mTime) / 1000 : 0;
+				outEdges[i].mAge = static_cast<uint32_t>(age < UINT32_MAX ? age : UINT32_MAX);
+				outEdges[i].mDigital = mEdges[i].mDigital;
+			}
+			const size_t count = mCount;
+			mCount = 0;
+			return count;
+		}
+
+		void Reset()
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mCount = 0;
+			mHasSample = false;
+		}
+
+		// Edges folded into a later one because too many came between two Takes.
+		uint64_t GetDroppedCount() const
+		{ return mDropped; }
+
+	private:
+		struct Edge
+		{
+			uint64_t mTime;
+			uint32_t mDigital;
+		};
+
+		std::mutex mMutex;
+		Edge mEdges[ButtonEdgeCapacity];
+		size_t mCount = 0;
+		uint64_t mDropped = 0;
+		uint32_t mDigital = 0;
+		bool mHasSample = false;
+	};
+}
@@ -0,0 +1,501 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace RdpGamepad
+{
+	enum RdpTraceAxis
+	{
+		TraceAxisLeftTrigger,
+		TraceAxisRightTrigger,
+		TraceAxisLeftX,
+		TraceAxisLeftY,
+		TraceAxisRightX,
+		TraceAxisRightY,
+
+		TraceAxisCount
+	};
+
+	// One controller state in a form common to every controller type.
+	struct RdpTraceFrame
+	{
+		uint64_t            mTime;		// RdpLatencyClock nanoseconds.
+		uint8_t             mSource;	// RdpTraceSource.
+		uint8_t             mKind;		// RdpTraceKind.
+		uint32_t            mButtons;
+		int32_t             mAxes[TraceAxisCount];
+	};
+
+	// Every field of a frame is stored in its own column, so a reader only touches the bytes of the
+	// fields it needs.
+	enum RdpTraceColumn
+	{
+		TraceColumnTime,
+		TraceColumnStream,			// Source and kind.
+		TraceColumnButtons,
+		TraceColumnAxes,			// TraceAxisCount columns, one per axis.
+
+		TraceColumnCount = TraceColumnAxes + TraceAxisCount
+	};
+
+	constexpr uint32_t TraceColumnsAll = (1u << TraceColumnCount) - 1;
+
+#pragma pack(push)
+#pragma pack(1)
+
+	// A columnar trace file is an RdpColumnarFileHeader, blocks of up to BlockCapacity frames, an index
+	// with one RdpColumnarBlockInfo per block and an RdpColumnarTrailer locating the index. Each block is
+	// a uint32_t frame count and the byte size of every column, followed by the columns. A column holds
+	// the differences between consecutive values, zigzag and varint encoded, starting from zero at the
+	// beginning of every block so each block decodes on its own.
+	struct RdpColumnarFileHeader
+	{
+		static constexpr uint32_t Magic = 0x54434752;	// "RGCT"
+		static constexpr uint16_t CurrentVersion = 1;
+
+		uint32_t            mMagic;
+		uint16_t            mVersion;
+		uint16_t            mReserved;
+	};
+
+	struct RdpColumnarBlockInfo
+	{
+		uint64_t            mOffset;
+		uint32_t            mSize;
+		uint32_t            mCount;
+		uint64_t            mFirstTime;
+		uint64_t            mMaxTime;	// Latest time in this block or any before it, which keeps the index sorted.
+	};
+
+	struct RdpColumnarTrailer
+	{
+		uint64_t            mIndexOffset;
+		uint32_t            mBlockCount;
+		uint32_t            mMagic;
+	};
+
+#pragma pack(pop)
+
+	namespace Columnar
+	{
+		inline void PutVarint(std::vector<uint8_t>& out, int64_t value)
+		{
+			uint64_t zigzag = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+			while (zigzag >= 0x80)
+			{
+				out.push_back(static_cast<uint8_t>(zigzag | 0x80));
+				zigzag >>= 7;
+			}
+			out.push_back(static_cast<uint8_t>(zigzag));
+		}
+
+		// Returns false when the varint runs past end or is longer than 64 bits.
+		inline bool GetVarint(const uint8_t*& data, const uint8_t* end, int64_t& outValue)
+		{
+			uint64_t zigzag = 0;
+			for (unsigned int shift = 0; shift < 64; shift += 7)
+			{
+				if (data == end)
+				{
+					return false;
+				}
+				const uint8_t byte = *data++;
+				zigzag |= static_cast<uint64_t>(byte & 0x7f) << shift;
+				if ((byte & 0x80) == 0)
+				{
+					outValue = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+					return true;
+				}
+			}
+			return false;
+		}
+
+		inline int64_t GetColumnValue(const RdpTraceFrame& frame, size_t column)
+		{
+			switch (column)
+			{
+			case TraceColumnTime:		return static_cast<int64_t>(frame.mTime);
+			case TraceColumnStream:		return (frame.mSource << 8) | frame.mKind;
+			case TraceColumnButtons:	return frame.mButtons;
+			default:					return frame.mAxes[column - TraceColumnAxes];
+			}
+		}
+
+		inline void SetColumnValue(RdpTraceFrame& frame, size_t column, int64_t value)
+		{
+			switch (column)
+			{
+			case TraceColumnTime:		frame.mTime = static_cast<uint64_t>(value); break;
+			case TraceColumnStream:		frame.mSource = static_cast<uint8_t>(value >> 8); frame.mKind = static_cast<uint8_t>(value); break;
+			case TraceColumnButtons:	frame.mButtons = static_cast<uint32_t>(value); break;
+			default:					frame.mAxes[column - TraceColumnAxes] = static_cast<int32_t>(value); break;
+			}
+		}
+	}
+
+	// Writes frames, which should be appended in time order, to a columnar trace file.
+	class RdpColumnarTraceWriter
+	{
+	public:
+		static constexpr size_t BlockCapacity = 4096;
+
+		~RdpColumnarTraceWriter()
+		{
+			Close();
+		}
+
+		template <typename PATH>
+		bool Open(const PATH& path)
+		{
+			mFile.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+			const RdpColumnarFileHeader header = { RdpColumnarFileHeader::Magic, RdpColumnarFileHeader::CurrentVersion, 0 };
+			mFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			mOffset = sizeof(header);
+			mFrames.reserve(BlockCapacity);
+			mIndex.clear();
+			mMaxTime = 0;
+			return static_cast<bool>(mFile);
+		}
+
+		void Append(const RdpTraceFrame& frame)
+		{
+			mFrames.push_back(frame);
+			if (mFrames.size() == BlockCapacity)
+			{
+				WriteBlock();
+			}
+		}
+
+		// Writes the last block and the index. The file is only readable once this returns true.
+		bool Close()
+		{
+			if (!mFile.is_open())
+			{
+				return false;
+			}
+
+			WriteBlock();
+			const RdpColumnarTrailer trailer = { mOffset, static_cast<uint32_t>(mIndex.size()), RdpColumnarFileHeader::Magic };
+			if (!mIndex.empty())
+			{
+				mFile.write(reinterpret_cast<const char*>(mIndex.data()), mIndex.size() * sizeof(RdpColumnarBlockInfo));
+			}
+			mFile.write(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+			const bool ok = static_cast<bool>(mFile);
+			mFile.close();
+			return ok;
+		}
+
+	private:
+		std::ofstream mFile;
+		uint64_t mOffset = 0;
+		uint64_t mMaxTime = 0;
+		std::vector<RdpTraceFrame> mFrames;
+		std::vector<uint8_t> mColumns[TraceColumnCount];
+		std::vector<RdpColumnarBlockInfo> mIndex;
+
+		void WriteBlock()
+		{
+			if (mFrames.empty())
+			{
+				return;
+			}
+
+			uint32_t sizes[1 + TraceColumnCount];
+			sizes[0] = static_cast<uint32_t>(mFrames.size());
+			for (size_t column = 0; column < TraceColumnCount; ++column)
+			{
+				std::vector<uint8_t>& bytes = mColumns[column];
+				bytes.clear();
+				int64_t previous = 0;
+				for (const RdpTraceFrame& frame : mFrames)
+				{
+					const int64_t value = Columnar::GetColumnValue(frame, column);
+					Columnar::PutVarint(bytes, value - previous);
+					previous = value;
+				}
+				sizes[1 + column] = static_cast<uint32_t>(bytes.size());
+			}
+
+			RdpColumnarBlockInfo info;
+			info.mOffset = mOffset;
+			info.mSize = sizeof(sizes);
+			info.mCount = sizes[0];
+			info.mFirstTime = mFrames.front().mTime;
+			for (const RdpTraceFrame& frame : mFrames)
+			{
+				mMaxTime = (std::max)(mMaxTime, frame.mTime);
+			}
+			info.mMaxTime = mMaxTime;
+
+			mFile.write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+			for (const std::vector<uint8_t>& bytes : mColumns)
+			{
+				mFile.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+				info.mSize += static_cast<uint32_t>(bytes.size());
+			}
+
+			mOffset += info.mSize;
+			mIndex.push_back(info);
+			mFrames.clear();
+		}
+	};
+
+	// A read only view of a whole file, paged in by the operating system as it is touched. A 32-bit
+	// process can only map files that fit in its address space.
+	class RdpMappedFile
+	{
+	public:
+		RdpMappedFile() = default;
+		RdpMappedFile(const RdpMappedFile&) = delete;
+		RdpMappedFile& operator=(const RdpMappedFile&) = delete;
+
+		~RdpMappedFile()
+		{
+			Close();
+		}
+
+		bool Open(const char* path)
+		{
+			Close();
+#if defined(_WIN32)
+			mFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			LARGE_INTEGER size;
+			if (mFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(mFile, &size) || size.QuadPart == 0 || uint64_t(size.QuadPart) > SIZE_MAX)
+			{
+				Close();
+				return false;
+			}
+			mMapping = CreateFileMappingW(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			mData = (mMapping != nullptr) ? static_cast<const uint8_t*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+			mSize = static_cast<size_t>(size.QuadPart);
+#else
+			mFile = open(path, O_RDONLY);
+			struct stat status;
+			if (mFile < 0 || fstat(mFile, &status) != 0 || status.st_size == 0 || uint64_t(status.st_size) > SIZE_MAX)
+			{
+				Close();
+				return false;
+			}
+			void* data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, mFile, 0);
+			mData = (data != MAP_FAILED) ? static_cast<const uint8_t*>(data) : nullptr;
+			mSize = static_cast<size_t>(status.st_size);
+#endif
+			if (mData == nullptr)
+			{
+				Close();
+				return false;
+			}
+			return true;
+		}
+
+		void Close()
+		{
+#if defined(_WIN32)
+			if (mData != nullptr)
+			{
+				UnmapViewOfFile(mData);
+			}
+			if (mMapping != nullptr)
+			{
+				CloseHandle(mMapping);
+			}
+			if (mFile != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(mFile);
+			}
+			mMapping = nullptr;
+			mFile = INVALID_HANDLE_VALUE;
+#else
+			if (mData != nullptr)
+			{
+				munmap(const_cast<uint8_t*>(mData), mSize);
+			}
+			if (mFile >= 0)
+			{
+				close(mFile);
+			}
+			mFile = -1;
+#endif
+			mData = nullptr;
+			mSize = 0;
+		}
+
+		const uint8_t* GetData() const
+		{ return mData; }
+
+		size_t GetSize() const
+		{ return mSize; }
+
+	private:
+#if defined(_WIN32)
+		HANDLE mFile = INVALID_HANDLE_VALUE;
+		HANDLE mMapping = nullptr;
+#else
+		int mFile = -1;
+#endif
+		const uint8_t* mData = nullptr;
+		size_t mSize = 0;
+	};
+
+	// Reads a columnar trace through a memory mapping. Only the index is read when the file is opened;
+	// blocks are decoded on demand, so finding a moment in a trace of any size costs a binary search
+	// and one block.
+	class RdpColumnarTraceReader
+	{
+	public:
+		bool Open(const char* path)
+		{
+			mIndex = nullptr;
+			mBlockCount = 0;
+			if (!mFile.Open(path))
+			{
+				return false;
+			}
+
+			const uint8_t* data = mFile.GetData();
+			const size_t size = mFile.GetSize();
+			RdpColumnarFileHeader header;
+			RdpColumnarTrailer trailer;
+			if (size < sizeof(header) + sizeof(trailer))
+			{
+				return false;
+			}
+			std::memcpy(&header, data, sizeof(header));
+			std::memcpy(&trailer, data + size - sizeof(trailer), sizeof(trailer));
+			if (header.mMagic != RdpColumnarFileHeader::Magic || header.mVersion != RdpColumnarFileHeader::CurrentVersion || trailer.mMagic != RdpColumnarFileHeader::Magic)
+			{
+				return false;
+			}
+
+			const uint64_t indexEnd = size - sizeof(trailer);
+			if (trailer.mIndexOffset > indexEnd || (indexEnd - trailer.mIndexOffset) != uint64_t(trailer.mBlockCount) * sizeof(RdpColumnarBlockInfo))
+			{
+				return false;
+			}
+			mIndex = data + trailer.mIndexOffset;
+			mBlockCount = trailer.mBlockCount;
+			mIndexOffset = trailer.mIndexOffset;
+			return true;
+		}
+
+		size_t GetBlockCount() const
+		{ return mBlockCount; }
+
+		RdpColumnarBlockInfo GetBlockInfo(size_t block) const
+		{
+			RdpColumnarBlockInfo info;
+			std::memcpy(&info, mIndex + block * sizeof(RdpColumnarBlockInfo), sizeof(info));
+			return info;
+		}
+
+		uint64_t GetFrameCount() const
+		{
+			uint64_t count = 0;
+			for (size_t block = 0; block < mBlockCount; ++block)
+			{
+				count += GetBlockInfo(block).mCount;
+			}
+			return count;
+		}
+
+		uint64_t GetFileSize() const
+		{ return mFile.GetSize(); }
+
+		// The first block that can hold frames at or after time, or GetBlockCount() when there is none.
+		size_t FindBlock(uint64_t time) const
+		{
+			size_t low = 0;
+			size_t high = mBlockCount;
+			while (low < high)
+			{
+				const size_t middle = low + (high - low) / 2;
+				if (GetBlockInfo(middle).mMaxTime < time)
+				{
+					low = middle + 1;
+				}
+				else
+				{
+					high = middle;
+				}
+			}
+			return low;
+		}
+
+		// Replaces outFrames with the frames of a block. Only the columns set in the columns mask are
+		// decoded; the other fields are left zero. Returns false for a corrupt block.
+		bool DecodeBlock(size_t block, std::vector<RdpTraceFrame>& outFrames, uint32_t columns = TraceColumnsAll) const
+		{
+			outFrames.clear();
+			if (block >= mBlockCount)
+			{
+				return false;
+			}
+
+			const RdpColumnarBlockInfo info = GetBlockInfo(block);
+			uint32_t sizes[1 + TraceColumnCount];
+			if (info.mOffset > mIndexOffset || info.mSize > mIndexOffset - info.mOffset || info.mSize < sizeof(sizes))
+			{
+				return false;
+			}
+			const uint8_t* data = mFile.GetData() + info.mOffset;
+			std::memcpy(sizes, data, sizeof(sizes));
+			if (sizes[0] != info.mCount || info.mCount > RdpColumnarTraceWriter::BlockCapacity)
+			{
+				return false;
+			}
+
+			outFrames.resize(info.mCount, RdpTraceFrame{});
+			const uint8_t* column = data + sizeof(sizes);
+			const uint8_t* const end = data + info.mSize;
+			for (size_t index = 0; index < TraceColumnCount; ++index)
+			{
+				const uint32_t size = sizes[1 + index];
+				if (size > static_cast<size_t>(end - column))
+				{
+					return false;
+				}
+				if (columns & (1u << index))
+				{
+					const uint8_t* read = column;
+					int64_t value = 0;
+					for (RdpTraceFrame& frame : outFrames)
+					{
+						int64_t delta;
+						if (!Columnar::GetVarint(read, column + size, delta))
+						{
+							return false;
+						}
+						value += delta;
+						Columnar::SetColumnValue(frame, index, value);
+					}
+				}
+				column += size;
+			}
+			return true;
+		}
+
+	private:
+		RdpMappedFile mFile;
+		const uint8_t* mIndex = nullptr;
+		size_t mBlockCount = 0;
+		uint64_t mIndexOffset = 0;
+	};
+}
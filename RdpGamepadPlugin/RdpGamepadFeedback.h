@@ -0,0 +1,116 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace RdpGamepad
+{
+#pragma pack(push)
+#pragma pack(1)
+
+	enum RdpFeedbackTarget : uint8_t
+	{
+		FeedbackTargetXInput,		// Apply through XInput, which only supports rumble.
+		FeedbackTargetDS4,			// Apply through libDS4.
+	};
+
+	enum RdpFeedbackFlags : uint8_t
+	{
+		FeedbackRumble    = 1 << 0,
+		FeedbackLightBar  = 1 << 1,
+		FeedbackPlayerLed = 1 << 2,
+	};
+
+	// Everything the host wants the physical controller to show, carried by a single output report.
+	struct RdpFeedback
+	{
+		uint16_t            mLargeMotor;
+		uint16_t            mSmallMotor;
+		uint8_t             mLightBarR;
+		uint8_t             mLightBarG;
+		uint8_t             mLightBarB;
+		uint8_t             mPlayerLed;		// Zero based player index.
+		uint8_t             mFlags;			// RdpFeedbackFlags of the fields the host has set; the others are meaningless.
+	};
+
+#pragma pack(pop)
+
+	// Gathers feedback from the virtual controller and decides when an output report is worth sending:
+	// only when something differs from the last report sent, and never more often than the minimum
+	// interval. Changes made while rate limited are merged into the next report, so the latest feedback
+	// always goes out eventually. Times are in milliseconds.
+	class RdpFeedbackCoalescer
+	{
+	public:
+		explicit RdpFeedbackCoalescer(uint64_t minInterval = 16)
+			: mMinInterval(minInterval)
+		{}
+
+		void SetMinInterval(uint64_t minInterval)
+		{ mMinInterval = minInterval; }
+
+		void SetRumble(uint16_t largeMotor, uint16_t smallMotor)
+		{
+			mPending.mLargeMotor = largeMotor;
+			mPending.mSmallMotor = smallMotor;
+			mPending.mFlags |= FeedbackRumble;
+		}
+
+		void SetLightBar(uint8_t r, uint8_t g, uint8_t b)
+		{
+			mPending.mLightBarR = r;
+			mPending.mLightBarG = g;
+			mPending.mLightBarB = b;
+			mPending.mFlags |= FeedbackLightBar;
+		}
+
+		void SetPlayerLed(uint8_t playerIndex)
+		{
+			mPending.mPlayerLed = playerIndex;
+			mPending.mFlags |= FeedbackPlayerLed;
+		}
+
+		// Returns true, filling outFeedback, when a report should be sent now.
+		bool TakeReport(uint64_t now, RdpFeedback& outFeedback)
+		{
+			if (mPending.mFlags == 0)
+			{
+				return false;
+			}
+			if (mHasSent)
+			{
+				if (std::memcmp(&mPending, &mSent, sizeof(RdpFeedback)) == 0 || (now - mSentTime) < mMinInterval)
+				{
+					return false;
+				}
+			}
+
+			mSent = mPending;
+			mSentTime = now;
+			mHasSent = true;
+			outFeedback = mPending;
+			return true;
+		}
+
+		// Forgets what was sent, so the current feedback goes out again, e.g. to a newly connected client.
+		void Invalidate()
+		{ mHasSent = false; }
+
+		// Forgets everything, as for a newly created virtual controller.
+		void Reset()
+		{
+			mPending = RdpFeedback{};
+			mHasSent = false;
+		}
+
+	private:
+		RdpFeedback mPending{};
+		RdpFeedback mSent{};
+		uint64_t mSentTime = 0;
+		uint64_t mMinInterval;
+		bool mHasSent = false;
+	};
+}
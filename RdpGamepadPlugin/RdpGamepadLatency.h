@@ -0,0 +1,311 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace RdpGamepad
+{
+	// Every timed step of a controller state's trip from the physical pad to the virtual one.
+	// The plugin records the first four, the receiver the rest.
+	enum RdpLatencyStage : uint8_t
+	{
+		LatencyTimerLateness,		// Plugin: how late the poll timer fired.
+		LatencySample,				// Plugin: XInputGetState or PadGetState.
+		LatencyEncode,				// Plugin: building the state response.
+		LatencyWrite,				// Plugin: writing the response to the channel.
+		LatencyRoundTrip,			// Receiver: from sending a state request to reading a response.
+		LatencyRead,				// Receiver: reading one packet from the channel.
+		LatencyDecode,				// Receiver: mapping and queueing a received state.
+		LatencySubmit,				// Receiver: submitting a report to ViGEm.
+
+		LatencyStageCount
+	};
+
+	inline const char* GetLatencyStageName(RdpLatencyStage stage)
+	{
+		static const char* const sNames[] =
+		{
+			"TimerLateness",
+			"Sample",
+			"Encode",
+			"Write",
+			"RoundTrip",
+			"Read",
+			"Decode",
+			"Submit",
+		};
+		static_assert(sizeof(sNames) / sizeof(sNames[0]) == LatencyStageCount, "sNames has incorrect size");
+		return sNames[stage];
+	}
+
+	struct RdpLatencyClock
+	{
+		// Monotonic time in nanoseconds.
+		static uint64_t Now()
+		{
+			using namespace std::chrono;
+			return static_cast<uint64_t>(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+		}
+	};
+
+#pragma pack(push)
+#pragma pack(1)
+
+	// Fixed size digest of a histogram, small enough to travel in a protocol message. Microseconds.
+	struct RdpLatencySummary
+	{
+		uint32_t            mCount;
+		uint32_t            mP50;
+		uint32_t            mP90;
+		uint32_t            mP99;
+		uint32_t            mMax;
+	};
+
+#pragma pack(pop)
+
+	// HDR style histogram of nanosecond durations: values below 2^SubBucketBits are counted exactly, larger
+	// values land in one of 2^SubBucketBits linear buckets per power of two, so every recorded value is
+	// known to within about 3%. Record is a single relaxed atomic add and may be called from any number
+	// of threads; snapshots can be taken at any time without stopping the writers.
+	class RdpLatencyHistogram
+	{
+	public:
+		static constexpr unsigned int SubBucketBits = 5;
+		static constexpr unsigned int MaxValueBits = 40;	// About 18 minutes; longer durations are clamped.
+		static constexpr size_t SubBucketCount = size_t(1) << SubBucketBits;
+		static constexpr size_t BucketCount = (MaxValueBits - SubBucketBits + 1) * SubBucketCount;
+
+		struct Snapshot
+		{
+			uint64_t mCounts[BucketCount];
+
+			uint64_t GetCount() const
+			{
+				uint64_t count = 0;
+				for (size_t i = 0; i < BucketCount; ++i)
+				{
+					count += mCounts[i];
+				}
+				return count;
+			}
+
+			// The highest value of the bucket holding the given fraction of the recorded values.
+			uint64_t GetPercentile(double fraction) const
+			{
+				const uint64_t count = GetCount();
+				if (count == 0)
+				{
+					return 0;
+				}
+
+				uint64_t rank = static_cast<uint64_t>(fraction * count + 0.5);
+				rank = (rank == 0) ? 1 : (rank > count) ? count : rank;
+				uint64_t seen = 0;
+				for (size_t i = 0; i < BucketCount; ++i)
+				{
+					seen += mCounts[i];
+					if (seen >= rank)
+					{
+						return GetBucketMax(i);
+					}
+				}
+				return GetBucketMax(BucketCount - 1);
+			}
+
+			uint64_t GetMax() const
+			{
+				for (size_t i = BucketCount; i != 0; --i)
+				{
+					if (mCounts[i - 1] != 0)
+					{
+						return GetBucketMax(i - 1);
+					}
+				}
+				return 0;
+			}
+
+			RdpLatencySummary Summarize() const
+			{
+				RdpLatencySummary summary;
+				summary.mCount = static_cast<uint32_t>(GetCount());
+				summary.mP50 = ToMicroseconds(GetPercentile(0.50));
+				summary.mP90 = ToMicroseconds(GetPercentile(0.90));
+				summary.mP99 = ToMicroseconds(GetPercentile(0.99));
+				summary.mMax = ToMicroseconds(GetMax());
+				return summary;
+			}
+		};
+
+		RdpLatencyHistogram()
+		{
+			Reset();
+		}
+
+		RdpLatencyHistogram(const RdpLatencyHistogram&) = delete;
+		RdpLatencyHistogram& operator=(const RdpLatencyHistogram&) = delete;
+
+		void Record(uint64_t value)
+		{
+			mCounts[GetBucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void TakeSnapshot(Snapshot& outSnapshot) const
+		{
+			for (size_t i = 0; i < BucketCount; ++i)
+			{
+				outSnapshot.mCounts[i] = mCounts[i].load(std::memory_order_relaxed);
+			}
+		}
+
+		void Reset()
+		{
+			for (size_t i = 0; i < BucketCount; ++i)
+			{
+				mCounts[i].store(0, std::memory_order_relaxed);
+			}
+		}
+
+		static size_t GetBucketIndex(uint64_t value)
+		{
+			const uint64_t maxValue = (uint64_t(1) << MaxValueBits) - 1;
+			value = (value < maxValue) ? value : maxValue;
+			if (value < SubBucketCount)
+			{
+				return static_cast<size_t>(value);
+			}
+
+			// The top SubBucketBits + 1 bits of the value pick the bucket within its power of two.
+			const unsigned int shift = HighestBit(value) - SubBucketBits;
+			return shift * SubBucketCount + static_cast<size_t>(value >> shift);
+		}
+
+		static uint64_t GetBucketMax(size_t index)
+		{
+			if (index < SubBucketCount * 2)
+			{
+				return index;
+			}
+			const unsigned int shift = static_cast<unsigned int>(index / SubBucketCount) - 1;
+			const uint64_t top = index - shift * SubBucketCount;
+			return ((top + 1) << shift) - 1;
+		}
+
+	private:
+		std::atomic<uint64_t> mCounts[BucketCount];
+
+		static unsigned int HighestBit(uint64_t value)
+		{
+#if defined(_MSC_VER)
+			unsigned long index;
+			if (_BitScanReverse(&index, static_cast<unsigned long>(value >> 32)))
+			{
+				return index + 32;
+			}
+			_BitScanReverse(&index, static_cast<unsigned long>(value | 1));
+			return index;
+#else
+			return 63 - __builtin_clzll(value | 1);
+#endif
+		}
+
+		static uint32_t ToMicroseconds(uint64_t nanoseconds)
+		{
+			const uint64_t microseconds = nanoseconds / 1000;
+			return (microseconds > UINT32_MAX) ? UINT32_MAX : static_cast<uint32_t>(microseconds);
+		}
+	};
+
+	// One histogram per stage.
+	class RdpLatencyStages
+	{
+	public:
+		void Record(RdpLatencyStage stage, uint64_t nanoseconds)
+		{ mHistograms[stage].Record(nanoseconds); }
+
+		// Records the time between start and end; an end earlier than start is dropped.
+		void Record(RdpLatencyStage stage, uint64_t start, uint64_t end)
+		{
+			if (end >= start)
+			{
+				mHistograms[stage].Record(end - start);
+			}
+		}
+
+		void TakeSnapshot(RdpLatencyStage stage, RdpLatencyHistogram::Snapshot& outSnapshot) const
+		{ mHistograms[stage].TakeSnapshot(outSnapshot); }
+
+		void Summarize(RdpLatencySummary (&outSummaries)[LatencyStageCount]) const
+		{
+			std::unique_ptr<RdpLatencyHistogram::Snapshot> snapshot(new RdpLatencyHistogram::Snapshot);
+			for (size_t stage = 0; stage < LatencyStageCount; ++stage)
+			{
+				mHistograms[stage].TakeSnapshot(*snapshot);
+				outSummaries[stage] = snapshot->Summarize();
+			}
+		}
+
+		void Reset()
+		{
+			for (auto& histogram : mHistograms)
+			{
+				histogram.Reset();
+			}
+		}
+
+	private:
+		RdpLatencyHistogram mHistograms[LatencyStageCount];
+	};
+
+	// Times request/response round trips by pairing responses with requests in the order they were sent.
+	class RdpLatencyRoundTrip
+	{
+	public:
+		static constexpr size_t Capacity = 8;
+
+		void Sent(uint64_t now)
+		{
+			if (mCount == Capacity)
+			{
+				// Responses are being lost; forget the oldest request.
+				mHead = (mHead + 1) % Capacity;
+				--mCount;
+			}
+			mSendTimes[(mHead + mCount) % Capacity] = now;
+			++mCount;
+		}
+
+		// Returns false when there is no outstanding request to match.
+		bool Received(uint64_t now, uint64_t& outElapsed)
+		{
+			if (mCount == 0)
+			{
+				return false;
+			}
+			outElapsed = now - mSendTimes[mHead];
+			mHead = (mHead + 1) % Capacity;
+			--mCount;
+			return true;
+		}
+
+		void Reset()
+		{
+			mHead = 0;
+			mCount = 0;
+		}
+
+	private:
+		uint64_t mSendTimes[Capacity];
+		size_t mHead = 0;
+		size_t mCount = 0;
+	};
+}
@@ -0,0 +1,150 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include "RdpGamepadProtocol.h"
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+namespace RdpGamepad
+{
+	// One received message inside a receive buffer, which holds no particular alignment; copy it out
+	// to look at anything past the header.
+	struct RdpPacketView
+	{
+		const char* mData;
+		size_t mSize;
+
+		RdpProtocolHeader GetHeader() const
+		{
+			RdpProtocolHeader header;
+			std::memcpy(&header, mData, sizeof(header));
+			return header;
+		}
+
+		void CopyTo(RdpProtocolPacket& outPacket) const
+		{ std::memcpy(&outPacket, mData, mSize); }
+	};
+
+	// A run of packet views, valid until the next receive on the transport that returned it.
+	class RdpPacketSpan
+	{
+	public:
+		RdpPacketSpan()
+		{}
+
+		RdpPacketSpan(const RdpPacketView* data, size_t size)
+			: mData(data)
+			, mSize(size)
+		{}
+
+		const RdpPacketView* begin() const
+		{ return mData; }
+
+		const RdpPacketView* end() const
+		{ return mData + mSize; }
+
+		const RdpPacketView& operator[](size_t index) const
+		{ return mData[index]; }
+
+		size_t size() const
+		{ return mSize; }
+
+		bool empty() const
+		{ return mSize == 0; }
+
+	private:
+		const RdpPacketView* mData = nullptr;
+		size_t mSize = 0;
+	};
+
+	// Splits a byte stream back into messages by their mMessageSize. Reads go straight into the free
+	// end of one reusable buffer, however the bytes were cut up on the way, and every whole message in
+	// it comes out of a single Split; a partial message waits for the rest.
+	class RdpMessageSplitter
+	{
+	public:
+		static constexpr size_t DefaultCapacity = 64 * 1024;
+
+		explicit RdpMessageSplitter(size_t capacity = DefaultCapacity)
+			: mBuffer(capacity < sizeof(RdpProtocolPacket) ? sizeof(RdpProtocolPacket) : capacity)
+		{}
+
+		// Free space for the next read. Moves any partial message to the front first, which invalidates
+		// the views of the last Split.
+		char* GetWriteBuffer(size_t& outSize)
+		{
+			if (mBegin != 0)
+			{
+				std::memmove(mBuffer.data(), mBuffer.data() + mBegin, mEnd - mBegin);
+				mEnd -= mBegin;
+				mBegin = 0;
+			}
+			outSize = mBuffer.size() - mEnd;
+			return mBuffer.data() + mEnd;
+		}
+
+		// Adds size bytes just read into the space GetWriteBuffer returned.
+		void Commit(size_t size)
+		{ mEnd += size; }
+
+		// Appends a view of every whole message buffered so far. Returns false on a malformed header,
+		// after which the stream can't be trusted any more.
+		bool Split(std::vector<RdpPacketView>& outPackets)
+		{
+			RdpPacketView view;
+			bool valid;
+			while ((valid = Next(view)) && view.mData != nullptr)
+			{
+				outPackets.push_back(view);
+			}
+			return valid;
+		}
+
+		// Takes the next whole message, or leaves outPacket.mData null if there is none yet. Returns
+		// false on a malformed header.
+		bool Next(RdpPacketView& outPacket)
+		{
+			outPacket.mData = nullptr;
+			outPacket.mSize = 0;
+
+			const size_t available = mEnd - mBegin;
+			if (available < sizeof(RdpProtocolHeader))
+			{
+				return true;
+			}
+
+			const char* data = mBuffer.data() + mBegin;
+			RdpProtocolPacket header;
+			std::memcpy(&header, data, sizeof(RdpProtocolHeader));
+			if (!header.IsValid())
+			{
+				return false;
+			}
+
+			const size_t size = header.mHeader.mMessageSize;
+			if (available >= size)
+			{
+				outPacket.mData = data;
+				outPacket.mSize = size;
+				mBegin += size;
+			}
+			return true;
+		}
+
+		// Bytes received but not handed out yet.
+		size_t GetBuffered() const
+		{ return mEnd - mBegin; }
+
+		void Reset()
+		{ mBegin = mEnd = 0; }
+
+	private:
+		std::vector<char> mBuffer;
+		size_t mBegin = 0;
+		size_t mEnd = 0;
+	};
+}
@@ -0,0 +1,272 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace RdpGamepad
+{
+	// Most samples one batch carries and the bytes available to encode them. At 1 kHz a batch sent every
+	// 16 ms needs about 9 bytes a sample, so both leave room for fast motion and late states.
+	static constexpr size_t MotionBatchCapacity = 48;
+	static constexpr size_t MotionDataCapacity = 512;
+
+	// Touchpad contacts a DualShock 4 tracks at once.
+	static constexpr size_t TouchPointCount = 2;
+
+#pragma pack(push)
+#pragma pack(1)
+
+	struct RdpTouchPoint
+	{
+		uint8_t             mDown;			// Non-zero while the finger is on the touchpad.
+		uint8_t             mId;			// Tracking number; changes with every new touch.
+		uint16_t            mX;				// 0 to 1919.
+		uint16_t            mY;				// 0 to 942.
+	};
+
+	// Motion samples as they go over the wire. The first sample's time is mTime. Every sample is then a
+	// varint holding how much the microseconds since the sample before it changed (left out for the first,
+	// a single zero byte while the sampler keeps its period) and one varint per axis holding the
+	// difference from the sample before it, starting from zero so a batch decodes on its own. Differences
+	// are zigzag encoded. mData comes last so messages can leave out the bytes it does not use.
+	struct RdpMotionBatch
+	{
+		uint32_t            mSequence;		// Number of the first sample since motion was enabled.
+		uint32_t            mTime;			// Microseconds of the first sample on the plugin's clock; wraps.
+		uint8_t             mCount;
+		uint16_t            mSize;			// Bytes of mData used.
+		RdpTouchPoint       mTouch[TouchPointCount];	// Touchpad contacts at the newest sample.
+		uint8_t             mData[MotionDataCapacity];
+	};
+
+#pragma pack(pop)
+
+	static constexpr size_t MotionBatchHeaderSize = offsetof(RdpMotionBatch, mData);
+
+	// One reading of the gyroscope and accelerometer in the DualShock 4's raw units.
+	struct RdpMotionSample
+	{
+		uint32_t            mTime;			// Microseconds on the plugin's clock; wraps.
+		int16_t             mGyro[3];
+		int16_t             mAccel[3];
+	};
+
+	namespace Motion
+	{
+		// Seven bits a byte, low bits first: a zigzag encoded axis difference takes at most 3 bytes.
+		inline bool PutVarint(uint8_t*& data, const uint8_t* end, uint32_t value)
+		{
+			while (value >= 0x80)
+			{
+				if (data == end)
+				{
+					return false;
+				}
+				*data++ = static_cast<uint8_t>(value | 0x80);
+				value >>= 7;
+			}
+			if (data == end)
+			{
+				return false;
+			}
+			*data++ = static_cast<uint8_t>(value);
+			return true;
+		}
+
+		// Returns false when the varint runs past end or is longer than 32 bits.
+		inline bool GetVarint(const uint8_t*& data, const uint8_t* end, uint32_t& outValue)
+		{
+			uint32_t value = 0;
+			for (unsigned int shift = 0; shift < 35; shift += 7)
+			{
+				if (data == end)
+				{
+					return false;
+				}
+				const uint8_t byte = *data++;
+				value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+				if ((byte & 0x80) == 0)
+				{
+					outValue = value;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		inline uint32_t ZigZag(int32_t value)
+		{ return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31); }
+
+		inline int32_t UnZigZag(uint32_t value)
+		{ return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1); }
+
+		// Encodes samples, oldest first, until the batch is full. Returns the number encoded.
+		inline size_t Encode(const RdpMotionSample* samples, size_t count, uint32_t sequence, RdpMotionBatch& outBatch)
+		{
+			outBatch.mSequence = sequence;
+			outBatch.mTime = (count != 0) ? samples[0].mTime : 0;
+			outBatch.mCount = 0;
+			outBatch.mSize = 0;
+
+			uint8_t* data = outBatch.mData;
+			const uint8_t* end = outBatch.mData + MotionDataCapacity;
+			RdpMotionSample previous = {};
+			uint32_t previousElapsed = 0;
+			size_t encoded = 0;
+			for (; encoded < count && encoded < MotionBatchCapacity; ++encoded)
+			{
+				const RdpMotionSample& sample = samples[encoded];
+				const uint32_t elapsed = (encoded == 0) ? 0 : sample.mTime - previous.mTime;
+				uint8_t* write = data;
+				bool fits = (encoded == 0) || PutVarint(write, end, ZigZag(static_cast<int32_t>(elapsed - previousElapsed)));
+				for (int axis = 0; axis < 3 && fits; ++axis)
+				{
+					fits = PutVarint(write, end, ZigZag(int32_t(sample.mGyro[axis]) - previous.mGyro[axis])) &&
+						PutVarint(write, end, ZigZag(int32_t(sample.mAccel[axis]) - previous.mAccel[axis]));
+				}
+				if (!fits)
+				{
+					break;
+				}
+				data = write;
+				previous = sample;
+				previousElapsed = elapsed;
+			}
+			outBatch.mCount = static_cast<uint8_t>(encoded);
+			outBatch.mSize = static_cast<uint16_t>(data - outBatch.mData);
+			return encoded;
+		}
+
+		// Decodes a batch whose mData holds size bytes. Returns the number of samples, or 0 if the batch
+		// is malformed.
+		inline size_t Decode(const RdpMotionBatch& batch, size_t size, RdpMotionSample (&outSamples)[MotionBatchCapacity])
+		{
+			if (batch.mCount > MotionBatchCapacity || batch.mSize > size || batch.mSize > MotionDataCapacity)
+			{
+				return 0;
+			}
+
+			const uint8_t* data = batch.mData;
+			const uint8_t* end = batch.mData + batch.mSize;
+			RdpMotionSample previous = {};
+			previous.mTime = batch.mTime;
+			uint32_t elapsed = 0;
+			for (size_t i = 0; i < batch.mCount; ++i)
+			{
+				RdpMotionSample& sample = outSamples[i];
+				uint32_t value = 0;
+				if (i != 0)
+				{
+					if (!GetVarint(data, end, value))
+					{
+						return 0;
+					}
+					elapsed += static_cast<uint32_t>(UnZigZag(value));
+				}
+				sample.mTime = previous.mTime + elapsed;
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					uint32_t gyro;
+					uint32_t accel;
+					if (!GetVarint(data, end, gyro) || !GetVarint(data, end, accel))
+					{
+						return 0;
+					}
+					sample.mGyro[axis] = static_cast<int16_t>(previous.mGyro[axis] + UnZigZag(gyro));
+					sample.mAccel[axis] = static_cast<int16_t>(previous.mAccel[axis] + UnZigZag(accel));
+				}
+				previous = sample;
+			}
+			return (data == end) ? batch.mCount : 0;
+		}
+	}
+
+	// Keeps the motion samples taken between two states until they are sent. Sample and Take may be
+	// called from different threads. When more are waiting than fit the oldest are dropped, which the
+	// receiver sees as a gap in the sequence numbers.
+	class RdpMotionRecorder
+	{
+	public:
+		static constexpr size_t Capacity = 256;
+
+		void Sample(const RdpMotionSample& sample, const RdpTouchPoint (&touch)[TouchPointCount])
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (mCount == Capacity)
+			{
+				mHead = (mHead + 1) % Capacity;
+				--mCount;
+				++mSequence;
+				++mDropped;
+			}
+			mSamples[(mHead + mCount) % Capacity] = sample;
+			++mCount;
+			for (size_t i = 0; i < TouchPointCount; ++i)
+			{
+				mTouch[i] = touch[i];
+			}
+		}
+
+		// Moves the oldest waiting samples that fit into outBatch. False if none were waiting.
+		bool Take(RdpMotionBatch& outBatch)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (mCount == 0)
+			{
+				return false;
+			}
+
+			// Encode needs the samples in one piece.
+			RdpMotionSample samples[MotionBatchCapacity];
+			const size_t count = (mCount < MotionBatchCapacity) ? mCount : MotionBatchCapacity;
+			for (size_t i = 0; i < count; ++i)
+			{
+				samples[i] = mSamples[(mHead + i) % Capacity];
+			}
+			const size_t encoded = Motion::Encode(samples, count, mSequence, outBatch);
+			for (size_t i = 0; i < TouchPointCount; ++i)
+			{
+				outBatch.mTouch[i] = mTouch[i];
+			}
+			mHead = (mHead + encoded) % Capacity;
+			mCount -= encoded;
+			mSequence += static_cast<uint32_t>(encoded);
+			return true;
+		}
+
+		size_t GetPendingCount()
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			return mCount;
+		}
+
+		void Reset()
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mHead = 0;
+			mCount = 0;
+			mSequence = 0;
+			for (size_t i = 0; i < TouchPointCount; ++i)
+			{
+				mTouch[i] = RdpTouchPoint{};
+			}
+		}
+
+		// Samples dropped because they were not sent in time.
+		uint64_t GetDroppedCount() const
+		{ return mDropped; }
+
+	private:
+		std::mutex mMutex;
+		RdpMotionSample mSamples[Capacity];
+		RdpTouchPoint mTouch[TouchPointCount] = {};
+		size_t mHead = 0;
+		size_t mCount = 0;
+		uint32_t mSequence = 0;
+		uint64_t mDropped = 0;
+	};
+}
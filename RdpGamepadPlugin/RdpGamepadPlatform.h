@@ -0,0 +1,90 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+// The protocol is described with Win32 and XInput types. Windows builds take them from the SDK. Other
+// platforms only see the protocol through test and benchmark tools, and get definitions with the same
+// sizes and layouts here.
+
+#if defined(_WIN32)
+
+#include <windows.h>
+#include <Xinput.h>
+
+#else
+
+#include <cstdint>
+
+typedef uint8_t             BYTE;
+typedef uint8_t             UINT8;
+typedef uint16_t            WORD;
+typedef uint16_t            UINT16;
+typedef int16_t             SHORT;
+typedef uint32_t            DWORD;
+typedef int32_t             HRESULT;
+
+#define SEVERITY_ERROR      1
+#define FACILITY_ITF        4
+#define MAKE_HRESULT(sev, fac, code) \
+	((HRESULT)(((uint32_t)(sev) << 31) | ((uint32_t)(fac) << 16) | ((uint32_t)(code))))
+#define SUCCEEDED(hr)       (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)          (((HRESULT)(hr)) < 0)
+
+#define S_OK                ((HRESULT)0)
+#define E_FAIL              ((HRESULT)0x80004005)
+#define ERROR_SUCCESS       0
+#define ERROR_DEVICE_NOT_CONNECTED 1167
+
+#define XINPUT_GAMEPAD_DPAD_UP          0x0001
+#define XINPUT_GAMEPAD_DPAD_DOWN        0x0002
+#define XINPUT_GAMEPAD_DPAD_LEFT        0x0004
+#define XINPUT_GAMEPAD_DPAD_RIGHT       0x0008
+#define XINPUT_GAMEPAD_START            0x0010
+#define XINPUT_GAMEPAD_BACK             0x0020
+#define XINPUT_GAMEPAD_LEFT_THUMB       0x0040
+#define XINPUT_GAMEPAD_RIGHT_THUMB      0x0080
+#define XINPUT_GAMEPAD_LEFT_SHOULDER    0x0100
+#define XINPUT_GAMEPAD_RIGHT_SHOULDER   0x0200
+#define XINPUT_GAMEPAD_A                0x1000
+#define XINPUT_GAMEPAD_B                0x2000
+#define XINPUT_GAMEPAD_X                0x4000
+#define XINPUT_GAMEPAD_Y                0x8000
+
+#define XINPUT_GAMEPAD_TRIGGER_THRESHOLD 30
+
+struct XINPUT_GAMEPAD
+{
+	WORD                wButtons;
+	BYTE                bLeftTrigger;
+	BYTE                bRightTrigger;
+	SHORT               sThumbLX;
+	SHORT               sThumbLY;
+	SHORT               sThumbRX;
+	SHORT               sThumbRY;
+};
+
+struct XINPUT_STATE
+{
+	DWORD               dwPacketNumber;
+	XINPUT_GAMEPAD      Gamepad;
+};
+
+struct XINPUT_VIBRATION
+{
+	WORD                wLeftMotorSpeed;
+	WORD                wRightMotorSpeed;
+};
+
+struct XINPUT_CAPABILITIES
+{
+	BYTE                Type;
+	BYTE                SubType;
+	WORD                Flags;
+	XINPUT_GAMEPAD      Gamepad;
+	XINPUT_VIBRATION    Vibration;
+};
+
+static_assert(sizeof(XINPUT_GAMEPAD) == 12 && sizeof(XINPUT_STATE) == 16 && sizeof(XINPUT_CAPABILITIES) == 20, "XInput types must match the Windows SDK");
+
+#endif
@@ -25,14 +25,100 @@ CRdpGamepadChannel::RdpProtocolHandlerFunction CRdpGamepadChannel::sProtocolHand
 	&CRdpGamepadChannel::HandleSetStateDS4,			// SetStateRequestDS4,
 	nullptr,										// GetStateResponseDS4,
 	nullptr,										// SetStateResponseDS4,
+	&CRdpGamepadChannel::HandleSetFeedback,			// SetFeedbackRequest,
+	nullptr,										// SetFeedbackResponse,
+	&CRdpGamepadChannel::HandleGetLatency,			// GetLatencyRequest,
+	nullptr,										// GetLatencyResponse,
+	&CRdpGamepadChannel::HandleSetButtonEvents,		// SetButtonEventsRequest,
+	nullptr,										// ButtonEventsResponse,
+	&CRdpGamepadChannel::HandleSetMotion,			// SetMotionRequest,
+	nullptr,										// MotionResponse,
+	&CRdpGamepadChannel::HandleSetRateControl,		// SetRateControlRequest,
+	&CRdpGamepadChannel::HandleRateProbe,			// RateProbe,
 };
 
+namespace
+{
+	const std::chrono::milliseconds kPollInterval(1000 / 30);
+
+	// Sampling buttons or motion faster than this only burns CPU; controllers report at 1 kHz at best.
+	const std::chrono::microseconds kMinSamplePeriod(250);
+
+	// PlayStation player colors, shown on the light bar when the host sets a player LED but no color.
+	const PadColor kPlayerColors[] =
+	{
+		{ 0x00, 0x00, 0x40 },
+		{ 0x40, 0x00, 0x00 },
+		{ 0x00, 0x40, 0x00 },
+		{ 0x20, 0x00, 0x20 },
+	};
+
+	uint32_t GetDigital(const PadState& state)
+	{
+		return state.Buttons | (uint32_t(state.SpecialButtons) << 16);
+	}
+
+	// Sticks and triggers on the rate controller's common scale.
+	void GetAnalog(const XINPUT_GAMEPAD& gamepad, uint16_t (&outAnalog)[RdpGamepad::RateAnalogCount])
+	{
+		outAnalog[0] = static_cast<uint16_t>(gamepad.sThumbLX + 32768);
+		outAnalog[1] = static_cast<uint16_t>(gamepad.sThumbLY + 32768);
+		outAnalog[2] = static_cast<uint16_t>(gamepad.sThumbRX + 32768);
+		outAnalog[3] = static_cast<uint16_t>(gamepad.sThumbRY + 32768);
+		outAnalog[4] = static_cast<uint16_t>(gamepad.bLeftTrigger * 257);
+		outAnalog[5] = static_cast<uint16_t>(gamepad.bRightTrigger * 257);
+	}
+
+	void GetAnalog(const PadState& state, uint16_t (&outAnalog)[RdpGamepad::RateAnalogCount])
+	{
+		outAnalog[0] = static_cast<uint16_t>(state.StickL.X * 257);
+		outAnalog[1] = static_cast<uint16_t>(state.StickL.Y * 257);
+		outAnalog[2] = static_cast<uint16_t>(state.StickR.X * 257);
+		outAnalog[3] = static_cast<uint16_t>(state.StickR.Y * 257);
+		outAnalog[4] = static_cast<uint16_t>(state.AnalogButtons.L2 * 257);
+		outAnalog[5] = static_cast<uint16_t>(state.AnalogButtons.R2 * 257);
+	}
+
+	void GetMotion(const PadState& state, uint64_t sampleTime, RdpGamepad::RdpMotionSample& outSample, RdpGamepad::RdpTouchPoint (&outTouch)[RdpGamepad::TouchPointCount])
+	{
+		outSample.mTime = static_cast<uint32_t>(sampleTime / 1000);
+		outSample.mGyro[0] = state.Gyro.X;
+		outSample.mGyro[1] = state.Gyro.Y;
+		outSample.mGyro[2] = state.Gyro.Z;
+		outSample.mAccel[0] = state.Accel.X;
+		outSample.mAccel[1] = state.Accel.Y;
+		outSample.mAccel[2] = state.Accel.Z;
+		for (size_t i = 0; i < RdpGamepad::TouchPointCount; ++i)
+		{
+			outTouch[i].mDown = state.Touch[i].Active ? 1 : 0;
+			outTouch[i].mId = state.Touch[i].Id;
+			outTouch[i].mX = state.Touch[i].X;
+			outTouch[i].mY = state.Touch[i].Y;
+		}
+	}
+
+	// Plain waitable timers only fire at the system timer resolution, often 15.6 ms.
+	HANDLE CreateSampleTimer()
+	{
+		HANDLE timer = nullptr;
+#ifdef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+		timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+#endif
+		if (timer == nullptr)
+		{
+			timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+		}
+		return timer;
+	}
+}
+
 //////////////////////////////////////////////////////////////////////////
 // IWTSPlugin
 
 HRESULT CRdpGamepadPlugin::Initialize(IWTSVirtualChannelManager* pChannelMgr)
 {
 	TimerManager::Get().Initialize();
+	StartTransportListener();
 	HRESULT hr = pChannelMgr->CreateListener(RDPGAMEPAD_VIRTUAL_CHANNEL_NAME, 0, this, &mListener);
 	return hr;
 }
@@ -49,6 +135,7 @@ HRESULT CRdpGamepadPlugin::Disconnected(DWORD dwDisconnectCode)
 
 HRESULT CRdpGamepadPlugin::Terminated()
 {
+	StopTransportListener();
 	TimerManager::Get().Terminate();
 	return S_OK;
 }
@@ -78,6 +165,76 @@ HRESULT CRdpGamepadPlugin::OnNewChannelConnection(IWTSVirtualChannel* pChannel,
 	return hr;
 }
 
+void CRdpGamepadPlugin::StartTransportListener()
+{
+	// Setting RDPGAMEPAD_LISTEN to a socket or shared memory address also serves receivers connecting
+	// there, for setups that carry the protocol without the RDP virtual channel.
+	char address[MAX_PATH];
+	const DWORD length = GetEnvironmentVariableA("RDPGAMEPAD_LISTEN", address, ARRAYSIZE(address));
+	if (length == 0 || length >= ARRAYSIZE(address))
+	{
+		return;
+	}
+
+	mTransportRunning = true;
+	mTransportThread = std::thread(&CRdpGamepadPlugin::RunTransportListener, this, std::string(address));
+}
+
+void CRdpGamepadPlugin::StopTransportListener()
+{
+	if (mTransportThread.joinable())
+	{
+		mTransportRunning = false;
+		mTransportThread.join();
+	}
+}
+
+void CRdpGamepadPlugin::RunTransportListener(std::string address)
+{
+	// Receivers are served one at a time on this thread, each by its own channel object.
+	auto serve = [this](auto& transport)
+	{
+		CComObject<CRdpGamepadChannel>* endPoint;
+		if (SUCCEEDED(CComObject<CRdpGamepadChannel>::CreateInstance(&endPoint)))
+		{
+			endPoint->AddRef();
+			endPoint->ServeTransport(transport, mTransportRunning);
+			endPoint->Release();
+		}
+	};
+
+	if (address.compare(0, 4, "shm:") == 0)
+	{
+		// A region serves a single receiver, so each one gets a fresh region under the same name.
+		while (mTransportRunning)
+		{
+			std::unique_ptr<RdpGamepad::RdpGamepadSharedMemoryTransport> transport = RdpGamepad::RdpGamepadSharedMemoryTransport::Create(address.substr(4));
+			if (!transport)
+			{
+				return;
+			}
+			serve(*transport);
+		}
+		return;
+	}
+
+	RdpGamepad::RdpSocketAddress socketAddress;
+	RdpGamepad::RdpGamepadSocketListener listener;
+	if (!socketAddress.Parse(address) || !listener.Listen(socketAddress))
+	{
+		return;
+	}
+
+	while (mTransportRunning)
+	{
+		std::unique_ptr<RdpGamepad::RdpGamepadSocketTransport> transport = listener.Accept(250);
+		if (transport)
+		{
+			serve(*transport);
+		}
+	}
+}
+
 //////////////////////////////////////////////////////////////////////////
 // IWTSVirtualChannelCallback
 
@@ -85,7 +242,7 @@ HRESULT CRdpGamepadChannel::OnDataReceived(ULONG cbSize, BYTE* pBuffer)
 {
 	static_assert(array_size(sProtocolHandlers) == RdpGamepad::RdpMessageType::MessageTypeCount, "sProtocolHandlers has incorrect number of elements.");
 
-	if (cbSize < sizeof(RdpGamepad::RdpProtocolHeader))
+	if (cbSize < sizeof(RdpGamepad::RdpProtocolHeader) || cbSize > sizeof(RdpGamepad::RdpProtocolPacket))
 	{
 		return RdpGamepad::RDPGAMEPAD_E_PROTOCOL;
 	}
@@ -114,6 +271,63 @@ HRESULT CRdpGamepadChannel::OnClose()
 {
 	TimerManager::Get().ClearTimer(mTimerPoll);
 	TimerManager::Get().ClearTimer(mTimerPollTimeout);
+	StopButtonSampler();
+	StopMotionSampler();
+	mRate.Disable();
+	return S_OK;
+}
+
+template <typename TRANSPORT>
+void CRdpGamepadChannel::ServeTransport(TRANSPORT& transport, const std::atomic<bool>& keepRunning)
+{
+	{
+		std::lock_guard<std::mutex> lock(mTransportMutex);
+		mTransport = &transport;
+	}
+
+	RdpGamepad::RdpProtocolPacket packet;
+	while (keepRunning)
+	{
+		bool received;
+		bool open;
+		{
+			std::lock_guard<std::mutex> lock(mTransportMutex);
+			received = transport.Receive(&packet);
+			open = transport.IsOpen();
+		}
+
+		if (received)
+		{
+			OnDataReceived(packet.mHeader.mMessageSize, reinterpret_cast<BYTE*>(&packet));
+		}
+		else if (!open)
+		{
+			break;
+		}
+		else
+		{
+			transport.WaitReadable(250);
+		}
+	}
+
+	OnClose();
+	std::lock_guard<std::mutex> lock(mTransportMutex);
+	mTransport = nullptr;
+}
+
+HRESULT CRdpGamepadChannel::Send(const RdpGamepad::RdpProtocolHeader& msg)
+{
+	if (mChannel)
+	{
+		return mChannel->Write(msg.mMessageSize, reinterpret_cast<BYTE*>(const_cast<RdpGamepad::RdpProtocolHeader*>(&msg)), nullptr);
+	}
+
+	// Poll timer callbacks send from the timer thread while the socket thread answers requests.
+	std::lock_guard<std::mutex> lock(mTransportMutex);
+	if (mTransport == nullptr || !mTransport->Send(msg))
+	{
+		return E_FAIL;
+	}
 	return S_OK;
 }
 
@@ -132,7 +346,9 @@ HRESULT CRdpGamepadChannel::HandlePollState(const RdpGamepad::RdpProtocolPacket&
 	if (SUCCEEDED(hr))
 	{
 		DWORD dwUserIndex = request.mUserIndex;
-		TimerManager::Get().SetTimer(mTimerPoll, [dwUserIndex, this]() { SendControllerState(dwUserIndex); }, std::chrono::seconds(1) / 30, true);
+		mLastPollTime = 0;
+		mPollInterval = GetPollInterval();
+		TimerManager::Get().SetTimer(mTimerPoll, [dwUserIndex, this]() { RecordPollTick(); SendControllerState(dwUserIndex); }, mPollInterval, true);
 		TimerManager::Get().SetTimer(mTimerPollTimeout, [this]() { TimerManager::Get().ClearTimer(mTimerPoll); }, std::chrono::seconds(2), false);
 	}
 
@@ -146,7 +362,7 @@ HRESULT CRdpGamepadChannel::HandleSetState(const RdpGamepad::RdpProtocolPacket&
 	DWORD result = ThunkXInputSetState(request.mUserIndex, const_cast<XINPUT_VIBRATION*>(&request.mVibration));
 
 	auto response = RdpGamepad::RdpSetStateResponse::MakeResponse(request.mUserIndex, result);
-	return mChannel->Write(sizeof(response), reinterpret_cast<BYTE*>(&response), nullptr);
+	return Send(response);
 }
 
 HRESULT CRdpGamepadChannel::HandleGetCapabilities(const RdpGamepad::RdpProtocolPacket& packet)
@@ -157,16 +373,38 @@ HRESULT CRdpGamepadChannel::HandleGetCapabilities(const RdpGamepad::RdpProtocolP
 	DWORD result = ThunkXInputGetCapabilities(request.mUserIndex, request.mFlags, &capabilities);
 
 	auto response = RdpGamepad::RdpGetCapabilitiesResponse::MakeResponse(request.mUserIndex, result, capabilities);
-	return mChannel->Write(sizeof(response), reinterpret_cast<BYTE*>(&response), nullptr);
+	return Send(response);
 }
 
 HRESULT CRdpGamepadChannel::SendControllerState(DWORD dwUserIndex)
 {
+	const uint64_t sampleTime = RdpGamepad::RdpLatencyClock::Now();
 	XINPUT_STATE state;
 	DWORD result = ThunkXInputGetState(dwUserIndex, &state);
 
+	const uint64_t encodeTime = RdpGamepad::RdpLatencyClock::Now();
 	auto response = RdpGamepad::RdpGetStateResponse::MakeResponse(dwUserIndex, result, state);
-	return mChannel->Write(sizeof(response), reinterpret_cast<BYTE*>(&response), nullptr);
+	if (result == ERROR_SUCCESS)
+	{
+		const HRESULT edges = SendButtonEvents(dwUserIndex, RdpGamepad::ButtonSourceXInput, sampleTime, state.Gamepad.wButtons);
+		uint16_t analog[RdpGamepad::RateAnalogCount];
+		GetAnalog(state.Gamepad, analog);
+		if (!AdmitState(dwUserIndex, sampleTime, state.Gamepad.wButtons, analog, edges == S_OK))
+		{
+			return S_OK;
+		}
+		mTrace.Record(RdpGamepad::TraceSourcePlugin, RdpGamepad::TraceKindXInput, sampleTime, state.Gamepad);
+	}
+
+	const uint64_t writeTime = RdpGamepad::RdpLatencyClock::Now();
+	HRESULT hr = Send(response);
+	const uint64_t writtenTime = RdpGamepad::RdpLatencyClock::Now();
+
+	mLatency.Record(RdpGamepad::LatencySample, sampleTime, encodeTime);
+	mLatency.Record(RdpGamepad::LatencyEncode, encodeTime, writeTime);
+	mLatency.Record(RdpGamepad::LatencyWrite, writeTime, writtenTime);
+	mRate.OnWrite((writtenTime - writeTime) / 1000);
+	return hr;
 }
 
 
@@ -185,7 +423,9 @@ HRESULT CRdpGamepadChannel::HandlePollStateDS4(const RdpGamepad::RdpProtocolPack
 	if (SUCCEEDED(hr))
 	{
 		DWORD dwUserIndex = request.mUserIndex;
-		TimerManager::Get().SetTimer(mTimerPoll, [dwUserIndex, this]() { SendControllerState(dwUserIndex); }, std::chrono::seconds(1) / 30, true);
+		mLastPollTime = 0;
+		mPollInterval = GetPollInterval();
+		TimerManager::Get().SetTimer(mTimerPoll, [dwUserIndex, this]() { RecordPollTick(); SendControllerState(dwUserIndex); }, mPollInterval, true);
 		TimerManager::Get().SetTimer(mTimerPollTimeout, [this]() { TimerManager::Get().ClearTimer(mTimerPoll); }, std::chrono::seconds(2), false);
 	}
 
@@ -200,15 +440,321 @@ HRESULT CRdpGamepadChannel::HandleSetStateDS4(const RdpGamepad::RdpProtocolPacke
 	DWORD result = (ret) ? S_OK : E_FAIL;
 
 	auto response = RdpGamepad::RdpSetStateResponseDS4::MakeResponse(request.mUserIndex, result);
-	return mChannel->Write(sizeof(response), reinterpret_cast<BYTE*>(&response), nullptr);
+	return Send(response);
 }
 
 HRESULT CRdpGamepadChannel::SendControllerStateDS4(DWORD dwUserIndex)
 {
+	const uint64_t sampleTime = RdpGamepad::RdpLatencyClock::Now();
 	PadState state;
-	auto ret = PadGetState(state);
+	bool ret;
+	{
+		std::lock_guard<std::mutex> lock(mPadMutex);
+		ret = PadGetState(state);
+	}
 	DWORD result = (ret) ? S_OK : E_FAIL;
 
+	const uint64_t encodeTime = RdpGamepad::RdpLatencyClock::Now();
 	auto response = RdpGamepad::RdpGetStateResponseDS4::MakeResponse(dwUserIndex, result, state);
-	return mChannel->Write(sizeof(response), reinterpret_cast<BYTE*>(&response), nullptr);
-}
\ No newline at end of file
+	if (ret)
+	{
+		const HRESULT edges = SendButtonEvents(dwUserIndex, RdpGamepad::ButtonSourceDS4, sampleTime, GetDigital(state));
+
+		// The sampler's motion goes out with every state read, sent or not, or the recorder would overflow
+		// while the sticks are still.
+		SendMotion(dwUserIndex);
+		uint16_t analog[RdpGamepad::RateAnalogCount];
+		GetAnalog(state, analog);
+		if (!AdmitState(dwUserIndex, sampleTime, GetDigital(state), analog, edges == S_OK))
+		{
+			return S_OK;
+		}
+		mTrace.Record(RdpGamepad::TraceSourcePlugin, RdpGamepad::TraceKindDS4, sampleTime, state);
+	}
+
+	const uint64_t writeTime = RdpGamepad::RdpLatencyClock::Now();
+	HRESULT hr = Send(response);
+	const uint64_t writtenTime = RdpGamepad::RdpLatencyClock::Now();
+
+	mLatency.Record(RdpGamepad::LatencySample, sampleTime, encodeTime);
+	mLatency.Record(RdpGamepad::LatencyEncode, encodeTime, writeTime);
+	mLatency.Record(RdpGamepad::LatencyWrite, writeTime, writtenTime);
+	mRate.OnWrite((writtenTime - writeTime) / 1000);
+	return hr;
+}
+
+HRESULT CRdpGamepadChannel::HandleSetFeedback(const RdpGamepad::RdpProtocolPacket& packet)
+{
+	const auto& request = packet.mSetFeedbackRequest;
+	const auto& feedback = request.mFeedback;
+
+	DWORD result = ERROR_SUCCESS;
+	if (request.mTarget == RdpGamepad::RdpFeedbackTarget::FeedbackTargetDS4)
+	{
+		bool ret = true;
+		if (feedback.mFlags & RdpGamepad::FeedbackRumble)
+		{
+			PadVibrationParam vibration;
+			vibration.LargeMotor = uint8_t(feedback.mLargeMotor >> 8);
+			vibration.SmallMotor = uint8_t(feedback.mSmallMotor >> 8);
+			ret = PadSetVibration(vibration) && ret;
+		}
+		if (feedback.mFlags & RdpGamepad::FeedbackLightBar)
+		{
+			PadColor color;
+			color.R = feedback.mLightBarR;
+			color.G = feedback.mLightBarG;
+			color.B = feedback.mLightBarB;
+			ret = PadSetLightBarColor(color) && ret;
+		}
+		else if (feedback.mFlags & RdpGamepad::FeedbackPlayerLed)
+		{
+			ret = PadSetLightBarColor(kPlayerColors[feedback.mPlayerLed % array_size(kPlayerColors)]) && ret;
+		}
+		result = (ret) ? S_OK : E_FAIL;
+	}
+	else if (feedback.mFlags & RdpGamepad::FeedbackRumble)
+	{
+		// XInput has no way to set the light bar or the player LED.
+		XINPUT_VIBRATION vibration;
+		vibration.wLeftMotorSpeed  = feedback.mLargeMotor;
+		vibration.wRightMotorSpeed = feedback.mSmallMotor;
+		result = ThunkXInputSetState(request.mUserIndex, &vibration);
+	}
+
+	auto response = RdpGamepad::RdpSetFeedbackResponse::MakeResponse(request.mUserIndex, result);
+	return Send(response);
+}
+
+HRESULT CRdpGamepadChannel::HandleGetLatency(const RdpGamepad::RdpProtocolPacket& packet)
+{
+	const auto& request = packet.mGetLatencyRequest;
+
+	RdpGamepad::RdpLatencySummary stages[RdpGamepad::LatencyStageCount];
+	mLatency.Summarize(stages);
+
+	auto response = RdpGamepad::RdpGetLatencyResponse::MakeResponse(request.mUserIndex, stages);
+	return Send(response);
+}
+
+HRESULT CRdpGamepadChannel::HandleSetButtonEvents(const RdpGamepad::RdpProtocolPacket& packet)
+{
+	const auto& request = packet.mSetButtonEventsRequest;
+
+	StopButtonSampler();
+	mButtonEdges.Reset();
+	if (request.mSamplePeriod == 0 || request.mSource > RdpGamepad::ButtonSourceDS4)
+	{
+		return S_OK;
+	}
+
+	const std::chrono::microseconds period(request.mSamplePeriod);
+	mButtonSource = static_cast<RdpGamepad::RdpButtonEventSource>(request.mSource);
+	mButtonEvents = true;
+	mButtonSampling = true;
+	mButtonSampler = std::thread(&CRdpGamepadChannel::RunButtonSampler, this, request.mUserIndex, mButtonSource,
+		(period > kMinSamplePeriod) ? period : kMinSamplePeriod);
+	return S_OK;
+}
+
+HRESULT CRdpGamepadChannel::SendButtonEvents(DWORD dwUserIndex, RdpGamepad::RdpButtonEventSource source, uint64_t sampleTime, uint32_t digital)
+{
+	if (!mButtonEvents || mButtonSource != source)
+	{
+		return S_FALSE;
+	}
+
+	mButtonEdges.Sample(sampleTime, digital);
+	RdpGamepad::RdpButtonEdge edges[RdpGamepad::ButtonEdgeCapacity];
+	const size_t count = mButtonEdges.Take(RdpGamepad::RdpLatencyClock::Now(), edges);
+	if (count == 0)
+	{
+		return S_FALSE;
+	}
+	return Send(RdpGamepad::RdpButtonEventsResponse::MakeResponse(dwUserIndex, source, edges, count));
+}
+
+void CRdpGamepadChannel::RunButtonSampler(DWORD dwUserIndex, RdpGamepad::RdpButtonEventSource source, std::chrono::microseconds period)
+{
+	HANDLE timer = CreateSampleTimer();
+	if (timer == nullptr)
+	{
+		return;
+	}
+
+	LARGE_INTEGER dueTime;
+	dueTime.QuadPart = -10 * static_cast<LONGLONG>(period.count());
+	while (mButtonSampling)
+	{
+		SetWaitableTimer(timer, &dueTime, 0, nullptr, nullptr, FALSE);
+		WaitForSingleObject(timer, INFINITE);
+
+		const uint64_t sampleTime = RdpGamepad::RdpLatencyClock::Now();
+		if (source == RdpGamepad::ButtonSourceXInput)
+		{
+			XINPUT_STATE state;
+			if (ThunkXInputGetState(dwUserIndex, &state) == ERROR_SUCCESS)
+			{
+				mButtonEdges.Sample(sampleTime, state.Gamepad.wButtons);
+			}
+		}
+		else
+		{
+			PadState state;
+			std::lock_guard<std::mutex> lock(mPadMutex);
+			if (PadGetState(state))
+			{
+				mButtonEdges.Sample(sampleTime, GetDigital(state));
+			}
+		}
+	}
+	CloseHandle(timer);
+}
+
+void CRdpGamepadChannel::StopButtonSampler()
+{
+	mButtonEvents = false;
+	mButtonSampling = false;
+	if (mButtonSampler.joinable())
+	{
+		mButtonSampler.join();
+	}
+}
+
+HRESULT CRdpGamepadChannel::HandleSetMotion(const RdpGamepad::RdpProtocolPacket& packet)
+{
+	const auto& request = packet.mSetMotionRequest;
+
+	StopMotionSampler();
+	mMotion.Reset();
+	if (request.mSamplePeriod == 0)
+	{
+		return S_OK;
+	}
+
+	const std::chrono::microseconds period(request.mSamplePeriod);
+	mMotionEnabled = true;
+	mMotionSampling = true;
+	mMotionSampler = std::thread(&CRdpGamepadChannel::RunMotionSampler, this,
+		(period > kMinSamplePeriod) ? period : kMinSamplePeriod);
+	return S_OK;
+}
+
+HRESULT CRdpGamepadChannel::SendMotion(DWORD dwUserIndex)
+{
+	if (!mMotionEnabled)
+	{
+		return S_OK;
+	}
+
+	// Only the sampler records, so samples reach the recorder in time order. A batch holds about 50 ms of
+	// samples at 1 kHz; states are usually asked for more often than that.
+	RdpGamepad::RdpMotionBatch batch;
+	while (mMotion.Take(batch))
+	{
+		HRESULT hr = Send(RdpGamepad::RdpMotionResponse::MakeResponse(dwUserIndex, batch));
+		if (FAILED(hr))
+		{
+			return hr;
+		}
+	}
+	return S_OK;
+}
+
+void CRdpGamepadChannel::RunMotionSampler(std::chrono::microseconds period)
+{
+	HANDLE timer = CreateSampleTimer();
+	if (timer == nullptr)
+	{
+		return;
+	}
+
+	LARGE_INTEGER dueTime;
+	dueTime.QuadPart = -10 * static_cast<LONGLONG>(period.count());
+	while (mMotionSampling)
+	{
+		SetWaitableTimer(timer, &dueTime, 0, nullptr, nullptr, FALSE);
+		WaitForSingleObject(timer, INFINITE);
+
+		// The time is read under the lock so it matches the state read with it.
+		PadState state;
+		std::lock_guard<std::mutex> lock(mPadMutex);
+		const uint64_t sampleTime = RdpGamepad::RdpLatencyClock::Now();
+		if (PadGetState(state))
+		{
+			RdpGamepad::RdpMotionSample sample;
+			RdpGamepad::RdpTouchPoint touch[RdpGamepad::TouchPointCount];
+			GetMotion(state, sampleTime, sample, touch);
+			mMotion.Sample(sample, touch);
+		}
+	}
+	CloseHandle(timer);
+}
+
+void CRdpGamepadChannel::StopMotionSampler()
+{
+	mMotionEnabled = false;
+	mMotionSampling = false;
+	if (mMotionSampler.joinable())
+	{
+		mMotionSampler.join();
+	}
+}
+
+HRESULT CRdpGamepadChannel::HandleSetRateControl(const RdpGamepad::RdpProtocolPacket& packet)
+{
+	const auto& request = packet.mSetRateControlRequest;
+
+	mRate.Configure(request.mLimits);
+	return S_OK;
+}
+
+HRESULT CRdpGamepadChannel::HandleRateProbe(const RdpGamepad::RdpProtocolPacket& packet)
+{
+	mRate.OnProbe(RdpGamepad::RdpLatencyClock::Now() / 1000, packet.mRateProbe.mTime);
+	return S_OK;
+}
+
+bool CRdpGamepadChannel::AdmitState(DWORD dwUserIndex, uint64_t sampleTime, uint32_t digital, const uint16_t (&analog)[RdpGamepad::RateAnalogCount], bool force)
+{
+	uint32_t probeTime;
+	if (mRate.TakeProbe(sampleTime / 1000, probeTime))
+	{
+		Send(RdpGamepad::RdpRateProbe::MakeProbe(dwUserIndex, probeTime));
+	}
+	return mRate.Admit(sampleTime / 1000, digital, analog, force);
+}
+
+std::chrono::milliseconds CRdpGamepadChannel::GetPollInterval()
+{
+	// With rate control the timer runs at the shortest interval allowed and the controller picks which
+	// of the states read there go out.
+	if (!mRate.IsEnabled())
+	{
+		return kPollInterval;
+	}
+	const std::chrono::milliseconds interval(mRate.GetMinInterval() / 1000);
+	return (interval.count() != 0) ? interval : std::chrono::milliseconds(1);
+}
+
+void CRdpGamepadChannel::RecordPollTick()
+{
+	const uint64_t now = RdpGamepad::RdpLatencyClock::Now();
+	if (mLastPollTime != 0)
+	{
+		const uint64_t interval = std::chrono::duration_cast<std::chrono::nanoseconds>(mPollInterval).count();
+		mLatency.Record(RdpGamepad::LatencyTimerLateness, mLastPollTime + interval, now);
+	}
+	mLastPollTime = now;
+}
+
+void CRdpGamepadChannel::StartTrace()
+{
+	// Setting RDPGAMEPAD_TRACE to a file path records every controller state sent to the host.
+	wchar_t path[MAX_PATH];
+	const DWORD length = GetEnvironmentVariableW(L"RDPGAMEPAD_TRACE", path, ARRAYSIZE(path));
+	if (length != 0 && length < ARRAYSIZE(path))
+	{
+		mTrace.Start(path);
+	}
+}
@@ -6,6 +6,9 @@
 #include "resource.h"
 #include "RdpGamepadPlugin_i.h"
 #include "RdpGamepadProtocol.h"
+#include "RdpGamepadSharedMemoryTransport.h"
+#include "RdpGamepadSocketTransport.h"
+#include "RdpGamepadTrace.h"
 #include "TimerManager.h"
 #include "ds4_pad.h"
 
@@ -30,11 +33,14 @@ public:
 
 	HRESULT FinalConstruct()
 	{
+		StartTrace();
 		return S_OK;
 	}
 
 	void FinalRelease()
 	{
+		StopButtonSampler();
+		StopMotionSampler();
 	}
 
 public:
@@ -47,7 +53,14 @@ public:
 	virtual HRESULT STDMETHODCALLTYPE OnDataReceived(ULONG cbSize, BYTE* pBuffer) override;
 	virtual HRESULT STDMETHODCALLTYPE OnClose() override;
 
+	// Answers requests arriving over a socket or shared memory transport instead of a virtual channel,
+	// until the receiver disconnects or keepRunning is cleared.
+	template <typename TRANSPORT>
+	void ServeTransport(TRANSPORT& transport, const std::atomic<bool>& keepRunning);
+
 private:
+	HRESULT Send(const RdpGamepad::RdpProtocolHeader& msg);
+
 	HRESULT HandleGetState(const RdpGamepad::RdpProtocolPacket& packet);
 	HRESULT HandlePollState(const RdpGamepad::RdpProtocolPacket& packet);
 	HRESULT HandleSetState(const RdpGamepad::RdpProtocolPacket& packet);
@@ -60,12 +73,57 @@ private:
 	HRESULT HandleSetStateDS4(const RdpGamepad::RdpProtocolPacket& packet);
 	HRESULT SendControllerStateDS4(DWORD dwUserIndex);
 
+	HRESULT HandleSetFeedback(const RdpGamepad::RdpProtocolPacket& packet);
+	HRESULT HandleGetLatency(const RdpGamepad::RdpProtocolPacket& packet);
+	HRESULT HandleSetButtonEvents(const RdpGamepad::RdpProtocolPacket& packet);
+
+	// Sends the button edges seen since the last state, ending with the digital inputs of the state about
+	// to be sent, if the host asked for edges of that source. Returns S_FALSE when there were none.
+	HRESULT SendButtonEvents(DWORD dwUserIndex, RdpGamepad::RdpButtonEventSource source, uint64_t sampleTime, uint32_t digital);
+	void RunButtonSampler(DWORD dwUserIndex, RdpGamepad::RdpButtonEventSource source, std::chrono::microseconds period);
+	void StopButtonSampler();
+
+	HRESULT HandleSetMotion(const RdpGamepad::RdpProtocolPacket& packet);
+
+	// Sends the motion samples the sampler took since the last state, if the host asked for motion.
+	HRESULT SendMotion(DWORD dwUserIndex);
+	void RunMotionSampler(std::chrono::microseconds period);
+	void StopMotionSampler();
+
+	HRESULT HandleSetRateControl(const RdpGamepad::RdpProtocolPacket& packet);
+	HRESULT HandleRateProbe(const RdpGamepad::RdpProtocolPacket& packet);
+
+	// Whether the rate controller lets a successfully read state go out; force it when button edges were
+	// just sent. Sends a probe first when one is due.
+	bool AdmitState(DWORD dwUserIndex, uint64_t sampleTime, uint32_t digital, const uint16_t (&analog)[RdpGamepad::RateAnalogCount], bool force);
+	std::chrono::milliseconds GetPollInterval();
+
+	void RecordPollTick();
+	void StartTrace();
+
 	typedef HRESULT(CRdpGamepadChannel::*RdpProtocolHandlerFunction)(const RdpGamepad::RdpProtocolPacket& packet);
 	static RdpProtocolHandlerFunction sProtocolHandlers[static_cast<int>(RdpGamepad::RdpMessageType::MessageTypeCount)];
 
 	CComPtr<IWTSVirtualChannel> mChannel;
+	RdpGamepad::RdpGamepadTransport* mTransport = nullptr;
+	std::mutex mTransportMutex;
 	TimerHandle mTimerPoll;
 	TimerHandle mTimerPollTimeout;
+	std::chrono::milliseconds mPollInterval{0};
+	uint64_t mLastPollTime = 0;
+	RdpGamepad::RdpLatencyStages mLatency;
+	RdpGamepad::RdpTraceRecorder mTrace;
+	RdpGamepad::RdpButtonEdgeDetector mButtonEdges;
+	RdpGamepad::RdpButtonEventSource mButtonSource = RdpGamepad::ButtonSourceXInput;
+	std::atomic<bool> mButtonEvents{false};
+	std::atomic<bool> mButtonSampling{false};
+	std::thread mButtonSampler;
+	RdpGamepad::RdpMotionRecorder mMotion;
+	std::atomic<bool> mMotionEnabled{false};
+	std::atomic<bool> mMotionSampling{false};
+	std::thread mMotionSampler;
+	std::mutex mPadMutex;			// libDS4 is read from the sampler threads too.
+	RdpGamepad::RdpRateController mRate;
 };
 
 class ATL_NO_VTABLE CRdpGamepadPlugin :
@@ -100,6 +158,7 @@ public:
 
 	void FinalRelease()
 	{
+		StopTransportListener();
 	}
 
 public:
@@ -113,7 +172,13 @@ public:
 	virtual HRESULT STDMETHODCALLTYPE OnNewChannelConnection(IWTSVirtualChannel* pChannel, BSTR data, BOOL* pbAccept, IWTSVirtualChannelCallback** ppCallback) override;
 
 private:
+	void StartTransportListener();
+	void StopTransportListener();
+	void RunTransportListener(std::string address);
+
 	CComPtr<IWTSListener> mListener;
+	std::thread mTransportThread;
+	std::atomic<bool> mTransportRunning{false};
 };
 
 OBJECT_ENTRY_AUTO(__uuidof(RdpGamepadPlugin), CRdpGamepadPlugin)
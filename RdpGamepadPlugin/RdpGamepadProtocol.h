@@ -3,18 +3,17 @@
 
 #pragma once
 
-#ifndef NTDDI_XP
-#define NTDDI_XP NTDDI_WINXP /* bug in SDK */
-#endif
+#include "RdpGamepadPlatform.h"
 
-#include <Xinput.h>
-#include <pchannel.h>
-#include <wtsapi32.h>
 #include <type_traits>
 #include <cstring>
 #include <ds4_pad.h>
 
-#pragma comment(lib, "wtsapi32.lib")
+#include "RdpGamepadButtonEvents.h"
+#include "RdpGamepadFeedback.h"
+#include "RdpGamepadLatency.h"
+#include "RdpGamepadMotion.h"
+#include "RdpGamepadRateControl.h"
 
 namespace RdpGamepad
 {
@@ -45,6 +44,21 @@ namespace RdpGamepad
 		GetStateResponseDS4,
 		SetStateResponseDS4,
 
+		SetFeedbackRequest,			// Request to apply rumble, light bar and player LED in one go
+		SetFeedbackResponse,		// Response with the result of applying the feedback
+
+		GetLatencyRequest,			// Request the plugin's latency summaries
+		GetLatencyResponse,			// Response with one RdpLatencySummary per RdpLatencyStage
+
+		SetButtonEventsRequest,		// Request button edges sampled between states, or stop them
+		ButtonEventsResponse,		// The button edges seen since the last state; sent just before a state response
+
+		SetMotionRequest,			// Request DS4 motion and touchpad samples, or stop them
+		MotionResponse,				// Motion samples taken since the last state; sent just before a DS4 state response
+
+		SetRateControlRequest,		// Request that the plugin hold back states to suit the link, within bounds, or stop
+		RateProbe,					// Sent by the plugin and echoed unchanged by the host to measure the round trip
+
 		MessageTypeCount
 	};
 
@@ -230,6 +244,166 @@ namespace RdpGamepad
 		}
 	};
 
+	//----------
+	struct RdpSetFeedbackRequest : RdpProtocolHeader
+	{
+		UINT8               mTarget;
+		RdpFeedback         mFeedback;
+
+		static RdpSetFeedbackRequest MakeRequest(DWORD userIndex, RdpFeedbackTarget target, const RdpFeedback& feedback)
+		{
+			RdpSetFeedbackRequest retVal;
+			retVal.mMessageType = RdpMessageType::SetFeedbackRequest;
+			retVal.mMessageSize = sizeof(retVal);
+			retVal.mUserIndex   = userIndex;
+			retVal.mTarget      = static_cast<UINT8>(target);
+			retVal.mFeedback    = feedback;
+			return retVal;
+		}
+	};
+
+	struct RdpSetFeedbackResponse : RdpProtocolHeader
+	{
+		DWORD               mResult;
+
+		static RdpSetFeedbackResponse MakeResponse(DWORD userIndex, DWORD result)
+		{
+			RdpSetFeedbackResponse retVal;
+			retVal.mMessageType = RdpMessageType::SetFeedbackResponse;
+			retVal.mMessageSize = sizeof(retVal);
+			retVal.mUserIndex   = userIndex;
+			retVal.mResult      = result;
+			return retVal;
+		}
+	};
+
+	struct RdpGetLatencyRequest : RdpProtocolHeader
+	{
+		static RdpGetLatencyRequest MakeRequest(DWORD userIndex)
+		{
+			RdpGetLatencyRequest retVal;
+			retVal.mMessageType = RdpMessageType::GetLatencyRequest;
+			retVal.mMessageSize = sizeof(retVal);
+			retVal.mUserIndex   = userIndex;
+			return retVal;
+		}
+	};
+
+	struct RdpGetLatencyResponse : RdpProtocolHeader
+	{
+		RdpLatencySummary   mStages[LatencyStageCount];
+
+		static RdpGetLatencyResponse MakeResponse(DWORD userIndex, const RdpLatencySummary (&stages)[LatencyStageCount])
+		{
+			RdpGetLatencyResponse retVal;
+			retVal.mMessageType = RdpMessageType::GetLatencyResponse;
+			retVal.mMessageSize = sizeof(retVal);
+			retVal.mUserIndex   = userIndex;
+			std::memcpy(retVal.mStages, stages, sizeof(retVal.mStages));
+			return retVal;
+		}
+	};
+
+	struct RdpSetButtonEventsRequest : RdpProtocolHeader
+	{
+		UINT8               mSource;			// RdpButtonEventSource
+		DWORD               mSamplePeriod;		// Microseconds between samples; 0 stops sampling.
+
+		static RdpSetButtonEventsRequest MakeRequest(DWORD userIndex, RdpButtonEventSource source, DWORD samplePeriod)
+		{
+			RdpSetButtonEventsRequest retVal;
+			retVal.mMessageType  = RdpMessageType::SetButtonEventsRequest;
+			retVal.mMessageSize  = sizeof(retVal);
+			retVal.mUserIndex    = userIndex;
+			retVal.mSource       = static_cast<UINT8>(source);
+			retVal.mSamplePeriod = samplePeriod;
+			return retVal;
+		}
+	};
+
+	struct RdpButtonEventsResponse : RdpProtocolHeader
+	{
+		UINT8               mSource;			// RdpButtonEventSource
+		UINT8               mCount;
+		RdpButtonEdge       mEdges[ButtonEdgeCapacity];		// Oldest first; only mCount are used.
+
+		static RdpButtonEventsResponse MakeResponse(DWORD userIndex, RdpButtonEventSource source, const RdpButtonEdge* edges, size_t count)
+		{
+			RdpButtonEventsResponse retVal = {};
+			retVal.mMessageType = RdpMessageType::ButtonEventsResponse;
+			retVal.mMessageSize = sizeof(retVal);
+			retVal.mUserIndex   = userIndex;
+			retVal.mSource      = static_cast<UINT8>(source);
+			retVal.mCount       = static_cast<UINT8>(count < ButtonEdgeCapacity ? count : ButtonEdgeCapacity);
+			std::memcpy(retVal.mEdges, edges, retVal.mCount * sizeof(RdpButtonEdge));
+			return retVal;
+		}
+	};
+
+	struct RdpSetMotionRequest : RdpProtocolHeader
+	{
+		DWORD               mSamplePeriod;		// Microseconds between samples; 0 stops sampling.
+
+		static RdpSetMotionRequest MakeRequest(DWORD userIndex, DWORD samplePeriod)
+		{
+			RdpSetMotionRequest retVal;
+			retVal.mMessageType  = RdpMessageType::SetMotionRequest;
+			retVal.mMessageSize  = sizeof(retVal);
+			retVal.mUserIndex    = userIndex;
+			retVal.mSamplePeriod = samplePeriod;
+			return retVal;
+		}
+	};
+
+	// The only message whose size varies: it ends after the mBatch.mData bytes in use.
+	struct RdpMotionResponse : RdpProtocolHeader
+	{
+		RdpMotionBatch      mBatch;
+
+		static RdpMotionResponse MakeResponse(DWORD userIndex, const RdpMotionBatch& batch)
+		{
+			RdpMotionResponse retVal;
+			retVal.mMessageType = RdpMessageType::MotionResponse;
+			retVal.mMessageSize = static_cast<UINT16>(sizeof(RdpProtocolHeader) + MotionBatchHeaderSize + batch.mSize);
+			retVal.mUserIndex   = userIndex;
+			std::memcpy(&retVal.mBatch, &batch, MotionBatchHeaderSize + batch.mSize);
+			return retVal;
+		}
+
+		// Bytes of mBatch.mData the message carries.
+		size_t GetDataSize() const
+		{ return mMessageSize - sizeof(RdpProtocolHeader) - MotionBatchHeaderSize; }
+	};
+
+	struct RdpSetRateControlRequest : RdpProtocolHeader
+	{
+		RdpRateLimits       mLimits;			// A zero mMinKeepalive stops rate control.
+
+		static RdpSetRateControlRequest MakeRequest(DWORD userIndex, const RdpRateLimits& limits)
+		{
+			RdpSetRateControlRequest retVal;
+			retVal.mMessageType = RdpMessageType::SetRateControlRequest;
+			retVal.mMessageSize = sizeof(retVal);
+			retVal.mUserIndex   = userIndex;
+			retVal.mLimits      = limits;
+			return retVal;
+		}
+	};
+
+	struct RdpRateProbe : RdpProtocolHeader
+	{
+		DWORD               mTime;				// Microseconds on the plugin's clock; wraps.
+
+		static RdpRateProbe MakeProbe(DWORD userIndex, DWORD time)
+		{
+			RdpRateProbe retVal;
+			retVal.mMessageType = RdpMessageType::RateProbe;
+			retVal.mMessageSize = sizeof(retVal);
+			retVal.mUserIndex   = userIndex;
+			retVal.mTime        = time;
+			return retVal;
+		}
+	};
 
 	const size_t kRdpMessageSizes[] =
 	{
@@ -243,9 +417,19 @@ namespace RdpGamepad
 		sizeof(RdpGetCapabilitiesResponse),  // GetCapabilitiesResponse
 		sizeof(RdpGetStateRequestDS4),		 // GetStateRequestDS4,
 		sizeof(RdpPollStateRequestDS4),		// PollStateRequestDS4,
-		sizeof(RdpPollStateRequestDS4),		// SetStateRequestDS4,
+		sizeof(RdpSetStateRequestDS4),		// SetStateRequestDS4,
 		sizeof(RdpGetStateResponseDS4),		// GetStateResponseDS4,
 		sizeof(RdpSetStateResponseDS4),		// SetStateResponseDS4,
+		sizeof(RdpSetFeedbackRequest),		// SetFeedbackRequest,
+		sizeof(RdpSetFeedbackResponse),		// SetFeedbackResponse,
+		sizeof(RdpGetLatencyRequest),		// GetLatencyRequest,
+		sizeof(RdpGetLatencyResponse),		// GetLatencyResponse,
+		sizeof(RdpSetButtonEventsRequest),	// SetButtonEventsRequest,
+		sizeof(RdpButtonEventsResponse),	// ButtonEventsResponse,
+		sizeof(RdpSetMotionRequest),		// SetMotionRequest,
+		sizeof(RdpMotionResponse),			// MotionResponse, at most
+		sizeof(RdpSetRateControlRequest),	// SetRateControlRequest,
+		sizeof(RdpRateProbe),				// RateProbe,
 	};
 	static_assert(sizeof(kRdpMessageSizes)/sizeof(kRdpMessageSizes[0]) == RdpMessageType::MessageTypeCount, "kRdpMessageSizes has incorrect size");
 
@@ -264,128 +448,30 @@ namespace RdpGamepad
 		RdpSetStateRequestDS4		mSetStateRequestDS4;
 		RdpGetStateResponseDS4		mGetStateResponseDS4;
 		RdpSetStateResponseDS4		mSetStateResponseDS4;
+		RdpSetFeedbackRequest		mSetFeedbackRequest;
+		RdpSetFeedbackResponse		mSetFeedbackResponse;
+		RdpGetLatencyRequest		mGetLatencyRequest;
+		RdpGetLatencyResponse		mGetLatencyResponse;
+		RdpSetButtonEventsRequest	mSetButtonEventsRequest;
+		RdpButtonEventsResponse		mButtonEventsResponse;
+		RdpSetMotionRequest			mSetMotionRequest;
+		RdpMotionResponse			mMotionResponse;
+		RdpSetRateControlRequest	mSetRateControlRequest;
+		RdpRateProbe				mRateProbe;
 
 		inline bool IsValid()
 		{
+			if (mHeader.mMessageType == RdpMessageType::MotionResponse)
+			{
+				return
+					(mHeader.mMessageSize >= sizeof(RdpProtocolHeader) + MotionBatchHeaderSize) &&
+					(mHeader.mMessageSize <= kRdpMessageSizes[mHeader.mMessageType]);
+			}
 			return
 				(mHeader.mMessageType < RdpMessageType::MessageTypeCount) &&
 				(mHeader.mMessageSize == kRdpMessageSizes[mHeader.mMessageType]);
 		}
 	};
 
-	class RdpGamepadVirtualChannel
-	{
-	private:
-		HANDLE mHandle;
-
-		union PduAndRdpPacket
-		{
-			char mResponseBytes[CHANNEL_PDU_LENGTH];
-			struct
-			{
-				CHANNEL_PDU_HEADER mPduHeader;
-				RdpProtocolPacket  mRdpPacket;
-			};
-
-			bool IsValid(ULONG size);
-		};
-		static_assert(sizeof(PduAndRdpPacket) == CHANNEL_PDU_LENGTH, "RdpChannelPacket has incorrect size");
-
-	public:
-		RdpGamepadVirtualChannel()
-			: mHandle(nullptr)
-		{}
-
-		bool Send(const RdpProtocolHeader& msg) const;
-		bool Receive(RdpProtocolPacket* outPacket);
-		bool Open();
-		void Close();
-		bool IsOpen() const;
-	};
-
-	inline bool RdpGamepadVirtualChannel::PduAndRdpPacket::IsValid(ULONG size)
-	{
-		// Check the size of the data matches the channel PDU data size.
-		if (size < sizeof(mPduHeader) || size != (sizeof(mPduHeader) + mPduHeader.length))
-		{
-			return false;
-		}
-
-		// Ignore fragmented packets. Should never happen given size of protocol messages.
-		if (mPduHeader.flags != CHANNEL_FLAG_ONLY)
-		{
-			return false;
-		}
-
-		// Make sure we get at least one headers worth of data
-		if (mPduHeader.length < sizeof(RdpGamepad::RdpProtocolHeader))
-		{
-			return false;
-		}
-
-		return mRdpPacket.IsValid();
-	}
-
-	inline bool RdpGamepadVirtualChannel::Send(const RdpProtocolHeader& msg) const
-	{
-		ULONG bytesWritten = 0;
-		if (!WTSVirtualChannelWrite(mHandle, (PCHAR)&msg, msg.mMessageSize, &bytesWritten) ||
-			bytesWritten != msg.mMessageSize)
-		{
-			return false;
-		}
-		return true;
-	}
-
-	inline bool RdpGamepadVirtualChannel::Receive(RdpProtocolPacket* outPacket)
-	{
-		ULONG bytesRead = 0;
-		PduAndRdpPacket channelPacket;
-		if (!WTSVirtualChannelRead(mHandle, 0, channelPacket.mResponseBytes, sizeof(channelPacket.mResponseBytes), &bytesRead))
-		{
-			Close();
-			return false;
-		}
-		else if (bytesRead == 0)
-		{
-			return false;
-		}
-		else if (!channelPacket.IsValid(bytesRead))
-		{
-			Close();
-			return false;
-		}
-		static_assert(std::is_trivially_copyable<RdpProtocolPacket>::value, "RdpProtocolPacket must be trivially copyable for memcpy");
-		std::memcpy(outPacket, &channelPacket.mRdpPacket, channelPacket.mRdpPacket.mHeader.mMessageSize);
-		return true;
-	}
-
-	inline bool RdpGamepadVirtualChannel::Open()
-	{
-		if (mHandle == nullptr)
-		{
-			mHandle = WTSVirtualChannelOpenEx(WTS_CURRENT_SESSION, const_cast<LPSTR>(RDPGAMEPAD_VIRTUAL_CHANNEL_NAME), WTS_CHANNEL_OPTION_DYNAMIC);
-			if (mHandle == nullptr)
-			{
-				return false;
-			}
-		}
-		return true;
-	}
-
-	inline void RdpGamepadVirtualChannel::Close()
-	{
-		if (mHandle != nullptr)
-		{
-			WTSVirtualChannelClose(mHandle);
-			mHandle = nullptr;
-		}
-	}
-
-	inline bool RdpGamepadVirtualChannel::IsOpen() const
-	{
-		return (mHandle != nullptr);
-	}
-
 #pragma pack(pop)
 }
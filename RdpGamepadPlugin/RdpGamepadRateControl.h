@@ -0,0 +1,307 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace RdpGamepad
+{
+	// Sticks and triggers the rate controller compares, each scaled to 0 to 65535.
+	static constexpr size_t RateAnalogCount = 6;
+
+#pragma pack(push)
+#pragma pack(1)
+
+	// The bounds the host sets for the controller. Times are microseconds, analog steps are out of 65535.
+	// The first of each pair applies on a clear link, the second on a congested one. A zero mMinKeepalive
+	// turns the controller off.
+	struct RdpRateLimits
+	{
+		uint32_t            mMinInterval;		// Between two states that only move the sticks or triggers.
+		uint32_t            mMaxInterval;
+		uint32_t            mMinAnalogStep;		// Smallest stick or trigger change worth a state.
+		uint32_t            mMaxAnalogStep;
+		uint32_t            mMinKeepalive;		// Longest time without any state.
+		uint32_t            mMaxKeepalive;
+	};
+
+#pragma pack(pop)
+
+	// What the controller is doing right now.
+	struct RdpRateStatus
+	{
+		double              mHeadroom;			// 1 on a clear link, 0 at the congested bounds.
+		uint32_t            mInterval;
+		uint32_t            mAnalogStep;
+		uint32_t            mKeepalive;
+		uint64_t            mSmoothedRtt;		// Microseconds; 0 until a probe came back.
+		uint64_t            mBaseRtt;
+		uint64_t            mAdmitted;
+		uint64_t            mSuppressed;
+		uint64_t            mBackoffs;
+	};
+
+	// Decides which controller states go out when the channel shares a link with other traffic, such as
+	// the session's video. It watches two signals: how long writes take, which grows once the transport's
+	// buffers are full, and the round trip time of small probes the host echoes, which grows with the
+	// queue in front of the link. Either one rising past its threshold halves the headroom at most once a
+	// round trip; otherwise the headroom grows back a little every round trip. The headroom sets the
+	// interval between analog-only states, the analog step below which changes are held back and the
+	// keepalive interval, each between the host's bounds. A change of the digital inputs is always sent
+	// at once, so presses and releases never wait behind analog drift. May be called from several
+	// threads. Times are microseconds.
+	class RdpRateController
+	{
+	public:
+		// A write that blocks this long means the transport cannot take more.
+		static constexpr uint64_t BackpressureThreshold = 2000;
+
+		// Queueing delay the link may build up before the controller backs off. The host reads messages
+		// once a tick, so the round trip varies by that much on an idle link as well.
+		static constexpr uint64_t TargetQueueDelay = 25000;
+
+		// How long the smallest round trip is remembered; the link's own delay may change over time.
+		static constexpr uint64_t BaseRttWindow = 10000000;
+
+		// Shortest time between two adjustments, for links whose round trip is shorter still.
+		static constexpr uint64_t MinAdjustPeriod = 50000;
+
+		// A probe goes out every this many intervals, and counts as lost if not back within ProbeTimeout.
+		static constexpr uint32_t ProbeIntervals = 8;
+		static constexpr uint64_t ProbeTimeout = 1000000;
+
+		void Configure(const RdpRateLimits& limits)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mLimits = limits;
+			if (mLimits.mMaxInterval < mLimits.mMinInterval)
+			{
+				mLimits.mMaxInterval = mLimits.mMinInterval;
+			}
+			if (mLimits.mMaxKeepalive < mLimits.mMinKeepalive)
+			{
+				mLimits.mMaxKeepalive = mLimits.mMinKeepalive;
+			}
+			mEnabled = mLimits.mMinKeepalive != 0;
+			mHeadroom = 1.0;
+			mHasSent = false;
+			mCongested = false;
+			mNextAdjust = 0;
+			mProbePending = false;
+			mNextProbe = 0;
+			mSmoothedRtt = 0;
+			mBaseRtt[0] = UINT64_MAX;
+			mBaseRtt[1] = UINT64_MAX;
+			mBaseRttStart = 0;
+			Apply();
+		}
+
+		void Disable()
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mEnabled = false;
+		}
+
+		bool IsEnabled()
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			return mEnabled;
+		}
+
+		// Shortest interval between states, so whoever schedules them can run no faster than that.
+		uint32_t GetMinInterval()
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			return mLimits.mMinInterval;
+		}
+
+		// Whether to send a state read at now. Always true when disabled, when force is set, when the
+		// digital inputs changed since the last state sent and when the keepalive is due; otherwise only
+		// once the interval has passed and a stick or trigger moved by at least the analog step.
+		bool Admit(uint64_t now, uint32_t digital, const uint16_t (&analog)[RateAnalogCount], bool force)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (!mEnabled)
+			{
+				return true;
+			}
+			Adjust(now);
+
+			// States count as due a quarter of the interval early, so requests arriving with a little
+			// jitter still get one each.
+			bool send = force || !mHasSent || digital != mDigital || now - mSentTime >= mKeepalive;
+			if (!send && now - mSentTime >= mInterval - mInterval / 4)
+			{
+				for (size_t i = 0; i < RateAnalogCount && !send; ++i)
+				{
+					const uint32_t change = (analog[i] > mAnalog[i]) ? analog[i] - mAnalog[i] : mAnalog[i] - analog[i];
+					send = change != 0 && change >= mAnalogStep;
+				}
+			}
+			if (!send)
+			{
+				++mSuppressed;
+				return false;
+			}
+
+			++mAdmitted;
+			mHasSent = true;
+			mSentTime = now;
+			mDigital = digital;
+			for (size_t i = 0; i < RateAnalogCount; ++i)
+			{
+				mAnalog[i] = analog[i];
+			}
+			return true;
+		}
+
+		// Whether to send a probe now, and the time to put in it.
+		bool TakeProbe(uint64_t now, uint32_t& outTime)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (!mEnabled || now < mNextProbe)
+			{
+				return false;
+			}
+			if (mProbePending)
+			{
+				if (now - mProbeTime < ProbeTimeout)
+				{
+					return false;
+				}
+				// Lost, or stuck behind a queue longer than any game tolerates.
+				mCongested = true;
+			}
+			mProbePending = true;
+			mProbeTime = now;
+			mNextProbe = now + uint64_t(mInterval) * ProbeIntervals;
+			outTime = static_cast<uint32_t>(now);
+			return true;
+		}
+
+		// A probe the host echoed, carrying the time TakeProbe put in it.
+		void OnProbe(uint64_t now, uint32_t time)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (!mEnabled || !mProbePending || time != static_cast<uint32_t>(mProbeTime))
+			{
+				return;
+			}
+			mProbePending = false;
+
+			const uint64_t rtt = now - mProbeTime;
+			mSmoothedRtt = (mSmoothedRtt == 0) ? rtt : (mSmoothedRtt * 7 + rtt) / 8;
+
+			// The smallest round trip of the current and the previous window stands for the empty link.
+			if (now - mBaseRttStart >= BaseRttWindow / 2)
+			{
+				mBaseRtt[1] = mBaseRtt[0];
+				mBaseRtt[0] = UINT64_MAX;
+				mBaseRttStart = now;
+			}
+			mBaseRtt[0] = (rtt < mBaseRtt[0]) ? rtt : mBaseRtt[0];
+
+			if (rtt > GetBaseRtt() + TargetQueueDelay)
+			{
+				mCongested = true;
+			}
+		}
+
+		// How long writing a message took.
+		void OnWrite(uint64_t duration)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (duration > BackpressureThreshold)
+			{
+				mCongested = true;
+			}
+		}
+
+		RdpRateStatus GetStatus()
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			RdpRateStatus status;
+			status.mHeadroom = mHeadroom;
+			status.mInterval = mInterval;
+			status.mAnalogStep = mAnalogStep;
+			status.mKeepalive = mKeepalive;
+			status.mSmoothedRtt = mSmoothedRtt;
+			status.mBaseRtt = (GetBaseRtt() != UINT64_MAX) ? GetBaseRtt() : 0;
+			status.mAdmitted = mAdmitted;
+			status.mSuppressed = mSuppressed;
+			status.mBackoffs = mBackoffs;
+			return status;
+		}
+
+	private:
+		std::mutex mMutex;
+		RdpRateLimits mLimits = {};
+		bool mEnabled = false;
+		double mHeadroom = 1.0;
+		uint32_t mInterval = 0;
+		uint32_t mAnalogStep = 0;
+		uint32_t mKeepalive = 0;
+
+		bool mHasSent = false;
+		uint64_t mSentTime = 0;
+		uint32_t mDigital = 0;
+		uint16_t mAnalog[RateAnalogCount] = {};
+
+		bool mCongested = false;
+		uint64_t mNextAdjust = 0;
+		bool mProbePending = false;
+		uint64_t mProbeTime = 0;
+		uint64_t mNextProbe = 0;
+		uint64_t mSmoothedRtt = 0;
+		uint64_t mBaseRtt[2] = { UINT64_MAX, UINT64_MAX };
+		uint64_t mBaseRttStart = 0;
+
+		uint64_t mAdmitted = 0;
+		uint64_t mSuppressed = 0;
+		uint64_t mBackoffs = 0;
+
+		uint64_t GetBaseRtt() const
+		{ return (mBaseRtt[0] < mBaseRtt[1]) ? mBaseRtt[0] : mBaseRtt[1]; }
+
+		// Halves the headroom if the link was congested since the last adjustment, otherwise adds a
+		// sixteenth, at most once a round trip.
+		void Adjust(uint64_t now)
+		{
+			if (now < mNextAdjust)
+			{
+				return;
+			}
+			if (mCongested)
+			{
+				mHeadroom *= 0.5;
+				++mBackoffs;
+			}
+			else
+			{
+				mHeadroom = (mHeadroom + 1.0 / 16 < 1.0) ? mHeadroom + 1.0 / 16 : 1.0;
+			}
+			mCongested = false;
+			mNextAdjust = now + ((mSmoothedRtt > MinAdjustPeriod) ? mSmoothedRtt : MinAdjustPeriod);
+			Apply();
+		}
+
+		// The send rate, rather than the interval, moves in step with the headroom, so halving the
+		// headroom roughly halves the bytes sent.
+		void Apply()
+		{
+			const double fastest = 1.0 / ((mLimits.mMinInterval != 0) ? mLimits.mMinInterval : 1);
+			const double slowest = 1.0 / ((mLimits.mMaxInterval != 0) ? mLimits.mMaxInterval : 1);
+			mInterval = static_cast<uint32_t>(1.0 / (slowest + (fastest - slowest) * mHeadroom) + 0.5);
+			mAnalogStep = Blend(mLimits.mMinAnalogStep, mLimits.mMaxAnalogStep);
+			mKeepalive = Blend(mLimits.mMinKeepalive, mLimits.mMaxKeepalive);
+		}
+
+		uint32_t Blend(uint32_t clear, uint32_t congested) const
+		{
+			return static_cast<uint32_t>(congested + (double(clear) - double(congested)) * mHeadroom + 0.5);
+		}
+	};
+}
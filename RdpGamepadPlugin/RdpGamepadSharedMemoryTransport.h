@@ -0,0 +1,511 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include "RdpGamepadTransport.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+
+namespace RdpGamepad
+{
+	// One direction of a shared memory transport: a single producer, single consumer ring of bytes that
+	// whole messages are copied into. It lives in memory shared between processes, so it only holds
+	// address free atomics, and the counters wrap at 2^32 like the unsigned arithmetic on them.
+	struct RdpSharedRing
+	{
+		static constexpr uint32_t Capacity = 4096;				// A power of two, many times the largest message.
+
+		alignas(64) std::atomic<uint32_t> mHead;				// Bytes ever written. Stored by the producer.
+		alignas(64) std::atomic<uint32_t> mTail;				// Bytes ever read. Stored by the consumer.
+		alignas(64) std::atomic<uint32_t> mSleeping;			// Set while the consumer waits for a wakeup.
+		std::atomic<uint32_t> mWakeups;							// Bumped by the producer to wake the consumer.
+		alignas(64) uint8_t mData[Capacity];
+	};
+
+	enum RdpSharedRingIndex
+	{
+		SharedRingToPlugin,
+		SharedRingToReceiver,
+		SharedRingCount,
+	};
+
+	struct RdpSharedRegion
+	{
+		static constexpr uint32_t Magic = 0x4d534752;			// "RGSM"
+
+		std::atomic<uint32_t> mMagic;							// Stored last by the creator.
+		std::atomic<uint32_t> mAttached;						// Set by the receiver that opened the region.
+		std::atomic<uint32_t> mClosed[SharedRingCount];			// Set by each side as it goes away, by the ring it reads.
+		RdpSharedRing mRings[SharedRingCount];
+	};
+
+	static_assert(ATOMIC_INT_LOCK_FREE == 2 && sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Shared rings need lock free atomics");
+
+	// Naming, mapping and wakeups of a shared region.
+	namespace RdpSharedMemory
+	{
+#if defined(_WIN32)
+		struct Mapping
+		{
+			HANDLE mFile = nullptr;
+			void* mView = nullptr;
+			HANDLE mEvents[SharedRingCount] = {};
+		};
+
+		inline bool Map(const std::string& name, bool create, Mapping& outMapping)
+		{
+			const std::string objectName = "Local\\RdpGamepad." + name;
+			if (create)
+			{
+				outMapping.mFile = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(RdpSharedRegion), objectName.c_str());
+				if (outMapping.mFile != nullptr && GetLastError() == ERROR_ALREADY_EXISTS)
+				{
+					// Someone else is serving this name.
+					CloseHandle(outMapping.mFile);
+					outMapping.mFile = nullptr;
+				}
+			}
+			else
+			{
+				outMapping.mFile = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, objectName.c_str());
+			}
+			if (outMapping.mFile == nullptr)
+			{
+				return false;
+			}
+
+			outMapping.mView = MapViewOfFile(outMapping.mFile, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(RdpSharedRegion));
+			for (int i = 0; i < SharedRingCount; ++i)
+			{
+				outMapping.mEvents[i] = CreateEventA(nullptr, FALSE, FALSE, (objectName + "." + char('0' + i)).c_str());
+			}
+			return outMapping.mView != nullptr && outMapping.mEvents[0] != nullptr && outMapping.mEvents[1] != nullptr;
+		}
+
+		inline void Unmap(const std::string&, bool, Mapping& mapping)
+		{
+			for (HANDLE& event : mapping.mEvents)
+			{
+				if (event != nullptr)
+				{
+					CloseHandle(event);
+					event = nullptr;
+				}
+			}
+			if (mapping.mView != nullptr)
+			{
+				UnmapViewOfFile(mapping.mView);
+				mapping.mView = nullptr;
+			}
+			if (mapping.mFile != nullptr)
+			{
+				CloseHandle(mapping.mFile);
+				mapping.mFile = nullptr;
+			}
+		}
+
+		inline void Wait(Mapping& mapping, int ring, std::atomic<uint32_t>&, uint32_t, int timeoutMs)
+		{ WaitForSingleObject(mapping.mEvents[ring], static_cast<DWORD>(timeoutMs)); }
+
+		inline void Wake(Mapping& mapping, int ring, std::atomic<uint32_t>&)
+		{ SetEvent(mapping.mEvents[ring]); }
+#else
+		struct Mapping
+		{
+			void* mView = nullptr;
+		};
+
+		inline bool Map(const std::string& name, bool create, Mapping& outMapping)
+		{
+			const std::string objectName = "/rdpgamepad-" + name;
+			int file;
+			if (create)
+			{
+				// A region left behind by a plugin that crashed would otherwise block the name forever.
+				shm_unlink(objectName.c_str());
+				file = shm_open(objectName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+				if (file != -1 && ftruncate(file, sizeof(RdpSharedRegion)) != 0)
+				{
+					close(file);
+					shm_unlink(objectName.c_str());
+					return false;
+				}
+			}
+			else
+			{
+				file = shm_open(objectName.c_str(), O_RDWR, 0);
+			}
+			if (file == -1)
+			{
+				return false;
+			}
+
+			struct stat status;
+			if (fstat(file, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(RdpSharedRegion)))
+			{
+				close(file);
+				return false;
+			}
+
+			void* view = mmap(nullptr, sizeof(RdpSharedRegion), PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+			close(file);
+			if (view == MAP_FAILED)
+			{
+				return false;
+			}
+			outMapping.mView = view;
+			return true;
+		}
+
+		inline void Unmap(const std::string& name, bool created, Mapping& mapping)
+		{
+			if (mapping.mView != nullptr)
+			{
+				munmap(mapping.mView, sizeof(RdpSharedRegion));
+				mapping.mView = nullptr;
+			}
+			if (created)
+			{
+				shm_unlink(("/rdpgamepad-" + name).c_str());
+			}
+		}
+
+#if defined(__linux__)
+		// Shared (not process private) futexes, as the two sides are usually different processes.
+		inline void Wait(Mapping&, int, std::atomic<uint32_t>& word, uint32_t value, int timeoutMs)
+		{
+			timespec timeout;
+			timeout.tv_sec = timeoutMs / 1000;
+			timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+			syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, value, &timeout, nullptr, 0);
+		}
+
+		inline void Wake(Mapping&, int, std::atomic<uint32_t>& word)
+		{ syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, 1, nullptr, nullptr, 0); }
+#else
+		// Without futexes the consumer naps briefly instead.
+		inline void Wait(Mapping&, int, std::atomic<uint32_t>& word, uint32_t value, int timeoutMs)
+		{
+			const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+			while (word.load(std::memory_order_acquire) == value && std::chrono::steady_clock::now() < deadline)
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			}
+		}
+
+		inline void Wake(Mapping&, int, std::atomic<uint32_t>&)
+		{}
+#endif
+#endif
+	}
+
+	// Both ends of a connection on one machine, through a named shared memory region holding a ring per
+	// direction. The rings carry the messages exactly as the virtual channel does. The plugin creates
+	// the region and a single receiver opens it; when either side closes, the other sees it once it has
+	// read everything that was sent before.
+	class RdpGamepadSharedMemoryTransport : public RdpGamepadTransport
+	{
+	public:
+		~RdpGamepadSharedMemoryTransport();
+
+		// Creates the region for a receiver to open, replacing one left behind by an earlier plugin.
+		static std::unique_ptr<RdpGamepadSharedMemoryTransport> Create(const std::string& name);
+
+		// Opens the region a plugin created. Returns nullptr if there is none or a receiver holds it.
+		static std::unique_ptr<RdpGamepadSharedMemoryTransport> Open(const std::string& name);
+
+		// Names are up to 64 letters, digits, '-' and '_'.
+		static bool IsValidName(const std::string& name);
+
+		bool Send(const RdpProtocolHeader& msg) override;
+		bool Receive(RdpProtocolPacket* outPacket) override;
+		void Close() override;
+		bool IsOpen() const override;
+
+		// Waits up to timeoutMs for a message or for the other side to close. Spins for a few
+		// microseconds before sleeping, since a sleeping reader costs a wakeup on every message.
+		bool WaitReadable(int timeoutMs);
+
+	private:
+		// How long Send waits for the reader to make room before giving up on the connection.
+		static const int SendTimeoutMs = 1000;
+		static const int SpinMicroseconds = 50;
+
+		std::string mName;
+		RdpSharedMemory::Mapping mMapping;
+		RdpSharedRegion* mRegion = nullptr;
+		int mIncoming = 0;
+		int mOutgoing = 0;
+		bool mCreated = false;
+		std::atomic<bool> mOpen{false};
+
+		RdpGamepadSharedMemoryTransport()
+		{}
+
+		bool HasIncoming() const;
+		bool IsPeerClosed() const
+		{ return mRegion->mClosed[mOutgoing].load(std::memory_order_acquire) != 0; }
+
+		void Read(const RdpSharedRing& ring, uint32_t position, void* data, uint32_t size) const;
+		void Write(RdpSharedRing& ring, uint32_t position, const void* data, uint32_t size);
+		void WakeReader(int ring, bool always);
+	};
+
+	inline RdpGamepadSharedMemoryTransport::~RdpGamepadSharedMemoryTransport()
+	{
+		Close();
+		RdpSharedMemory::Unmap(mName, mCreated, mMapping);
+	}
+
+	inline std::unique_ptr<RdpGamepadSharedMemoryTransport> RdpGamepadSharedMemoryTransport::Create(const std::string& name)
+	{
+		if (!IsValidName(name))
+		{
+			return nullptr;
+		}
+
+		std::unique_ptr<RdpGamepadSharedMemoryTransport> transport(new RdpGamepadSharedMemoryTransport());
+		transport->mName = name;
+		if (!RdpSharedMemory::Map(name, true, transport->mMapping))
+		{
+			return nullptr;
+		}
+		transport->mCreated = true;
+
+		RdpSharedRegion* region = new (transport->mMapping.mView) RdpSharedRegion;
+		region->mAttached.store(0, std::memory_order_relaxed);
+		for (int i = 0; i < SharedRingCount; ++i)
+		{
+			region->mClosed[i].store(0, std::memory_order_relaxed);
+			region->mRings[i].mHead.store(0, std::memory_order_relaxed);
+			region->mRings[i].mTail.store(0, std::memory_order_relaxed);
+			region->mRings[i].mSleeping.store(0, std::memory_order_relaxed);
+			region->mRings[i].mWakeups.store(0, std::memory_order_relaxed);
+		}
+		region->mMagic.store(RdpSharedRegion::Magic, std::memory_order_release);
+
+		transport->mRegion = region;
+		transport->mIncoming = SharedRingToPlugin;
+		transport->mOutgoing = SharedRingToReceiver;
+		transport->mOpen = true;
+		return transport;
+	}
+
+	inline std::unique_ptr<RdpGamepadSharedMemoryTransport> RdpGamepadSharedMemoryTransport::Open(const std::string& name)
+	{
+		if (!IsValidName(name))
+		{
+			return nullptr;
+		}
+
+		std::unique_ptr<RdpGamepadSharedMemoryTransport> transport(new RdpGamepadSharedMemoryTransport());
+		transport->mName = name;
+		if (!RdpSharedMemory::Map(name, false, transport->mMapping))
+		{
+			return nullptr;
+		}
+
+		RdpSharedRegion* region = static_cast<RdpSharedRegion*>(transport->mMapping.mView);
+		uint32_t detached = 0;
+		if (region->mMagic.load(std::memory_order_acquire) != RdpSharedRegion::Magic ||
+			region->mClosed[SharedRingToReceiver].load(std::memory_order_acquire) != 0 ||
+			!region->mAttached.compare_exchange_strong(detached, 1))
+		{
+			return nullptr;
+		}
+
+		transport->mRegion = region;
+		transport->mIncoming = SharedRingToReceiver;
+		transport->mOutgoing = SharedRingToPlugin;
+		transport->mOpen = true;
+		return transport;
+	}
+
+	inline bool RdpGamepadSharedMemoryTransport::IsValidName(const std::string& name)
+	{
+		return !name.empty() && name.size() <= 64 && std::all_of(name.begin(), name.end(), [](char c)
+		{
+			return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_';
+		});
+	}
+
+	inline bool RdpGamepadSharedMemoryTransport::Send(const RdpProtocolHeader& msg)
+	{
+		if (!IsOpen())
+		{
+			return false;
+		}
+
+		RdpSharedRing& ring = mRegion->mRings[mOutgoing];
+		const uint32_t size = msg.mMessageSize;
+		const uint32_t head = ring.mHead.load(std::memory_order_relaxed);
+		if (ring.mTail.load(std::memory_order_acquire) + RdpSharedRing::Capacity - head < size)
+		{
+			const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SendTimeoutMs);
+			while (ring.mTail.load(std::memory_order_acquire) + RdpSharedRing::Capacity - head < size)
+			{
+				if (IsPeerClosed() || std::chrono::steady_clock::now() > deadline)
+				{
+					Close();
+					return false;
+				}
+				std::this_thread::yield();
+			}
+		}
+
+		Write(ring, head, &msg, size);
+		ring.mHead.store(head + size, std::memory_order_release);
+		WakeReader(mOutgoing, false);
+		return true;
+	}
+
+	inline bool RdpGamepadSharedMemoryTransport::Receive(RdpProtocolPacket* outPacket)
+	{
+		static_assert(std::is_trivially_copyable<RdpProtocolPacket>::value, "RdpProtocolPacket must be trivially copyable for memcpy");
+
+		if (!IsOpen())
+		{
+			return false;
+		}
+
+		RdpSharedRing& ring = mRegion->mRings[mIncoming];
+		const uint32_t tail = ring.mTail.load(std::memory_order_relaxed);
+		const uint32_t available = ring.mHead.load(std::memory_order_acquire) - tail;
+		if (available == 0)
+		{
+			// Only report the close once everything sent before it has been read.
+			if (IsPeerClosed() && ring.mHead.load(std::memory_order_acquire) == tail)
+			{
+				Close();
+			}
+			return false;
+		}
+
+		// The writer publishes whole messages, so anything short or malformed means a corrupt ring.
+		if (available > RdpSharedRing::Capacity || available < sizeof(RdpProtocolHeader))
+		{
+			++mInvalidPackets;
+			Close();
+			return false;
+		}
+
+		// The peer can rewrite the ring at any time, so the header is fetched once, checked, and never read
+		// from the ring again; only the body follows it.
+		RdpProtocolHeader header;
+		Read(ring, tail, &header, sizeof(header));
+		outPacket->mHeader = header;
+		if (!outPacket->IsValid() || available < header.mMessageSize)
+		{
+			++mInvalidPackets;
+			Close();
+			return false;
+		}
+
+		Read(ring, tail + sizeof(header), reinterpret_cast<uint8_t*>(outPacket) + sizeof(header), static_cast<uint32_t>(header.mMessageSize - sizeof(header)));
+		ring.mTail.store(tail + header.mMessageSize, std::memory_order_release);
+		return true;
+	}
+
+	inline void RdpGamepadSharedMemoryTransport::Close()
+	{
+		if (mOpen.exchange(false))
+		{
+			// Tell the other side, waking it if it sleeps on the ring it reads.
+			mRegion->mClosed[mIncoming].store(1, std::memory_order_release);
+			WakeReader(mOutgoing, true);
+		}
+	}
+
+	inline bool RdpGamepadSharedMemoryTransport::IsOpen() const
+	{
+		return mOpen;
+	}
+
+	inline bool RdpGamepadSharedMemoryTransport::WaitReadable(int timeoutMs)
+	{
+		if (!IsOpen())
+		{
+			return false;
+		}
+
+		// Yield while spinning, so on a single core the writer gets to run.
+		const auto spinEnd = std::chrono::steady_clock::now() + std::chrono::microseconds(SpinMicroseconds);
+		do
+		{
+			if (HasIncoming() || IsPeerClosed())
+			{
+				return true;
+			}
+			std::this_thread::yield();
+		}
+		while (std::chrono::steady_clock::now() < spinEnd);
+
+		// Announce the sleep, then check again: a writer either sees mSleeping and wakes us, or published
+		// before the check below. Any wakeup after reading mWakeups makes the wait return at once.
+		RdpSharedRing& ring = mRegion->mRings[mIncoming];
+		const uint32_t wakeups = ring.mWakeups.load(std::memory_order_acquire);
+		ring.mSleeping.store(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (!HasIncoming() && !IsPeerClosed())
+		{
+			RdpSharedMemory::Wait(mMapping, mIncoming, ring.mWakeups, wakeups, timeoutMs);
+		}
+		ring.mSleeping.store(0, std::memory_order_relaxed);
+		return HasIncoming() || IsPeerClosed();
+	}
+
+	inline bool RdpGamepadSharedMemoryTransport::HasIncoming() const
+	{
+		const RdpSharedRing& ring = mRegion->mRings[mIncoming];
+		return ring.mHead.load(std::memory_order_acquire) != ring.mTail.load(std::memory_order_relaxed);
+	}
+
+	inline void RdpGamepadSharedMemoryTransport::Read(const RdpSharedRing& ring, uint32_t position, void* data, uint32_t size) const
+	{
+		const uint32_t offset = position & (RdpSharedRing::Capacity - 1);
+		const uint32_t first = std::min(size, RdpSharedRing::Capacity - offset);
+		std::memcpy(data, ring.mData + offset, first);
+		std::memcpy(static_cast<uint8_t*>(data) + first, ring.mData, size - first);
+	}
+
+	inline void RdpGamepadSharedMemoryTransport::Write(RdpSharedRing& ring, uint32_t position, const void* data, uint32_t size)
+	{
+		const uint32_t offset = position & (RdpSharedRing::Capacity - 1);
+		const uint32_t first = std::min(size, RdpSharedRing::Capacity - offset);
+		std::memcpy(ring.mData + offset, data, first);
+		std::memcpy(ring.mData, static_cast<const uint8_t*>(data) + first, size - first);
+	}
+
+	inline void RdpGamepadSharedMemoryTransport::WakeReader(int ring, bool always)
+	{
+		// Pairs with the fence in WaitReadable between announcing the sleep and checking the ring.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		RdpSharedRing& target = mRegion->mRings[ring];
+		if (always || target.mSleeping.load(std::memory_order_relaxed) != 0)
+		{
+			target.mWakeups.fetch_add(1, std::memory_order_release);
+			RdpSharedMemory::Wake(mMapping, ring, target.mWakeups);
+		}
+	}
+}
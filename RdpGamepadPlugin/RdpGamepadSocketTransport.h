@@ -0,0 +1,453 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include "RdpGamepadTransport.h"
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+namespace RdpGamepad
+{
+	// The few socket calls that differ between Winsock and POSIX.
+	namespace RdpSocket
+	{
+#if defined(_WIN32)
+		typedef SOCKET Handle;
+		const Handle InvalidHandle = INVALID_SOCKET;
+		const int SendFlags = 0;
+
+		inline bool Startup()
+		{
+			static const bool started = []()
+			{
+				WSADATA data;
+				return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+			}();
+			return started;
+		}
+
+		inline void CloseSocket(Handle socket)
+		{ closesocket(socket); }
+
+		inline bool SetNonBlocking(Handle socket)
+		{
+			u_long enable = 1;
+			return ioctlsocket(socket, FIONBIO, &enable) == 0;
+		}
+
+		inline bool WouldBlock()
+		{ return WSAGetLastError() == WSAEWOULDBLOCK; }
+
+		inline bool Wait(Handle socket, short events, int timeoutMs)
+		{
+			WSAPOLLFD descriptor = { socket, events, 0 };
+			return WSAPoll(&descriptor, 1, timeoutMs) > 0;
+		}
+
+		inline void RemovePath(const char* path)
+		{ DeleteFileA(path); }
+#else
+		typedef int Handle;
+		const Handle InvalidHandle = -1;
+		const int SendFlags = MSG_NOSIGNAL;
+
+		inline bool Startup()
+		{ return true; }
+
+		inline void CloseSocket(Handle socket)
+		{ close(socket); }
+
+		inline bool SetNonBlocking(Handle socket)
+		{
+			const int flags = fcntl(socket, F_GETFL, 0);
+			return flags != -1 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+		}
+
+		inline bool WouldBlock()
+		{ return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR; }
+
+		inline bool Wait(Handle socket, short events, int timeoutMs)
+		{
+			pollfd descriptor = { socket, events, 0 };
+			return poll(&descriptor, 1, timeoutMs) > 0;
+		}
+
+		inline void RemovePath(const char* path)
+		{ unlink(path); }
+#endif
+	}
+
+	// A socket address written as "tcp:<port>", "tcp:<IPv4 address>:<port>" or "unix:<path>". A TCP
+	// address without a host is 127.0.0.1.
+	struct RdpSocketAddress
+	{
+		sockaddr_storage mStorage;
+		socklen_t mLength = 0;
+
+		bool Parse(const std::string& text);
+
+		int GetFamily() const
+		{ return mStorage.ss_family; }
+
+		const sockaddr* Get() const
+		{ return reinterpret_cast<const sockaddr*>(&mStorage); }
+
+		const char* GetPath() const
+		{ return reinterpret_cast<const sockaddr_un*>(&mStorage)->sun_path; }
+	};
+
+	// A connected stream socket. Messages are written back to back with no extra framing; the reader
+	// splits the stream with mMessageSize, so a socket carries exactly what the virtual channel carries.
+	// ReceiveBatch takes in everything waiting with a single recv.
+	class RdpGamepadSocketTransport : public RdpGamepadTransport
+	{
+	public:
+		// Takes ownership of a connected socket.
+		explicit RdpGamepadSocketTransport(RdpSocket::Handle socket);
+
+		~RdpGamepadSocketTransport()
+		{ Close(); }
+
+		// Connects to a listening plugin. Returns nullptr when nothing listens at the address.
+		static std::unique_ptr<RdpGamepadSocketTransport> Connect(const RdpSocketAddress& address);
+
+		bool Send(const RdpProtocolHeader& msg) override;
+		bool Receive(RdpProtocolPacket* outPacket) override;
+		bool ReceiveBatch(RdpPacketSpan& outPackets) override;
+		void Close() override;
+		bool IsOpen() const override;
+
+		// Waits up to timeoutMs for more data, so a reader can block between calls to Receive. Safe to
+		// call while another thread sends.
+		bool WaitReadable(int timeoutMs) const
+		{ return RdpSocket::Wait(mSocket, POLLIN, timeoutMs); }
+
+	private:
+		// How long Send waits for a full socket buffer to drain before giving up on the connection.
+		static const int SendTimeoutMs = 1000;
+
+		std::atomic<RdpSocket::Handle> mSocket;
+		RdpMessageSplitter mSplitter;
+
+		// Reads whatever the socket holds, up to the free space in the splitter. Returns the number of
+		// bytes read, 0 if there were none, or -1 once the socket has closed.
+		int Fill();
+	};
+
+	// Accepts connections from receivers at one address.
+	class RdpGamepadSocketListener
+	{
+	public:
+		~RdpGamepadSocketListener()
+		{ Close(); }
+
+		bool Listen(const RdpSocketAddress& address);
+
+		// Waits up to timeoutMs for a receiver to connect. Returns nullptr if none did.
+		std::unique_ptr<RdpGamepadSocketTransport> Accept(int timeoutMs);
+
+		void Close();
+
+	private:
+		RdpSocket::Handle mSocket = RdpSocket::InvalidHandle;
+		std::string mPath;
+	};
+
+	inline bool RdpSocketAddress::Parse(const std::string& text)
+	{
+		std::memset(&mStorage, 0, sizeof(mStorage));
+		mLength = 0;
+
+		if (text.compare(0, 5, "unix:") == 0)
+		{
+			const std::string path = text.substr(5);
+			sockaddr_un* address = reinterpret_cast<sockaddr_un*>(&mStorage);
+			if (path.empty() || path.size() >= sizeof(address->sun_path))
+			{
+				return false;
+			}
+			address->sun_family = AF_UNIX;
+			std::memcpy(address->sun_path, path.c_str(), path.size() + 1);
+			mLength = sizeof(sockaddr_un);
+			return true;
+		}
+
+		if (text.compare(0, 4, "tcp:") == 0)
+		{
+			std::string host = "127.0.0.1";
+			std::string port = text.substr(4);
+			const size_t colon = port.rfind(':');
+			if (colon != std::string::npos)
+			{
+				host = port.substr(0, colon);
+				port = port.substr(colon + 1);
+			}
+
+			char* end = nullptr;
+			const unsigned long value = std::strtoul(port.c_str(), &end, 10);
+			if (port.empty() || *end != '\0' || value == 0 || value > 65535)
+			{
+				return false;
+			}
+
+			sockaddr_in* address = reinterpret_cast<sockaddr_in*>(&mStorage);
+			address->sin_family = AF_INET;
+			address->sin_port = htons(static_cast<uint16_t>(value));
+			if (inet_pton(AF_INET, host.c_str(), &address->sin_addr) != 1)
+			{
+				return false;
+			}
+			mLength = sizeof(sockaddr_in);
+			return true;
+		}
+
+		return false;
+	}
+
+	inline RdpGamepadSocketTransport::RdpGamepadSocketTransport(RdpSocket::Handle socket)
+		: mSocket(socket)
+	{
+		// Messages are tiny and latency bound; never hold one back to coalesce it with the next.
+		int noDelay = 1;
+		setsockopt(mSocket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+		if (!RdpSocket::SetNonBlocking(mSocket))
+		{
+			Close();
+		}
+	}
+
+	inline std::unique_ptr<RdpGamepadSocketTransport> RdpGamepadSocketTransport::Connect(const RdpSocketAddress& address)
+	{
+		if (address.mLength == 0 || !RdpSocket::Startup())
+		{
+			return nullptr;
+		}
+
+		RdpSocket::Handle socket = ::socket(address.GetFamily(), SOCK_STREAM, 0);
+		if (socket == RdpSocket::InvalidHandle)
+		{
+			return nullptr;
+		}
+		if (::connect(socket, address.Get(), address.mLength) != 0)
+		{
+			RdpSocket::CloseSocket(socket);
+			return nullptr;
+		}
+
+		std::unique_ptr<RdpGamepadSocketTransport> transport(new RdpGamepadSocketTransport(socket));
+		return transport->IsOpen() ? std::move(transport) : nullptr;
+	}
+
+	inline bool RdpGamepadSocketTransport::Send(const RdpProtocolHeader& msg)
+	{
+		if (!IsOpen())
+		{
+			return false;
+		}
+
+		const char* data = reinterpret_cast<const char*>(&msg);
+		size_t remaining = msg.mMessageSize;
+		while (remaining != 0)
+		{
+			const auto sent = ::send(mSocket, data, static_cast<int>(remaining), RdpSocket::SendFlags);
+			if (sent > 0)
+			{
+				data += sent;
+				remaining -= static_cast<size_t>(sent);
+			}
+			else if (sent < 0 && RdpSocket::WouldBlock() && RdpSocket::Wait(mSocket, POLLOUT, SendTimeoutMs))
+			{
+				continue;
+			}
+			else
+			{
+				Close();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	inline bool RdpGamepadSocketTransport::Receive(RdpProtocolPacket* outPacket)
+	{
+		while (IsOpen())
+		{
+			RdpPacketView packet;
+			if (!mSplitter.Next(packet))
+			{
+				++mInvalidPackets;
+				Close();
+				return false;
+			}
+			if (packet.mData != nullptr)
+			{
+				packet.CopyTo(*outPacket);
+				return true;
+			}
+			if (Fill() <= 0)
+			{
+				return false;
+			}
+		}
+		return false;
+	}
+
+	inline bool RdpGamepadSocketTransport::ReceiveBatch(RdpPacketSpan& outPackets)
+	{
+		outPackets = RdpPacketSpan();
+		mBatch.clear();
+		if (!IsOpen())
+		{
+			return false;
+		}
+
+		// Whole messages a Receive left buffered go first: reading past them could find the socket
+		// closed, and closing drops the buffer.
+		bool valid = mSplitter.Split(mBatch);
+		if (valid && mBatch.empty())
+		{
+			if (Fill() < 0)
+			{
+				return false;
+			}
+			valid = mSplitter.Split(mBatch);
+		}
+		if (!valid)
+		{
+			++mInvalidPackets;
+			Close();
+			return false;
+		}
+		outPackets = RdpPacketSpan(mBatch.data(), mBatch.size());
+		return !mBatch.empty();
+	}
+
+	inline int RdpGamepadSocketTransport::Fill()
+	{
+		size_t space;
+		char* buffer = mSplitter.GetWriteBuffer(space);
+		if (space == 0)
+		{
+			return 0;
+		}
+
+		const auto received = ::recv(mSocket, buffer, static_cast<int>(space), 0);
+		if (received > 0)
+		{
+			mSplitter.Commit(static_cast<size_t>(received));
+			return static_cast<int>(received);
+		}
+		if (received < 0 && RdpSocket::WouldBlock())
+		{
+			return 0;
+		}
+
+		// Closed by the other end, or failed.
+		Close();
+		return -1;
+	}
+
+	inline void RdpGamepadSocketTransport::Close()
+	{
+		const RdpSocket::Handle socket = mSocket.exchange(RdpSocket::InvalidHandle);
+		if (socket != RdpSocket::InvalidHandle)
+		{
+			RdpSocket::CloseSocket(socket);
+		}
+		mSplitter.Reset();
+	}
+
+	inline bool RdpGamepadSocketTransport::IsOpen() const
+	{
+		return (mSocket != RdpSocket::InvalidHandle);
+	}
+
+	inline bool RdpGamepadSocketListener::Listen(const RdpSocketAddress& address)
+	{
+		Close();
+		if (address.mLength == 0 || !RdpSocket::Startup())
+		{
+			return false;
+		}
+
+		mSocket = ::socket(address.GetFamily(), SOCK_STREAM, 0);
+		if (mSocket == RdpSocket::InvalidHandle)
+		{
+			return false;
+		}
+
+		if (address.GetFamily() == AF_UNIX)
+		{
+			// A socket file left behind by an earlier run would make bind fail.
+			RdpSocket::RemovePath(address.GetPath());
+			mPath = address.GetPath();
+		}
+		else
+		{
+			int reuse = 1;
+			setsockopt(mSocket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+		}
+
+		if (::bind(mSocket, address.Get(), address.mLength) != 0 || ::listen(mSocket, 4) != 0)
+		{
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	inline std::unique_ptr<RdpGamepadSocketTransport> RdpGamepadSocketListener::Accept(int timeoutMs)
+	{
+		if (mSocket == RdpSocket::InvalidHandle || !RdpSocket::Wait(mSocket, POLLIN, timeoutMs))
+		{
+			return nullptr;
+		}
+
+		RdpSocket::Handle socket = ::accept(mSocket, nullptr, nullptr);
+		if (socket == RdpSocket::InvalidHandle)
+		{
+			return nullptr;
+		}
+
+		std::unique_ptr<RdpGamepadSocketTransport> transport(new RdpGamepadSocketTransport(socket));
+		return transport->IsOpen() ? std::move(transport) : nullptr;
+	}
+
+	inline void RdpGamepadSocketListener::Close()
+	{
+		if (mSocket != RdpSocket::InvalidHandle)
+		{
+			RdpSocket::CloseSocket(mSocket);
+			mSocket = RdpSocket::InvalidHandle;
+		}
+		if (!mPath.empty())
+		{
+			RdpSocket::RemovePath(mPath.c_str());
+			mPath.clear();
+		}
+	}
+}
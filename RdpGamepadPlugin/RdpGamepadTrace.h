@@ -0,0 +1,327 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+#include "RdpGamepadLatency.h"
+
+namespace RdpGamepad
+{
+	// Where in the pipeline a sample was taken.
+	enum RdpTraceSource : uint8_t
+	{
+		TraceSourcePlugin,			// Plugin: the state read from the physical controller.
+		TraceSourceReceiver,		// Receiver: the state submitted to the virtual controller.
+	};
+
+	// The type of the state a sample holds.
+	enum RdpTraceKind : uint8_t
+	{
+		TraceKindXInput,			// XINPUT_GAMEPAD.
+		TraceKindDS4,				// PadState.
+	};
+
+#pragma pack(push)
+#pragma pack(1)
+
+	// A trace file is an RdpTraceFileHeader followed by samples, each an RdpTraceSampleHeader followed
+	// by mSize bytes of state. Files are only ever appended to, so a trace cut short by a crash is
+	// still readable up to its last complete sample.
+	struct RdpTraceFileHeader
+	{
+		static constexpr uint32_t Magic = 0x52544752;	// "RGTR"
+		static constexpr uint16_t CurrentVersion = 1;
+
+		uint32_t            mMagic;
+		uint16_t            mVersion;
+		uint16_t            mReserved;
+	};
+
+	struct RdpTraceSampleHeader
+	{
+		uint64_t            mTime;		// RdpLatencyClock nanoseconds.
+		uint8_t             mSource;	// RdpTraceSource.
+		uint8_t             mKind;		// RdpTraceKind.
+		uint16_t            mSize;
+	};
+
+#pragma pack(pop)
+
+	struct RdpTraceSample
+	{
+		static constexpr size_t MaxSize = 64;
+
+		RdpTraceSampleHeader mHeader;
+		uint8_t             mData[MaxSize];
+
+		// Copies the state out, returning false when the sample holds a state of another size.
+		template <typename STATE>
+		bool GetState(STATE& outState) const
+		{
+			static_assert(std::is_trivially_copyable<STATE>::value, "Trace states must be trivially copyable");
+			if (mHeader.mSize != sizeof(STATE))
+			{
+				return false;
+			}
+			std::memcpy(&outState, mData, sizeof(STATE));
+			return true;
+		}
+	};
+
+	// Records controller states to a trace file without blocking the thread producing them: samples
+	// are copied into a preallocated ring and a background thread appends them to the file. When the
+	// writer falls behind and the ring fills up, new samples are dropped and counted.
+	class RdpTraceRecorder
+	{
+	public:
+		static constexpr size_t Capacity = 1024;
+
+		RdpTraceRecorder()
+			: mRing(new RdpTraceSample[Capacity])
+		{}
+
+		~RdpTraceRecorder()
+		{
+			Stop();
+		}
+
+		RdpTraceRecorder(const RdpTraceRecorder&) = delete;
+		RdpTraceRecorder& operator=(const RdpTraceRecorder&) = delete;
+
+		// Starts appending to the given file, replacing the trace it held. PATH is anything std::ofstream
+		// accepts, which includes std::wstring with the Microsoft library.
+		template <typename PATH>
+		bool Start(const PATH& path)
+		{
+			Stop();
+
+			mFile.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+			const RdpTraceFileHeader header = { RdpTraceFileHeader::Magic, RdpTraceFileHeader::CurrentVersion, 0 };
+			mFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			if (!mFile)
+			{
+				mFile.close();
+				return false;
+			}
+
+			{
+				std::unique_lock<std::mutex> lock{mMutex};
+				mHead = 0;
+				mCount = 0;
+				mStopping = false;
+			}
+			mDropped = 0;
+			mThread = std::thread(&RdpTraceRecorder::Write, this);
+			mRecording = true;
+			return true;
+		}
+
+		// Writes out every recorded sample and closes the file.
+		void Stop()
+		{
+			if (!mThread.joinable())
+			{
+				return;
+			}
+
+			mRecording = false;
+			{
+				std::unique_lock<std::mutex> lock{mMutex};
+				mStopping = true;
+			}
+			mWake.notify_one();
+			mThread.join();
+			mFile.close();
+		}
+
+		bool IsRecording() const
+		{ return mRecording; }
+
+		uint64_t GetDroppedCount() const
+		{ return mDropped; }
+
+		template <typename STATE>
+		void Record(RdpTraceSource source, RdpTraceKind kind, const STATE& state)
+		{
+			Record(source, kind, RdpLatencyClock::Now(), state);
+		}
+
+		template <typename STATE>
+		void Record(RdpTraceSource source, RdpTraceKind kind, uint64_t time, const STATE& state)
+		{
+			static_assert(std::is_trivially_copyable<STATE>::value, "Trace states must be trivially copyable");
+			static_assert(sizeof(STATE) <= RdpTraceSample::MaxSize, "State is too large to trace");
+
+			if (!mRecording)
+			{
+				return;
+			}
+
+			bool wake;
+			{
+				std::unique_lock<std::mutex> lock{mMutex};
+				if (mCount == Capacity)
+				{
+					++mDropped;
+					return;
+				}
+
+				RdpTraceSample& sample = mRing[(mHead + mCount) % Capacity];
+				sample.mHeader.mTime = time;
+				sample.mHeader.mSource = source;
+				sample.mHeader.mKind = kind;
+				sample.mHeader.mSize = static_cast<uint16_t>(sizeof(STATE));
+				std::memcpy(sample.mData, &state, sizeof(STATE));
+				++mCount;
+				wake = (mCount == WakeCount);
+			}
+			if (wake)
+			{
+				mWake.notify_one();
+			}
+		}
+
+	private:
+		// The writer runs when a quarter of the ring is used, and at least every 250ms otherwise.
+		static constexpr size_t WakeCount = Capacity / 4;
+
+		std::unique_ptr<RdpTraceSample[]> mRing;
+		size_t mHead = 0;
+		size_t mCount = 0;
+		std::atomic<uint64_t> mDropped{0};
+		std::atomic<bool> mRecording{false};
+		bool mStopping = false;
+		std::mutex mMutex;
+		std::condition_variable mWake;
+		std::thread mThread;
+		std::ofstream mFile;
+
+		void Write()
+		{
+			const std::chrono::milliseconds flushInterval(250);
+
+			std::unique_lock<std::mutex> lock{mMutex};
+			for (;;)
+			{
+				mWake.wait_for(lock, flushInterval, [this]() { return mStopping || mCount >= WakeCount; });
+				const bool stopping = mStopping;
+
+				// The samples taken here stay reserved until mHead moves past them, so producers can keep
+				// filling the rest of the ring while they are written.
+				const size_t head = mHead;
+				const size_t count = mCount;
+				lock.unlock();
+
+				for (size_t i = 0; i < count; ++i)
+				{
+					const RdpTraceSample& sample = mRing[(head + i) % Capacity];
+					mFile.write(reinterpret_cast<const char*>(&sample.mHeader), sizeof(sample.mHeader));
+					mFile.write(reinterpret_cast<const char*>(sample.mData), sample.mHeader.mSize);
+				}
+				if (count != 0)
+				{
+					mFile.flush();
+				}
+
+				lock.lock();
+				mHead = (head + count) % Capacity;
+				mCount -= count;
+				if (stopping && mCount == 0)
+				{
+					return;
+				}
+			}
+		}
+	};
+
+	// Reads the samples of a trace file in the order they were recorded.
+	class RdpTraceReader
+	{
+	public:
+		template <typename PATH>
+		bool Open(const PATH& path)
+		{
+			mFile.open(path, std::ios::in | std::ios::binary);
+			RdpTraceFileHeader header;
+			if (!mFile.read(reinterpret_cast<char*>(&header), sizeof(header)))
+			{
+				return false;
+			}
+			return header.mMagic == RdpTraceFileHeader::Magic && header.mVersion == RdpTraceFileHeader::CurrentVersion;
+		}
+
+		// Returns false at the end of the trace, or at a truncated or malformed sample.
+		bool Next(RdpTraceSample& outSample)
+		{
+			if (!mFile.read(reinterpret_cast<char*>(&outSample.mHeader), sizeof(outSample.mHeader)))
+			{
+				return false;
+			}
+			if (outSample.mHeader.mSize > RdpTraceSample::MaxSize)
+			{
+				return false;
+			}
+			return static_cast<bool>(mFile.read(reinterpret_cast<char*>(outSample.mData), outSample.mHeader.mSize));
+		}
+
+	private:
+		std::ifstream mFile;
+	};
+
+	// Feeds the samples of a trace to a callback, either spaced out as they were recorded or as fast
+	// as the callback accepts them. With no real time pacing the output depends only on the trace,
+	// which makes a trace a deterministic regression and benchmark input.
+	class RdpTraceReplayer
+	{
+	public:
+		enum Pacing
+		{
+			PacingRealTime,				// Reproduce the recorded spacing of the samples.
+			PacingFastest,				// Deliver the samples back to back.
+		};
+
+		// Calls sink(const RdpTraceSample&) for every sample from the given source and returns how many
+		// there were.
+		template <typename SINK>
+		static uint64_t Replay(RdpTraceReader& reader, RdpTraceSource source, Pacing pacing, SINK&& sink)
+		{
+			using Clock = std::chrono::steady_clock;
+
+			uint64_t count = 0;
+			uint64_t firstTime = 0;
+			const Clock::time_point start = Clock::now();
+			RdpTraceSample sample;
+			while (reader.Next(sample))
+			{
+				if (sample.mHeader.mSource != source)
+				{
+					continue;
+				}
+
+				if (count == 0)
+				{
+					firstTime = sample.mHeader.mTime;
+				}
+				if (pacing == PacingRealTime && sample.mHeader.mTime > firstTime)
+				{
+					std::this_thread::sleep_until(start + std::chrono::nanoseconds(sample.mHeader.mTime - firstTime));
+				}
+
+				sink(static_cast<const RdpTraceSample&>(sample));
+				++count;
+			}
+			return count;
+		}
+	};
+}
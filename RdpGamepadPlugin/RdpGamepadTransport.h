@@ -0,0 +1,222 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include "RdpGamepadMessageSplitter.h"
+#include "RdpGamepadProtocol.h"
+
+#if defined(_WIN32)
+#ifndef NTDDI_XP
+#define NTDDI_XP NTDDI_WINXP /* bug in SDK */
+#endif
+
+#include <pchannel.h>
+#include <wtsapi32.h>
+
+#pragma comment(lib, "wtsapi32.lib")
+#endif
+
+#include <vector>
+
+namespace RdpGamepad
+{
+	// The receiver's end of a connection to the plugin. Every backend carries the same messages: an
+	// RdpProtocolHeader followed by the rest of the message, mMessageSize bytes in all.
+	class RdpGamepadTransport
+	{
+	public:
+		virtual ~RdpGamepadTransport()
+		{}
+
+		virtual bool Send(const RdpProtocolHeader& msg) = 0;
+
+		// Never blocks. Returns false when no whole message is waiting; a failed or misbehaving
+		// connection is closed as well.
+		virtual bool Receive(RdpProtocolPacket* outPacket) = 0;
+
+		// Receives every whole message waiting, as views into a buffer the transport reuses; they stay
+		// valid until the next Receive or ReceiveBatch. Returns false when nothing is waiting, like
+		// Receive. Backends that can read many messages at once override the default, which calls
+		// Receive for each.
+		virtual bool ReceiveBatch(RdpPacketSpan& outPackets);
+
+		virtual void Close() = 0;
+		virtual bool IsOpen() const = 0;
+
+		// Number of malformed packets Receive has rejected, each of which also closed the transport.
+		unsigned int GetInvalidPacketCount() const
+		{ return mInvalidPackets; }
+
+	protected:
+		unsigned int mInvalidPackets = 0;
+		std::vector<RdpPacketView> mBatch;
+
+	private:
+		std::vector<RdpProtocolPacket> mBatchPackets;
+	};
+
+	inline bool RdpGamepadTransport::ReceiveBatch(RdpPacketSpan& outPackets)
+	{
+		// Views point into mBatchPackets, so it must not grow while the batch fills.
+		const size_t MaxBatch = 32;
+		mBatchPackets.resize(MaxBatch);
+		mBatch.clear();
+		while (mBatch.size() < MaxBatch && Receive(&mBatchPackets[mBatch.size()]))
+		{
+			const RdpProtocolPacket& packet = mBatchPackets[mBatch.size()];
+			mBatch.push_back(RdpPacketView{ reinterpret_cast<const char*>(&packet), packet.mHeader.mMessageSize });
+		}
+		outPackets = RdpPacketSpan(mBatch.data(), mBatch.size());
+		return !mBatch.empty();
+	}
+
+#if defined(_WIN32)
+	// The RDP dynamic virtual channel opened with WTSVirtualChannelOpenEx in the remote session.
+	class RdpGamepadVirtualChannel : public RdpGamepadTransport
+	{
+	private:
+		HANDLE mHandle;
+
+		union PduAndRdpPacket
+		{
+			char mResponseBytes[CHANNEL_PDU_LENGTH];
+			struct
+			{
+				CHANNEL_PDU_HEADER mPduHeader;
+				RdpProtocolPacket  mRdpPacket;
+			};
+
+			bool IsValid(ULONG size);
+		};
+		static_assert(sizeof(PduAndRdpPacket) == CHANNEL_PDU_LENGTH, "RdpChannelPacket has incorrect size");
+
+	public:
+		RdpGamepadVirtualChannel()
+			: mHandle(nullptr)
+		{}
+
+		// Takes ownership of a handle returned by OpenChannelHandle.
+		explicit RdpGamepadVirtualChannel(HANDLE handle)
+			: mHandle(handle)
+		{}
+
+		~RdpGamepadVirtualChannel()
+		{ Close(); }
+
+		bool Send(const RdpProtocolHeader& msg) override;
+		bool Receive(RdpProtocolPacket* outPacket) override;
+		bool Open();
+		void Close() override;
+		bool IsOpen() const override;
+
+		// Takes ownership of a handle returned by OpenChannelHandle, closing any handle already held.
+		void Attach(HANDLE handle);
+
+		// Opens the channel of the given session; only a service can open another session's channel.
+		static HANDLE OpenChannelHandle(DWORD sessionId = WTS_CURRENT_SESSION);
+		static void CloseChannelHandle(HANDLE handle);
+	};
+
+	inline bool RdpGamepadVirtualChannel::PduAndRdpPacket::IsValid(ULONG size)
+	{
+		// Check the size of the data matches the channel PDU data size.
+		if (size < sizeof(mPduHeader) || size != (sizeof(mPduHeader) + mPduHeader.length))
+		{
+			return false;
+		}
+
+		// Ignore fragmented packets. Should never happen given size of protocol messages.
+		if (mPduHeader.flags != CHANNEL_FLAG_ONLY)
+		{
+			return false;
+		}
+
+		// Make sure we get at least one headers worth of data
+		if (mPduHeader.length < sizeof(RdpGamepad::RdpProtocolHeader))
+		{
+			return false;
+		}
+
+		return mRdpPacket.IsValid();
+	}
+
+	inline bool RdpGamepadVirtualChannel::Send(const RdpProtocolHeader& msg)
+	{
+		ULONG bytesWritten = 0;
+		if (!WTSVirtualChannelWrite(mHandle, (PCHAR)&msg, msg.mMessageSize, &bytesWritten) ||
+			bytesWritten != msg.mMessageSize)
+		{
+			return false;
+		}
+		return true;
+	}
+
+	inline bool RdpGamepadVirtualChannel::Receive(RdpProtocolPacket* outPacket)
+	{
+		ULONG bytesRead = 0;
+		PduAndRdpPacket channelPacket;
+		if (!WTSVirtualChannelRead(mHandle, 0, channelPacket.mResponseBytes, sizeof(channelPacket.mResponseBytes), &bytesRead))
+		{
+			Close();
+			return false;
+		}
+		else if (bytesRead == 0)
+		{
+			return false;
+		}
+		else if (!channelPacket.IsValid(bytesRead))
+		{
+			++mInvalidPackets;
+			Close();
+			return false;
+		}
+		static_assert(std::is_trivially_copyable<RdpProtocolPacket>::value, "RdpProtocolPacket must be trivially copyable for memcpy");
+		std::memcpy(outPacket, &channelPacket.mRdpPacket, channelPacket.mRdpPacket.mHeader.mMessageSize);
+		return true;
+	}
+
+	inline bool RdpGamepadVirtualChannel::Open()
+	{
+		if (mHandle == nullptr)
+		{
+			mHandle = OpenChannelHandle();
+			if (mHandle == nullptr)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	inline void RdpGamepadVirtualChannel::Close()
+	{
+		if (mHandle != nullptr)
+		{
+			CloseChannelHandle(mHandle);
+			mHandle = nullptr;
+		}
+	}
+
+	inline void RdpGamepadVirtualChannel::Attach(HANDLE handle)
+	{
+		Close();
+		mHandle = handle;
+	}
+
+	inline HANDLE RdpGamepadVirtualChannel::OpenChannelHandle(DWORD sessionId)
+	{
+		return WTSVirtualChannelOpenEx(sessionId, const_cast<LPSTR>(RDPGAMEPAD_VIRTUAL_CHANNEL_NAME), WTS_CHANNEL_OPTION_DYNAMIC);
+	}
+
+	inline void RdpGamepadVirtualChannel::CloseChannelHandle(HANDLE handle)
+	{
+		WTSVirtualChannelClose(handle);
+	}
+
+	inline bool RdpGamepadVirtualChannel::IsOpen() const
+	{
+		return (mHandle != nullptr);
+	}
+#endif
+}
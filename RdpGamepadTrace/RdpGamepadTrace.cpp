@@ -0,0 +1,303 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+// Converts controller state traces to the columnar format and summarizes them:
+//
+//   RdpGamepadTrace convert <trace> <columnar trace>
+//   RdpGamepadTrace info <columnar trace>
+//   RdpGamepadTrace summary <columnar trace> [--window ms] [--from ms] [--to ms] [--source plugin|receiver]
+//
+// Summary times are milliseconds from the first frame of the trace.
+
+#include <RdpGamepadColumnarTrace.h>
+#include <RdpGamepadTrace.h>
+#include <ds4_pad.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	using namespace RdpGamepad;
+
+	constexpr uint64_t NanosecondsPerMillisecond = 1000000;
+
+	bool MakeFrame(const RdpTraceSample& sample, RdpTraceFrame& outFrame)
+	{
+		outFrame = RdpTraceFrame{};
+		outFrame.mTime = sample.mHeader.mTime;
+		outFrame.mSource = sample.mHeader.mSource;
+		outFrame.mKind = sample.mHeader.mKind;
+
+		if (sample.mHeader.mKind == TraceKindXInput)
+		{
+			// XINPUT_GAMEPAD, read by layout so the tool does not need the Windows headers: WORD wButtons,
+			// BYTE bLeftTrigger, BYTE bRightTrigger and SHORT sThumbLX, sThumbLY, sThumbRX, sThumbRY.
+			if (sample.mHeader.mSize != 12)
+			{
+				return false;
+			}
+			uint16_t buttons;
+			int16_t thumbs[4];
+			std::memcpy(&buttons, sample.mData, sizeof(buttons));
+			std::memcpy(thumbs, sample.mData + 4, sizeof(thumbs));
+			outFrame.mButtons = buttons;
+			outFrame.mAxes[TraceAxisLeftTrigger] = sample.mData[2];
+			outFrame.mAxes[TraceAxisRightTrigger] = sample.mData[3];
+			outFrame.mAxes[TraceAxisLeftX] = thumbs[0];
+			outFrame.mAxes[TraceAxisLeftY] = thumbs[1];
+			outFrame.mAxes[TraceAxisRightX] = thumbs[2];
+			outFrame.mAxes[TraceAxisRightY] = thumbs[3];
+			return true;
+		}
+
+		if (sample.mHeader.mKind == TraceKindDS4)
+		{
+			PadState state;
+			if (!sample.GetState(state))
+			{
+				return false;
+			}
+			outFrame.mButtons = state.Buttons | (uint32_t(state.SpecialButtons) << 16);
+			outFrame.mAxes[TraceAxisLeftTrigger] = state.AnalogButtons.L2;
+			outFrame.mAxes[TraceAxisRightTrigger] = state.AnalogButtons.R2;
+			outFrame.mAxes[TraceAxisLeftX] = state.StickL.X;
+			outFrame.mAxes[TraceAxisLeftY] = state.StickL.Y;
+			outFrame.mAxes[TraceAxisRightX] = state.StickR.X;
+			outFrame.mAxes[TraceAxisRightY] = state.StickR.Y;
+			return true;
+		}
+
+		return false;
+	}
+
+	int Convert(const char* tracePath, const char* columnarPath)
+	{
+		RdpTraceReader reader;
+		if (!reader.Open(tracePath))
+		{
+			std::fprintf(stderr, "Cannot read trace %s\n", tracePath);
+			return 1;
+		}
+
+		RdpColumnarTraceWriter writer;
+		if (!writer.Open(columnarPath))
+		{
+			std::fprintf(stderr, "Cannot create %s\n", columnarPath);
+			return 1;
+		}
+
+		uint64_t count = 0;
+		uint64_t skipped = 0;
+		RdpTraceSample sample;
+		RdpTraceFrame frame;
+		while (reader.Next(sample))
+		{
+			if (MakeFrame(sample, frame))
+			{
+				writer.Append(frame);
+				++count;
+			}
+			else
+			{
+				++skipped;
+			}
+		}
+
+		if (!writer.Close())
+		{
+			std::fprintf(stderr, "Cannot write %s\n", columnarPath);
+			return 1;
+		}
+		std::printf("%llu frames written, %llu samples skipped\n", (unsigned long long)count, (unsigned long long)skipped);
+		return 0;
+	}
+
+	int Info(const char* columnarPath)
+	{
+		RdpColumnarTraceReader reader;
+		if (!reader.Open(columnarPath))
+		{
+			std::fprintf(stderr, "Cannot read columnar trace %s\n", columnarPath);
+			return 1;
+		}
+
+		const uint64_t frames = reader.GetFrameCount();
+		std::printf("Blocks   %llu\n", (unsigned long long)reader.GetBlockCount());
+		std::printf("Frames   %llu\n", (unsigned long long)frames);
+		std::printf("Bytes    %llu (%.2f per frame)\n", (unsigned long long)reader.GetFileSize(), frames ? double(reader.GetFileSize()) / frames : 0.0);
+		if (reader.GetBlockCount() != 0)
+		{
+			const uint64_t start = reader.GetBlockInfo(0).mFirstTime;
+			const uint64_t end = reader.GetBlockInfo(reader.GetBlockCount() - 1).mMaxTime;
+			std::printf("Duration %.3f s\n", double(end - start) / 1e9);
+		}
+		return 0;
+	}
+
+	// Activity and update intervals of one window of a summary.
+	struct Window
+	{
+		uint64_t mFrames = 0;
+		uint64_t mPresses = 0;
+		uint64_t mAxisMoves = 0;
+		std::vector<uint64_t> mIntervals;
+
+		void Print(uint64_t startMs) const
+		{
+			std::vector<uint64_t> intervals = mIntervals;
+			auto percentile = [&intervals](double fraction) -> double
+			{
+				if (intervals.empty())
+				{
+					return 0.0;
+				}
+				const size_t rank = std::min(intervals.size() - 1, static_cast<size_t>(fraction * intervals.size()));
+				std::nth_element(intervals.begin(), intervals.begin() + rank, intervals.end());
+				return double(intervals[rank]) / NanosecondsPerMillisecond;
+			};
+			std::printf("%10llu %8llu %8.2f %8.2f %8.2f %8llu %8llu\n", (unsigned long long)startMs, (unsigned long long)mFrames,
+				percentile(0.50), percentile(0.99), percentile(1.0), (unsigned long long)mPresses, (unsigned long long)mAxisMoves);
+		}
+	};
+
+	int Summary(const char* columnarPath, uint64_t windowMs, uint64_t fromMs, uint64_t toMs, RdpTraceSource source)
+	{
+		RdpColumnarTraceReader reader;
+		if (!reader.Open(columnarPath))
+		{
+			std::fprintf(stderr, "Cannot read columnar trace %s\n", columnarPath);
+			return 1;
+		}
+		if (reader.GetBlockCount() == 0)
+		{
+			return 0;
+		}
+
+		const uint64_t origin = reader.GetBlockInfo(0).mFirstTime;
+		const uint64_t from = origin + fromMs * NanosecondsPerMillisecond;
+		const uint64_t to = (toMs == UINT64_MAX) ? UINT64_MAX : origin + toMs * NanosecondsPerMillisecond;
+		const uint64_t window = windowMs * NanosecondsPerMillisecond;
+
+		std::printf("%10s %8s %8s %8s %8s %8s %8s\n", "start_ms", "frames", "p50_ms", "p99_ms", "max_ms", "presses", "moves");
+
+		Window current;
+		uint64_t currentIndex = 0;
+		bool hasPrevious = false;
+		RdpTraceFrame previous{};
+		std::vector<RdpTraceFrame> frames;
+		for (size_t block = reader.FindBlock(from); block < reader.GetBlockCount() && reader.GetBlockInfo(block).mFirstTime <= to; ++block)
+		{
+			if (!reader.DecodeBlock(block, frames))
+			{
+				std::fprintf(stderr, "Block %llu is corrupt\n", (unsigned long long)block);
+				return 1;
+			}
+
+			for (const RdpTraceFrame& frame : frames)
+			{
+				if (frame.mSource != source || frame.mTime < from || frame.mTime > to)
+				{
+					continue;
+				}
+
+				const uint64_t index = (frame.mTime - from) / window;
+				if (index > currentIndex && current.mFrames != 0)
+				{
+					current.Print(fromMs + currentIndex * windowMs);
+					current = Window();
+				}
+				currentIndex = std::max(currentIndex, index);
+
+				++current.mFrames;
+				if (hasPrevious)
+				{
+					if (frame.mTime >= previous.mTime)
+					{
+						current.mIntervals.push_back(frame.mTime - previous.mTime);
+					}
+					uint32_t pressed = frame.mButtons & ~previous.mButtons;
+					for (; pressed != 0; pressed &= pressed - 1)
+					{
+						++current.mPresses;
+					}
+					if (std::memcmp(frame.mAxes, previous.mAxes, sizeof(frame.mAxes)) != 0)
+					{
+						++current.mAxisMoves;
+					}
+				}
+				previous = frame;
+				hasPrevious = true;
+			}
+		}
+		if (current.mFrames != 0)
+		{
+			current.Print(fromMs + currentIndex * windowMs);
+		}
+		return 0;
+	}
+
+	int Usage()
+	{
+		std::fprintf(stderr,
+			"Usage:\n"
+			"  RdpGamepadTrace convert <trace> <columnar trace>\n"
+			"  RdpGamepadTrace info <columnar trace>\n"
+			"  RdpGamepadTrace summary <columnar trace> [--window ms] [--from ms] [--to ms] [--source plugin|receiver]\n");
+		return 2;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc == 4 && std::strcmp(argv[1], "convert") == 0)
+	{
+		return Convert(argv[2], argv[3]);
+	}
+
+	if (argc == 3 && std::strcmp(argv[1], "info") == 0)
+	{
+		return Info(argv[2]);
+	}
+
+	if (argc >= 3 && std::strcmp(argv[1], "summary") == 0)
+	{
+		uint64_t windowMs = 1000;
+		uint64_t fromMs = 0;
+		uint64_t toMs = UINT64_MAX;
+		RdpTraceSource source = TraceSourcePlugin;
+		for (int i = 3; i + 1 < argc; i += 2)
+		{
+			if (std::strcmp(argv[i], "--window") == 0)
+			{
+				windowMs = std::strtoull(argv[i + 1], nullptr, 10);
+			}
+			else if (std::strcmp(argv[i], "--from") == 0)
+			{
+				fromMs = std::strtoull(argv[i + 1], nullptr, 10);
+			}
+			else if (std::strcmp(argv[i], "--to") == 0)
+			{
+				toMs = std::strtoull(argv[i + 1], nullptr, 10);
+			}
+			else if (std::strcmp(argv[i], "--source") == 0)
+			{
+				source = (std::strcmp(argv[i + 1], "receiver") == 0) ? TraceSourceReceiver : TraceSourcePlugin;
+			}
+			else
+			{
+				return Usage();
+			}
+		}
+		if ((argc - 3) % 2 != 0 || windowMs == 0 || fromMs > toMs)
+		{
+			return Usage();
+		}
+		return Summary(argv[2], windowMs, fromMs, toMs, source);
+	}
+
+	return Usage();
+}
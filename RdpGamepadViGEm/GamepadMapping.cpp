@@ -0,0 +1,301 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "pch.h"
+
+#include "GamepadMapping.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+namespace {
+
+constexpr double MaxRadialGain = 16.0;
+
+const struct
+{
+	const char* mName;
+	uint16_t mMask;
+} ButtonNames[] =
+{
+	{ "DPAD_UP",        XINPUT_GAMEPAD_DPAD_UP },
+	{ "DPAD_DOWN",      XINPUT_GAMEPAD_DPAD_DOWN },
+	{ "DPAD_LEFT",      XINPUT_GAMEPAD_DPAD_LEFT },
+	{ "DPAD_RIGHT",     XINPUT_GAMEPAD_DPAD_RIGHT },
+	{ "START",          XINPUT_GAMEPAD_START },
+	{ "BACK",           XINPUT_GAMEPAD_BACK },
+	{ "LEFT_THUMB",     XINPUT_GAMEPAD_LEFT_THUMB },
+	{ "RIGHT_THUMB",    XINPUT_GAMEPAD_RIGHT_THUMB },
+	{ "LEFT_SHOULDER",  XINPUT_GAMEPAD_LEFT_SHOULDER },
+	{ "RIGHT_SHOULDER", XINPUT_GAMEPAD_RIGHT_SHOULDER },
+	{ "A",              XINPUT_GAMEPAD_A },
+	{ "B",              XINPUT_GAMEPAD_B },
+	{ "X",              XINPUT_GAMEPAD_X },
+	{ "Y",              XINPUT_GAMEPAD_Y },
+};
+
+double Clamp01(double value)
+{
+	return std::min(std::max(value, 0.0), 1.0);
+}
+
+int32_t ClampAxis(int64_t value)
+{
+	return static_cast<int32_t>(std::min<int64_t>(std::max<int64_t>(value, SHRT_MIN), SHRT_MAX));
+}
+
+bool ParseButton(const std::string& name, uint16_t& outMask)
+{
+	for (const auto& button : ButtonNames)
+	{
+		if (name == button.mName)
+		{
+			outMask = button.mMask;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ParseFloat(const std::string& text, float& outValue)
+{
+	char* end;
+	outValue = std::strtof(text.c_str(), &end);
+	return end != text.c_str() && *end == '\0' && std::isfinite(outValue);
+}
+
+bool ParseByte(const std::string& text, uint8_t& outValue)
+{
+	char* end;
+	const unsigned long value = std::strtoul(text.c_str(), &end, 10);
+	outValue = static_cast<uint8_t>(value);
+	return end != text.c_str() && *end == '\0' && value <= 255;
+}
+
+bool ParseStickSetting(const std::string& field, const std::string& value, StickProfile& stick)
+{
+	float* setting =
+		(field == "AxialDeadzone")    ? &stick.AxialDeadzone :
+		(field == "RadialDeadzone")   ? &stick.RadialDeadzone :
+		(field == "RadialSaturation") ? &stick.RadialSaturation :
+		(field == "CurveExponent")    ? &stick.CurveExponent : nullptr;
+	return setting != nullptr && ParseFloat(value, *setting);
+}
+
+bool ParseTriggerSetting(const std::string& field, const std::string& value, TriggerProfile& trigger)
+{
+	if (field == "CurveExponent")
+	{
+		return ParseFloat(value, trigger.CurveExponent);
+	}
+	uint8_t* setting =
+		(field == "Deadzone")   ? &trigger.Deadzone :
+		(field == "Saturation") ? &trigger.Saturation : nullptr;
+	return setting != nullptr && ParseByte(value, *setting);
+}
+
+bool ParseButtonSetting(const std::string& field, const std::string& value, MappingProfile& profile)
+{
+	uint16_t from;
+	uint16_t to = 0;
+	if (!ParseButton(field, from) || (value != "None" && !ParseButton(value, to)))
+	{
+		return false;
+	}
+	for (unsigned int i = 0; i < 16; ++i)
+	{
+		if (from == (1u << i))
+		{
+			profile.ButtonMap[i] = to;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+MappingProfile::MappingProfile()
+{
+	for (unsigned int i = 0; i < 16; ++i)
+	{
+		ButtonMap[i] = uint16_t(1 << i);
+	}
+}
+
+bool ParseMappingProfile(std::istream& input, MappingProfile& outProfile)
+{
+	MappingProfile profile;
+	std::string line;
+	while (std::getline(input, line))
+	{
+		std::istringstream fields(line.substr(0, line.find('#')));
+		std::string name;
+		std::string value;
+		std::string extra;
+		if (!(fields >> name))
+		{
+			continue;
+		}
+		const size_t dot = name.find('.');
+		if (!(fields >> value) || (fields >> extra) || dot == std::string::npos)
+		{
+			return false;
+		}
+
+		const std::string group = name.substr(0, dot);
+		const std::string field = name.substr(dot + 1);
+		const bool valid =
+			(group == "ButtonMap")    ? ParseButtonSetting(field, value, profile) :
+			(group == "LeftStick")    ? ParseStickSetting(field, value, profile.LeftStick) :
+			(group == "RightStick")   ? ParseStickSetting(field, value, profile.RightStick) :
+			(group == "LeftTrigger")  ? ParseTriggerSetting(field, value, profile.LeftTrigger) :
+			(group == "RightTrigger") ? ParseTriggerSetting(field, value, profile.RightTrigger) : false;
+		if (!valid)
+		{
+			return false;
+		}
+	}
+	outProfile = profile;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// CompiledMapping
+
+CompiledMapping::CompiledMapping(const MappingProfile& profile)
+{
+	for (size_t nibble = 0; nibble < 4; ++nibble)
+	{
+		for (size_t index = 0; index < 16; ++index)
+		{
+			uint16_t result = 0;
+			for (size_t bit = 0; bit < 4; ++bit)
+			{
+				if (index & (size_t(1) << bit))
+				{
+					result |= profile.ButtonMap[nibble * 4 + bit];
+				}
+			}
+			mButtons.mValues[nibble][index] = result;
+		}
+	}
+
+	CompileStick(profile.LeftStick, mSticks[0]);
+	CompileStick(profile.RightStick, mSticks[1]);
+	CompileTrigger(profile.LeftTrigger, mTriggers[0]);
+	CompileTrigger(profile.RightTrigger, mTriggers[1]);
+}
+
+void CompiledMapping::CompileStick(const StickProfile& profile, Stick& stick)
+{
+	const double axial = Clamp01(profile.AxialDeadzone);
+	stick.mAxialOffset = static_cast<int32_t>(axial * SHRT_MAX);
+	// At least one raw unit is left past the deadzone, which keeps the Q16 scale within int32_t.
+	stick.mAxialScale = static_cast<int32_t>(65536.0 / std::max(1.0 - axial, 1.0 / SHRT_MAX));
+
+	const double inner = Clamp01(profile.RadialDeadzone);
+	const double outer = std::max(Clamp01(profile.RadialSaturation), inner + 1.0 / SHRT_MAX);
+	const double exponent = std::max(double(profile.CurveExponent), 0.01);
+	for (size_t index = 0; index < RadialTableSize; ++index)
+	{
+		// Evaluate each bucket at its middle so the error is split evenly across it.
+		const double magnitude = std::sqrt((double(index) + 0.5) * double(1u << RadialShift)) / SHRT_MAX;
+		const double deflection = Clamp01((magnitude - inner) / (outer - inner));
+		const double gain = std::min(std::pow(deflection, exponent) / magnitude, MaxRadialGain);
+		stick.mRadialScale[index] = static_cast<uint32_t>(gain * 65536.0);
+	}
+}
+
+void CompiledMapping::CompileTrigger(const TriggerProfile& profile, uint8_t (&table)[256])
+{
+	const double low = profile.Deadzone;
+	const double high = std::max(double(profile.Saturation), low + 1.0);
+	const double exponent = std::max(double(profile.CurveExponent), 0.01);
+	for (int value = 0; value < 256; ++value)
+	{
+		const double pressure = Clamp01((value - low) / (high - low));
+		table[value] = static_cast<uint8_t>(std::lround(std::pow(pressure, exponent) * 255.0));
+	}
+}
+
+void CompiledMapping::ApplyStick(const Stick& stick, SHORT& x, SHORT& y)
+{
+	// Axial deadzone: shrink each axis towards the center and stretch the remainder back to full range.
+	const int32_t signX = int32_t(x) >> 31;
+	const int32_t signY = int32_t(y) >> 31;
+	const int32_t absX = (int32_t(x) ^ signX) - signX;
+	const int32_t absY = (int32_t(y) ^ signY) - signY;
+	const int32_t axialX = ClampAxis((int64_t(std::max(absX - stick.mAxialOffset, 0)) * stick.mAxialScale) >> 16);
+	const int32_t axialY = ClampAxis((int64_t(std::max(absY - stick.mAxialOffset, 0)) * stick.mAxialScale) >> 16);
+	const int32_t ax = (axialX ^ signX) - signX;
+	const int32_t ay = (axialY ^ signY) - signY;
+
+	// Radial deadzone, saturation and response curve as one gain looked up by squared magnitude.
+	const uint32_t magnitude2 = uint32_t(ax * ax) + uint32_t(ay * ay);
+	const uint32_t gain = stick.mRadialScale[magnitude2 >> RadialShift];
+	x = static_cast<SHORT>(ClampAxis((int64_t(ax) * gain) >> 16));
+	y = static_cast<SHORT>(ClampAxis((int64_t(ay) * gain) >> 16));
+}
+
+void CompiledMapping::Apply(XINPUT_GAMEPAD& gamepad) const
+{
+	gamepad.wButtons = mButtons.Remap(gamepad.wButtons);
+	gamepad.bLeftTrigger = mTriggers[0][gamepad.bLeftTrigger];
+	gamepad.bRightTrigger = mTriggers[1][gamepad.bRightTrigger];
+	ApplyStick(mSticks[0], gamepad.sThumbLX, gamepad.sThumbLY);
+	ApplyStick(mSticks[1], gamepad.sThumbRX, gamepad.sThumbRY);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// GamepadMapper
+
+void GamepadMapper::SetProfile(const MappingProfile& profile)
+{
+	Publish(std::unique_ptr<const CompiledMapping>(new CompiledMapping(profile)));
+}
+
+void GamepadMapper::ClearProfile()
+{
+	Publish(nullptr);
+}
+
+bool GamepadMapper::Apply(XINPUT_GAMEPAD& gamepad) const
+{
+	mActiveReaders.fetch_add(1);
+	const CompiledMapping* mapping = mCurrent.load();
+	if (mapping != nullptr)
+	{
+		mapping->Apply(gamepad);
+	}
+	mActiveReaders.fetch_sub(1);
+	return mapping != nullptr;
+}
+
+size_t GamepadMapper::GetRetiredCount()
+{
+	std::unique_lock<std::mutex> lock{mPublishMutex};
+	return mRetired.size();
+}
+
+void GamepadMapper::Publish(std::unique_ptr<const CompiledMapping> mapping)
+{
+	std::unique_lock<std::mutex> lock{mPublishMutex};
+
+	mCurrent.store(mapping.get());
+	if (mOwned)
+	{
+		mRetired.push_back(std::move(mOwned));
+	}
+	mOwned = std::move(mapping);
+
+	// Readers that loaded a retired mapping are done with it as soon as no reader is active, since any
+	// reader starting after the store above sees the new mapping.
+	if (mActiveReaders.load() == 0)
+	{
+		mRetired.clear();
+	}
+}
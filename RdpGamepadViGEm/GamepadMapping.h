@@ -0,0 +1,110 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <RdpGamepadPlatform.h>
+
+#include "ViGEmConversion.h"
+
+struct StickProfile
+{
+	float AxialDeadzone = 0.0f;		// Per axis, fraction of full range ignored around the center.
+	float RadialDeadzone = 0.0f;	// Fraction of full deflection ignored around the center.
+	float RadialSaturation = 1.0f;	// Fraction of full deflection that already reports full deflection. The square
+									// corners of the raw range are past 1, so they are pulled onto the circle too.
+	float CurveExponent = 1.0f;		// Output magnitude is input^CurveExponent; 1 is linear.
+};
+
+struct TriggerProfile
+{
+	uint8_t Deadzone = 0;			// Raw values at or below this report 0.
+	uint8_t Saturation = 255;		// Raw values at or above this report 255.
+	float CurveExponent = 1.0f;
+};
+
+// A user facing description of how controller input should be reshaped before it reaches the virtual pad.
+struct MappingProfile
+{
+	uint16_t ButtonMap[16];			// XInput button bit i is reported as ButtonMap[i] (0 drops the button).
+	StickProfile LeftStick;
+	StickProfile RightStick;
+	TriggerProfile LeftTrigger;
+	TriggerProfile RightTrigger;
+
+	MappingProfile();
+};
+
+// Reads a profile from text with one setting per line, a name and a value, where # starts a comment:
+//
+//   ButtonMap.A B                   Report A as B; a value of None drops the button.
+//   LeftStick.RadialDeadzone 0.1    Any StickProfile field, for LeftStick and RightStick.
+//   RightTrigger.Deadzone 30        Any TriggerProfile field, for LeftTrigger and RightTrigger.
+//
+// Buttons are named as the XINPUT_GAMEPAD_ constants without the prefix, such as DPAD_UP, START or A.
+// Settings not given keep their defaults. Returns false, leaving outProfile untouched, at the first line
+// it cannot read.
+bool ParseMappingProfile(std::istream& input, MappingProfile& outProfile);
+
+// A MappingProfile flattened into tables so applying it is a handful of loads and multiplies with no branches.
+class CompiledMapping
+{
+public:
+	static constexpr unsigned int RadialShift = 19;
+	static constexpr size_t RadialTableSize = (size_t(2) * 32768 * 32768 >> RadialShift) + 1;
+
+	explicit CompiledMapping(const MappingProfile& profile);
+
+	void Apply(XINPUT_GAMEPAD& gamepad) const;
+
+private:
+	struct Stick
+	{
+		int32_t mAxialOffset;			// Axial deadzone in raw units.
+		int32_t mAxialScale;			// Q16 rescale of what is left after the axial deadzone.
+		uint32_t mRadialScale[RadialTableSize];	// Q16 gain indexed by squared magnitude >> RadialShift.
+	};
+
+	ViGEmConversion::ButtonTable mButtons;
+	Stick mSticks[2];
+	uint8_t mTriggers[2][256];
+
+	static void CompileStick(const StickProfile& profile, Stick& stick);
+	static void CompileTrigger(const TriggerProfile& profile, uint8_t (&table)[256]);
+	static void ApplyStick(const Stick& stick, SHORT& x, SHORT& y);
+};
+
+// Applies the current mapping profile to controller states. Profiles can be replaced from any thread
+// while another thread is applying them; Apply never takes a lock.
+class GamepadMapper
+{
+public:
+	GamepadMapper() = default;
+	GamepadMapper(const GamepadMapper&) = delete;
+	GamepadMapper& operator=(const GamepadMapper&) = delete;
+
+	void SetProfile(const MappingProfile& profile);
+	void ClearProfile();
+
+	// Returns false, leaving gamepad untouched, when no profile is set.
+	bool Apply(XINPUT_GAMEPAD& gamepad) const;
+
+	// Replaced mappings that a reader may still be using and are not freed yet.
+	size_t GetRetiredCount();
+
+private:
+	std::atomic<const CompiledMapping*> mCurrent{nullptr};
+	mutable std::atomic<unsigned int> mActiveReaders{0};
+	std::unique_ptr<const CompiledMapping> mOwned;
+	std::vector<std::unique_ptr<const CompiledMapping>> mRetired;
+	std::mutex mPublishMutex;
+
+	void Publish(std::unique_ptr<const CompiledMapping> mapping);
+};
@@ -0,0 +1,138 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "RdpGamepadStateQueue.h"
+
+// Plays the button edges the plugin sampled between two states back onto the newest state, one edge at
+// a time and in order, holding each combination of buttons for at least the minimum hold time so a tap
+// shorter than the state interval still reaches the game. Edges that arrived together keep their spacing
+// at the source when it is longer. Analog changes are never held back. All times are in microseconds.
+template <typename STATE, typename TRAITS = RdpGamepadButtonTraits<STATE>>
+class RdpGamepadButtonReplay
+{
+public:
+	static constexpr size_t Capacity = 32;
+
+	explicit RdpGamepadButtonReplay(uint64_t minHold = 20000)
+		: mMinHold(minHold)
+	{}
+
+	void SetMinHold(uint64_t minHold)
+	{ mMinHold = minHold; }
+
+	// An edge: the digital inputs right after a change, when the change happened and when it arrived.
+	void PushEdge(uint32_t digital, uint64_t time, uint64_t now)
+	{
+		const bool queued = mCount != 0;
+		const uint32_t last = queued ? mEntries[(mHead + mCount - 1) % Capacity].mDigital : mDigital;
+		if ((queued || mHasDigital) && digital == last)
+		{
+			return;
+		}
+
+		// Out of room: fold the change into the newest edge, which keeps the final state right.
+		if (mCount == Capacity)
+		{
+			mEntries[(mHead + mCount - 1) % Capacity].mDigital = digital;
+			++mFolded;
+			return;
+		}
+		Entry& entry = mEntries[(mHead + mCount) % Capacity];
+		entry.mDigital = digital;
+		entry.mTime = time;
+		entry.mArrival = now;
+		++mCount;
+	}
+
+	// A complete state. Its digital inputs count as one more edge if the edges before it did not end there,
+	// as happens with a plugin that does not send edges.
+	void Push(const STATE& state, uint64_t now)
+	{
+		mLatest = state;
+		mHasLatest = true;
+		mLatestChanged = true;
+		PushEdge(TRAITS::GetDigital(state), now, now);
+	}
+
+	// Calls apply with the newest state carrying the digital inputs that are due: the next edge once the
+	// current one has been held long enough, otherwise the current one if a new state arrived.
+	template <typename FUNC>
+	void Release(uint64_t now, FUNC&& apply)
+	{
+		if (!mHasLatest)
+		{
+			return;
+		}
+
+		if (mCount != 0)
+		{
+			const Entry& next = mEntries[mHead];
+			const bool together = mHasDigital && next.mArrival == mDigitalArrival && next.mTime > mDigitalTime;
+			const uint64_t spacing = together ? next.mTime - mDigitalTime : 0;
+			const uint64_t hold = (spacing > mMinHold) ? spacing : mMinHold;
+			if (!mHasDigital || now - mAppliedTime >= hold)
+			{
+				mDigital = next.mDigital;
+				mDigitalTime = next.mTime;
+				mDigitalArrival = next.mArrival;
+				mAppliedTime = now;
+				mHasDigital = true;
+				mHead = (mHead + 1) % Capacity;
+				--mCount;
+				mLatestChanged = true;
+			}
+		}
+
+		if (mLatestChanged && mHasDigital)
+		{
+			STATE state = mLatest;
+			TRAITS::SetDigital(state, mDigital);
+			apply(state);
+			mLatestChanged = false;
+		}
+	}
+
+	void Reset()
+	{
+		mHead = 0;
+		mCount = 0;
+		mHasLatest = false;
+		mHasDigital = false;
+		mLatestChanged = false;
+	}
+
+	// Edges not waiting their turn yet.
+	size_t GetPendingCount() const
+	{ return mCount; }
+
+	// Edges merged into a later one because too many were waiting.
+	uint64_t GetFoldedCount() const
+	{ return mFolded; }
+
+private:
+	struct Entry
+	{
+		uint64_t mTime;
+		uint64_t mArrival;
+		uint32_t mDigital;
+	};
+
+	std::array<Entry, Capacity> mEntries{};
+	size_t mHead = 0;
+	size_t mCount = 0;
+	uint64_t mMinHold;
+	uint64_t mFolded = 0;
+	STATE mLatest{};
+	uint64_t mDigitalTime = 0;
+	uint64_t mDigitalArrival = 0;
+	uint64_t mAppliedTime = 0;
+	uint32_t mDigital = 0;
+	bool mHasLatest = false;
+	bool mHasDigital = false;
+	bool mLatestChanged = false;
+};
@@ -0,0 +1,102 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "pch.h"
+
+#include "RdpGamepadConnection.h"
+
+namespace {
+
+constexpr std::chrono::milliseconds OpenRetryInitialDelay{100};
+constexpr std::chrono::milliseconds OpenRetryMaxDelay{5000};
+constexpr double OpenRetryJitter = 0.25;
+
+} // namespace
+
+RdpGamepadConnection::RdpGamepadConnection(OpenFunction open, CloseFunction close)
+	: mOpen(std::move(open))
+	, mClose(std::move(close))
+	, mBackoff(OpenRetryInitialDelay, OpenRetryMaxDelay, OpenRetryJitter, std::random_device{}())
+{}
+
+RdpGamepadConnection::~RdpGamepadConnection()
+{
+	Stop();
+}
+
+void RdpGamepadConnection::Start()
+{
+	std::unique_lock<std::mutex> lock{mMutex};
+	if (mKeepRunning)
+	{
+		return;
+	}
+
+	mKeepRunning = true;
+	mWantHandle = true;
+	mBackoff.Reset();
+	mThread = std::thread(&RdpGamepadConnection::Run, this);
+}
+
+void RdpGamepadConnection::Stop()
+{
+	{
+		std::unique_lock<std::mutex> lock{mMutex};
+		mKeepRunning = false;
+	}
+	mWakeUp.notify_all();
+
+	// An open that is already in progress can't be interrupted, so this waits for it to return.
+	if (mThread.joinable())
+	{
+		mThread.join();
+	}
+
+	if (Handle handle = mHandle.exchange(nullptr))
+	{
+		mClose(handle);
+	}
+}
+
+void RdpGamepadConnection::Reconnect()
+{
+	{
+		std::unique_lock<std::mutex> lock{mMutex};
+		if (mWantHandle || mHandle.load() != nullptr)
+		{
+			return;
+		}
+		mWantHandle = true;
+	}
+	mWakeUp.notify_all();
+}
+
+void RdpGamepadConnection::Run()
+{
+	std::unique_lock<std::mutex> lock{mMutex};
+	while (mKeepRunning)
+	{
+		if (!mWantHandle)
+		{
+			mWakeUp.wait(lock, [this]() { return !mKeepRunning || mWantHandle; });
+			continue;
+		}
+
+		lock.unlock();
+		++mOpenAttempts;
+		Handle handle = mOpen();
+		lock.lock();
+
+		if (handle != nullptr)
+		{
+			mBackoff.Reset();
+			mWantHandle = false;
+			mHandle.store(handle);
+		}
+		else
+		{
+			const auto delay = mBackoff.NextDelay();
+			mWakeUp.wait_for(lock, delay, [this]() { return !mKeepRunning; });
+		}
+	}
+}
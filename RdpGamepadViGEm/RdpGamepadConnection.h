@@ -0,0 +1,86 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+
+// Exponential backoff with random jitter for channel open retries.
+class RdpGamepadBackoff
+{
+public:
+	RdpGamepadBackoff(std::chrono::milliseconds initialDelay, std::chrono::milliseconds maxDelay, double jitter, unsigned int seed)
+		: mInitialDelay(initialDelay)
+		, mMaxDelay(maxDelay)
+		, mJitter(jitter)
+		, mNextDelay(initialDelay)
+		, mRandom(seed)
+	{}
+
+	// Returns the delay to wait before the next attempt and doubles the base delay for the one after.
+	std::chrono::milliseconds NextDelay()
+	{
+		const std::chrono::milliseconds base = mNextDelay;
+		mNextDelay = (mNextDelay * 2 < mMaxDelay) ? mNextDelay * 2 : mMaxDelay;
+
+		std::uniform_real_distribution<double> spread(1.0 - mJitter, 1.0 + mJitter);
+		return std::chrono::milliseconds(static_cast<long long>(base.count() * spread(mRandom)));
+	}
+
+	void Reset()
+	{ mNextDelay = mInitialDelay; }
+
+private:
+	std::chrono::milliseconds mInitialDelay;
+	std::chrono::milliseconds mMaxDelay;
+	double mJitter;
+	std::chrono::milliseconds mNextDelay;
+	std::minstd_rand mRandom;
+};
+
+// Opens the RDP virtual channel on a background thread so the processing loop never blocks on
+// WTSVirtualChannelOpenEx. An opened handle is published for the processing loop to take; once taken
+// the connection stays idle until Reconnect is called.
+class RdpGamepadConnection
+{
+public:
+	typedef void* Handle;
+	typedef std::function<Handle()> OpenFunction;
+	typedef std::function<void(Handle)> CloseFunction;
+
+	RdpGamepadConnection(OpenFunction open, CloseFunction close);
+	~RdpGamepadConnection();
+
+	void Start();
+	void Stop();
+
+	// Returns the opened handle, transferring ownership to the caller, or nullptr if none is ready.
+	Handle TakeHandle()
+	{ return mHandle.exchange(nullptr); }
+
+	// Requests a new handle. Does nothing if a handle is already waiting or an open is in progress.
+	void Reconnect();
+
+	unsigned int GetOpenAttempts() const
+	{ return mOpenAttempts; }
+
+private:
+	OpenFunction mOpen;
+	CloseFunction mClose;
+	RdpGamepadBackoff mBackoff;
+	std::atomic<Handle> mHandle{nullptr};
+	std::atomic<unsigned int> mOpenAttempts{0};
+	std::thread mThread;
+	std::mutex mMutex;
+	std::condition_variable mWakeUp;
+	bool mWantHandle = false;
+	bool mKeepRunning = false;
+
+	void Run();
+};
@@ -0,0 +1,440 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// All times are in microseconds.
+struct RdpGamepadTaskStatistics
+{
+	uint64_t mRuns = 0;
+	uint64_t mStolenRuns = 0;		// Runs on a worker other than the task's home worker.
+	uint64_t mDeadlineMisses = 0;	// Runs that finished after the task was due again.
+	uint64_t mSkippedRuns = 0;		// Periods dropped because the task was still behind.
+	uint64_t mRunTime = 0;			// Total time spent running the task.
+	uint64_t mMaxRunTime = 0;
+	uint64_t mMaxStartDelay = 0;	// Longest wait between the task falling due and starting.
+};
+
+// Runs periodic tasks, such as the tick of each pad or session, on a small pool of worker threads.
+// Each task runs once per period and has to finish before it is due again, its deadline. Every task has
+// a home worker, whose queue runs tasks in the order they fall due, so with equal periods the earliest
+// deadline goes first. Tasks stay on their home worker, and on its core when workers are pinned, unless
+// that worker falls behind: a worker with nothing due steals the most overdue task of the others once it
+// is StealSlackUs late, and the task goes back home afterwards. A task never runs on two workers at
+// once, and a task that overran drops the periods it missed instead of running them back to back.
+class RdpGamepadExecutor
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr int64_t StealSlackUs = 200;
+
+	// A worker count of 0 starts one worker per core, but at least two so that one stuck task can't
+	// stall the others.
+	explicit RdpGamepadExecutor(unsigned int workers = 0)
+	{
+		if (workers == 0)
+		{
+			workers = std::thread::hardware_concurrency();
+			workers = (workers < 2) ? 2 : workers;
+		}
+		for (unsigned int i = 0; i < workers; ++i)
+		{
+			mWorkers.emplace_back(new Worker);
+		}
+	}
+
+	~RdpGamepadExecutor()
+	{ Stop(); }
+
+	// Pins worker i to core i, modulo the number of cores. Only call this while stopped.
+	void SetPinWorkers(bool pin)
+	{ mPinWorkers = pin; }
+
+	void Start()
+	{
+		if (mRunning.exchange(true))
+		{
+			return;
+		}
+		for (unsigned int i = 0; i < mWorkers.size(); ++i)
+		{
+			mWorkers[i]->mThread = std::thread(&RdpGamepadExecutor::Work, this, i);
+		}
+	}
+
+	// Waits for running tasks to finish. Tasks stay added and resume at the next Start.
+	void Stop()
+	{
+		mRunning = false;
+		for (auto& worker : mWorkers)
+		{
+			{
+				std::unique_lock<std::mutex> lock(worker->mMutex);
+			}
+			worker->mWake.notify_all();
+		}
+		for (auto& worker : mWorkers)
+		{
+			if (worker->mThread.joinable())
+			{
+				worker->mThread.join();
+			}
+		}
+	}
+
+	// Runs tick every period from now on, first at a point spread over the period. Tasks whose affinity
+	// hints are equal modulo the worker count share a home worker; a negative hint picks the worker with
+	// the fewest tasks. Returns the id that Remove and GetStatistics take.
+	uint32_t Add(std::function<void()> tick, std::chrono::microseconds period, int affinity = -1)
+	{
+		std::shared_ptr<Task> task = std::make_shared<Task>();
+		task->mTick = std::move(tick);
+		task->mPeriod = period;
+
+		uint32_t id;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			id = mNextId++;
+			if (affinity >= 0)
+			{
+				task->mHome = static_cast<unsigned int>(affinity) % mWorkers.size();
+			}
+			else
+			{
+				task->mHome = 0;
+				for (unsigned int i = 1; i < mWorkers.size(); ++i)
+				{
+					task->mHome = (mWorkers[i]->mTaskCount < mWorkers[task->mHome]->mTaskCount) ? i : task->mHome;
+				}
+			}
+			++mWorkers[task->mHome]->mTaskCount;
+			mTasks.emplace(id, task);
+		}
+
+		// Spread first runs over the period by the golden ratio, which keeps any run of ids even.
+		const uint64_t offset = (uint64_t(id) * 0x9E3779B9u & 0xffffffffu) * period.count() >> 32;
+		Push(Due{ Clock::now() + std::chrono::microseconds(offset), task });
+		return id;
+	}
+
+	// Waits for a running tick of the task to finish, and releases the tick function, so whatever it
+	// uses can be destroyed right after. Don't call this from a task.
+	bool Remove(uint32_t id)
+	{
+		std::shared_ptr<Task> task;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			auto it = mTasks.find(id);
+			if (it == mTasks.end())
+			{
+				return false;
+			}
+			task = std::move(it->second);
+			mTasks.erase(it);
+			--mWorkers[task->mHome]->mTaskCount;
+		}
+
+		// Its last entry stays queued until a worker pops and drops it.
+		std::unique_lock<std::mutex> lock(task->mMutex);
+		task->mRemoved = true;
+		task->mIdle.wait(lock, [&task]() { return !task->mRunning; });
+		task->mTick = nullptr;
+		return true;
+	}
+
+	bool GetStatistics(uint32_t id, RdpGamepadTaskStatistics& outStatistics) const
+	{
+		std::shared_ptr<Task> task;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			auto it = mTasks.find(id);
+			if (it == mTasks.end())
+			{
+				return false;
+			}
+			task = it->second;
+		}
+		std::unique_lock<std::mutex> lock(task->mMutex);
+		outStatistics = task->mStatistics;
+		return true;
+	}
+
+	size_t GetTaskCount() const
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		return mTasks.size();
+	}
+
+	unsigned int GetWorkerCount() const
+	{ return static_cast<unsigned int>(mWorkers.size()); }
+
+	// Runs of all tasks, removed ones included, that a worker other than their home worker took.
+	uint64_t GetStealCount() const
+	{ return mSteals; }
+
+private:
+	struct Task
+	{
+		std::function<void()> mTick;
+		std::chrono::microseconds mPeriod;
+		unsigned int mHome = 0;
+
+		// Guards the rest.
+		std::mutex mMutex;
+		std::condition_variable mIdle;
+		RdpGamepadTaskStatistics mStatistics;
+		bool mRunning = false;
+		bool mRemoved = false;
+	};
+
+	struct Due
+	{
+		Clock::time_point mTime;
+		std::shared_ptr<Task> mTask;
+
+		bool operator>(const Due& other) const
+		{ return mTime > other.mTime; }
+	};
+
+	struct Worker
+	{
+		std::mutex mMutex;
+		std::condition_variable mWake;
+		std::priority_queue<Due, std::vector<Due>, std::greater<Due>> mQueue;
+		std::thread mThread;
+		size_t mTaskCount = 0;		// Tasks at home here, guarded by the executor's mMutex.
+		bool mSleeping = false;
+		Clock::time_point mSleepUntil;	// While sleeping, when the worker wakes by itself.
+	};
+
+	std::vector<std::unique_ptr<Worker>> mWorkers;
+	mutable std::mutex mMutex;
+	std::unordered_map<uint32_t, std::shared_ptr<Task>> mTasks;
+	std::atomic<bool> mRunning{false};
+	std::atomic<uint64_t> mSteals{0};
+	std::atomic<uint64_t> mPushes{0};		// Bumped after every push, so a worker going to sleep sees it missed one.
+	std::atomic<unsigned int> mSleepers{0};
+	uint32_t mNextId = 1;
+	bool mPinWorkers = false;
+
+	void Push(Due due)
+	{
+		const unsigned int home = due.mTask->mHome;
+		const Clock::time_point stealTime = due.mTime + std::chrono::microseconds(StealSlackUs);
+		{
+			Worker& worker = *mWorkers[home];
+			std::unique_lock<std::mutex> lock(worker.mMutex);
+			const bool earliest = worker.mQueue.empty() || due.mTime < worker.mQueue.top().mTime;
+			worker.mQueue.push(std::move(due));
+			if (earliest)
+			{
+				worker.mWake.notify_one();
+			}
+		}
+
+		// The home worker may be busy, and the others planned their sleep without this task. Wake one that
+		// would sleep past the moment it could steal it.
+		++mPushes;
+		if (mSleepers == 0)
+		{
+			return;
+		}
+		for (unsigned int i = 1; i < mWorkers.size(); ++i)
+		{
+			Worker& worker = *mWorkers[(home + i) % mWorkers.size()];
+			std::unique_lock<std::mutex> lock(worker.mMutex);
+			if (worker.mSleeping && worker.mSleepUntil > stealTime)
+			{
+				worker.mSleeping = false;
+				worker.mWake.notify_one();
+				return;
+			}
+		}
+	}
+
+	// Pops the first task of a worker if it fell due at least slack ago.
+	bool TakeDue(Worker& worker, Clock::time_point now, std::chrono::microseconds slack, Due& outDue)
+	{
+		std::unique_lock<std::mutex> lock(worker.mMutex);
+		if (worker.mQueue.empty() || worker.mQueue.top().mTime + slack > now)
+		{
+			return false;
+		}
+		outDue = worker.mQueue.top();
+		worker.mQueue.pop();
+		return true;
+	}
+
+	// Takes the most overdue task of the other workers, if any is late enough to steal.
+	bool Steal(unsigned int self, Clock::time_point now, Due& outDue)
+	{
+		const std::chrono::microseconds slack(StealSlackUs);
+		Worker* victim = nullptr;
+		Clock::time_point oldest = now - slack;
+		for (unsigned int i = 1; i < mWorkers.size(); ++i)
+		{
+			Worker& worker = *mWorkers[(self + i) % mWorkers.size()];
+			std::unique_lock<std::mutex> lock(worker.mMutex);
+			if (!worker.mQueue.empty() && worker.mQueue.top().mTime <= oldest)
+			{
+				oldest = worker.mQueue.top().mTime;
+				victim = &worker;
+			}
+		}
+		return victim != nullptr && TakeDue(*victim, now, slack, outDue);
+	}
+
+	void Sleep(unsigned int self)
+	{
+		// Wake for the next task at home, or when a task elsewhere becomes late enough to steal.
+		const uint64_t pushes = mPushes;
+		const std::chrono::microseconds slack(StealSlackUs);
+		Clock::time_point wake = Clock::time_point::max();
+		for (unsigned int i = 1; i < mWorkers.size(); ++i)
+		{
+			Worker& worker = *mWorkers[(self + i) % mWorkers.size()];
+			std::unique_lock<std::mutex> lock(worker.mMutex);
+			if (!worker.mQueue.empty() && worker.mQueue.top().mTime + slack < wake)
+			{
+				wake = worker.mQueue.top().mTime + slack;
+			}
+		}
+
+		Worker& worker = *mWorkers[self];
+		std::unique_lock<std::mutex> lock(worker.mMutex);
+		if (!worker.mQueue.empty() && worker.mQueue.top().mTime < wake)
+		{
+			wake = worker.mQueue.top().mTime;
+		}
+		if (!mRunning)
+		{
+			return;
+		}
+
+		// Announced before checking for pushes, so a push either shows up here or finds this worker asleep.
+		worker.mSleeping = true;
+		worker.mSleepUntil = wake;
+		++mSleepers;
+		if (mPushes == pushes)
+		{
+			if (wake == Clock::time_point::max())
+			{
+				worker.mWake.wait(lock);
+			}
+			else
+			{
+				worker.mWake.wait_until(lock, wake);
+			}
+		}
+		worker.mSleeping = false;
+		--mSleepers;
+	}
+
+	void Pin(unsigned int self)
+	{
+		const unsigned int cores = std::thread::hardware_concurrency();
+		const unsigned int core = (cores != 0) ? self % cores : 0;
+#if defined(_WIN32)
+		SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << (core % (sizeof(DWORD_PTR) * 8)));
+#elif defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+		(void)core;
+#endif
+	}
+
+	void Work(unsigned int self)
+	{
+		if (mPinWorkers)
+		{
+			Pin(self);
+		}
+
+		while (mRunning)
+		{
+			const Clock::time_point now = Clock::now();
+			Due due;
+			bool stolen = false;
+			if (!TakeDue(*mWorkers[self], now, std::chrono::microseconds(0), due))
+			{
+				stolen = Steal(self, now, due);
+				if (!stolen)
+				{
+					Sleep(self);
+					continue;
+				}
+			}
+			Run(due, stolen);
+		}
+	}
+
+	void Run(Due& due, bool stolen)
+	{
+		Task& task = *due.mTask;
+		{
+			std::unique_lock<std::mutex> lock(task.mMutex);
+			if (task.mRemoved)
+			{
+				return;
+			}
+			task.mRunning = true;
+		}
+
+		const Clock::time_point start = Clock::now();
+		task.mTick();
+		const Clock::time_point end = Clock::now();
+
+		std::unique_lock<std::mutex> lock(task.mMutex);
+		task.mRunning = false;
+		if (task.mRemoved)
+		{
+			task.mIdle.notify_all();
+			return;
+		}
+
+		using std::chrono::duration_cast;
+		using std::chrono::microseconds;
+		RdpGamepadTaskStatistics& statistics = task.mStatistics;
+		const uint64_t delay = duration_cast<microseconds>(start - due.mTime).count();
+		const uint64_t runTime = duration_cast<microseconds>(end - start).count();
+		++statistics.mRuns;
+		statistics.mStolenRuns += stolen ? 1 : 0;
+		statistics.mDeadlineMisses += (end > due.mTime + task.mPeriod) ? 1 : 0;
+		statistics.mRunTime += runTime;
+		statistics.mMaxRunTime = (runTime > statistics.mMaxRunTime) ? runTime : statistics.mMaxRunTime;
+		statistics.mMaxStartDelay = (delay > statistics.mMaxStartDelay) ? delay : statistics.mMaxStartDelay;
+		if (stolen)
+		{
+			++mSteals;
+		}
+
+		// Keep the task on its own beat, dropping the periods that already passed.
+		const uint64_t missed = uint64_t((end - due.mTime) / task.mPeriod);
+		statistics.mSkippedRuns += missed;
+		lock.unlock();
+		due.mTime += task.mPeriod * (missed + 1);
+		Push(std::move(due));
+	}
+};
@@ -0,0 +1,121 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include "RdpGamepadStateQueue.h"
+
+// Delays analog-only state changes just enough to play them out at an even pace despite the variable
+// delivery delay of the RDP channel. The delay follows the measured arrival jitter and never exceeds
+// the configured maximum. A state whose buttons or d-pad differ from the previous one skips the buffer
+// so presses and releases are never delayed. All times are in microseconds.
+template <typename STATE, typename TRAITS = RdpGamepadButtonTraits<STATE>>
+class RdpGamepadJitterBuffer
+{
+public:
+	static constexpr size_t Capacity = 16;
+
+	explicit RdpGamepadJitterBuffer(uint64_t maxDelay = 50000)
+		: mMaxDelay(maxDelay)
+	{}
+
+	void SetMaxDelay(uint64_t maxDelay)
+	{ mMaxDelay = maxDelay; }
+
+	void Push(const STATE& state, uint64_t now)
+	{
+		if (mHasArrival)
+		{
+			// Running estimates of the arrival interval and of how far arrivals stray from it.
+			const int64_t gap = static_cast<int64_t>(now - mLastArrival);
+			mInterval = (mInterval == 0) ? gap : mInterval + (gap - mInterval) / 8;
+			const int64_t deviation = (gap > mInterval) ? gap - mInterval : mInterval - gap;
+			mJitter += (deviation - mJitter) / 16;
+		}
+		mLastArrival = now;
+		mHasArrival = true;
+		mTargetDelay = std::min<uint64_t>(static_cast<uint64_t>(mJitter) * 2, mMaxDelay);
+
+		const uint32_t digital = TRAITS::GetDigital(state);
+		uint64_t playout = now;
+		if (mHasDigital && digital == mLastDigital)
+		{
+			// Aim for one interval after the previous state, but never earlier than the previous state,
+			// never before it arrived and never later than the target delay allows.
+			const uint64_t paced = mLastPlayout + static_cast<uint64_t>(mInterval);
+			playout = std::max(now, std::min(now + mTargetDelay, paced));
+			playout = std::max(playout, mLastPlayout);
+		}
+		else
+		{
+			// Button edge: anything still queued is older than this state, so drop it and play this now.
+			mCount = 0;
+		}
+		mLastDigital = digital;
+		mHasDigital = true;
+		mLastPlayout = playout;
+
+		if (mCount == Capacity)
+		{
+			mHead = (mHead + 1) % Capacity;
+			--mCount;
+		}
+		Entry& entry = mEntries[(mHead + mCount) % Capacity];
+		entry.mState = state;
+		entry.mPlayoutTime = playout;
+		++mCount;
+	}
+
+	// Calls apply, oldest first, for every state whose playout time has been reached.
+	template <typename FUNC>
+	void Release(uint64_t now, FUNC&& apply)
+	{
+		while (mCount != 0 && mEntries[mHead].mPlayoutTime <= now)
+		{
+			apply(mEntries[mHead].mState);
+			mHead = (mHead + 1) % Capacity;
+			--mCount;
+		}
+	}
+
+	void Reset()
+	{
+		mHead = 0;
+		mCount = 0;
+		mHasArrival = false;
+		mHasDigital = false;
+		mInterval = 0;
+		mJitter = 0;
+		mTargetDelay = 0;
+	}
+
+	uint64_t GetTargetDelay() const
+	{ return mTargetDelay; }
+
+	uint64_t GetJitter() const
+	{ return static_cast<uint64_t>(mJitter); }
+
+private:
+	struct Entry
+	{
+		STATE mState;
+		uint64_t mPlayoutTime;
+	};
+
+	std::array<Entry, Capacity> mEntries{};
+	size_t mHead = 0;
+	size_t mCount = 0;
+	uint64_t mMaxDelay;
+	uint64_t mTargetDelay = 0;
+	uint64_t mLastArrival = 0;
+	uint64_t mLastPlayout = 0;
+	int64_t mInterval = 0;
+	int64_t mJitter = 0;
+	uint32_t mLastDigital = 0;
+	bool mHasArrival = false;
+	bool mHasDigital = false;
+};
@@ -0,0 +1,138 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstdint>
+
+// What one non-blocking read of the channel brought in.
+enum RdpLifecycleRead
+{
+	LifecycleReadNone = 0,		// Nothing is waiting; try again next step.
+	LifecycleReadMessage,		// A message that carried no controller state.
+	LifecycleReadState,			// A controller state, already queued for the virtual controller.
+};
+
+// The work a session lifecycle drives: the channel, the virtual controller and the state queues.
+// Every call must return without waiting.
+class RdpGamepadLifecycleHost
+{
+public:
+	virtual ~RdpGamepadLifecycleHost()
+	{}
+
+	// Makes sure a channel is open, taking one opened in the background if needed. False if there is none yet.
+	virtual bool AttachChannel() = 0;
+
+	// Plugs in or takes back the virtual controller for a new connection.
+	virtual void Connect() = 0;
+
+	// Drops the channel and the controller and asks for a new channel.
+	virtual void Disconnect() = 0;
+
+	// Sends the state request and pending feedback. False if the channel failed.
+	virtual bool SendRequests() = 0;
+
+	// Reads and handles at most one message.
+	virtual RdpLifecycleRead Read() = 0;
+
+	// Submits the states queued by Read to the virtual controller.
+	virtual void SubmitStates() = 0;
+
+	// Called once when the plugin has not sent a state for the stale timeout.
+	virtual void StaleTimeout() = 0;
+
+	// Puts the virtual controller at rest; called every step while the session is stale.
+	virtual void SubmitNeutral() = 0;
+
+	virtual bool IsChannelOpen() = 0;
+};
+
+// The connect, poll, drain, stale and tidy lifecycle of one receiver session, written as a resumable
+// step instead of a thread: each Step runs until it would have to wait for the channel or the clock and
+// then returns, so one thread can drive any number of sessions. Times are in milliseconds of any clock
+// the owner chooses.
+class RdpGamepadLifecycle
+{
+public:
+	enum Phase
+	{
+		PhaseDetached = 0,		// Waiting for a channel.
+		PhaseConnected,			// States are arriving.
+		PhaseStale,				// The channel is open but the plugin stopped answering.
+	};
+
+	explicit RdpGamepadLifecycle(RdpGamepadLifecycleHost& host, uint64_t staleTimeout = 2000)
+		: mHost(host)
+		, mStaleTimeout(staleTimeout)
+	{}
+
+	void Step(uint64_t now)
+	{
+		if (!mHost.AttachChannel())
+		{
+			Disconnect();
+			return;
+		}
+
+		if (mPhase == PhaseDetached)
+		{
+			mHost.Connect();
+			mPhase = PhaseConnected;
+			mLastStateTime = now;
+		}
+
+		if (!mHost.SendRequests())
+		{
+			Disconnect();
+			return;
+		}
+
+		// Drain everything that is waiting, then submit what the messages carried.
+		RdpLifecycleRead read;
+		while ((read = mHost.Read()) != LifecycleReadNone)
+		{
+			if (read == LifecycleReadState)
+			{
+				mLastStateTime = now;
+				mPhase = PhaseConnected;
+			}
+		}
+		mHost.SubmitStates();
+
+		if (now - mLastStateTime > mStaleTimeout)
+		{
+			if (mPhase != PhaseStale)
+			{
+				mPhase = PhaseStale;
+				mHost.StaleTimeout();
+			}
+			mHost.SubmitNeutral();
+		}
+
+		if (!mHost.IsChannelOpen())
+		{
+			Disconnect();
+		}
+	}
+
+	// Connects again at the next step but keeps the channel, for example after the controller type changed.
+	void Restart()
+	{ mPhase = PhaseDetached; }
+
+	// Drops the channel now.
+	void Disconnect()
+	{
+		mHost.Disconnect();
+		mPhase = PhaseDetached;
+	}
+
+	Phase GetPhase() const
+	{ return mPhase; }
+
+private:
+	RdpGamepadLifecycleHost& mHost;
+	uint64_t mStaleTimeout;
+	uint64_t mLastStateTime = 0;
+	Phase mPhase = PhaseDetached;
+};
@@ -0,0 +1,145 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <RdpGamepadMotion.h>
+
+// What an extended DS4 report carries besides the buttons, sticks and triggers.
+struct RdpGamepadMotionReport
+{
+	uint64_t mTime = 0;			// Microseconds on the plugin's clock, unwrapped.
+	int16_t mGyro[3] = {};
+	int16_t mAccel[3] = {};
+	RdpGamepad::RdpTouchPoint mTouch[RdpGamepad::TouchPointCount] = {};
+};
+
+// Folds the motion samples that arrived since the last report into one, averaging the rates and
+// accelerations over the time the samples cover and stamping it with the newest sample's time. A game
+// that integrates the gyroscope between report timestamps then turns as far as the controller did,
+// although reports go out once a tick rather than once a sample. Samples seen before are skipped by their
+// sequence numbers.
+class RdpGamepadMotionFilter
+{
+public:
+	// Returns the number of samples missing between the last batch and this one.
+	uint32_t Push(const RdpGamepad::RdpMotionBatch& batch, const RdpGamepad::RdpMotionSample* samples, size_t count)
+	{
+		size_t first = 0;
+		uint32_t lost = 0;
+		if (mHasSequence)
+		{
+			const int32_t gap = static_cast<int32_t>(batch.mSequence - mNextSequence);
+			if (gap < 0)
+			{
+				first = (size_t(-int64_t(gap)) < count) ? size_t(-int64_t(gap)) : count;
+			}
+			else
+			{
+				lost = static_cast<uint32_t>(gap);
+			}
+		}
+		if (first < count || !mHasSequence)
+		{
+			mNextSequence = batch.mSequence + static_cast<uint32_t>(count);
+			mHasSequence = true;
+		}
+
+		for (size_t i = first; i < count; ++i)
+		{
+			const RdpGamepad::RdpMotionSample& sample = samples[i];
+
+			// Each sample stands for the time since the one before it, including any that went missing. A
+			// sample older than the last one is dropped rather than taken for a step of over an hour.
+			uint32_t weight = 1;
+			if (mHasSample)
+			{
+				const int32_t elapsed = static_cast<int32_t>(sample.mTime - mLastSampleTime);
+				if (elapsed < 0)
+				{
+					continue;
+				}
+				mReport.mTime += static_cast<uint32_t>(elapsed);
+				weight = (elapsed != 0) ? static_cast<uint32_t>(elapsed) : 1;
+			}
+			mHasSample = true;
+			mLastSampleTime = sample.mTime;
+
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				mGyroSum[axis] += int64_t(sample.mGyro[axis]) * weight;
+				mAccelSum[axis] += int64_t(sample.mAccel[axis]) * weight;
+			}
+			mWeight += weight;
+		}
+
+		if (std::memcmp(mReport.mTouch, batch.mTouch, sizeof(mReport.mTouch)) != 0)
+		{
+			std::memcpy(mReport.mTouch, batch.mTouch, sizeof(mReport.mTouch));
+			mTouchChanged = true;
+		}
+		return lost;
+	}
+
+	// The report covering the samples since the last call. False if nothing changed.
+	bool Take(RdpGamepadMotionReport& outReport)
+	{
+		if (mWeight == 0 && !mTouchChanged)
+		{
+			return false;
+		}
+
+		if (mWeight != 0)
+		{
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				mReport.mGyro[axis] = Average(mGyroSum[axis]);
+				mReport.mAccel[axis] = Average(mAccelSum[axis]);
+				mGyroSum[axis] = 0;
+				mAccelSum[axis] = 0;
+			}
+			mWeight = 0;
+		}
+		mTouchChanged = false;
+		outReport = mReport;
+		return true;
+	}
+
+	// Forgets the stream, as when the plugin is asked to start it over. The report clock keeps running so
+	// timestamps never go backwards.
+	void Reset()
+	{
+		const uint64_t time = mReport.mTime;
+		mReport = RdpGamepadMotionReport();
+		mReport.mTime = time;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			mGyroSum[axis] = 0;
+			mAccelSum[axis] = 0;
+		}
+		mWeight = 0;
+		mHasSample = false;
+		mHasSequence = false;
+		mTouchChanged = false;
+	}
+
+private:
+	RdpGamepadMotionReport mReport;
+	int64_t mGyroSum[3] = {};
+	int64_t mAccelSum[3] = {};
+	uint64_t mWeight = 0;
+	uint32_t mLastSampleTime = 0;
+	uint32_t mNextSequence = 0;
+	bool mHasSample = false;
+	bool mHasSequence = false;
+	bool mTouchChanged = false;
+
+	int16_t Average(int64_t sum) const
+	{
+		const int64_t half = int64_t(mWeight / 2);
+		return static_cast<int16_t>((sum >= 0) ? (sum + half) / int64_t(mWeight) : (sum - half) / int64_t(mWeight));
+	}
+};
@@ -5,22 +5,103 @@
 
 #include "RdpGamepadProcessor.h"
 
+#include "RdpGamepadConnection.h"
 #include "ViGEmInterface.h"
 #include <RdpGamepadProtocol.h>
+#include <RdpGamepadSharedMemoryTransport.h>
+#include <RdpGamepadSocketTransport.h>
+
+#include <fstream>
+
+namespace
+{
+	class ViGEmTargetSink360 : public RdpGamepadTargetSink<ViGEmTarget360>
+	{
+	public:
+		explicit ViGEmTargetSink360(std::shared_ptr<ViGEmClient> client)
+			: mClient(client)
+		{}
+
+		std::shared_ptr<ViGEmTarget360> Add() override
+		{ return mClient->CreateControllerAs360(); }
+
+		// The target unplugs itself once the last reference is gone.
+		void Remove(std::shared_ptr<ViGEmTarget360>) override
+		{}
+
+		void SubmitNeutral(ViGEmTarget360& target) override
+		{ target.SetGamepadState(RdpGamepadButtonTraits<XINPUT_GAMEPAD>::Neutral()); }
+
+	private:
+		std::shared_ptr<ViGEmClient> mClient;
+	};
+
+	class ViGEmTargetSinkDS4 : public RdpGamepadTargetSink<ViGEmTargetDS4>
+	{
+	public:
+		explicit ViGEmTargetSinkDS4(std::shared_ptr<ViGEmClient> client)
+			: mClient(client)
+		{}
+
+		std::shared_ptr<ViGEmTargetDS4> Add() override
+		{ return mClient->CreateControllerAsDS4(); }
+
+		void Remove(std::shared_ptr<ViGEmTargetDS4>) override
+		{}
+
+		void SubmitNeutral(ViGEmTargetDS4& target) override
+		{
+			target.ResetMotion();
+			target.SetGamepadState(RdpGamepadButtonTraits<PadState>::Neutral());
+		}
+
+	private:
+		std::shared_ptr<ViGEmClient> mClient;
+	};
+}
 
 RdpGamepadProcessor::RdpGamepadProcessor()
-	: mRdpGamepadChannel(new RdpGamepad::RdpGamepadVirtualChannel())
+	: mRdpGamepadConnection(new RdpGamepadConnection([this]() { return OpenTransport(); }, &CloseTransport))
+	, mLifecycle(*this, StaleTimeoutMs)
 	, mViGEmClient(std::make_shared<ViGEmClient>())
+	, mTargetPool360(std::unique_ptr<RdpGamepadTargetSink<ViGEmTarget360>>(new ViGEmTargetSink360(mViGEmClient)))
+	, mTargetPoolDS4(std::unique_ptr<RdpGamepadTargetSink<ViGEmTargetDS4>>(new ViGEmTargetSinkDS4(mViGEmClient)))
 {}
 
 RdpGamepadProcessor::~RdpGamepadProcessor()
 {}
 
 void RdpGamepadProcessor::Start(CONTROLLER_TYPE type)
+{
+	StartScheduled(type);
+	mThread = std::thread(&RdpGamepadProcessor::Run, this);
+}
+
+void RdpGamepadProcessor::StartScheduled(CONTROLLER_TYPE type)
 {
 	mType = type;
+	mRequestedType = type;
 	mKeepRunning = true;
-	mThread = std::thread(&RdpGamepadProcessor::Run, this);
+	mRdpGamepadConnection->Start();
+}
+
+void RdpGamepadProcessor::Tick()
+{
+	std::unique_lock<std::recursive_mutex> lock{mMutex};
+	if (mKeepRunning)
+	{
+		RdpGamepadTick();
+	}
+}
+
+bool RdpGamepadProcessor::SetTransportAddress(const std::string& address)
+{
+	RdpGamepad::RdpSocketAddress socketAddress;
+	const bool valid = address.empty() ||
+		(address.compare(0, 4, "shm:") == 0 && RdpGamepad::RdpGamepadSharedMemoryTransport::IsValidName(address.substr(4))) ||
+		socketAddress.Parse(address);
+	mTransportAddress = valid ? address : std::string();
+	return valid;
 }
 
 void RdpGamepadProcessor::Stop()
@@ -29,410 +110,907 @@ void RdpGamepadProcessor::Stop()
 		std::unique_lock<std::recursive_mutex> lock{mMutex};
 		mKeepRunning = false;
 	}
-	mThread.join();
+	mRdpGamepadConnection->Stop();
+	if (mThread.joinable())
+	{
+		mThread.join();
+	}
+	else
+	{
+		std::unique_lock<std::recursive_mutex> lock{mMutex};
+		RdpGamepadShutdown();
+	}
 }
 
-void RdpGamepadProcessor::Run()
+void RdpGamepadProcessor::SetType(CONTROLLER_TYPE type)
+{
+	mRequestedType = type;
+}
+
+void RdpGamepadProcessor::SetCoalesceStates(bool enable)
+{
+	std::unique_lock<std::recursive_mutex> lock{mMutex};
+	mCoalesceStates = enable;
+}
+
+void RdpGamepadProcessor::GetLatency(RdpGamepad::RdpLatencySummary (&outStages)[RdpGamepad::LatencyStageCount])
 {
-	static constexpr int PollFrequency = 16; // ms
+	mLatency.Summarize(outStages);
 
+	std::unique_lock<std::recursive_mutex> lock{mMutex};
+	for (size_t stage = 0; stage < RdpGamepad::LatencyRoundTrip; ++stage)
+	{
+		outStages[stage] = mRemoteLatency[stage];
+	}
+}
+
+void RdpGamepadProcessor::SetTargetGracePeriod(unsigned int gracePeriodMs)
+{
+	std::unique_lock<std::recursive_mutex> lock{mMutex};
+	mTargetPool360.SetGracePeriod(gracePeriodMs);
+	mTargetPoolDS4.SetGracePeriod(gracePeriodMs);
+}
+
+void RdpGamepadProcessor::SetReportRefreshInterval(unsigned int intervalMs)
+{
+	std::unique_lock<std::recursive_mutex> lock{mMutex};
+	mReportRefreshInterval = intervalMs;
+	if (mViGEmTarget360)
+	{
+		mViGEmTarget360->SetRefreshInterval(intervalMs);
+	}
+	if (mViGEmTargetDS4)
+	{
+		mViGEmTargetDS4->SetRefreshInterval(intervalMs);
+	}
+}
+
+void RdpGamepadProcessor::SetStatisticsFile(const std::wstring& path, unsigned int intervalMs)
+{
+	std::unique_lock<std::recursive_mutex> lock{mMutex};
+	mStatisticsPath = path;
+	mStatisticsInterval = intervalMs;
+	mStatisticsWriteTime = 0;
+}
+
+bool RdpGamepadProcessor::SetTraceFile(const std::wstring& path)
+{
+	if (path.empty())
+	{
+		mTrace.Stop();
+		return true;
+	}
+	return mTrace.Start(path);
+}
+
+bool RdpGamepadProcessor::LoadMappingProfile(const std::wstring& path)
+{
+	std::ifstream file(path);
+	MappingProfile profile;
+	if (!file || !ParseMappingProfile(file, profile))
+	{
+		return false;
+	}
+	mMapper.SetProfile(profile);
+	return true;
+}
+
+uint64_t RdpGamepadProcessor::ReplayTrace(const std::wstring& path, RdpGamepad::RdpTraceReplayer::Pacing pacing)
+{
+	std::unique_lock<std::recursive_mutex> lock{mMutex};
+
+	RdpGamepad::RdpTraceReader reader;
+	if (!reader.Open(path))
+	{
+		return 0;
+	}
+
+	uint64_t count = 0;
+	switch (mType)
+	{
+	case CONTROLLER_360:
+		mViGEmTarget360 = AcquireTarget(mTargetPool360);
+		count = ReplayStates(reader, pacing, *mViGEmTarget360, mGamepadJitter, mGamepadStates);
+		break;
+
+	case CONTROLLER_360_EMU:
+		mViGEmTarget360 = AcquireTarget(mTargetPool360);
+		count = ReplayStates(reader, pacing, *mViGEmTarget360, mPadJitter, mPadStates);
+		break;
+
+	case CONTROLLER_DS4:
+		mViGEmTargetDS4 = AcquireTarget(mTargetPoolDS4);
+		count = ReplayStates(reader, pacing, *mViGEmTargetDS4, mPadJitter, mPadStates);
+		break;
+
+	case CONTROLLER_DS4_EMU:
+		mViGEmTargetDS4 = AcquireTarget(mTargetPoolDS4);
+		count = ReplayStates(reader, pacing, *mViGEmTargetDS4, mGamepadJitter, mGamepadStates);
+		break;
+	}
+
+	RdpGamepadSwitchType(mType);
+	return count;
+}
+
+void RdpGamepadProcessor::SetJitterBuffer(bool enable, unsigned int maxDelayMs)
+{
+	std::unique_lock<std::recursive_mutex> lock{mMutex};
+	mUseJitterBuffer = enable;
+	mGamepadJitter.SetMaxDelay(maxDelayMs * 1000ull);
+	mPadJitter.SetMaxDelay(maxDelayMs * 1000ull);
+	mGamepadJitter.Reset();
+	mPadJitter.Reset();
+}
+
+void RdpGamepadProcessor::SetButtonEvents(bool enable, unsigned int minHoldMs)
+{
+	std::unique_lock<std::recursive_mutex> lock{mMutex};
+	mUseButtonEvents = enable;
+	mButtonEventsChanged = true;
+	mGamepadReplay.SetMinHold(minHoldMs * 1000ull);
+	mPadReplay.SetMinHold(minHoldMs * 1000ull);
+	mGamepadReplay.Reset();
+	mPadReplay.Reset();
+}
+
+void RdpGamepadProcessor::SetMotion(bool enable)
+{
+	std::unique_lock<std::recursive_mutex> lock{mMutex};
+	mUseMotion = enable;
+	mMotionChanged = true;
+}
+
+void RdpGamepadProcessor::SetRateControl(bool enable)
+{
+	std::unique_lock<std::recursive_mutex> lock{mMutex};
+	mUseRateControl = enable;
+	mRateControlChanged = true;
+	mRoundTrip.Reset();
+}
+
+template <typename STATE>
+void RdpGamepadProcessor::QueueState(RdpGamepadJitterBuffer<STATE>& jitter, RdpGamepadStateQueue<STATE>& states, const STATE& receivedState, uint64_t now)
+{
+	STATE state = receivedState;
+	MapState(state);
+
+	if (mUseJitterBuffer)
+	{
+		jitter.Push(state, now);
+	}
+	else
+	{
+		states.Push(state);
+	}
+}
+
+template <typename STATE>
+void RdpGamepadProcessor::ReceiveState(RdpGamepadJitterBuffer<STATE>& jitter, RdpGamepadStateQueue<STATE>& states, const STATE& receivedState, uint64_t now)
+{
+	const uint64_t decodeTime = RdpGamepad::RdpLatencyClock::Now();
+	if (mUseButtonEvents)
+	{
+		// Edges arrive unmapped, so states are mapped only once the replay lets them go.
+		GetButtonReplay(receivedState).Push(receivedState, now);
+	}
+	else
+	{
+		QueueState(jitter, states, receivedState, now);
+	}
+	mLatency.Record(RdpGamepad::LatencyDecode, decodeTime, RdpGamepad::RdpLatencyClock::Now());
+}
+
+template <typename STATE>
+void RdpGamepadProcessor::ReleaseStates(RdpGamepadJitterBuffer<STATE>& jitter, RdpGamepadStateQueue<STATE>& states, uint64_t now)
+{
+	if (mUseButtonEvents)
+	{
+		GetButtonReplay(STATE()).Release(now, [this, &jitter, &states, now](const STATE& state) { QueueState(jitter, states, state, now); });
+	}
+	if (mUseJitterBuffer)
+	{
+		jitter.Release(now, [&states](const STATE& state) { states.Push(state); });
+	}
+}
+
+template <typename TARGET, typename STATE>
+void RdpGamepadProcessor::SubmitState(TARGET& target, const STATE& state)
+{
+	const uint64_t submitTime = RdpGamepad::RdpLatencyClock::Now();
+	if (target.SetGamepadState(state))
+	{
+		mCounters.Increment(CounterReportsSubmitted);
+	}
+	mLatency.Record(RdpGamepad::LatencySubmit, submitTime, RdpGamepad::RdpLatencyClock::Now());
+	mTrace.Record(RdpGamepad::TraceSourceReceiver, GetTraceKind(state), submitTime, state);
+}
+
+template <typename TARGET, typename STATE>
+uint64_t RdpGamepadProcessor::ReplayStates(RdpGamepad::RdpTraceReader& reader, RdpGamepad::RdpTraceReplayer::Pacing pacing, TARGET& target, RdpGamepadJitterBuffer<STATE>& jitter, RdpGamepadStateQueue<STATE>& states)
+{
+	auto applyState = [this, &target](const STATE& state) { SubmitState(target, state); };
+	const RdpGamepad::RdpTraceKind kind = GetTraceKind(STATE());
+	uint64_t count = 0;
+
+	// Played back to back, the jitter buffer and button replay run on the recorded spacing of the
+	// samples instead of waiting for the real clock to catch up.
+	const bool fastest = (pacing == RdpGamepad::RdpTraceReplayer::PacingFastest);
+	const uint64_t start = GetTimeMicroseconds();
+	uint64_t firstTime = UINT64_MAX;
+	uint64_t replayTime = start;
+	RdpGamepad::RdpTraceReplayer::Replay(reader, RdpGamepad::TraceSourcePlugin, pacing, [&](const RdpGamepad::RdpTraceSample& sample)
+	{
+		STATE state;
+		if (sample.mHeader.mKind == kind && sample.GetState(state))
+		{
+			if (firstTime == UINT64_MAX)
+			{
+				firstTime = sample.mHeader.mTime;
+			}
+			const uint64_t recordedTime = start + ((sample.mHeader.mTime > firstTime) ? (sample.mHeader.mTime - firstTime) / 1000 : 0);
+			if (fastest && recordedTime > replayTime)
+			{
+				replayTime = recordedTime;
+			}
+			const uint64_t now = fastest ? replayTime : GetTimeMicroseconds();
+			ReceiveState(jitter, states, state, now);
+			ReleaseStates(jitter, states, now);
+			states.Apply(applyState);
+			++count;
+		}
+	});
+
+	// Let the jitter buffer drain, then leave the controller at rest.
+	GetButtonReplay(STATE()).Reset();
+	jitter.Release(UINT64_MAX, [&states](const STATE& state) { states.Push(state); });
+	states.Push(RdpGamepadButtonTraits<STATE>::Neutral());
+	states.Apply(applyState);
+	return count;
+}
+
+template <typename TARGET>
+std::shared_ptr<TARGET> RdpGamepadProcessor::AcquireTarget(RdpGamepadTargetPool<TARGET>& pool)
+{
+	bool reused;
+	std::shared_ptr<TARGET> target = pool.Acquire(reused);
+	mCounters.Increment(reused ? CounterTargetsReused : CounterTargetsAdded);
+	if (target)
+	{
+		target->SetRefreshInterval(mReportRefreshInterval);
+		mTargetUpdates = target->GetUpdateStats();
+	}
+	return target;
+}
+
+void RdpGamepadProcessor::RdpGamepadReleaseTargets()
+{
+	RdpGamepadCollectUpdateStats();
+	const ULONGLONG now = GetTickCount64();
+	mTargetPool360.Release(std::move(mViGEmTarget360), now);
+	mTargetPoolDS4.Release(std::move(mViGEmTargetDS4), now);
+}
+
+void RdpGamepadProcessor::RdpGamepadCollectUpdateStats()
+{
+	// The targets count the reports they skip; add what the current one skipped since the last call.
+	ViGEmUpdateStats stats;
+	if (mViGEmTarget360)
+	{
+		stats = mViGEmTarget360->GetUpdateStats();
+	}
+	else if (mViGEmTargetDS4)
+	{
+		stats = mViGEmTargetDS4->GetUpdateStats();
+	}
+	else
+	{
+		return;
+	}
+	mCounters.Increment(CounterReportsSkipped, stats.Skipped - mTargetUpdates.Skipped);
+	mTargetUpdates = stats;
+}
+
+uint64_t RdpGamepadProcessor::GetTimeMicroseconds()
+{
+	using namespace std::chrono;
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void RdpGamepadProcessor::Run()
+{
 	HANDLE TimerEvent;
 	LARGE_INTEGER DueTime;
 	DueTime.QuadPart = -1;
 
 	TimerEvent = CreateWaitableTimerEx(NULL, NULL, 0, TIMER_ALL_ACCESS);
-	SetWaitableTimer(TimerEvent, &DueTime, PollFrequency, NULL, NULL, false);
+	SetWaitableTimer(TimerEvent, &DueTime, TickPeriodMs, NULL, NULL, false);
 
 	std::unique_lock<std::recursive_mutex> lock{mMutex};
 	while (mKeepRunning)
 	{
 		mMutex.unlock();
-		const unsigned long WaitResult = WaitForSingleObject(TimerEvent, PollFrequency * 2);
+		const unsigned long WaitResult = WaitForSingleObject(TimerEvent, TickPeriodMs * 2);
 		mMutex.lock();
 
 		if (WaitResult == 0)
 		{
-			switch(mType)
-			{
-			case CONTROLLER_360:
-				RdpGamepadProcess360();
-				break;
-
-			case CONTROLLER_360_EMU:
-				RdpGamepadProcess360Emulate();
-				break;
-
-			case CONTROLLER_DS4:
-				RdpGamepadProcessDS4();
-				break;
-
-			case CONTROLLER_DS4_EMU:
-				RdpGamepadProcessDS4Emulate();
-				break;
-			}
+			RdpGamepadTick();
 		}
 	}
 
 	CancelWaitableTimer(TimerEvent);
 	CloseHandle(TimerEvent);
-	RdpGamepadTidy();
+	RdpGamepadShutdown();
 }
 
-void RdpGamepadProcessor::RdpGamepadTidy()
+void RdpGamepadProcessor::RdpGamepadTick()
 {
-	mViGEmTarget360 = nullptr;
-	mViGEmTargetDS4 = nullptr;
-	mRdpGamepadChannel->Close();
-	mRdpGamepadConnected = false;
-	mRdpGamepadPollTicks = 0;
+	const ULONGLONG tickStart = GetTickCount64();
+	const CONTROLLER_TYPE requestedType = mRequestedType;
+	if (requestedType != mType)
+	{
+		RdpGamepadSwitchType(requestedType);
+	}
+
+	mLifecycle.Step(tickStart);
+	RdpGamepadCollectUpdateStats();
+
+	mTargetPool360.Expire(tickStart);
+	mTargetPoolDS4.Expire(tickStart);
+
+	const ULONGLONG tickEnd = GetTickCount64();
+	if (tickEnd - tickStart > TickPeriodMs)
+	{
+		mCounters.Increment(CounterTickOverruns);
+	}
+	if (!mStatisticsPath.empty() && tickEnd - mStatisticsWriteTime >= mStatisticsInterval)
+	{
+		mStatisticsWriteTime = tickEnd;
+		RdpGamepadWriteStatistics();
+
+		// So the plugin's stages in the next file are at most one interval old.
+		RequestRemoteLatency();
+	}
 }
 
-void RdpGamepadProcessor::RdpGamepadProcess360()
+void RdpGamepadProcessor::RdpGamepadShutdown()
 {
-	++mRdpGamepadPollTicks;
+	mLifecycle.Disconnect();
+	mTargetPool360.Clear();
+	mTargetPoolDS4.Clear();
+}
 
-	// Try to open the channel if we don't have a channel open already
-	if (!mRdpGamepadChannel->IsOpen())
+void RdpGamepadProcessor::RdpGamepadTidy()
+{
+	RdpGamepadReleaseTargets();
+	mPending = RdpGamepad::RdpPacketSpan();
+	mPendingIndex = 0;
+	mRdpGamepadChannel.reset();
+	if (mKeepRunning)
 	{
-		// Only try to reconnect every few seconds instead of every tick as WTSVirtualChannelOpen can take a bit long.
-		// I would probably be best if we called that outside of the critical section lock but for now this should
-		// really make things much better.
-		if (mRdpGamepadOpenRetry == 0)
-		{
-			if (!mRdpGamepadChannel->Open())
-			{
-				mRdpGamepadOpenRetry = 35; // Retry about every second
-				RdpGamepadTidy();
-				return;
-			}
-		}
-		else
+		if (mRdpGamepadConnected)
 		{
-			--mRdpGamepadOpenRetry;
-			RdpGamepadTidy();
-			return;
+			mCounters.Increment(CounterReconnects);
 		}
+		mRdpGamepadConnection->Reconnect();
 	}
+	mRdpGamepadConnected = false;
+	mGamepadStates.Reset();
+	mPadStates.Reset();
+	mGamepadJitter.Reset();
+	mPadJitter.Reset();
+	mGamepadReplay.Reset();
+	mPadReplay.Reset();
+	mMotion.Reset();
+	mFeedback.Reset();
+	mRoundTrip.Reset();
+}
 
-	//assert(mRdpGamepadChannel->IsOpen());
-	if (!mRdpGamepadConnected)
+bool RdpGamepadProcessor::AttachChannel()
+{
+	if (mRdpGamepadChannel && mRdpGamepadChannel->IsOpen())
 	{
-		//assert(mViGEmTarget360 == nullptr)
-		mViGEmTarget360 = mViGEmClient->CreateControllerAs360();
-		mRdpGamepadConnected = true;
-		mErrorCode = S_OK;
+		return true;
 	}
 
-	// Request controller state and update vibration
-	if (!mRdpGamepadChannel->Send(RdpGamepad::RdpGetStateRequest::MakeRequest(0)))
+	RdpGamepad::RdpGamepadTransport* transport = static_cast<RdpGamepad::RdpGamepadTransport*>(mRdpGamepadConnection->TakeHandle());
+	if (transport == nullptr)
 	{
-		RdpGamepadTidy();
-		return;
+		return false;
 	}
+	mRdpGamepadChannel.reset(transport);
+	mPending = RdpGamepad::RdpPacketSpan();
+	mPendingIndex = 0;
+	mInvalidPackets = 0;
+	mFeedbackAcknowledged = false;
+	return true;
+}
 
-	XINPUT_VIBRATION PendingVibes;
-	if (mViGEmTarget360->GetVibration(PendingVibes))
+void* RdpGamepadProcessor::OpenTransport()
+{
+	// Runs on the connection thread, which only starts after the address has been set.
+	if (mTransportAddress.compare(0, 4, "shm:") == 0)
 	{
-		if (!mRdpGamepadChannel->Send(RdpGamepad::RdpSetStateRequest::MakeRequest(0, PendingVibes)))
-		{
-			RdpGamepadTidy();
-			return;
-		}
+		return RdpGamepad::RdpGamepadSharedMemoryTransport::Open(mTransportAddress.substr(4)).release();
 	}
-
-	// Read all the pending messages
-	RdpGamepad::RdpProtocolPacket packet;
-	while (mRdpGamepadChannel->Receive(&packet))
+	if (!mTransportAddress.empty())
 	{
-		// Handle controller state
-		if (packet.mHeader.mMessageType == RdpGamepad::RdpMessageType::GetStateResponse)
-		{
-			if (packet.mGetStateResponse.mUserIndex == 0)
-			{
-				if (packet.mGetStateResponse.mResult == 0)
-				{
-					mViGEmTarget360->SetGamepadState(packet.mGetStateResponse.mState.Gamepad);
-				}
-				else
-				{
-					mViGEmTarget360->SetGamepadState(XINPUT_GAMEPAD{0});
-					mErrorCode = packet.mGetStateResponse.mResult;
-				}
-				mLastGetStateResponseTicks = mRdpGamepadPollTicks;
-			}
-		}
+		RdpGamepad::RdpSocketAddress socketAddress;
+		socketAddress.Parse(mTransportAddress);
+		return RdpGamepad::RdpGamepadSocketTransport::Connect(socketAddress).release();
 	}
 
-	// Remove stale controller data
-	if (mRdpGamepadPollTicks < mLastGetStateResponseTicks || (mRdpGamepadPollTicks - mLastGetStateResponseTicks) > 120) // Timeout in about 2 seconds
+	HANDLE handle = RdpGamepad::RdpGamepadVirtualChannel::OpenChannelHandle(mSessionId);
+	if (handle == nullptr)
 	{
-		mViGEmTarget360->SetGamepadState(XINPUT_GAMEPAD{0});
+		return nullptr;
 	}
+	return new RdpGamepad::RdpGamepadVirtualChannel(handle);
+}
+
+void RdpGamepadProcessor::CloseTransport(void* handle)
+{
+	delete static_cast<RdpGamepad::RdpGamepadTransport*>(handle);
+}
 
-	// Check connection state
-	if (!mRdpGamepadChannel->IsOpen())
+void RdpGamepadProcessor::RdpGamepadSwitchType(CONTROLLER_TYPE type)
+{
+	// Put the old virtual controller back in its pool but keep the channel; the next tick takes the
+	// new controller as if the channel had just connected.
+	RdpGamepadReleaseTargets();
+
+	// A controller of the other kind will not be taken again, so unplug it now instead of after the grace
+	// period, or games see both controllers until then.
+	const bool wasX360 = (mType == CONTROLLER_360 || mType == CONTROLLER_360_EMU);
+	const bool isX360 = (type == CONTROLLER_360 || type == CONTROLLER_360_EMU);
+	if (wasX360 && !isX360)
+	{
+		mTargetPool360.Clear();
+	}
+	else if (!wasX360 && isX360)
 	{
-		RdpGamepadTidy();
+		mTargetPoolDS4.Clear();
 	}
+
+	mRdpGamepadConnected = false;
+	mGamepadStates.Reset();
+	mPadStates.Reset();
+	mGamepadJitter.Reset();
+	mPadJitter.Reset();
+	mGamepadReplay.Reset();
+	mPadReplay.Reset();
+	mMotion.Reset();
+	mFeedback.Reset();
+	mRoundTrip.Reset();
+	mLifecycle.Restart();
+	mType = type;
 }
 
-void RdpGamepadProcessor::RdpGamepadProcess360Emulate()
+bool RdpGamepadProcessor::RdpGamepadSendFeedback(RdpGamepad::RdpFeedbackTarget target)
 {
-	++mRdpGamepadPollTicks;
+	if (mViGEmTarget360)
+	{
+		XINPUT_VIBRATION PendingVibes;
+		if (mViGEmTarget360->GetVibration(PendingVibes))
+		{
+			mFeedback.SetRumble(PendingVibes.wLeftMotorSpeed, PendingVibes.wRightMotorSpeed);
+		}
 
-	// Try to open the channel if we don't have a channel open already
-	if (!mRdpGamepadChannel->IsOpen())
+		UCHAR PendingLed;
+		if (mViGEmTarget360->GetPlayerLed(PendingLed))
+		{
+			mFeedback.SetPlayerLed(PendingLed);
+		}
+	}
+
+	if (mViGEmTargetDS4)
 	{
-		// Only try to reconnect every few seconds instead of every tick as WTSVirtualChannelOpen can take a bit long.
-		// I would probably be best if we called that outside of the critical section lock but for now this should
-		// really make things much better.
-		if (mRdpGamepadOpenRetry == 0)
+		PadVibrationParam PendingVibesDS4;
+		if (mViGEmTargetDS4->GetVibration(PendingVibesDS4))
 		{
-			if (!mRdpGamepadChannel->Open())
-			{
-				mRdpGamepadOpenRetry = 35; // Retry about every second
-				RdpGamepadTidy();
-				return;
-			}
+			mFeedback.SetRumble(uint16_t(PendingVibesDS4.LargeMotor << 8), uint16_t(PendingVibesDS4.SmallMotor << 8));
 		}
-		else
+
+		PadColor PendingColor;
+		if (mViGEmTargetDS4->GetLightBarColor(PendingColor))
 		{
-			--mRdpGamepadOpenRetry;
-			RdpGamepadTidy();
-			return;
+			mFeedback.SetLightBar(PendingColor.R, PendingColor.G, PendingColor.B);
 		}
 	}
 
-	//assert(mRdpGamepadChannel->IsOpen());
-	if (!mRdpGamepadConnected)
+	RdpGamepad::RdpFeedback feedback;
+	if (!mFeedback.TakeReport(GetTickCount64(), feedback))
 	{
-		//assert(mViGEmTarget360 == nullptr)
-		mViGEmTarget360 = mViGEmClient->CreateControllerAs360();
-		mRdpGamepadConnected = true;
-		mErrorCode = S_OK;
+		return true;
 	}
+	if (!mRdpGamepadChannel->Send(RdpGamepad::RdpSetFeedbackRequest::MakeRequest(0, target, feedback)))
+	{
+		return false;
+	}
+	mCounters.Increment(CounterPacketsSent);
+	mCounters.Increment(CounterFeedbackForwards);
 
-	// Request controller state and update vibration
-	if (!mRdpGamepadChannel->Send(RdpGamepad::RdpGetStateRequestDS4::MakeRequest(0)))
+	if (mFeedbackAcknowledged || (feedback.mFlags & RdpGamepad::FeedbackRumble) == 0)
 	{
-		RdpGamepadTidy();
-		return;
+		return true;
 	}
+	bool sent;
+	if (target == RdpGamepad::FeedbackTargetDS4)
+	{
+		PadVibrationParam vibration;
+		vibration.LargeMotor = uint8_t(feedback.mLargeMotor >> 8);
+		vibration.SmallMotor = uint8_t(feedback.mSmallMotor >> 8);
+		sent = mRdpGamepadChannel->Send(RdpGamepad::RdpSetStateRequestDS4::MakeRequest(0, vibration));
+	}
+	else
+	{
+		XINPUT_VIBRATION vibration;
+		vibration.wLeftMotorSpeed = feedback.mLargeMotor;
+		vibration.wRightMotorSpeed = feedback.mSmallMotor;
+		sent = mRdpGamepadChannel->Send(RdpGamepad::RdpSetStateRequest::MakeRequest(0, vibration));
+	}
+	if (!sent)
+	{
+		return false;
+	}
+	mCounters.Increment(CounterPacketsSent);
+	return true;
+}
 
-	PadVibrationParam PendingVibesDS4;
-	if (mViGEmTarget360->GetVibration(PendingVibesDS4))
+bool RdpGamepadProcessor::RdpGamepadRequestState(const RdpGamepad::RdpProtocolHeader& request)
+{
+	if (mRemoteLatencyRequested.exchange(false))
 	{
-		if (!mRdpGamepadChannel->Send(RdpGamepad::RdpSetStateRequestDS4::MakeRequest(0, PendingVibesDS4)))
+		if (!mRdpGamepadChannel->Send(RdpGamepad::RdpGetLatencyRequest::MakeRequest(0)))
 		{
-			RdpGamepadTidy();
-			return;
+			return false;
 		}
+		mCounters.Increment(CounterPacketsSent);
 	}
 
-	// Read all the pending messages
-	RdpGamepad::RdpProtocolPacket packet;
-	while (mRdpGamepadChannel->Receive(&packet))
+	const uint64_t requestTime = RdpGamepad::RdpLatencyClock::Now();
+	if (!mRdpGamepadChannel->Send(request))
 	{
-		// Handle controller state
-		if (packet.mHeader.mMessageType == RdpGamepad::RdpMessageType::GetStateResponseDS4)
+		return false;
+	}
+	mCounters.Increment(CounterPacketsSent);
+	if (!mUseRateControl)
+	{
+		mRoundTrip.Sent(requestTime);
+	}
+	return true;
+}
+
+bool RdpGamepadProcessor::RdpGamepadReceive(RdpGamepad::RdpProtocolPacket& packet)
+{
+	// Hand out what the last read brought in before reading again.
+	if (mPendingIndex == mPending.size())
+	{
+		const uint64_t readTime = RdpGamepad::RdpLatencyClock::Now();
+		mPendingIndex = 0;
+		if (!mRdpGamepadChannel->ReceiveBatch(mPending))
 		{
-			if (packet.mGetStateResponseDS4.mResult == 0)
+			const unsigned int invalidPackets = mRdpGamepadChannel->GetInvalidPacketCount();
+			if (invalidPackets != mInvalidPackets)
 			{
-				mViGEmTarget360->SetGamepadState(packet.mGetStateResponseDS4.mState);
+				mCounters.Increment(CounterInvalidPackets, invalidPackets - mInvalidPackets);
+				mInvalidPackets = invalidPackets;
 			}
-			else
-			{
-				mViGEmTarget360->SetGamepadState(XINPUT_GAMEPAD{0});
-				mErrorCode = packet.mGetStateResponseDS4.mResult;
-			}
-			mLastGetStateResponseTicks = mRdpGamepadPollTicks;
+			return false;
 		}
+		mLatency.Record(RdpGamepad::LatencyRead, readTime, RdpGamepad::RdpLatencyClock::Now());
 	}
+	mPending[mPendingIndex++].CopyTo(packet);
 
-	// Remove stale controller data
-	if (mRdpGamepadPollTicks < mLastGetStateResponseTicks || (mRdpGamepadPollTicks - mLastGetStateResponseTicks) > 120) // Timeout in about 2 seconds
-	{
-		mViGEmTarget360->SetGamepadState(XINPUT_GAMEPAD{0});
-	}
+	const uint64_t now = RdpGamepad::RdpLatencyClock::Now();
+	mCounters.Increment(CounterPacketsReceived);
 
-	// Check connection state
-	if (!mRdpGamepadChannel->IsOpen())
+	switch (packet.mHeader.mMessageType)
 	{
-		RdpGamepadTidy();
+	case RdpGamepad::RdpMessageType::GetStateResponse:
+	case RdpGamepad::RdpMessageType::GetStateResponseDS4:
+		{
+			uint64_t elapsed;
+			if (mRoundTrip.Received(now, elapsed))
+			{
+				mLatency.Record(RdpGamepad::LatencyRoundTrip, elapsed);
+			}
+		}
+		break;
+
+	case RdpGamepad::RdpMessageType::SetFeedbackResponse:
+		mFeedbackAcknowledged = true;
+		break;
+
+	case RdpGamepad::RdpMessageType::GetLatencyResponse:
+		std::memcpy(mRemoteLatency, packet.mGetLatencyResponse.mStages, sizeof(mRemoteLatency));
+		break;
+
+	case RdpGamepad::RdpMessageType::RateProbe:
+		if (mRdpGamepadChannel->Send(packet.mRateProbe))
+		{
+			mCounters.Increment(CounterPacketsSent);
+			mCounters.Increment(CounterRateProbes);
+		}
+		break;
 	}
+	return true;
 }
 
-void RdpGamepadProcessor::RdpGamepadProcessDS4()
+void RdpGamepadProcessor::RdpGamepadWriteStatistics()
 {
-	++mRdpGamepadPollTicks;
+	const RdpGamepadStatistics statistics = mCounters.TakeSnapshot();
 
-	// Try to open the channel if we don't have a channel open already
-	if (!mRdpGamepadChannel->IsOpen())
+	// Write a temporary file and swap it in so readers never see a partial file.
+	const std::wstring temporaryPath = mStatisticsPath + L".tmp";
 	{
-		// Only try to reconnect every few seconds instead of every tick as WTSVirtualChannelOpen can take a bit long.
-		// I would probably be best if we called that outside of the critical section lock but for now this should
-		// really make things much better.
-		if (mRdpGamepadOpenRetry == 0)
+		std::ofstream file(temporaryPath, std::ios::out | std::ios::trunc);
+		if (!file)
 		{
-			if (!mRdpGamepadChannel->Open())
-			{
-				mRdpGamepadOpenRetry = 35; // Retry about every second
-				RdpGamepadTidy();
-				return;
-			}
+			return;
 		}
-		else
+		for (size_t i = 0; i < CounterCount; ++i)
+		{
+			const RdpGamepadCounter counter = static_cast<RdpGamepadCounter>(i);
+			file << GetCounterName(counter) << ' ' << statistics[counter] << '\n';
+		}
+		file << "Consistent " << (statistics.mConsistent ? 1 : 0) << '\n';
+
+		// One line per stage: count, then p50, p90, p99 and max in microseconds.
+		RdpGamepad::RdpLatencySummary stages[RdpGamepad::LatencyStageCount];
+		GetLatency(stages);
+		for (size_t i = 0; i < RdpGamepad::LatencyStageCount; ++i)
+		{
+			const RdpGamepad::RdpLatencySummary& stage = stages[i];
+			file << "Latency" << RdpGamepad::GetLatencyStageName(static_cast<RdpGamepad::RdpLatencyStage>(i)) << ' '
+				<< stage.mCount << ' ' << stage.mP50 << ' ' << stage.mP90 << ' ' << stage.mP99 << ' ' << stage.mMax << '\n';
+		}
+		if (!file)
 		{
-			--mRdpGamepadOpenRetry;
-			RdpGamepadTidy();
 			return;
 		}
 	}
+	MoveFileExW(temporaryPath.c_str(), mStatisticsPath.c_str(), MOVEFILE_REPLACE_EXISTING);
+}
 
-	//assert(mRdpGamepadChannel->IsOpen());
-	if (!mRdpGamepadConnected)
+template <typename FUNCTION>
+void RdpGamepadProcessor::WithPipeline(FUNCTION function)
+{
+	switch (mType)
 	{
-		//assert(mViGEmTargetDS4 == nullptr)
-		mViGEmTargetDS4 = mViGEmClient->CreateControllerAsDS4();
-		mRdpGamepadConnected = true;
-		mErrorCode = S_OK;
+	case CONTROLLER_360:
+		function(*mViGEmTarget360, mGamepadJitter, mGamepadStates);
+		break;
+
+	case CONTROLLER_360_EMU:
+		function(*mViGEmTarget360, mPadJitter, mPadStates);
+		break;
+
+	case CONTROLLER_DS4:
+		function(*mViGEmTargetDS4, mPadJitter, mPadStates);
+		break;
+
+	case CONTROLLER_DS4_EMU:
+		function(*mViGEmTargetDS4, mGamepadJitter, mGamepadStates);
+		break;
 	}
+}
 
-	// Request controller state and update vibration
-	if (!mRdpGamepadChannel->Send(RdpGamepad::RdpGetStateRequestDS4::MakeRequest(0)))
+void RdpGamepadProcessor::Connect()
+{
+	if (mType == CONTROLLER_360 || mType == CONTROLLER_360_EMU)
 	{
-		RdpGamepadTidy();
-		return;
+		mViGEmTarget360 = AcquireTarget(mTargetPool360);
 	}
+	else
+	{
+		mViGEmTargetDS4 = AcquireTarget(mTargetPoolDS4);
+	}
+	mRdpGamepadConnected = true;
+	mErrorCode = S_OK;
+	mButtonEventsChanged = mUseButtonEvents;
+	mMotionChanged = mUseMotion;
+	mRateControlChanged = mUseRateControl;
+}
+
+void RdpGamepadProcessor::Disconnect()
+{
+	RdpGamepadTidy();
+}
 
-	PadVibrationParam PendingVibesDS4;
-	if (mViGEmTargetDS4->GetVibration(PendingVibesDS4))
+bool RdpGamepadProcessor::SendRequests()
+{
+	const RdpGamepad::RdpButtonEventSource source = ReadsXInput() ? RdpGamepad::ButtonSourceXInput : RdpGamepad::ButtonSourceDS4;
+	if (mButtonEventsChanged)
 	{
-		if (!mRdpGamepadChannel->Send(RdpGamepad::RdpSetStateRequestDS4::MakeRequest(0, PendingVibesDS4)))
+		if (!mRdpGamepadChannel->Send(RdpGamepad::RdpSetButtonEventsRequest::MakeRequest(0, source, mUseButtonEvents ? ButtonSamplePeriodUs : 0)))
 		{
-			RdpGamepadTidy();
-			return;
+			return false;
+		}
+		mCounters.Increment(CounterPacketsSent);
+		mButtonEventsChanged = false;
+	}
+	if (mMotionChanged)
+	{
+		// A new request also restarts the stream's sequence numbers.
+		mMotion.Reset();
+		const bool motion = mUseMotion && mType == CONTROLLER_DS4;
+		if (!mRdpGamepadChannel->Send(RdpGamepad::RdpSetMotionRequest::MakeRequest(0, motion ? MotionSamplePeriodUs : 0)))
+		{
+			return false;
+		}
+		mCounters.Increment(CounterPacketsSent);
+		mMotionChanged = false;
+	}
+	if (mRateControlChanged)
+	{
+		RdpGamepad::RdpRateLimits limits = {};
+		if (mUseRateControl)
+		{
+			limits.mMinInterval = TickPeriodMs * 1000;
+			limits.mMaxInterval = RateMaxIntervalUs;
+			limits.mMaxAnalogStep = RateMaxAnalogStep;
+			limits.mMinKeepalive = RateMinKeepaliveUs;
+			limits.mMaxKeepalive = RateMaxKeepaliveUs;
+		}
+		if (!mRdpGamepadChannel->Send(RdpGamepad::RdpSetRateControlRequest::MakeRequest(0, limits)))
+		{
+			return false;
 		}
+		mCounters.Increment(CounterPacketsSent);
+		mRateControlChanged = false;
 	}
 
-	// Read all the pending messages
+	// Request controller state and update rumble, light bar and player LED
+	if (ReadsXInput())
+	{
+		return RdpGamepadRequestState(RdpGamepad::RdpGetStateRequest::MakeRequest(0)) &&
+			RdpGamepadSendFeedback(RdpGamepad::FeedbackTargetXInput);
+	}
+	return RdpGamepadRequestState(RdpGamepad::RdpGetStateRequestDS4::MakeRequest(0)) &&
+		RdpGamepadSendFeedback(RdpGamepad::FeedbackTargetDS4);
+}
+
+RdpLifecycleRead RdpGamepadProcessor::Read()
+{
 	RdpGamepad::RdpProtocolPacket packet;
-	while (mRdpGamepadChannel->Receive(&packet))
+	if (!RdpGamepadReceive(packet))
+	{
+		return LifecycleReadNone;
+	}
+
+	// Handle controller state
+	RdpLifecycleRead read = LifecycleReadMessage;
+	if (ReadsXInput())
 	{
-		// Handle controller state
-		if (packet.mHeader.mMessageType == RdpGamepad::RdpMessageType::GetStateResponseDS4)
+		if (packet.mHeader.mMessageType == RdpGamepad::RdpMessageType::GetStateResponse && packet.mGetStateResponse.mUserIndex == 0)
 		{
-			if (packet.mGetStateResponseDS4.mResult == 0)
+			if (packet.mGetStateResponse.mResult == 0)
 			{
-				mViGEmTargetDS4->SetGamepadState(packet.mGetStateResponseDS4.mState);
+				ReceiveState(mGamepadJitter, mGamepadStates, packet.mGetStateResponse.mState.Gamepad, GetTimeMicroseconds());
 			}
 			else
 			{
-				mViGEmTargetDS4->SetGamepadState(XINPUT_GAMEPAD{0});
-				mErrorCode = packet.mGetStateResponseDS4.mResult;
+				ReceiveState(mGamepadJitter, mGamepadStates, RdpGamepadButtonTraits<XINPUT_GAMEPAD>::Neutral(), GetTimeMicroseconds());
+				mErrorCode = packet.mGetStateResponse.mResult;
 			}
-			mLastGetStateResponseTicks = mRdpGamepadPollTicks;
+			read = LifecycleReadState;
 		}
 	}
-
-	// Remove stale controller data
-	if (mRdpGamepadPollTicks < mLastGetStateResponseTicks || (mRdpGamepadPollTicks - mLastGetStateResponseTicks) > 120) // Timeout in about 2 seconds
+	else if (packet.mHeader.mMessageType == RdpGamepad::RdpMessageType::GetStateResponseDS4)
+	{
+		if (packet.mGetStateResponseDS4.mResult == 0)
+		{
+			ReceiveState(mPadJitter, mPadStates, packet.mGetStateResponseDS4.mState, GetTimeMicroseconds());
+		}
+		else
+		{
+			ReceiveState(mPadJitter, mPadStates, RdpGamepadButtonTraits<PadState>::Neutral(), GetTimeMicroseconds());
+			mErrorCode = packet.mGetStateResponseDS4.mResult;
+		}
+		read = LifecycleReadState;
+	}
+	else if (packet.mHeader.mMessageType == RdpGamepad::RdpMessageType::ButtonEventsResponse)
+	{
+		RdpGamepadReceiveEdges(packet.mButtonEventsResponse);
+	}
+	else if (packet.mHeader.mMessageType == RdpGamepad::RdpMessageType::MotionResponse)
 	{
-		mViGEmTargetDS4->SetGamepadState(XINPUT_GAMEPAD{0});
+		RdpGamepadReceiveMotion(packet.mMotionResponse);
 	}
 
-	// Check connection state
-	if (!mRdpGamepadChannel->IsOpen())
+	if (!mCoalesceStates)
 	{
-		RdpGamepadTidy();
+		WithPipeline([this](auto& target, auto&, auto& states)
+		{
+			states.Apply([this, &target](const auto& state) { SubmitState(target, state); });
+		});
 	}
+	return read;
 }
 
-void RdpGamepadProcessor::RdpGamepadProcessDS4Emulate()
+void RdpGamepadProcessor::RdpGamepadReceiveEdges(const RdpGamepad::RdpButtonEventsResponse& response)
 {
-	++mRdpGamepadPollTicks;
+	const RdpGamepad::RdpButtonEventSource source = ReadsXInput() ? RdpGamepad::ButtonSourceXInput : RdpGamepad::ButtonSourceDS4;
+	if (!mUseButtonEvents || response.mSource != source)
+	{
+		return;
+	}
 
-	// Try to open the channel if we don't have a channel open already
-	if (!mRdpGamepadChannel->IsOpen())
+	const uint64_t now = GetTimeMicroseconds();
+	const size_t count = (response.mCount < RdpGamepad::ButtonEdgeCapacity) ? response.mCount : RdpGamepad::ButtonEdgeCapacity;
+	for (size_t i = 0; i < count; ++i)
 	{
-		// Only try to reconnect every few seconds instead of every tick as WTSVirtualChannelOpen can take a bit long.
-		// I would probably be best if we called that outside of the critical section lock but for now this should
-		// really make things much better.
-		if (mRdpGamepadOpenRetry == 0)
+		const RdpGamepad::RdpButtonEdge& edge = response.mEdges[i];
+		const uint64_t time = (now > edge.mAge) ? now - edge.mAge : 0;
+		if (source == RdpGamepad::ButtonSourceXInput)
 		{
-			if (!mRdpGamepadChannel->Open())
-			{
-				mRdpGamepadOpenRetry = 35; // Retry about every second
-				RdpGamepadTidy();
-				return;
-			}
+			mGamepadReplay.PushEdge(edge.mDigital, time, now);
 		}
 		else
 		{
-			--mRdpGamepadOpenRetry;
-			RdpGamepadTidy();
-			return;
+			mPadReplay.PushEdge(edge.mDigital, time, now);
 		}
 	}
+	mCounters.Increment(CounterButtonEdges, count);
+}
 
-	//assert(mRdpGamepadChannel->IsOpen());
-	if (!mRdpGamepadConnected)
+void RdpGamepadProcessor::RdpGamepadReceiveMotion(const RdpGamepad::RdpMotionResponse& response)
+{
+	if (!mUseMotion || mType != CONTROLLER_DS4)
 	{
-		//assert(mViGEmTargetDS4 == nullptr)
-		mViGEmTargetDS4 = mViGEmClient->CreateControllerAsDS4();
-		mRdpGamepadConnected = true;
-		mErrorCode = S_OK;
+		return;
 	}
 
-	// Request controller state and update vibration
-	if (!mRdpGamepadChannel->Send(RdpGamepad::RdpGetStateRequest::MakeRequest(0)))
+	RdpGamepad::RdpMotionSample samples[RdpGamepad::MotionBatchCapacity];
+	const size_t count = RdpGamepad::Motion::Decode(response.mBatch, response.GetDataSize(), samples);
+	if (count != response.mBatch.mCount)
 	{
-		RdpGamepadTidy();
 		return;
 	}
+	mCounters.Increment(CounterMotionSamplesLost, mMotion.Push(response.mBatch, samples, count));
+	mCounters.Increment(CounterMotionSamples, count);
+}
 
-	XINPUT_VIBRATION  PendingVibes360;
-	if (mViGEmTargetDS4->GetVibration(PendingVibes360))
+void RdpGamepadProcessor::SubmitStates()
+{
+	WithPipeline([this](auto& target, auto& jitter, auto& states)
 	{
-		if (!mRdpGamepadChannel->Send(RdpGamepad::RdpSetStateRequest::MakeRequest(0, PendingVibes360)))
-		{
-			RdpGamepadTidy();
-			return;
-		}
-	}
+		ReleaseStates(jitter, states, GetTimeMicroseconds());
+		states.Apply([this, &target](const auto& state) { SubmitState(target, state); });
+	});
 
-	// Read all the pending messages
-	RdpGamepad::RdpProtocolPacket packet;
-	while (mRdpGamepadChannel->Receive(&packet))
+	RdpGamepadMotionReport motion;
+	if (mType == CONTROLLER_DS4 && mMotion.Take(motion) && mViGEmTargetDS4->SetMotion(motion))
 	{
-		// Handle controller state
-		if (packet.mHeader.mMessageType == RdpGamepad::RdpMessageType::GetStateResponse)
-		{
-			if (packet.mGetStateResponse.mUserIndex == 0)
-			{
-				if (packet.mGetStateResponse.mResult == 0)
-				{
-					mViGEmTargetDS4->SetGamepadState(packet.mGetStateResponse.mState.Gamepad);
-				}
-				else
-				{
-					mViGEmTargetDS4->SetGamepadState(XINPUT_GAMEPAD{0});
-					mErrorCode = packet.mGetStateResponse.mResult;
-				}
-				mLastGetStateResponseTicks = mRdpGamepadPollTicks;
-			}
-		}
+		mCounters.Increment(CounterReportsSubmitted);
 	}
+}
 
+void RdpGamepadProcessor::StaleTimeout()
+{
+	mCounters.Increment(CounterStaleTimeouts);
+}
+
+void RdpGamepadProcessor::SubmitNeutral()
+{
 	// Remove stale controller data
-	if (mRdpGamepadPollTicks < mLastGetStateResponseTicks || (mRdpGamepadPollTicks - mLastGetStateResponseTicks) > 120) // Timeout in about 2 seconds
+	if (mType == CONTROLLER_DS4)
 	{
-		mViGEmTargetDS4->SetGamepadState(XINPUT_GAMEPAD{0});
+		mViGEmTargetDS4->ResetMotion();
 	}
-
-	// Check connection state
-	if (!mRdpGamepadChannel->IsOpen())
+	WithPipeline([this](auto& target, auto& jitter, auto& states)
 	{
-		RdpGamepadTidy();
-	}
-}
\ No newline at end of file
+		typedef typename std::decay<decltype(states)>::type::State State;
+		GetButtonReplay(State()).Reset();
+		jitter.Reset();
+		states.Push(RdpGamepadButtonTraits<State>::Neutral());
+		states.Apply([this, &target](const State& state) { SubmitState(target, state); });
+	});
+}
+
+bool RdpGamepadProcessor::IsChannelOpen()
+{
+	return mRdpGamepadChannel->IsOpen();
+}
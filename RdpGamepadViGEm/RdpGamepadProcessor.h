@@ -3,11 +3,33 @@
 
 #pragma once
 
+#include <Xinput.h>
+#include <ds4_pad.h>
+#include <RdpGamepadFeedback.h>
+#include <RdpGamepadLatency.h>
+#include <RdpGamepadMessageSplitter.h>
+#include <RdpGamepadTrace.h>
+
+#include "GamepadMapping.h"
+#include "RdpGamepadButtonReplay.h"
+#include "RdpGamepadJitterBuffer.h"
+#include "RdpGamepadLifecycle.h"
+#include "RdpGamepadMotionFilter.h"
+#include "RdpGamepadStateQueue.h"
+#include "RdpGamepadStatistics.h"
+#include "RdpGamepadTargetPool.h"
+#include "ViGEmReportCache.h"
+
 namespace RdpGamepad
 {
-	class RdpGamepadVirtualChannel;
+	class RdpGamepadTransport;
+	union RdpProtocolPacket;
+	struct RdpProtocolHeader;
+	struct RdpButtonEventsResponse;
+	struct RdpMotionResponse;
 }
 
+class RdpGamepadConnection;
 class ViGEmClient;
 class ViGEmTarget360;
 class ViGEmTargetDS4;
@@ -21,17 +43,55 @@ enum CONTROLLER_TYPE
 	CONTROLLER_DS4_EMU,		// XInput ---> Dual Shock 4.
 };
 
-class RdpGamepadProcessor
+class RdpGamepadProcessor : private RdpGamepadLifecycleHost
 {
 public:
+	static constexpr unsigned int TickPeriodMs = 16;
+
+	// The plugin counts as gone when it has not sent a state for this long.
+	static constexpr unsigned int StaleTimeoutMs = 2000;
+
+	// How often the plugin samples the buttons when button events are enabled.
+	static constexpr unsigned int ButtonSamplePeriodUs = 1000;
+
+	// How often the plugin samples the gyroscope, accelerometer and touchpad when motion is enabled.
+	static constexpr unsigned int MotionSamplePeriodUs = 1000;
+
+	// Bounds for the plugin's rate controller: a state every tick and every analog change on a clear
+	// link, down to ten a second and steps of 1/32 of the range on a congested one. The longest
+	// keepalive stays well within StaleTimeoutMs.
+	static constexpr unsigned int RateMaxIntervalUs = 100000;
+	static constexpr unsigned int RateMaxAnalogStep = 2048;
+	static constexpr unsigned int RateMinKeepaliveUs = 100000;
+	static constexpr unsigned int RateMaxKeepaliveUs = StaleTimeoutMs * 1000 / 2;
+
 	RdpGamepadProcessor();
 	~RdpGamepadProcessor();
 
 	void Start(CONTROLLER_TYPE type = CONTROLLER_360);
 	void Stop();
 
+	// Starts without a polling thread of its own; the owner calls Tick every TickPeriodMs instead,
+	// from one thread at a time, until Stop.
+	void StartScheduled(CONTROLLER_TYPE type = CONTROLLER_360);
+	void Tick();
+
+	// Opens the virtual channel of another session than the current one, which only works from a
+	// service. Only call this while the processor is stopped.
+	void SetSessionId(DWORD sessionId)
+	{ mSessionId = sessionId; }
+
+	// Connects to a plugin at a transport address instead of opening the RDP virtual channel: a socket
+	// ("tcp:<port>", "tcp:<host>:<port>" or "unix:<path>") or a shared memory region on this machine
+	// ("shm:<name>"). An empty address restores the virtual channel. Only call this while the processor
+	// is stopped; returns false for a malformed address.
+	bool SetTransportAddress(const std::string& address);
+
+	// Switches the emulated controller at the next tick without closing the RDP channel.
+	void SetType(CONTROLLER_TYPE type);
+
 	CONTROLLER_TYPE GetType() const
-	{ return mType; }
+	{ return mRequestedType; }
 
 	bool IsConnected() const
 	{ return mRdpGamepadConnected; }
@@ -39,25 +99,197 @@ public:
 	DWORD GetErrorCode() const
 	{ return mErrorCode; }
 
+	// When enabled (the default) all states received during a tick are collapsed into the newest one
+	// before being sent to the virtual controller, instead of replaying every queued state.
+	void SetCoalesceStates(bool enable);
+
+	// Smooths out uneven state delivery by holding analog-only changes for up to maxDelayMs.
+	// Disabled by default.
+	void SetJitterBuffer(bool enable, unsigned int maxDelayMs = 50);
+
+	// Has the plugin sample the buttons every millisecond and send every press and release between two
+	// states. They are played back in order, each held for at least minHoldMs, so a tap shorter than a
+	// tick still reaches the game. Disabled by default.
+	void SetButtonEvents(bool enable, unsigned int minHoldMs = 20);
+
+	// Has the plugin stream the DualShock 4's gyroscope, accelerometer and touchpad at 1 kHz and forwards
+	// them in extended reports, one per tick averaging the samples since the last. Only CONTROLLER_DS4
+	// carries motion. Disabled by default.
+	void SetMotion(bool enable);
+
+	// Has the plugin measure the round trip and how long its writes take, and hold back analog-only
+	// states, within the Rate* bounds, while the link is congested. Button changes always go out at once.
+	// The round trip latency stage is not recorded meanwhile, as states no longer answer requests one
+	// for one. Disabled by default.
+	void SetRateControl(bool enable);
+
+	// Remaps buttons and reshapes sticks and triggers of XInput sourced states (CONTROLLER_360 and
+	// CONTROLLER_DS4_EMU). Safe to call from any thread at any time.
+	void SetMappingProfile(const MappingProfile& profile)
+	{ mMapper.SetProfile(profile); }
+
+	void ClearMappingProfile()
+	{ mMapper.ClearProfile(); }
+
+	// Reads a profile in the format of ParseMappingProfile and sets it. Returns false, keeping the current
+	// profile, if the file cannot be opened or read.
+	bool LoadMappingProfile(const std::wstring& path);
+
+	// Latency summaries for every stage. Plugin stages come from its answer to the last RequestRemoteLatency.
+	void GetLatency(RdpGamepad::RdpLatencySummary (&outStages)[RdpGamepad::LatencyStageCount]);
+
+	// Asks the plugin for its latency summaries at the next tick.
+	void RequestRemoteLatency()
+	{ mRemoteLatencyRequested = true; }
+
+	RdpGamepadStatistics GetStatistics() const
+	{ return mCounters.TakeSnapshot(); }
+
+	// Keeps a virtual controller plugged in, at rest, for gracePeriodMs after its channel drops so a
+	// reconnect within that time gets the same device back. 0 unplugs it right away; the default is
+	// 10 seconds.
+	void SetTargetGracePeriod(unsigned int gracePeriodMs);
+
+	// Resends an unchanged report to the virtual controller once it is intervalMs old. 0, the default,
+	// only sends reports that changed.
+	void SetReportRefreshInterval(unsigned int intervalMs);
+
+	// Rewrites the given file with the current statistics and latencies every intervalMs, asking the plugin
+	// for its latencies each time. An empty path turns this off.
+	void SetStatisticsFile(const std::wstring& path, unsigned int intervalMs = 5000);
+
+	// Records every state submitted to the virtual controller to the given trace file. An empty path
+	// stops recording.
+	bool SetTraceFile(const std::wstring& path);
+
+	// Feeds the plugin states of a trace through the mapping, jitter buffer and virtual controller of the
+	// current type, as if they had arrived over the channel. Returns the number of states replayed. Only
+	// call this while the processor is stopped; with the jitter buffer and button events disabled and
+	// PacingFastest the submitted states depend on nothing but the trace.
+	uint64_t ReplayTrace(const std::wstring& path, RdpGamepad::RdpTraceReplayer::Pacing pacing);
+
 private:
-	std::unique_ptr<RdpGamepad::RdpGamepadVirtualChannel> mRdpGamepadChannel;
+	std::unique_ptr<RdpGamepad::RdpGamepadTransport> mRdpGamepadChannel;
+	std::unique_ptr<RdpGamepadConnection> mRdpGamepadConnection;
+	RdpGamepadLifecycle mLifecycle;
 	std::shared_ptr<ViGEmClient> mViGEmClient;
 	std::shared_ptr<ViGEmTarget360> mViGEmTarget360;
 	std::shared_ptr<ViGEmTargetDS4> mViGEmTargetDS4;
+	RdpGamepadTargetPool<ViGEmTarget360> mTargetPool360;
+	RdpGamepadTargetPool<ViGEmTargetDS4> mTargetPoolDS4;
+	RdpGamepadStateQueue<XINPUT_GAMEPAD> mGamepadStates;
+	RdpGamepadStateQueue<PadState> mPadStates;
+	RdpGamepadJitterBuffer<XINPUT_GAMEPAD> mGamepadJitter;
+	RdpGamepadJitterBuffer<PadState> mPadJitter;
+	RdpGamepadButtonReplay<XINPUT_GAMEPAD> mGamepadReplay;
+	RdpGamepadButtonReplay<PadState> mPadReplay;
+	RdpGamepadMotionFilter mMotion;
+	GamepadMapper mMapper;
+	RdpGamepad::RdpFeedbackCoalescer mFeedback;
+	RdpGamepad::RdpLatencyStages mLatency;
+	RdpGamepad::RdpLatencyRoundTrip mRoundTrip;
+	RdpGamepad::RdpLatencySummary mRemoteLatency[RdpGamepad::LatencyStageCount]{};
+	std::atomic<bool> mRemoteLatencyRequested{false};
+	RdpGamepadCounters mCounters;
+	RdpGamepad::RdpTraceRecorder mTrace;
+	std::string mTransportAddress;
+	DWORD mSessionId = DWORD(-1);	// WTS_CURRENT_SESSION
+	std::wstring mStatisticsPath;
+	ULONGLONG mStatisticsInterval = 0;
+	ULONGLONG mStatisticsWriteTime = 0;
+	unsigned int mReportRefreshInterval = 0;
+	ViGEmUpdateStats mTargetUpdates;	// Of the current virtual controller, as last added to mCounters.
+	unsigned int mInvalidPackets = 0;
+	// Messages of the last read not handed out yet; they point into the transport's receive buffer.
+	RdpGamepad::RdpPacketSpan mPending;
+	size_t mPendingIndex = 0;
 	std::thread mThread;
 	std::recursive_mutex mMutex;
-	unsigned int mRdpGamepadOpenRetry = 0;
-	unsigned int mRdpGamepadPollTicks = 0;
-	unsigned int mLastGetStateResponseTicks = 0;
-	bool mRdpGamepadConnected = false;
+	std::atomic<bool> mRdpGamepadConnected{false};
 	bool mKeepRunning = false;
+	bool mCoalesceStates = true;
+	bool mUseJitterBuffer = false;
+	bool mUseButtonEvents = false;
+	bool mButtonEventsChanged = false;
+	bool mUseMotion = false;
+	bool mMotionChanged = false;
+	bool mUseRateControl = false;
+	bool mRateControlChanged = false;
+	// The plugin has answered a SetFeedbackRequest. Until then it may be one that predates them and
+	// ignores them, so rumble also goes out as the per-mode SetStateRequest it understands.
+	bool mFeedbackAcknowledged = false;
 	CONTROLLER_TYPE mType = CONTROLLER_360;
-	DWORD mErrorCode = S_OK;
+	std::atomic<CONTROLLER_TYPE> mRequestedType{CONTROLLER_360};
+	std::atomic<DWORD> mErrorCode{S_OK};
 
 	void Run();
+	void RdpGamepadTick();
+	void RdpGamepadShutdown();
 	void RdpGamepadTidy();
-	void RdpGamepadProcess360();
-	void RdpGamepadProcess360Emulate();
-	void RdpGamepadProcessDS4();
-	void RdpGamepadProcessDS4Emulate();
+	void RdpGamepadSwitchType(CONTROLLER_TYPE type);
+	void RdpGamepadReleaseTargets();
+	void RdpGamepadCollectUpdateStats();
+	bool RdpGamepadSendFeedback(RdpGamepad::RdpFeedbackTarget target);
+	bool RdpGamepadRequestState(const RdpGamepad::RdpProtocolHeader& request);
+	bool RdpGamepadReceive(RdpGamepad::RdpProtocolPacket& packet);
+	void RdpGamepadReceiveEdges(const RdpGamepad::RdpButtonEventsResponse& response);
+	void RdpGamepadReceiveMotion(const RdpGamepad::RdpMotionResponse& response);
+	void RdpGamepadWriteStatistics();
+
+	// RdpGamepadLifecycleHost, for the controller type in mType.
+	bool AttachChannel() override;
+	void Connect() override;
+	void Disconnect() override;
+	bool SendRequests() override;
+	RdpLifecycleRead Read() override;
+	void SubmitStates() override;
+	void StaleTimeout() override;
+	void SubmitNeutral() override;
+	bool IsChannelOpen() override;
+
+	// Whether the current type asks the plugin for XInput states rather than DS4 states.
+	bool ReadsXInput() const
+	{ return mType == CONTROLLER_360 || mType == CONTROLLER_DS4_EMU; }
+
+	// Calls function with the virtual controller, jitter buffer and state queue of the current type.
+	template <typename FUNCTION>
+	void WithPipeline(FUNCTION function);
+
+	// now is in GetTimeMicroseconds() units; replaying a trace as fast as possible passes the trace's time instead.
+	template <typename STATE>
+	void ReceiveState(RdpGamepadJitterBuffer<STATE>& jitter, RdpGamepadStateQueue<STATE>& states, const STATE& state, uint64_t now);
+	template <typename STATE>
+	void QueueState(RdpGamepadJitterBuffer<STATE>& jitter, RdpGamepadStateQueue<STATE>& states, const STATE& state, uint64_t now);
+	template <typename STATE>
+	void ReleaseStates(RdpGamepadJitterBuffer<STATE>& jitter, RdpGamepadStateQueue<STATE>& states, uint64_t now);
+	template <typename TARGET>
+	std::shared_ptr<TARGET> AcquireTarget(RdpGamepadTargetPool<TARGET>& pool);
+	template <typename TARGET, typename STATE>
+	void SubmitState(TARGET& target, const STATE& state);
+	template <typename TARGET, typename STATE>
+	uint64_t ReplayStates(RdpGamepad::RdpTraceReader& reader, RdpGamepad::RdpTraceReplayer::Pacing pacing, TARGET& target, RdpGamepadJitterBuffer<STATE>& jitter, RdpGamepadStateQueue<STATE>& states);
+
+	void MapState(XINPUT_GAMEPAD& state)
+	{ mMapper.Apply(state); }
+
+	void MapState(PadState&)
+	{}
+
+	RdpGamepadButtonReplay<XINPUT_GAMEPAD>& GetButtonReplay(const XINPUT_GAMEPAD&)
+	{ return mGamepadReplay; }
+
+	RdpGamepadButtonReplay<PadState>& GetButtonReplay(const PadState&)
+	{ return mPadReplay; }
+
+	static RdpGamepad::RdpTraceKind GetTraceKind(const XINPUT_GAMEPAD&)
+	{ return RdpGamepad::TraceKindXInput; }
+
+	static RdpGamepad::RdpTraceKind GetTraceKind(const PadState&)
+	{ return RdpGamepad::TraceKindDS4; }
+
+	static uint64_t GetTimeMicroseconds();
+
+	// Open and close functions of the connection; its handles are RdpGamepadTransport objects.
+	void* OpenTransport();
+	static void CloseTransport(void* handle);
 };
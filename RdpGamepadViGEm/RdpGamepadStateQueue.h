@@ -0,0 +1,137 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstdint>
+
+// Describes where the digital buttons live in a controller state so the queue can track edges,
+// and what a released controller looks like.
+template <typename STATE>
+struct RdpGamepadButtonTraits;
+
+template <>
+struct RdpGamepadButtonTraits<XINPUT_GAMEPAD>
+{
+	static uint32_t GetButtons(const XINPUT_GAMEPAD& state)
+	{ return state.wButtons; }
+
+	static void SetButtons(XINPUT_GAMEPAD& state, uint32_t buttons)
+	{ state.wButtons = static_cast<WORD>(buttons); }
+
+	static uint32_t GetDigital(const XINPUT_GAMEPAD& state)
+	{ return state.wButtons; }
+
+	static void SetDigital(XINPUT_GAMEPAD& state, uint32_t digital)
+	{ state.wButtons = static_cast<WORD>(digital); }
+
+	static XINPUT_GAMEPAD Neutral()
+	{ return XINPUT_GAMEPAD{}; }
+};
+
+template <>
+struct RdpGamepadButtonTraits<PadState>
+{
+	// The low nibble of PadState::Buttons is the d-pad direction, not a bit mask, so it is left alone
+	// and always follows the newest state.
+	static constexpr uint32_t DpadMask = 0xf;
+
+	static uint32_t GetButtons(const PadState& state)
+	{ return (state.Buttons & ~DpadMask & 0xffff) | (uint32_t(state.SpecialButtons) << 16); }
+
+	static void SetButtons(PadState& state, uint32_t buttons)
+	{
+		state.Buttons = static_cast<uint16_t>((state.Buttons & DpadMask) | (buttons & ~DpadMask & 0xffff));
+		state.SpecialButtons = static_cast<uint8_t>(buttons >> 16);
+	}
+
+	// Every digital input including the d-pad direction.
+	static uint32_t GetDigital(const PadState& state)
+	{ return state.Buttons | (uint32_t(state.SpecialButtons) << 16); }
+
+	static void SetDigital(PadState& state, uint32_t digital)
+	{
+		state.Buttons = static_cast<uint16_t>(digital);
+		state.SpecialButtons = static_cast<uint8_t>(digital >> 16);
+	}
+
+	static PadState Neutral()
+	{
+		PadState state = {};
+		state.StickL.X = 128;
+		state.StickL.Y = 128;
+		state.StickR.X = 128;
+		state.StickR.Y = 128;
+		state.Buttons = PAD_BUTTON_DPAD_NONE;
+		return state;
+	}
+};
+
+// Collects the controller states received during one tick and hands back only the newest one.
+// Button presses or releases that happened inside the burst but are undone by the newest state
+// are kept by emitting one extra state with those buttons flipped before the newest state.
+template <typename STATE, typename TRAITS = RdpGamepadButtonTraits<STATE>>
+class RdpGamepadStateQueue
+{
+public:
+	typedef STATE State;
+
+	void Push(const STATE& state)
+	{
+		const uint32_t buttons = TRAITS::GetButtons(state);
+		mPressed |= buttons;
+		mReleased |= ~buttons;
+		mLatest = state;
+		mHasLatest = true;
+	}
+
+	bool IsEmpty() const
+	{ return !mHasLatest; }
+
+	// Calls apply with the minimal transition sequence for the pending burst, then empties the queue.
+	template <typename FUNC>
+	void Apply(FUNC&& apply)
+	{
+		if (!mHasLatest)
+		{
+			return;
+		}
+
+		const uint32_t latest = TRAITS::GetButtons(mLatest);
+		if (mHasApplied)
+		{
+			// Buttons that went down and back up (or up and back down) without the newest state showing it.
+			const uint32_t lost = (mPressed & ~mApplied & ~latest) | (mReleased & mApplied & latest);
+			if (lost != 0)
+			{
+				STATE transition = mLatest;
+				TRAITS::SetButtons(transition, latest ^ lost);
+				apply(transition);
+			}
+		}
+		apply(mLatest);
+
+		mApplied = latest;
+		mHasApplied = true;
+		mPressed = 0;
+		mReleased = 0;
+		mHasLatest = false;
+	}
+
+	void Reset()
+	{
+		mPressed = 0;
+		mReleased = 0;
+		mApplied = 0;
+		mHasLatest = false;
+		mHasApplied = false;
+	}
+
+private:
+	STATE mLatest{};
+	uint32_t mPressed = 0;
+	uint32_t mReleased = 0;
+	uint32_t mApplied = 0;
+	bool mHasLatest = false;
+	bool mHasApplied = false;
+};
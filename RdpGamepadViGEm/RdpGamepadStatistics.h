@@ -0,0 +1,164 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+enum RdpGamepadCounter
+{
+	CounterPacketsSent,			// Messages written to the RDP channel.
+	CounterPacketsReceived,		// Valid messages read from the RDP channel.
+	CounterInvalidPackets,		// Malformed messages, each of which also closes the channel.
+	CounterReconnects,			// Times an open channel was lost and a new one requested.
+	CounterStaleTimeouts,		// Times the client stopped answering and the pad was reset to neutral.
+	CounterReportsSubmitted,	// Reports sent to the ViGEm driver (one IOCTL each).
+	CounterReportsSkipped,		// Reports not sent because they matched the last one, each an IOCTL saved.
+	CounterFeedbackForwards,	// Rumble/light bar reports forwarded to the client.
+	CounterTickOverruns,		// Ticks that took longer than the poll period.
+	CounterTargetsAdded,		// Virtual controllers plugged in.
+	CounterTargetsReused,		// Connections that got a virtual controller still plugged in from before.
+	CounterButtonEdges,			// Button presses and releases the plugin sampled between states.
+	CounterMotionSamples,		// Gyroscope and accelerometer samples received.
+	CounterMotionSamplesLost,	// Samples the plugin took but never delivered.
+	CounterRateProbes,			// Rate control probes echoed back to the plugin.
+
+	CounterCount
+};
+
+inline const char* GetCounterName(RdpGamepadCounter counter)
+{
+	static const char* const sNames[] =
+	{
+		"PacketsSent",
+		"PacketsReceived",
+		"InvalidPackets",
+		"Reconnects",
+		"StaleTimeouts",
+		"ReportsSubmitted",
+		"ReportsSkipped",
+		"FeedbackForwards",
+		"TickOverruns",
+		"TargetsAdded",
+		"TargetsReused",
+		"ButtonEdges",
+		"MotionSamples",
+		"MotionSamplesLost",
+		"RateProbes",
+	};
+	static_assert(sizeof(sNames) / sizeof(sNames[0]) == CounterCount, "sNames has incorrect size");
+	return sNames[counter];
+}
+
+struct RdpGamepadStatistics
+{
+	uint64_t mValues[CounterCount];
+	bool mConsistent;			// All values were observed at the same instant.
+
+	uint64_t operator[](RdpGamepadCounter counter) const
+	{ return mValues[counter]; }
+};
+
+// Monotonic event counters that any thread can bump without contention: every thread adds to its own
+// cache line sized slot and readers sum the slots. Threads beyond SlotCount share slots, which stays
+// correct since every add is atomic, only slower.
+class RdpGamepadCounters
+{
+public:
+	static constexpr size_t SlotCount = 8;
+	static constexpr size_t CacheLineSize = 64;
+	static constexpr unsigned int SnapshotAttempts = 4;
+
+	// The slots are aligned by hand in a separate allocation rather than with alignas, since operator new
+	// before C++17 ignores alignment beyond max_align_t and the counters live in heap allocated objects.
+	RdpGamepadCounters()
+		: mStorage(new unsigned char[SlotCount * SlotStride + CacheLineSize - 1])
+	{
+		const uintptr_t address = reinterpret_cast<uintptr_t>(mStorage.get());
+		mSlotBase = mStorage.get() + ((CacheLineSize - address % CacheLineSize) % CacheLineSize);
+		for (size_t i = 0; i < SlotCount; ++i)
+		{
+			Slot* slot = new (mSlotBase + i * SlotStride) Slot;
+			for (auto& value : slot->mValues)
+			{
+				value.store(0, std::memory_order_relaxed);
+			}
+		}
+	}
+
+	RdpGamepadCounters(const RdpGamepadCounters&) = delete;
+	RdpGamepadCounters& operator=(const RdpGamepadCounters&) = delete;
+
+	void Increment(RdpGamepadCounter counter, uint64_t amount = 1)
+	{ GetSlot(GetThreadSlot()).mValues[counter].fetch_add(amount, std::memory_order_relaxed); }
+
+	// Counters only grow, so two identical passes over the slots mean every value held still between
+	// them, and the totals are an exact picture of one instant. Writers that never pause get the last
+	// pass with mConsistent cleared.
+	RdpGamepadStatistics TakeSnapshot() const
+	{
+		RdpGamepadStatistics previous;
+		Collect(previous);
+		for (unsigned int attempt = 0; attempt < SnapshotAttempts; ++attempt)
+		{
+			RdpGamepadStatistics current;
+			Collect(current);
+			bool same = true;
+			for (size_t i = 0; i < CounterCount; ++i)
+			{
+				same = same && (current.mValues[i] == previous.mValues[i]);
+			}
+			if (same)
+			{
+				current.mConsistent = true;
+				return current;
+			}
+			previous = current;
+		}
+		previous.mConsistent = false;
+		return previous;
+	}
+
+	// Where the given thread slot lives, for checking that no two slots share a cache line.
+	const void* GetSlotAddress(size_t index) const
+	{ return &GetSlot(index); }
+
+private:
+	struct Slot
+	{
+		std::atomic<uint64_t> mValues[CounterCount];
+	};
+
+	static constexpr size_t SlotStride = (sizeof(Slot) + CacheLineSize - 1) / CacheLineSize * CacheLineSize;
+
+	std::unique_ptr<unsigned char[]> mStorage;
+	unsigned char* mSlotBase;
+
+	Slot& GetSlot(size_t index) const
+	{ return *reinterpret_cast<Slot*>(mSlotBase + index * SlotStride); }
+
+	void Collect(RdpGamepadStatistics& outStatistics) const
+	{
+		for (size_t i = 0; i < CounterCount; ++i)
+		{
+			uint64_t total = 0;
+			for (size_t slot = 0; slot < SlotCount; ++slot)
+			{
+				total += GetSlot(slot).mValues[i].load(std::memory_order_acquire);
+			}
+			outStatistics.mValues[i] = total;
+		}
+		outStatistics.mConsistent = false;
+	}
+
+	static size_t GetThreadSlot()
+	{
+		static std::atomic<size_t> sNextThread{0};
+		thread_local const size_t sSlot = sNextThread.fetch_add(1, std::memory_order_relaxed) % SlotCount;
+		return sSlot;
+	}
+};
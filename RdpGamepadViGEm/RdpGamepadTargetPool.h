@@ -0,0 +1,125 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// What the pool needs from the driver: plugging virtual controllers in and out, and putting one at
+// rest.
+template <typename TARGET>
+class RdpGamepadTargetSink
+{
+public:
+	virtual ~RdpGamepadTargetSink()
+	{}
+
+	// Plugs in a new virtual controller, or returns null if the driver refused.
+	virtual std::shared_ptr<TARGET> Add() = 0;
+
+	// Unplugs a virtual controller that Add returned.
+	virtual void Remove(std::shared_ptr<TARGET> target) = 0;
+
+	// Sends the report of a controller with nothing pressed and the sticks centered.
+	virtual void SubmitNeutral(TARGET& target) = 0;
+};
+
+// Keeps virtual controllers plugged in for a grace period after their channel drops, so a reconnect
+// gets the same device back instead of a slow unplug and plug that games often lose the binding
+// over. An idle controller only ever sees a neutral report. All times are in milliseconds.
+template <typename TARGET>
+class RdpGamepadTargetPool
+{
+public:
+	static constexpr size_t MaxIdle = 4;
+
+	explicit RdpGamepadTargetPool(std::unique_ptr<RdpGamepadTargetSink<TARGET>> sink, uint64_t gracePeriod = 10000)
+		: mSink(std::move(sink))
+		, mGracePeriod(gracePeriod)
+	{}
+
+	~RdpGamepadTargetPool()
+	{ Clear(); }
+
+	// A grace period of 0 unplugs a controller as soon as it is released.
+	void SetGracePeriod(uint64_t gracePeriod)
+	{ mGracePeriod = gracePeriod; }
+
+	// Takes the most recently released controller, which is the one a game is most likely still bound
+	// to, or plugs in a new one. outReused tells which.
+	std::shared_ptr<TARGET> Acquire(bool& outReused)
+	{
+		outReused = !mIdle.empty();
+		if (!outReused)
+		{
+			return mSink->Add();
+		}
+		std::shared_ptr<TARGET> target = std::move(mIdle.back().mTarget);
+		mIdle.pop_back();
+		return target;
+	}
+
+	// Takes back a controller whose channel dropped and leaves it at rest until the grace period
+	// passes. Accepts null.
+	void Release(std::shared_ptr<TARGET> target, uint64_t now)
+	{
+		if (!target)
+		{
+			return;
+		}
+		if (mGracePeriod == 0)
+		{
+			mSink->Remove(std::move(target));
+			return;
+		}
+
+		mSink->SubmitNeutral(*target);
+		if (mIdle.size() == MaxIdle)
+		{
+			mSink->Remove(std::move(mIdle.front().mTarget));
+			mIdle.erase(mIdle.begin());
+		}
+		mIdle.push_back(Idle{ std::move(target), now });
+	}
+
+	// Unplugs the controllers whose grace period has passed. Call this regularly, connected or not.
+	void Expire(uint64_t now)
+	{
+		// Released in order, so the expired ones are at the front.
+		size_t expired = 0;
+		while (expired < mIdle.size() && now - mIdle[expired].mReleaseTime >= mGracePeriod)
+		{
+			mSink->Remove(std::move(mIdle[expired].mTarget));
+			++expired;
+		}
+		mIdle.erase(mIdle.begin(), mIdle.begin() + expired);
+	}
+
+	// Unplugs every idle controller now.
+	void Clear()
+	{
+		for (Idle& idle : mIdle)
+		{
+			mSink->Remove(std::move(idle.mTarget));
+		}
+		mIdle.clear();
+	}
+
+	size_t GetIdleCount() const
+	{ return mIdle.size(); }
+
+private:
+	struct Idle
+	{
+		std::shared_ptr<TARGET> mTarget;
+		uint64_t mReleaseTime;
+	};
+
+	std::unique_ptr<RdpGamepadTargetSink<TARGET>> mSink;
+	std::vector<Idle> mIdle;
+	uint64_t mGracePeriod;
+};
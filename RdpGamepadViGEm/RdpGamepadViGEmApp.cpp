@@ -4,6 +4,7 @@
 #include "pch.h"
 
 #include "RdpGamepadProcessor.h"
+#include "RdpGamepadViGEmService.h"
 #include "resource.h"
 
 #include <shellapi.h>
@@ -15,6 +16,70 @@ class RdpGamepadViGEmApp
 public:
 	RdpGamepadViGEmApp()
 	{
+		wchar_t tempPath[MAX_PATH];
+		const DWORD length = GetTempPathW(ARRAYSIZE(tempPath), tempPath);
+		if (length != 0 && length < ARRAYSIZE(tempPath))
+		{
+			mRdpProcessor.SetStatisticsFile(std::wstring(tempPath) + L"RdpGamepadViGEm.stats");
+		}
+
+		// Setting RDPGAMEPAD_TRACE to a file path records every state sent to the virtual controller.
+		wchar_t tracePath[MAX_PATH];
+		const DWORD traceLength = GetEnvironmentVariableW(L"RDPGAMEPAD_TRACE", tracePath, ARRAYSIZE(tracePath));
+		if (traceLength != 0 && traceLength < ARRAYSIZE(tracePath))
+		{
+			mRdpProcessor.SetTraceFile(tracePath);
+		}
+
+		// Setting RDPGAMEPAD_TRANSPORT to a socket or shared memory address connects to a plugin serving
+		// there instead of using the RDP virtual channel.
+		char transportAddress[MAX_PATH];
+		const DWORD transportLength = GetEnvironmentVariableA("RDPGAMEPAD_TRANSPORT", transportAddress, ARRAYSIZE(transportAddress));
+		if (transportLength != 0 && transportLength < ARRAYSIZE(transportAddress))
+		{
+			mRdpProcessor.SetTransportAddress(transportAddress);
+		}
+
+		// Setting RDPGAMEPAD_BUTTON_EVENTS to a hold time in milliseconds replays presses shorter than a tick.
+		wchar_t minHold[16];
+		const DWORD minHoldLength = GetEnvironmentVariableW(L"RDPGAMEPAD_BUTTON_EVENTS", minHold, ARRAYSIZE(minHold));
+		if (minHoldLength != 0 && minHoldLength < ARRAYSIZE(minHold))
+		{
+			mRdpProcessor.SetButtonEvents(true, wcstoul(minHold, nullptr, 10));
+		}
+
+		// Setting RDPGAMEPAD_MOTION to 1 forwards the DualShock 4's gyroscope, accelerometer and touchpad.
+		wchar_t motion[4];
+		const DWORD motionLength = GetEnvironmentVariableW(L"RDPGAMEPAD_MOTION", motion, ARRAYSIZE(motion));
+		if (motionLength != 0 && motionLength < ARRAYSIZE(motion))
+		{
+			mRdpProcessor.SetMotion(wcstoul(motion, nullptr, 10) != 0);
+		}
+
+		// Setting RDPGAMEPAD_RATE_CONTROL to 1 has the plugin send fewer states while the link is congested.
+		wchar_t rateControl[4];
+		const DWORD rateControlLength = GetEnvironmentVariableW(L"RDPGAMEPAD_RATE_CONTROL", rateControl, ARRAYSIZE(rateControl));
+		if (rateControlLength != 0 && rateControlLength < ARRAYSIZE(rateControl))
+		{
+			mRdpProcessor.SetRateControl(wcstoul(rateControl, nullptr, 10) != 0);
+		}
+
+		// Setting RDPGAMEPAD_REPORT_REFRESH to milliseconds resends an unchanged report to the virtual
+		// controller that often.
+		wchar_t reportRefresh[16];
+		const DWORD reportRefreshLength = GetEnvironmentVariableW(L"RDPGAMEPAD_REPORT_REFRESH", reportRefresh, ARRAYSIZE(reportRefresh));
+		if (reportRefreshLength != 0 && reportRefreshLength < ARRAYSIZE(reportRefresh))
+		{
+			mRdpProcessor.SetReportRefreshInterval(wcstoul(reportRefresh, nullptr, 10));
+		}
+
+		// Setting RDPGAMEPAD_MAPPING to a profile file remaps buttons and reshapes sticks and triggers.
+		wchar_t mappingPath[MAX_PATH];
+		const DWORD mappingLength = GetEnvironmentVariableW(L"RDPGAMEPAD_MAPPING", mappingPath, ARRAYSIZE(mappingPath));
+		if (mappingLength != 0 && mappingLength < ARRAYSIZE(mappingPath))
+		{
+			mRdpProcessor.LoadMappingProfile(mappingPath);
+		}
 		mRdpProcessor.Start();
 	}
 
@@ -149,6 +214,10 @@ private:
 		MENUITEMINFOW info = {};
 		GetState(info);
 		SetMenuItemInfoW(hPopupMenu, ID_CONNECTION_STATE, FALSE, &info);
+		InsertMenuW(hPopupMenu, 1, MF_BYPOSITION | MF_POPUP | MF_STRING, reinterpret_cast<UINT_PTR>(CreateStatisticsMenu()), L"Statistics");
+
+		// The plugin's latencies shown next time are the ones it has by then.
+		mRdpProcessor.RequestRemoteLatency();
 		CheckMenuRadioItem(hPopupMenu, 
 			ID_CONTOLLERTYPE_XBOX360,
 			ID_CONTOLLERTYPE_DUALSHOCK4_EMULATE,
@@ -223,35 +292,19 @@ private:
 				break;
 
 			case ID_CONTOLLERTYPE_XBOX360:
-				if (mRdpProcessor.GetType() != CONTROLLER_360)
-				{
-					mRdpProcessor.Stop();
-					mRdpProcessor.Start(CONTROLLER_360);
-				}
+				mRdpProcessor.SetType(CONTROLLER_360);
 				break;
 
 			case ID_CONTOLLERTYPE_XBOX360_EMULATE:
-				if (mRdpProcessor.GetType() != CONTROLLER_360_EMU)
-				{
-					mRdpProcessor.Stop();
-					mRdpProcessor.Start(CONTROLLER_360_EMU);
-				}
+				mRdpProcessor.SetType(CONTROLLER_360_EMU);
 				break;
 
 			case ID_CONTOLLERTYPE_DUALSHOCK4:
-				if (mRdpProcessor.GetType() != CONTROLLER_DS4)
-				{
-					mRdpProcessor.Stop();
-					mRdpProcessor.Start(CONTROLLER_DS4);
-				}
+				mRdpProcessor.SetType(CONTROLLER_DS4);
 				break;
 
 			case ID_CONTOLLERTYPE_DUALSHOCK4_EMULATE:
-				if (mRdpProcessor.GetType() != CONTROLLER_DS4_EMU)
-				{
-					mRdpProcessor.Stop();
-					mRdpProcessor.Start(CONTROLLER_DS4_EMU);
-				}
+				mRdpProcessor.SetType(CONTROLLER_DS4_EMU);
 				break;
 
 			default:
@@ -264,6 +317,73 @@ private:
 		return 0;
 	}
 
+	// Owned by the popup menu it is inserted into, which destroys it.
+	HMENU CreateStatisticsMenu()
+	{
+		const RdpGamepadStatistics statistics = mRdpProcessor.GetStatistics();
+		const struct
+		{
+			const wchar_t* mLabel;
+			RdpGamepadCounter mCounter;
+		} items[] =
+		{
+			{ L"Packets sent",      CounterPacketsSent },
+			{ L"Packets received",  CounterPacketsReceived },
+			{ L"Invalid packets",   CounterInvalidPackets },
+			{ L"Reconnects",        CounterReconnects },
+			{ L"Stale timeouts",    CounterStaleTimeouts },
+			{ L"Reports submitted", CounterReportsSubmitted },
+			{ L"Reports skipped",   CounterReportsSkipped },
+			{ L"Feedback forwards", CounterFeedbackForwards },
+			{ L"Tick overruns",     CounterTickOverruns },
+			{ L"Targets added",     CounterTargetsAdded },
+			{ L"Targets reused",    CounterTargetsReused },
+			{ L"Button edges",      CounterButtonEdges },
+			{ L"Motion samples",    CounterMotionSamples },
+			{ L"Motion lost",       CounterMotionSamplesLost },
+			{ L"Rate probes",       CounterRateProbes },
+		};
+
+		HMENU hMenu = CreatePopupMenu();
+		for (const auto& item : items)
+		{
+			wchar_t text[128];
+			swprintf_s(text, L"%s : %llu", item.mLabel, statistics[item.mCounter]);
+			AppendMenuW(hMenu, MF_STRING | MF_GRAYED, 0, text);
+		}
+		AppendMenuW(hMenu, MF_POPUP | MF_STRING, reinterpret_cast<UINT_PTR>(CreateLatencyMenu()), L"Latency");
+		return hMenu;
+	}
+
+	// Owned by the statistics menu.
+	HMENU CreateLatencyMenu()
+	{
+		RdpGamepad::RdpLatencySummary stages[RdpGamepad::LatencyStageCount];
+		mRdpProcessor.GetLatency(stages);
+		static const wchar_t* const sLabels[] =
+		{
+			L"Plugin timer lateness",
+			L"Plugin sample",
+			L"Plugin encode",
+			L"Plugin write",
+			L"Round trip",
+			L"Read",
+			L"Decode",
+			L"Submit",
+		};
+		static_assert(ARRAYSIZE(sLabels) == RdpGamepad::LatencyStageCount, "sLabels has incorrect size");
+
+		HMENU hMenu = CreatePopupMenu();
+		for (size_t i = 0; i < RdpGamepad::LatencyStageCount; ++i)
+		{
+			wchar_t text[128];
+			swprintf_s(text, L"%s : p50 %u us, p99 %u us, max %u us (%u)",
+				sLabels[i], stages[i].mP50, stages[i].mP99, stages[i].mMax, stages[i].mCount);
+			AppendMenuW(hMenu, MF_STRING | MF_GRAYED, 0, text);
+		}
+		return hMenu;
+	}
+
 	void GetState(MENUITEMINFOW& result)
 	{
 		swprintf_s(mState, L"State : %s (0x%x)",
@@ -280,6 +400,21 @@ private:
 
 int APIENTRY wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLine, int nCmdShow)
 {
+	// The service serves every session itself, so it runs instead of the tray app.
+	if (lpCmdLine != nullptr && wcscmp(lpCmdLine, L"/service") == 0)
+	{
+		return RunRdpGamepadViGEmService();
+	}
+
+	// Plays the plugin states of a recorded trace into a virtual Xbox 360 controller, spaced as recorded,
+	// to reproduce a session without Remote Desktop.
+	static constexpr wchar_t ReplayOption[] = L"/replay ";
+	if (lpCmdLine != nullptr && wcsncmp(lpCmdLine, ReplayOption, ARRAYSIZE(ReplayOption) - 1) == 0)
+	{
+		RdpGamepadProcessor processor;
+		return (processor.ReplayTrace(lpCmdLine + ARRAYSIZE(ReplayOption) - 1, RdpGamepad::RdpTraceReplayer::PacingRealTime) != 0) ? 0 : 1;
+	}
+
 	RdpGamepadViGEmApp TheApp;
 	return TheApp.Run(hInstance);
 }
@@ -0,0 +1,318 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "pch.h"
+
+#include "RdpGamepadViGEmService.h"
+
+#include "RdpGamepadExecutor.h"
+#include "RdpGamepadProcessor.h"
+
+#include <WtsApi32.h>
+
+#include <fstream>
+#include <map>
+
+#pragma comment(lib, "wtsapi32.lib")
+
+namespace
+{
+	// One RDP session's receiver, ticked by the shared executor instead of a thread of its own. Each has
+	// its own ViGEm client, so creating one connects to the driver and destroying one unplugs its
+	// controllers. ViGEm pads are machine-wide, though: every session's games see the controllers of all
+	// sessions, so sessions served by one service are not isolated from each other.
+	class RdpGamepadSession
+	{
+	public:
+		RdpGamepadSession(DWORD sessionId, const std::wstring& statisticsPath)
+		{
+			mProcessor.SetSessionId(sessionId);
+			if (!statisticsPath.empty())
+			{
+				mProcessor.SetStatisticsFile(statisticsPath);
+			}
+			mProcessor.StartScheduled();
+		}
+
+		~RdpGamepadSession()
+		{ mProcessor.Stop(); }
+
+		void Tick()
+		{ mProcessor.Tick(); }
+
+	private:
+		RdpGamepadProcessor mProcessor;
+	};
+
+	// Keeps one RdpGamepadSession for every user session, from logon or connect until logoff. A
+	// disconnected session keeps its receiver, which reopens the channel when the user reconnects.
+	class RdpGamepadSessionManager
+	{
+	public:
+		RdpGamepadSessionManager()
+		{
+			wchar_t tempPath[MAX_PATH];
+			const DWORD length = GetTempPathW(ARRAYSIZE(tempPath), tempPath);
+			if (length != 0 && length < ARRAYSIZE(tempPath))
+			{
+				mStatisticsDirectory = tempPath;
+			}
+		}
+
+		void Start()
+		{
+			mExecutor.Start();
+
+			WTS_SESSION_INFOW* sessions = nullptr;
+			DWORD count = 0;
+			if (WTSEnumerateSessionsW(WTS_CURRENT_SERVER_HANDLE, 0, 1, &sessions, &count))
+			{
+				for (DWORD i = 0; i < count; ++i)
+				{
+					if (sessions[i].State == WTSActive || sessions[i].State == WTSConnected || sessions[i].State == WTSDisconnected)
+					{
+						AddSession(sessions[i].SessionId);
+					}
+				}
+				WTSFreeMemory(sessions);
+			}
+		}
+
+		void Stop()
+		{
+			std::map<DWORD, Entry> sessions;
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				sessions.swap(mSessions);
+			}
+
+			// Removing waits for a running tick and destroying unplugs controllers; do both unlocked.
+			for (auto& session : sessions)
+			{
+				mExecutor.Remove(session.second.mId);
+			}
+			sessions.clear();
+			mExecutor.Stop();
+		}
+
+		// Called with the event types of SERVICE_CONTROL_SESSIONCHANGE.
+		void OnSessionChange(DWORD eventType, DWORD sessionId)
+		{
+			switch (eventType)
+			{
+			case WTS_CONSOLE_CONNECT:
+			case WTS_REMOTE_CONNECT:
+			case WTS_SESSION_LOGON:
+				AddSession(sessionId);
+				break;
+
+			case WTS_SESSION_LOGOFF:
+				RemoveSession(sessionId);
+				break;
+			}
+		}
+
+		// Rewrites the session summary next to the per session statistics files.
+		void WriteStatistics()
+		{
+			if (mStatisticsDirectory.empty())
+			{
+				return;
+			}
+
+			const std::wstring path = mStatisticsDirectory + L"RdpGamepadViGEm.sessions";
+			const std::wstring temporaryPath = path + L".tmp";
+			{
+				std::ofstream file(temporaryPath, std::ios::out | std::ios::trunc);
+				if (!file)
+				{
+					return;
+				}
+
+				std::unique_lock<std::mutex> lock(mMutex);
+				file << "Workers " << mExecutor.GetWorkerCount() << " Steals " << mExecutor.GetStealCount() << '\n';
+				for (const auto& session : mSessions)
+				{
+					RdpGamepadTaskStatistics statistics;
+					if (mExecutor.GetStatistics(session.second.mId, statistics))
+					{
+						file << "Session " << session.first
+							<< " Ticks " << statistics.mRuns
+							<< " StolenTicks " << statistics.mStolenRuns
+							<< " DeadlineMisses " << statistics.mDeadlineMisses
+							<< " SkippedTicks " << statistics.mSkippedRuns
+							<< " MeanTickUs " << (statistics.mRuns ? statistics.mRunTime / statistics.mRuns : 0)
+							<< " MaxTickUs " << statistics.mMaxRunTime
+							<< " MaxStartDelayUs " << statistics.mMaxStartDelay << '\n';
+					}
+				}
+				if (!file)
+				{
+					return;
+				}
+			}
+			MoveFileExW(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+		}
+
+	private:
+		struct Entry
+		{
+			uint32_t mId;
+			std::shared_ptr<RdpGamepadSession> mSession;
+		};
+
+		RdpGamepadExecutor mExecutor;
+		std::mutex mMutex;
+		std::map<DWORD, Entry> mSessions;
+		std::wstring mStatisticsDirectory;
+
+		void AddSession(DWORD sessionId)
+		{
+			// Session 0 only runs services and never has a channel.
+			if (sessionId == 0)
+			{
+				return;
+			}
+
+			if (HasSession(sessionId))
+			{
+				return;
+			}
+
+			// Connecting to the driver can take a while, so the session is built unlocked. Should a
+			// notification for the same session have won the race meanwhile, this one is dropped again.
+			const std::wstring statisticsPath = mStatisticsDirectory.empty() ? std::wstring() :
+				mStatisticsDirectory + L"RdpGamepadViGEm." + std::to_wstring(sessionId) + L".stats";
+			std::shared_ptr<RdpGamepadSession> session = std::make_shared<RdpGamepadSession>(sessionId, statisticsPath);
+			const uint32_t id = mExecutor.Add([session]() { session->Tick(); }, std::chrono::milliseconds(RdpGamepadProcessor::TickPeriodMs));
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				if (mSessions.emplace(sessionId, Entry{ id, session }).second)
+				{
+					return;
+				}
+			}
+			mExecutor.Remove(id);
+		}
+
+		bool HasSession(DWORD sessionId)
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			return mSessions.count(sessionId) != 0;
+		}
+
+		void RemoveSession(DWORD sessionId)
+		{
+			uint32_t id;
+			std::shared_ptr<RdpGamepadSession> session;
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				auto it = mSessions.find(sessionId);
+				if (it == mSessions.end())
+				{
+					return;
+				}
+				id = it->second.mId;
+				session = std::move(it->second.mSession);
+				mSessions.erase(it);
+			}
+
+			// Removing waits for a running tick and stopping unplugs the session's controllers, which
+			// can take a while; do both unlocked.
+			mExecutor.Remove(id);
+			session.reset();
+		}
+	};
+
+	class RdpGamepadViGEmService
+	{
+	public:
+		static void WINAPI ServiceMain(DWORD, LPWSTR*)
+		{
+			RdpGamepadViGEmService service;
+			service.Run();
+		}
+
+	private:
+		static constexpr DWORD StatisticsIntervalMs = 5000;
+
+		RdpGamepadSessionManager mSessions;
+		SERVICE_STATUS_HANDLE mStatusHandle = nullptr;
+		SERVICE_STATUS mStatus = {};
+		HANDLE mStopEvent = nullptr;
+
+		void Run()
+		{
+			mStatusHandle = RegisterServiceCtrlHandlerExW(RDPGAMEPAD_SERVICE_NAME, &StaticControlHandler, this);
+			if (mStatusHandle == nullptr)
+			{
+				return;
+			}
+
+			mStatus.dwServiceType = SERVICE_WIN32_OWN_PROCESS;
+			mStopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+			if (mStopEvent == nullptr)
+			{
+				SetState(SERVICE_STOPPED, GetLastError());
+				return;
+			}
+
+			SetState(SERVICE_START_PENDING);
+			mSessions.Start();
+			SetState(SERVICE_RUNNING);
+
+			while (WaitForSingleObject(mStopEvent, StatisticsIntervalMs) == WAIT_TIMEOUT)
+			{
+				mSessions.WriteStatistics();
+			}
+
+			mSessions.Stop();
+			CloseHandle(mStopEvent);
+			SetState(SERVICE_STOPPED);
+		}
+
+		void SetState(DWORD state, DWORD exitCode = NO_ERROR)
+		{
+			mStatus.dwCurrentState = state;
+			mStatus.dwWin32ExitCode = exitCode;
+			mStatus.dwControlsAccepted = (state == SERVICE_RUNNING) ?
+				SERVICE_ACCEPT_STOP | SERVICE_ACCEPT_SHUTDOWN | SERVICE_ACCEPT_SESSIONCHANGE : 0;
+			mStatus.dwWaitHint = (state == SERVICE_START_PENDING || state == SERVICE_STOP_PENDING) ? 10000 : 0;
+			SetServiceStatus(mStatusHandle, &mStatus);
+		}
+
+		// Runs on the service control dispatcher thread.
+		static DWORD WINAPI StaticControlHandler(DWORD control, DWORD eventType, LPVOID eventData, LPVOID context)
+		{
+			auto pThis = static_cast<RdpGamepadViGEmService*>(context);
+			switch (control)
+			{
+			case SERVICE_CONTROL_STOP:
+			case SERVICE_CONTROL_SHUTDOWN:
+				pThis->SetState(SERVICE_STOP_PENDING);
+				SetEvent(pThis->mStopEvent);
+				return NO_ERROR;
+
+			case SERVICE_CONTROL_SESSIONCHANGE:
+				pThis->mSessions.OnSessionChange(eventType, static_cast<WTSSESSION_NOTIFICATION*>(eventData)->dwSessionId);
+				return NO_ERROR;
+
+			case SERVICE_CONTROL_INTERROGATE:
+				return NO_ERROR;
+
+			default:
+				return ERROR_CALL_NOT_IMPLEMENTED;
+			}
+		}
+	};
+}
+
+int RunRdpGamepadViGEmService()
+{
+	SERVICE_TABLE_ENTRYW table[] =
+	{
+		{ const_cast<LPWSTR>(RDPGAMEPAD_SERVICE_NAME), &RdpGamepadViGEmService::ServiceMain },
+		{ nullptr, nullptr },
+	};
+	return StartServiceCtrlDispatcherW(table) ? 0 : static_cast<int>(GetLastError());
+}
@@ -0,0 +1,12 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+// Name the service is registered under, for example with
+// sc create RdpGamepadViGEm binPath= "<path>\RdpGamepadViGEm.exe /service" start= auto
+static constexpr wchar_t RDPGAMEPAD_SERVICE_NAME[] = L"RdpGamepadViGEm";
+
+// Runs the receiver as a service that serves every session on the machine. Only returns once the
+// service stops; returns an error code if the process was not started by the service manager.
+int RunRdpGamepadViGEmService();
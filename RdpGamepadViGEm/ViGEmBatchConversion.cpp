@@ -0,0 +1,154 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#include "pch.h"
+
+#include "ViGEmConversion.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <emmintrin.h>
+
+namespace {
+
+typedef void (*ConvertToDS4Function)(const XINPUT_GAMEPAD* gamepads, DS4_REPORT* outReports, size_t count);
+
+//////////////////////////////////////////////////////////////////////////
+// Scalar
+
+void ConvertToDS4Scalar(const XINPUT_GAMEPAD* gamepads, DS4_REPORT* outReports, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		outReports[i] = ViGEmConversion::ToDS4Report(gamepads[i]);
+	}
+}
+
+// The digital part of a report is a table lookup per nibble and stays scalar.
+void FillDS4Digital(const XINPUT_GAMEPAD& gamepad, DS4_REPORT& report)
+{
+	report.wButtons  = ViGEmConversion::ToDS4Buttons(gamepad);
+	report.bSpecial  = 0;
+	report.bTriggerL = gamepad.bLeftTrigger;
+	report.bTriggerR = gamepad.bRightTrigger;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// SSE2
+
+// The kernel works on 16 bit lanes holding LX, LY, RX, RY of consecutive pads, so the Y lanes, which are
+// inverted between the two formats, alternate with the X lanes. Converting to Xbox 360 reports has no
+// kernel: the stick table lookups beat every vector version, see RdpGamepadLoopback --conversion.
+
+inline __m128i SelectSSE2(__m128i mask, __m128i ifSet, __m128i ifClear)
+{
+	return _mm_or_si128(_mm_and_si128(mask, ifSet), _mm_andnot_si128(mask, ifClear));
+}
+
+// Exactly ThumbToStick for X lanes and ThumbToStickInverted for Y lanes, one stick value per 16 bit lane.
+inline __m128i ThumbsToSticksSSE2(__m128i thumbs)
+{
+	const __m128i yLanes = _mm_setr_epi16(0, -1, 0, -1, 0, -1, 0, -1);
+	const __m128i value = SelectSSE2(yLanes, _mm_subs_epi16(_mm_setzero_si128(), thumbs), thumbs);
+	const __m128i biased = _mm_add_epi16(value, _mm_set1_epi16(128));
+	const __m128i low = _mm_srai_epi16(biased, 8);
+	const __m128i high = _mm_srli_epi16(_mm_mulhi_epu16(biased, _mm_set1_epi16(16257)), 6);
+	const __m128i centered = SelectSSE2(_mm_srai_epi16(value, 15), low, high);
+	return _mm_add_epi16(centered, _mm_set1_epi16(128));
+}
+
+void ConvertToDS4SSE2(const XINPUT_GAMEPAD* gamepads, DS4_REPORT* outReports, size_t count)
+{
+	size_t i = 0;
+	for (; i + 2 <= count; i += 2)
+	{
+		const XINPUT_GAMEPAD* pads = gamepads + i;
+		const __m128i thumbs = _mm_setr_epi16(
+			pads[0].sThumbLX, pads[0].sThumbLY, pads[0].sThumbRX, pads[0].sThumbRY,
+			pads[1].sThumbLX, pads[1].sThumbLY, pads[1].sThumbRX, pads[1].sThumbRY);
+		const __m128i sticks = _mm_packus_epi16(ThumbsToSticksSSE2(thumbs), _mm_setzero_si128());
+
+		alignas(16) uint8_t axes[16];
+		_mm_store_si128(reinterpret_cast<__m128i*>(axes), sticks);
+
+		for (size_t pad = 0; pad < 2; ++pad)
+		{
+			DS4_REPORT& report = outReports[i + pad];
+			report.bThumbLX = axes[pad * 4 + 0];
+			report.bThumbLY = axes[pad * 4 + 1];
+			report.bThumbRX = axes[pad * 4 + 2];
+			report.bThumbRY = axes[pad * 4 + 3];
+			FillDS4Digital(pads[pad], report);
+		}
+	}
+	ConvertToDS4Scalar(gamepads + i, outReports + i, count - i);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Dispatch
+
+#if defined(_MSC_VER)
+
+void Cpuid(int (&info)[4], int leaf)
+{
+	__cpuidex(info, leaf, 0);
+}
+
+#else
+
+void Cpuid(int (&info)[4], int leaf)
+{
+	unsigned int regs[4] = {};
+	__cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+	for (size_t i = 0; i < 4; ++i)
+	{
+		info[i] = static_cast<int>(regs[i]);
+	}
+}
+
+#endif
+
+bool CpuSupportsSSE2()
+{
+	int info[4];
+	Cpuid(info, 1);
+	return (info[3] & (1 << 26)) != 0;
+}
+
+ViGEmConversion::BatchKernel SelectKernel()
+{
+	if (CpuSupportsSSE2())
+	{
+		return ViGEmConversion::BatchKernel::SSE2;
+	}
+	return ViGEmConversion::BatchKernel::Scalar;
+}
+
+} // namespace
+
+namespace ViGEmConversion
+{
+	BatchKernel GetBatchKernel()
+	{
+		static const BatchKernel sKernel = SelectKernel();
+		return sKernel;
+	}
+
+	void ConvertToX360Reports(const PadState* states, XUSB_REPORT* outReports, size_t count)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			outReports[i] = ToX360Report(states[i]);
+		}
+	}
+
+	void ConvertToDS4Reports(const XINPUT_GAMEPAD* gamepads, DS4_REPORT* outReports, size_t count, BatchKernel kernel)
+	{
+		static const ConvertToDS4Function sKernels[] = {&ConvertToDS4Scalar, &ConvertToDS4SSE2};
+		const BatchKernel supported = GetBatchKernel();
+		sKernels[static_cast<size_t>(kernel < supported ? kernel : supported)](gamepads, outReports, count);
+	}
+}
@@ -0,0 +1,261 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+
+#include <ds4_pad.h>
+
+#include "ViGEmPlatform.h"
+
+// Table driven conversions between the XInput, DS4 and ViGEm report formats.
+// All tables are generated at compile time from the scalar converters below.
+namespace ViGEmConversion
+{
+	constexpr uint16_t DS4_BUTTON_MASK[] = {
+		XINPUT_GAMEPAD_X,
+		XINPUT_GAMEPAD_A,
+		XINPUT_GAMEPAD_B,
+		XINPUT_GAMEPAD_Y,
+		XINPUT_GAMEPAD_LEFT_SHOULDER,
+		XINPUT_GAMEPAD_RIGHT_SHOULDER,
+		0,
+		0,
+		XINPUT_GAMEPAD_BACK,
+		XINPUT_GAMEPAD_START,
+		XINPUT_GAMEPAD_LEFT_THUMB,
+		XINPUT_GAMEPAD_RIGHT_THUMB,
+	};
+
+	constexpr uint16_t X360_DPAD_MASK[] = {
+		XUSB_GAMEPAD_DPAD_UP,
+		XUSB_GAMEPAD_DPAD_UP | XUSB_GAMEPAD_DPAD_RIGHT,
+		XUSB_GAMEPAD_DPAD_RIGHT,
+		XUSB_GAMEPAD_DPAD_DOWN | XUSB_GAMEPAD_DPAD_RIGHT,
+		XUSB_GAMEPAD_DPAD_DOWN,
+		XUSB_GAMEPAD_DPAD_DOWN | XUSB_GAMEPAD_DPAD_LEFT,
+		XUSB_GAMEPAD_DPAD_LEFT,
+		XUSB_GAMEPAD_DPAD_UP | XUSB_GAMEPAD_DPAD_LEFT,
+		0,
+	};
+
+	constexpr uint16_t X360_BUTTON_MASK[] = {
+		XUSB_GAMEPAD_X,
+		XUSB_GAMEPAD_A,
+		XUSB_GAMEPAD_B,
+		XUSB_GAMEPAD_Y,
+		XUSB_GAMEPAD_LEFT_SHOULDER,
+		XUSB_GAMEPAD_RIGHT_SHOULDER,
+		0,
+		0,
+		XUSB_GAMEPAD_BACK,
+		XUSB_GAMEPAD_START,
+		XUSB_GAMEPAD_LEFT_THUMB,
+		XUSB_GAMEPAD_RIGHT_THUMB
+	};
+
+	template <typename T, size_t N>
+	struct Table
+	{
+		T mValues[N];
+
+		constexpr T operator[](size_t index) const
+		{ return mValues[index]; }
+	};
+
+	// Remaps a 16 bit button word one nibble at a time, so any bit permutation costs four loads.
+	struct ButtonTable
+	{
+		uint16_t mValues[4][16];
+
+		uint16_t Remap(uint16_t buttons) const
+		{
+			return mValues[0][buttons & 0xf]
+				 | mValues[1][(buttons >> 4) & 0xf]
+				 | mValues[2][(buttons >> 8) & 0xf]
+				 | mValues[3][(buttons >> 12) & 0xf];
+		}
+	};
+
+	//////////////////////////////////////////////////////////////////////////
+	// Sticks
+
+	// DS4 axes are 8 bit with 128 at the center, XInput axes are 16 bit with 0 at the center. The negative
+	// half of the DS4 range (128 values) scales by exactly 256 and the positive half (127 values) by 32767/127,
+	// rounded, so 0, 128 and 255 map to -32768, 0 and 32767 and ThumbToStick(StickToThumb(x)) == x for every x.
+	// Y axes are flipped with a saturating negate, which keeps the same guarantees. Everything is integer
+	// arithmetic that maps directly onto 16 bit SIMD lanes.
+
+	constexpr int16_t SaturatingNegate(int16_t value)
+	{ return int16_t(value == SHRT_MIN ? SHRT_MAX : -int32_t(value)); }
+
+	// Centered DS4 axis [-128, 127] to XInput axis. v * 258 + (v >> 6) is round(v * 32767 / 127) for v in [0, 127].
+	constexpr int16_t CenteredToThumb(int32_t value)
+	{ return int16_t(value * 256 + (value > 0 ? value * 2 + (value >> 6) : 0)); }
+
+	// DS4 8 bit axis (0 = left/up) to XInput 16 bit axis (-32768 = left/down).
+	constexpr int16_t StickToThumb(uint8_t value)
+	{ return CenteredToThumb(int32_t(value) - 128); }
+
+	constexpr int16_t StickToThumbInverted(uint8_t value)
+	{ return SaturatingNegate(StickToThumb(value)); }
+
+	constexpr Table<int16_t, 256> MakeStickTable(bool inverted)
+	{
+		Table<int16_t, 256> table{};
+		for (size_t i = 0; i < 256; ++i)
+		{
+			table.mValues[i] = inverted ? StickToThumbInverted(uint8_t(i)) : StickToThumb(uint8_t(i));
+		}
+		return table;
+	}
+
+	constexpr Table<int16_t, 256> StickToThumbTable = MakeStickTable(false);
+	constexpr Table<int16_t, 256> StickToThumbInvertedTable = MakeStickTable(true);
+
+	// XInput 16 bit axis to DS4 8 bit axis, rounding to the nearest step of the matching half of the range
+	// with ties going to the center: the negative half is (x + 128) >> 8 and the positive half is
+	// round(x * 127 / 32767), which ((x + 128) * 16257) >> 22 computes exactly for x in [0, 32767].
+	// [-128, 129] all map to the center 128.
+	inline uint8_t ThumbToStick(int16_t value)
+	{
+		const int32_t biased = int32_t(value) + 128;
+		const int32_t centered = (value < 0) ? (biased >> 8) : int32_t((uint32_t(biased) * 16257u) >> 22);
+		return uint8_t(centered + 128);
+	}
+
+	inline uint8_t ThumbToStickInverted(int16_t value)
+	{ return ThumbToStick(SaturatingNegate(value)); }
+
+	//////////////////////////////////////////////////////////////////////////
+	// Buttons
+
+	constexpr uint8_t ToDS4Dpad(uint16_t buttonMask)
+	{
+		const bool N = (buttonMask & XINPUT_GAMEPAD_DPAD_UP)    == XINPUT_GAMEPAD_DPAD_UP;
+		const bool S = (buttonMask & XINPUT_GAMEPAD_DPAD_DOWN)  == XINPUT_GAMEPAD_DPAD_DOWN;
+		const bool W = (buttonMask & XINPUT_GAMEPAD_DPAD_LEFT)  == XINPUT_GAMEPAD_DPAD_LEFT;
+		const bool E = (buttonMask & XINPUT_GAMEPAD_DPAD_RIGHT) == XINPUT_GAMEPAD_DPAD_RIGHT;
+
+		return (N && E) ? PAD_BUTTON_DPAD_NORTHEAST
+			 : (N && W) ? PAD_BUTTON_DPAD_NORTHWEST
+			 : (S && E) ? PAD_BUTTON_DPAD_SOUTHEAST
+			 : (S && W) ? PAD_BUTTON_DPAD_SOUTHWEST
+			 : N        ? PAD_BUTTON_DPAD_NORTH
+			 : S        ? PAD_BUTTON_DPAD_SOUTH
+			 : W        ? PAD_BUTTON_DPAD_WEST
+			 : E        ? PAD_BUTTON_DPAD_EAST
+			 : PAD_BUTTON_DPAD_NONE;
+	}
+
+	// XInput wButtons to DS4 wButtons: the d-pad bits become the direction value in the low nibble and
+	// each remaining button moves to bit (i + 4) for its index i in DS4_BUTTON_MASK.
+	constexpr ButtonTable MakeDS4ButtonTable()
+	{
+		ButtonTable table{};
+		for (size_t index = 0; index < 16; ++index)
+		{
+			table.mValues[0][index] = ToDS4Dpad(uint16_t(index));
+			for (size_t nibble = 1; nibble < 4; ++nibble)
+			{
+				uint16_t result = 0;
+				for (size_t i = 0; i < 12; ++i)
+				{
+					const uint16_t mask = DS4_BUTTON_MASK[i];
+					if (mask != 0 && (uint32_t(index) << (nibble * 4)) & mask)
+					{
+						result |= uint16_t(1 << (i + 4));
+					}
+				}
+				table.mValues[nibble][index] = result;
+			}
+		}
+		return table;
+	}
+
+	// DS4 Buttons to XUSB wButtons: the low nibble is a direction value (anything past 8 is released)
+	// and bit (i + 4) becomes X360_BUTTON_MASK[i].
+	constexpr ButtonTable MakeX360ButtonTable()
+	{
+		ButtonTable table{};
+		for (size_t index = 0; index < 16; ++index)
+		{
+			table.mValues[0][index] = X360_DPAD_MASK[index > 8 ? 8 : index];
+			for (size_t nibble = 1; nibble < 4; ++nibble)
+			{
+				uint16_t result = 0;
+				for (size_t bit = 0; bit < 4; ++bit)
+				{
+					if (index & (size_t(1) << bit))
+					{
+						result |= X360_BUTTON_MASK[(nibble - 1) * 4 + bit];
+					}
+				}
+				table.mValues[nibble][index] = result;
+			}
+		}
+		return table;
+	}
+
+	constexpr ButtonTable DS4ButtonTable = MakeDS4ButtonTable();
+	constexpr ButtonTable X360ButtonTable = MakeX360ButtonTable();
+
+	//////////////////////////////////////////////////////////////////////////
+	// Reports
+
+	inline XUSB_REPORT ToX360Report(const PadState& state)
+	{
+		XUSB_REPORT report;
+		report.sThumbLX      = StickToThumbTable[state.StickL.X];
+		report.sThumbLY      = StickToThumbInvertedTable[state.StickL.Y];
+		report.sThumbRX      = StickToThumbTable[state.StickR.X];
+		report.sThumbRY      = StickToThumbInvertedTable[state.StickR.Y];
+		report.bLeftTrigger  = state.AnalogButtons.L2;
+		report.bRightTrigger = state.AnalogButtons.R2;
+		report.wButtons      = X360ButtonTable.Remap(state.Buttons);
+		return report;
+	}
+
+	inline uint16_t ToDS4Buttons(const XINPUT_GAMEPAD& gamepad)
+	{
+		uint16_t button = DS4ButtonTable.Remap(gamepad.wButtons);
+		button |= uint16_t(DS4_BUTTON_TRIGGER_LEFT  * (gamepad.bLeftTrigger  >= XINPUT_GAMEPAD_TRIGGER_THRESHOLD));
+		button |= uint16_t(DS4_BUTTON_TRIGGER_RIGHT * (gamepad.bRightTrigger >= XINPUT_GAMEPAD_TRIGGER_THRESHOLD));
+		return button;
+	}
+
+	inline DS4_REPORT ToDS4Report(const XINPUT_GAMEPAD& gamepad)
+	{
+		DS4_REPORT report = {};
+		report.bThumbLX  = ThumbToStick(gamepad.sThumbLX);			// left = 0, right = 255.
+		report.bThumbLY  = ThumbToStickInverted(gamepad.sThumbLY);	// up   = 0, down  = 255.
+		report.bThumbRX  = ThumbToStick(gamepad.sThumbRX);			// left = 0, right = 255.
+		report.bThumbRY  = ThumbToStickInverted(gamepad.sThumbRY);	// up   = 0, down  = 255.
+		report.wButtons  = ToDS4Buttons(gamepad);
+		report.bSpecial  = 0;	// XInputGetState has no guide button to map to the PS button.
+		report.bTriggerL = gamepad.bLeftTrigger;
+		report.bTriggerR = gamepad.bRightTrigger;
+		return report;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// Batches
+
+	enum class BatchKernel
+	{
+		Scalar,
+		SSE2,
+	};
+
+	// The widest kernel the CPU supports, detected on first use.
+	BatchKernel GetBatchKernel();
+
+	// Convert count states at once, giving exactly the same reports as ToX360Report/ToDS4Report. Only the
+	// DS4 direction has a vector kernel; kernel is an upper bound and is lowered to what the CPU supports.
+	// RdpGamepadLoopback --conversion times each kernel.
+	void ConvertToX360Reports(const PadState* states, XUSB_REPORT* outReports, size_t count);
+	void ConvertToDS4Reports(const XINPUT_GAMEPAD* gamepads, DS4_REPORT* outReports, size_t count, BatchKernel kernel = BatchKernel::SSE2);
+}
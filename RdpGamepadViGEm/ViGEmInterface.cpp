@@ -4,95 +4,11 @@
 #include "pch.h"
 
 #include "ViGEmInterface.h"
+#include "ViGEmConversion.h"
+#include "RdpGamepadMotionFilter.h"
 
 #pragma comment(lib, "setupapi.lib")
 
-namespace {
-
-constexpr uint8_t DS4_DPAD_MASK[] = {
-	XINPUT_GAMEPAD_DPAD_UP,
-	XINPUT_GAMEPAD_DPAD_UP | XINPUT_GAMEPAD_DPAD_RIGHT,
-	XINPUT_GAMEPAD_DPAD_RIGHT,
-	XINPUT_GAMEPAD_DPAD_DOWN | XINPUT_GAMEPAD_DPAD_RIGHT,
-	XINPUT_GAMEPAD_DPAD_DOWN,
-	XINPUT_GAMEPAD_DPAD_DOWN | XINPUT_GAMEPAD_DPAD_LEFT,
-	XINPUT_GAMEPAD_DPAD_LEFT,
-	XINPUT_GAMEPAD_DPAD_UP | XINPUT_GAMEPAD_DPAD_LEFT,
-};
-
-constexpr uint16_t DS4_BUTTON_MASK[] = {
-	XINPUT_GAMEPAD_X,
-	XINPUT_GAMEPAD_A,
-	XINPUT_GAMEPAD_B,
-	XINPUT_GAMEPAD_Y,
-	XINPUT_GAMEPAD_LEFT_SHOULDER,
-	XINPUT_GAMEPAD_RIGHT_SHOULDER,
-	0,
-	0,
-	XINPUT_GAMEPAD_BACK,
-	XINPUT_GAMEPAD_START,
-	XINPUT_GAMEPAD_LEFT_THUMB,
-	XINPUT_GAMEPAD_RIGHT_THUMB,
-};
-
-constexpr uint16_t X360_DPAD_MASK[] = {
-	XUSB_GAMEPAD_DPAD_UP,
-	XUSB_GAMEPAD_DPAD_UP | XUSB_GAMEPAD_DPAD_RIGHT,
-	XUSB_GAMEPAD_DPAD_RIGHT,
-	XUSB_GAMEPAD_DPAD_DOWN | XUSB_GAMEPAD_DPAD_RIGHT,
-	XUSB_GAMEPAD_DPAD_DOWN,
-	XUSB_GAMEPAD_DPAD_DOWN | XUSB_GAMEPAD_DPAD_LEFT,
-	XUSB_GAMEPAD_DPAD_LEFT,
-	XUSB_GAMEPAD_DPAD_UP | XUSB_GAMEPAD_DPAD_LEFT,
-	0,
-};
-
-constexpr uint16_t X360_BUTTON_MASK[] = {
-	XUSB_GAMEPAD_X,
-	XUSB_GAMEPAD_A,
-	XUSB_GAMEPAD_B,
-	XUSB_GAMEPAD_Y,
-	XUSB_GAMEPAD_LEFT_SHOULDER,
-	XUSB_GAMEPAD_RIGHT_SHOULDER,
-	0,
-	0,
-	XUSB_GAMEPAD_BACK,
-	XUSB_GAMEPAD_START,
-	XUSB_GAMEPAD_LEFT_THUMB,
-	XUSB_GAMEPAD_RIGHT_THUMB
-};
-
-uint8_t ToDS4Dpad(uint16_t buttonMask)
-{
-	auto N = (buttonMask & XINPUT_GAMEPAD_DPAD_UP)    == XINPUT_GAMEPAD_DPAD_UP;
-	auto S = (buttonMask & XINPUT_GAMEPAD_DPAD_DOWN)  == XINPUT_GAMEPAD_DPAD_DOWN;
-	auto W = (buttonMask & XINPUT_GAMEPAD_DPAD_LEFT)  == XINPUT_GAMEPAD_DPAD_LEFT;
-	auto E = (buttonMask & XINPUT_GAMEPAD_DPAD_RIGHT) == XINPUT_GAMEPAD_DPAD_RIGHT;
-
-	uint8_t result = PAD_BUTTON_DPAD_NONE;
-
-	if (N && E)
-	{ result = PAD_BUTTON_DPAD_NORTHEAST; }
-	else if (N && W)
-	{ result = PAD_BUTTON_DPAD_NORTHWEST; }
-	else if (S && E)
-	{ result = PAD_BUTTON_DPAD_SOUTHEAST; }
-	else if (S && W)
-	{ result = PAD_BUTTON_DPAD_SOUTHWEST; }
-	else if (N)
-	{ result = PAD_BUTTON_DPAD_NORTH; }
-	else if (S)
-	{ result = PAD_BUTTON_DPAD_SOUTH; }
-	else if (W)
-	{ result = PAD_BUTTON_DPAD_WEST; }
-	else if (E)
-	{ result = PAD_BUTTON_DPAD_EAST; }
-
-	return result;
-}
-
-} // namespace
-
 ViGEmTarget360::ViGEmTarget360(std::shared_ptr<ViGEmClient> Client)
 {
 	mClient = Client;
@@ -110,7 +26,7 @@ ViGEmTarget360::~ViGEmTarget360()
 	vigem_target_free(mTarget);
 }
 
-void ViGEmTarget360::SetGamepadState(const XINPUT_GAMEPAD& Gamepad)
+bool ViGEmTarget360::SetGamepadState(const XINPUT_GAMEPAD& Gamepad)
 {
 	std::unique_lock<std::recursive_mutex> lock(mMutex);
 
@@ -122,7 +38,7 @@ void ViGEmTarget360::SetGamepadState(const XINPUT_GAMEPAD& Gamepad)
 	report.sThumbLY = Gamepad.sThumbLY;
 	report.sThumbRX = Gamepad.sThumbRX;
 	report.sThumbRY = Gamepad.sThumbRY;
-	vigem_target_x360_update(mClient->GetHandle(), mTarget, report);
+	return SubmitReport(report);
 }
 
 bool ViGEmTarget360::GetVibration(XINPUT_VIBRATION& OutVibration)
@@ -137,37 +53,10 @@ bool ViGEmTarget360::GetVibration(XINPUT_VIBRATION& OutVibration)
 	return false;
 }
 
-void ViGEmTarget360::SetGamepadState(const PadState& Gamepad)
+bool ViGEmTarget360::SetGamepadState(const PadState& Gamepad)
 {
 	std::unique_lock<std::recursive_mutex> lock(mMutex);
-
-	uint16_t button = 0;
-	uint8_t dpad = uint8_t(Gamepad.Buttons & 0xf);
-	if (dpad > 8)
-	{ dpad = 8; }
-
-	button |= X360_DPAD_MASK[dpad];
-
-	for(auto i=0; i<12; ++i)
-	{
-		if (X360_BUTTON_MASK[i] == 0)
-		{ continue; }
-
-		auto mask = (1 << (i+4));
-		if ((Gamepad.Buttons & mask) == mask)
-		{ button |= X360_BUTTON_MASK[i]; }
-	}
-
-	XUSB_REPORT report;
-	report.sThumbLX      = int16_t( ((float(Gamepad.StickL.X) / float(255.0f)) * 2.0f - 1.0f) * SHRT_MAX);
-	report.sThumbLY      = int16_t(-((float(Gamepad.StickL.Y) / float(255.0f)) * 2.0f - 1.0f) * SHRT_MAX);
-	report.sThumbRX      = int16_t( ((float(Gamepad.StickR.X) / float(255.0f)) * 2.0f - 1.0f) * SHRT_MAX);
-	report.sThumbRY      = int16_t(-((float(Gamepad.StickR.Y) / float(255.0f)) * 2.0f - 1.0f) * SHRT_MAX);
-	report.bLeftTrigger  = Gamepad.AnalogButtons.L2;
-	report.bRightTrigger = Gamepad.AnalogButtons.R2;
-	report.wButtons      = button;
-
-	vigem_target_x360_update(mClient->GetHandle(), mTarget, report);
+	return SubmitReport(ViGEmConversion::ToX360Report(Gamepad));
 }
 
 bool ViGEmTarget360::GetVibration(PadVibrationParam& OutVibration)
@@ -183,6 +72,43 @@ bool ViGEmTarget360::GetVibration(PadVibrationParam& OutVibration)
 	return false;
 }
 
+bool ViGEmTarget360::GetPlayerLed(UCHAR& OutLedNumber)
+{
+	std::unique_lock<std::recursive_mutex> lock(mMutex);
+	if (mHasPendingLed)
+	{
+		OutLedNumber = mPendingLedNumber;
+		mHasPendingLed = false;
+		return true;
+	}
+	return false;
+}
+
+void ViGEmTarget360::SetRefreshInterval(ULONGLONG Milliseconds)
+{
+	std::unique_lock<std::recursive_mutex> lock(mMutex);
+	mReportCache.SetRefreshInterval(Milliseconds);
+}
+
+ViGEmUpdateStats ViGEmTarget360::GetUpdateStats()
+{
+	std::unique_lock<std::recursive_mutex> lock(mMutex);
+	return mReportCache.GetStats();
+}
+
+void ViGEmTarget360::ConvertStates(const PadState* States, XUSB_REPORT* OutReports, size_t Count)
+{
+	ViGEmConversion::ConvertToX360Reports(States, OutReports, Count);
+}
+
+bool ViGEmTarget360::SubmitReport(const XUSB_REPORT& Report)
+{
+	return mReportCache.Submit(Report, GetTickCount64(), [this](const XUSB_REPORT& report)
+	{
+		return VIGEM_SUCCESS(vigem_target_x360_update(mClient->GetHandle(), mTarget, report));
+	});
+}
+
 void ViGEmTarget360::StaticControllerNotification(PVIGEM_CLIENT Client, PVIGEM_TARGET Target, UCHAR LargeMotor, UCHAR SmallMotor, UCHAR LedNumber, LPVOID Context)
 {
 	auto pThis = static_cast<ViGEmTarget360*>(Context);
@@ -190,7 +116,9 @@ void ViGEmTarget360::StaticControllerNotification(PVIGEM_CLIENT Client, PVIGEM_T
 	std::unique_lock<std::recursive_mutex> lock(pThis->mMutex);
 	pThis->mPendingVibration.wLeftMotorSpeed = LargeMotor << 8;
 	pThis->mPendingVibration.wRightMotorSpeed = SmallMotor << 8;
+	pThis->mPendingLedNumber = LedNumber;
 	pThis->mHasPendingVibration = true;
+	pThis->mHasPendingLed = true;
 }
 
 ViGEmTargetDS4::ViGEmTargetDS4(std::shared_ptr<ViGEmClient> Client)
@@ -198,6 +126,11 @@ ViGEmTargetDS4::ViGEmTargetDS4(std::shared_ptr<ViGEmClient> Client)
 	mClient = Client;
 	mTarget = vigem_target_ds4_alloc();
 	vigem_target_add(mClient->GetHandle(), mTarget);
+
+	DS4_REPORT neutral;
+	DS4_REPORT_INIT(&neutral);
+	CopyReport(neutral, mReportEx);
+
 	vigem_target_ds4_register_notification(mClient->GetHandle(), mTarget, &StaticControllerNotification, this);
 }
 
@@ -210,44 +143,13 @@ ViGEmTargetDS4::~ViGEmTargetDS4()
 	vigem_target_free(mTarget);
 }
 
-void ViGEmTargetDS4::SetGamepadState(const XINPUT_GAMEPAD& Gamepad)
+bool ViGEmTargetDS4::SetGamepadState(const XINPUT_GAMEPAD& Gamepad)
 {
 	std::unique_lock<std::recursive_mutex> lock(mMutex);
-
-	uint8_t dpad = ToDS4Dpad(Gamepad.wButtons);
-
-	uint16_t button = dpad;
-	for(auto i=0; i<12; ++i)
-	{
-		if (DS4_BUTTON_MASK[i] == 0)
-		{ continue; }
-
-		if ((Gamepad.wButtons & DS4_BUTTON_MASK[i]) == DS4_BUTTON_MASK[i])
-		{ button |= (1 << (i + 4)); }
-	}
-
-	if (Gamepad.bLeftTrigger >= XINPUT_GAMEPAD_TRIGGER_THRESHOLD)
-	{ button |= DS4_BUTTON_TRIGGER_LEFT; }
-
-	if (Gamepad.bRightTrigger >= XINPUT_GAMEPAD_TRIGGER_THRESHOLD)
-	{ button |= DS4_BUTTON_TRIGGER_RIGHT; }
-
-	uint8_t special_button = 0;	// TODO.
-
-	DS4_REPORT report = {};
-	report.bThumbLX  = static_cast<uint8_t>( ((Gamepad.sThumbLX + SHRT_MAX) / float(USHRT_MAX)) * 0xff);	// left = 0, right = 255.
-	report.bThumbLY  = static_cast<uint8_t>(-((Gamepad.sThumbLY - SHRT_MAX) / float(USHRT_MAX)) * 0xff);	// up   = 0, down  = 255.
-	report.bThumbRX  = static_cast<uint8_t>( ((Gamepad.sThumbRX + SHRT_MAX) / float(USHRT_MAX)) * 0xff);	// left = 0, right = 255.
-	report.bThumbRY  = static_cast<uint8_t>(-((Gamepad.sThumbRY - SHRT_MAX) / float(USHRT_MAX)) * 0xff);	// up   = 0, down  = 255.
-	report.wButtons  = button;
-	report.bSpecial  = special_button;
-	report.bTriggerL = Gamepad.bLeftTrigger;
-	report.bTriggerR = Gamepad.bRightTrigger;
-
-	vigem_target_ds4_update(mClient->GetHandle(), mTarget, report);
+	return SubmitReport(ViGEmConversion::ToDS4Report(Gamepad));
 }
 
-void ViGEmTargetDS4::SetGamepadState(const PadState& State)
+bool ViGEmTargetDS4::SetGamepadState(const PadState& State)
 {
 	std::unique_lock<std::recursive_mutex> lock(mMutex);
 
@@ -261,7 +163,71 @@ void ViGEmTargetDS4::SetGamepadState(const PadState& State)
 	report.bTriggerL = State.AnalogButtons.L2;
 	report.bTriggerR = State.AnalogButtons.R2;
 
-	vigem_target_ds4_update(mClient->GetHandle(), mTarget, report);
+	return SubmitReport(report);
+}
+
+bool ViGEmTargetDS4::SetMotion(const RdpGamepadMotionReport& Motion)
+{
+	std::unique_lock<std::recursive_mutex> lock(mMutex);
+
+	DS4_REPORT_EX report = mReportEx;
+	report.Report.wTimestamp = USHORT(Motion.mTime * 3 / 16);		// In units of 5.33 us.
+	report.Report.wGyroX  = Motion.mGyro[0];
+	report.Report.wGyroY  = Motion.mGyro[1];
+	report.Report.wGyroZ  = Motion.mGyro[2];
+	report.Report.wAccelX = Motion.mAccel[0];
+	report.Report.wAccelY = Motion.mAccel[1];
+	report.Report.wAccelZ = Motion.mAccel[2];
+
+	// One touch packet per report: 7 bit tracking number, bit 7 set while lifted, then 12 bit X and Y.
+	DS4_TOUCH touch = {};
+	const RdpGamepad::RdpTouchPoint& first = Motion.mTouch[0];
+	const RdpGamepad::RdpTouchPoint& second = Motion.mTouch[1];
+	touch.bIsUpTrackingNum1 = UCHAR((first.mDown ? 0x00 : 0x80) | (first.mId & 0x7f));
+	touch.bTouchData1[0]    = UCHAR(first.mX & 0xff);
+	touch.bTouchData1[1]    = UCHAR(((first.mX >> 8) & 0x0f) | ((first.mY & 0x0f) << 4));
+	touch.bTouchData1[2]    = UCHAR(first.mY >> 4);
+	touch.bIsUpTrackingNum2 = UCHAR((second.mDown ? 0x00 : 0x80) | (second.mId & 0x7f));
+	touch.bTouchData2[0]    = UCHAR(second.mX & 0xff);
+	touch.bTouchData2[1]    = UCHAR(((second.mX >> 8) & 0x0f) | ((second.mY & 0x0f) << 4));
+	touch.bTouchData2[2]    = UCHAR(second.mY >> 4);
+	SetTouch(report, touch);
+
+	mHasMotion = true;
+	return SubmitReportEx(report);
+}
+
+void ViGEmTargetDS4::ResetMotion()
+{
+	std::unique_lock<std::recursive_mutex> lock(mMutex);
+	if (!mHasMotion)
+	{
+		return;
+	}
+
+	DS4_REPORT_EX report = mReportEx;
+	report.Report.wGyroX = 0;
+	report.Report.wGyroY = 0;
+	report.Report.wGyroZ = 0;
+	DS4_TOUCH touch = report.Report.sCurrentTouch;
+	touch.bIsUpTrackingNum1 |= 0x80;
+	touch.bIsUpTrackingNum2 |= 0x80;
+	SetTouch(report, touch);
+	SubmitReportEx(report);
+}
+
+void ViGEmTargetDS4::SetTouch(DS4_REPORT_EX& Report, DS4_TOUCH Touch)
+{
+	// A new touch packet only when the contacts changed, so games don't see a repeated one as movement.
+	Touch.bPacketCounter = Report.Report.sCurrentTouch.bPacketCounter;
+	if (std::memcmp(&Touch, &Report.Report.sCurrentTouch, sizeof(Touch)) != 0)
+	{
+		Touch.bPacketCounter = ++mTouchPacket;
+		Report.Report.sPreviousTouch[1] = Report.Report.sPreviousTouch[0];
+		Report.Report.sPreviousTouch[0] = Report.Report.sCurrentTouch;
+		Report.Report.sCurrentTouch = Touch;
+	}
+	Report.Report.bTouchPacketsN = 1;
 }
 
 bool ViGEmTargetDS4::GetVibration(XINPUT_VIBRATION& OutVibration)
@@ -269,8 +235,8 @@ bool ViGEmTargetDS4::GetVibration(XINPUT_VIBRATION& OutVibration)
 	std::unique_lock<std::recursive_mutex> lock(mMutex);
 	if (mHasPendingVibration)
 	{
-		OutVibration.wLeftMotorSpeed  = mPendingLargeMotor;
-		OutVibration.wRightMotorSpeed = mPendingSmallMotor;
+		OutVibration.wLeftMotorSpeed  = WORD(mPendingLargeMotor << 8);
+		OutVibration.wRightMotorSpeed = WORD(mPendingSmallMotor << 8);
 		mHasPendingVibration = false;
 		return true;
 	}
@@ -297,13 +263,74 @@ bool ViGEmTargetDS4::GetLightBarColor(PadColor& OutLightBarColor)
 	{
 		OutLightBarColor.R = mPendingLightBarR;
 		OutLightBarColor.G = mPendingLightBarG;
-		OutLightBarColor.B = mPendingLightBarG;
+		OutLightBarColor.B = mPendingLightBarB;
 		mHasPendingLightBar = false;
 		return true;
 	}
 	return false;
 }
 
+void ViGEmTargetDS4::SetRefreshInterval(ULONGLONG Milliseconds)
+{
+	std::unique_lock<std::recursive_mutex> lock(mMutex);
+	mReportCache.SetRefreshInterval(Milliseconds);
+	mReportExCache.SetRefreshInterval(Milliseconds);
+}
+
+ViGEmUpdateStats ViGEmTargetDS4::GetUpdateStats()
+{
+	std::unique_lock<std::recursive_mutex> lock(mMutex);
+	ViGEmUpdateStats stats = mReportCache.GetStats();
+	stats.Submitted += mReportExCache.GetStats().Submitted;
+	stats.Skipped += mReportExCache.GetStats().Skipped;
+	stats.Failed += mReportExCache.GetStats().Failed;
+	return stats;
+}
+
+void ViGEmTargetDS4::ConvertStates(const XINPUT_GAMEPAD* Gamepads, DS4_REPORT* OutReports, size_t Count)
+{
+	ViGEmConversion::ConvertToDS4Reports(Gamepads, OutReports, Count);
+}
+
+bool ViGEmTargetDS4::SubmitReport(const DS4_REPORT& Report)
+{
+	// Keep the extended report current so motion starts from the latest buttons and sticks.
+	DS4_REPORT_EX report = mReportEx;
+	CopyReport(Report, report);
+	if (mHasMotion)
+	{
+		// Once motion is on, stick to extended reports so the driver never mixes the two.
+		return SubmitReportEx(report);
+	}
+	mReportEx = report;
+
+	return mReportCache.Submit(Report, GetTickCount64(), [this](const DS4_REPORT& report)
+	{
+		return VIGEM_SUCCESS(vigem_target_ds4_update(mClient->GetHandle(), mTarget, report));
+	});
+}
+
+void ViGEmTargetDS4::CopyReport(const DS4_REPORT& Report, DS4_REPORT_EX& OutReport)
+{
+	OutReport.Report.bThumbLX  = Report.bThumbLX;
+	OutReport.Report.bThumbLY  = Report.bThumbLY;
+	OutReport.Report.bThumbRX  = Report.bThumbRX;
+	OutReport.Report.bThumbRY  = Report.bThumbRY;
+	OutReport.Report.wButtons  = Report.wButtons;
+	OutReport.Report.bSpecial  = Report.bSpecial;
+	OutReport.Report.bTriggerL = Report.bTriggerL;
+	OutReport.Report.bTriggerR = Report.bTriggerR;
+}
+
+bool ViGEmTargetDS4::SubmitReportEx(const DS4_REPORT_EX& Report)
+{
+	mReportEx = Report;
+	return mReportExCache.Submit(Report, GetTickCount64(), [this](const DS4_REPORT_EX& report)
+	{
+		return VIGEM_SUCCESS(vigem_target_ds4_update_ex(mClient->GetHandle(), mTarget, report));
+	});
+}
+
 void ViGEmTargetDS4::StaticControllerNotification(PVIGEM_CLIENT Client, PVIGEM_TARGET Target, UCHAR LargeMotor, UCHAR SmallMotor, DS4_LIGHTBAR_COLOR LightBarColor, LPVOID UserData)
 {
 	auto pThis = static_cast<ViGEmTargetDS4*>(UserData);
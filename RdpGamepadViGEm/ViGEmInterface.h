@@ -7,6 +7,21 @@
 #include <Xinput.h>
 #include <ds4_pad.h>
 
+#include "ViGEmReportCache.h"
+
+// DS4_REPORT ends in a padding byte, so the cache compares its fields.
+template <>
+struct ViGEmReportTraits<DS4_REPORT>
+{
+	static bool Equal(const DS4_REPORT& a, const DS4_REPORT& b)
+	{
+		return a.bThumbLX == b.bThumbLX && a.bThumbLY == b.bThumbLY && a.bThumbRX == b.bThumbRX && a.bThumbRY == b.bThumbRY &&
+			a.wButtons == b.wButtons && a.bSpecial == b.bSpecial && a.bTriggerL == b.bTriggerL && a.bTriggerR == b.bTriggerR;
+	}
+};
+
+struct RdpGamepadMotionReport;
+
 class ViGEmClient : public std::enable_shared_from_this<ViGEmClient>
 {
 public:
@@ -30,19 +45,32 @@ private:
 
 public:
 	~ViGEmTarget360();
-	void SetGamepadState(const XINPUT_GAMEPAD& Gamepad);
+	bool SetGamepadState(const XINPUT_GAMEPAD& Gamepad);
 	bool GetVibration(XINPUT_VIBRATION& OutVibration);
 
-	void SetGamepadState(const PadState& Gamepad);
+	bool SetGamepadState(const PadState& Gamepad);
 	bool GetVibration(PadVibrationParam& OutVibration);
+	bool GetPlayerLed(UCHAR& OutLedNumber);
+
+	void SetRefreshInterval(ULONGLONG Milliseconds);
+	ViGEmUpdateStats GetUpdateStats();
+
+	// Converts many states at once with the fastest SIMD kernel available; same results as SetGamepadState.
+	static void ConvertStates(const PadState* States, XUSB_REPORT* OutReports, size_t Count);
 
 private:
 	std::shared_ptr<ViGEmClient> mClient;
 	PVIGEM_TARGET mTarget;
+	ViGEmReportCache<XUSB_REPORT> mReportCache;
 	XINPUT_VIBRATION mPendingVibration{0};
+	UCHAR mPendingLedNumber = 0;
 	bool mHasPendingVibration = false;
+	bool mHasPendingLed = false;
 	std::recursive_mutex mMutex;
 
+	// Returns true if the driver took the report, false if it was skipped as a duplicate or rejected.
+	bool SubmitReport(const XUSB_REPORT& Report);
+
 	static void CALLBACK StaticControllerNotification(PVIGEM_CLIENT Client, PVIGEM_TARGET Target, UCHAR LargeMotor, UCHAR SmallMotor, UCHAR LedNumber, LPVOID Context);
 };
 
@@ -55,16 +83,33 @@ private:
 
 public:
 	~ViGEmTargetDS4();
-	void SetGamepadState(const XINPUT_GAMEPAD& Gamepad);
+	bool SetGamepadState(const XINPUT_GAMEPAD& Gamepad);
 	bool GetVibration(XINPUT_VIBRATION& OutVibration);
 
-	void SetGamepadState(const PadState& State);
+	bool SetGamepadState(const PadState& State);
 	bool GetVibration(PadVibrationParam& OutVibration);
 	bool GetLightBarColor(PadColor& OutLightBarColor);
 
+	// Sends the motion and touchpad in an extended report; the reports that follow keep them.
+	bool SetMotion(const RdpGamepadMotionReport& Motion);
+
+	// Stops any rotation and lifts the fingers off the touchpad, keeping the last acceleration.
+	void ResetMotion();
+
+	void SetRefreshInterval(ULONGLONG Milliseconds);
+	ViGEmUpdateStats GetUpdateStats();
+
+	// Converts many states at once with the fastest SIMD kernel available; same results as SetGamepadState.
+	static void ConvertStates(const XINPUT_GAMEPAD* Gamepads, DS4_REPORT* OutReports, size_t Count);
+
 private:
 	std::shared_ptr<ViGEmClient> mClient;
 	PVIGEM_TARGET mTarget;
+	ViGEmReportCache<DS4_REPORT> mReportCache;
+	ViGEmReportCache<DS4_REPORT_EX> mReportExCache;
+	DS4_REPORT_EX mReportEx{};
+	uint8_t mTouchPacket = 0;
+	bool mHasMotion = false;
 	uint8_t mPendingLargeMotor = 0;
 	uint8_t mPendingSmallMotor = 0;
 	uint8_t mPendingLightBarR = 0;
@@ -74,5 +119,10 @@ private:
 	bool mHasPendingLightBar = false;
 	std::recursive_mutex mMutex;
 
+	bool SubmitReport(const DS4_REPORT& Report);
+	bool SubmitReportEx(const DS4_REPORT_EX& Report);
+	void SetTouch(DS4_REPORT_EX& Report, DS4_TOUCH Touch);
+	static void CopyReport(const DS4_REPORT& Report, DS4_REPORT_EX& OutReport);
+
 	static void CALLBACK StaticControllerNotification(PVIGEM_CLIENT Client, PVIGEM_TARGET Target, UCHAR LargeMotor, UCHAR SmallMotor, DS4_LIGHTBAR_COLOR LightbarColor, LPVOID UserData);
 };
@@ -0,0 +1,80 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <RdpGamepadPlatform.h>
+
+// The report formats of the ViGEm driver. Windows builds take them from the ViGEm client SDK. Other
+// platforms only see them through the conversion tests and benchmarks of the loopback tool, and get the
+// report types with the same sizes and layouts here.
+
+#if defined(_WIN32)
+
+#include <ViGEm/Client.h>
+
+#else
+
+typedef uint16_t            USHORT;
+
+enum XUSB_BUTTON
+{
+	XUSB_GAMEPAD_DPAD_UP            = 0x0001,
+	XUSB_GAMEPAD_DPAD_DOWN          = 0x0002,
+	XUSB_GAMEPAD_DPAD_LEFT          = 0x0004,
+	XUSB_GAMEPAD_DPAD_RIGHT         = 0x0008,
+	XUSB_GAMEPAD_START              = 0x0010,
+	XUSB_GAMEPAD_BACK               = 0x0020,
+	XUSB_GAMEPAD_LEFT_THUMB         = 0x0040,
+	XUSB_GAMEPAD_RIGHT_THUMB        = 0x0080,
+	XUSB_GAMEPAD_LEFT_SHOULDER      = 0x0100,
+	XUSB_GAMEPAD_RIGHT_SHOULDER     = 0x0200,
+	XUSB_GAMEPAD_GUIDE              = 0x0400,
+	XUSB_GAMEPAD_A                  = 0x1000,
+	XUSB_GAMEPAD_B                  = 0x2000,
+	XUSB_GAMEPAD_X                  = 0x4000,
+	XUSB_GAMEPAD_Y                  = 0x8000,
+};
+
+struct XUSB_REPORT
+{
+	USHORT              wButtons;
+	BYTE                bLeftTrigger;
+	BYTE                bRightTrigger;
+	SHORT               sThumbLX;
+	SHORT               sThumbLY;
+	SHORT               sThumbRX;
+	SHORT               sThumbRY;
+};
+
+enum DS4_BUTTONS
+{
+	DS4_BUTTON_THUMB_RIGHT          = 1 << 15,
+	DS4_BUTTON_THUMB_LEFT           = 1 << 14,
+	DS4_BUTTON_OPTIONS              = 1 << 13,
+	DS4_BUTTON_SHARE                = 1 << 12,
+	DS4_BUTTON_TRIGGER_RIGHT        = 1 << 11,
+	DS4_BUTTON_TRIGGER_LEFT         = 1 << 10,
+	DS4_BUTTON_SHOULDER_RIGHT       = 1 << 9,
+	DS4_BUTTON_SHOULDER_LEFT        = 1 << 8,
+	DS4_BUTTON_TRIANGLE             = 1 << 7,
+	DS4_BUTTON_CIRCLE               = 1 << 6,
+	DS4_BUTTON_CROSS                = 1 << 5,
+	DS4_BUTTON_SQUARE               = 1 << 4,
+};
+
+struct DS4_REPORT
+{
+	BYTE                bThumbLX;
+	BYTE                bThumbLY;
+	BYTE                bThumbRX;
+	BYTE                bThumbRY;
+	USHORT              wButtons;
+	BYTE                bSpecial;
+	BYTE                bTriggerL;
+	BYTE                bTriggerR;
+};
+
+static_assert(sizeof(XUSB_REPORT) == 12 && sizeof(DS4_REPORT) == 10, "ViGEm reports must match the ViGEm client SDK");
+
+#endif
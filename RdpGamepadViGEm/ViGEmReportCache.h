@@ -0,0 +1,77 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+struct ViGEmUpdateStats
+{
+	uint64_t Submitted = 0;		// Reports the driver took.
+	uint64_t Skipped = 0;		// Reports dropped because they matched the last submitted one.
+	uint64_t Failed = 0;		// Reports the driver rejected.
+};
+
+// How the cache compares two reports: byte by byte unless specialized. A report with padding needs a
+// specialization comparing its fields, since the padding of two equal reports may differ.
+template <typename REPORT>
+struct ViGEmReportTraits
+{
+	static_assert(std::is_trivially_copyable<REPORT>::value, "REPORT must be trivially copyable for memcmp");
+
+	static bool Equal(const REPORT& a, const REPORT& b)
+	{ return std::memcmp(&a, &b, sizeof(REPORT)) == 0; }
+};
+
+// Remembers the last report sent to a target so identical reports don't cost a driver round-trip.
+// A non-zero refresh interval forces a resubmit of an unchanged report once that many ms have passed.
+template <typename REPORT, typename TRAITS = ViGEmReportTraits<REPORT>>
+class ViGEmReportCache
+{
+public:
+	// Calls update with the report unless it matches the last one the driver took. Returns update's
+	// result, or false if the report was skipped. A rejected report is forgotten so the next one goes
+	// out even if it matches.
+	template <typename UPDATE>
+	bool Submit(const REPORT& report, uint64_t now, UPDATE&& update)
+	{
+		if (mHasReport && TRAITS::Equal(mReport, report))
+		{
+			if (mRefreshInterval == 0 || (now - mSubmitTime) < mRefreshInterval)
+			{
+				++mStats.Skipped;
+				return false;
+			}
+		}
+
+		if (!update(report))
+		{
+			mHasReport = false;
+			++mStats.Failed;
+			return false;
+		}
+		mReport = report;
+		mHasReport = true;
+		mSubmitTime = now;
+		++mStats.Submitted;
+		return true;
+	}
+
+	void Invalidate()
+	{ mHasReport = false; }
+
+	void SetRefreshInterval(uint64_t interval)
+	{ mRefreshInterval = interval; }
+
+	const ViGEmUpdateStats& GetStats() const
+	{ return mStats; }
+
+private:
+	REPORT mReport{};
+	uint64_t mSubmitTime = 0;
+	uint64_t mRefreshInterval = 0;
+	ViGEmUpdateStats mStats;
+	bool mHasReport = false;
+};
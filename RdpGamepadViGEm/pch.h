@@ -3,6 +3,9 @@
 
 #pragma once
 
+// The loopback tool also builds some of the receiver's sources on other platforms.
+#if defined(_WIN32)
+
 #include <SDKDDKVer.h>
 
 #define WIN32_LEAN_AND_MEAN
@@ -11,9 +14,15 @@
 #include <strsafe.h>
 #include <tchar.h>
 
+#endif
+
+#include <atomic>
+#include <chrono>
 #include <cstring>
 #include <functional>
 #include <iostream>
 #include <mutex>
+#include <string>
 #include <thread>
+#include <type_traits>
 #include <memory>